@@ -0,0 +1,1330 @@
+/*-
+ * Copyright (c) 2009-2010 Alexey Illarionov <littlesavage@rambler.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * ourfa_apigen: generate typed C stubs for api.xml functions.
+ *
+ * For every function the generator emits input and output structures,
+ * encode/decode routines built on ourfa_connection_write_*() and
+ * ourfa_connection_read_*(), and a call wrapper. Each <for> loop becomes
+ * a counted array of row structures. Functions with nodes that need the
+ * interpreter (set, error, call, parameter, math, break) or with
+ * variables that do not map onto a fixed structure are skipped.
+ *
+ * Usage: ourfa_apigen [-p prefix] [-o basename] api.xml [function ...]
+ */
+
+#ifdef WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/ssl.h>
+
+#include <libxml/hash.h>
+
+#include "ourfa.h"
+
+#define GEN_NAME_SIZE 128
+#define GEN_MAX_IDX   20
+
+enum gen_dir_t {
+   GEN_IN,
+   GEN_OUT
+};
+
+struct gen_field_t {
+   const char *name;
+   char cname[GEN_NAME_SIZE];
+   enum ourfa_xmlapi_func_node_type_t type;
+   const char *defval;
+   /* Unconditionally defined in the root structure  */
+   unsigned top_level;
+   struct gen_field_t *next;
+};
+
+struct gen_rec_t {
+   const ourfa_xmlapi_func_node_t *loop; /* NULL for root  */
+   struct gen_rec_t *parent;
+   unsigned depth;
+   char cname[GEN_NAME_SIZE];  /* Array member name in parent  */
+   char tag[GEN_NAME_SIZE*2];  /* Structure tag  */
+   struct gen_field_t *fields;
+   struct gen_rec_t *children;
+   struct gen_rec_t *next;
+};
+
+struct gen_func_t {
+   ourfa_xmlapi_func_t *f;
+   char cname[GEN_NAME_SIZE];
+   struct gen_rec_t in;
+   struct gen_rec_t out;
+   char err[256];
+   struct gen_func_t *next;
+};
+
+static const char *c_keywords[] = {
+   "auto", "break", "case", "char", "const", "continue", "default", "do",
+   "double", "else", "enum", "extern", "float", "for", "goto", "if",
+   "inline", "int", "long", "register", "restrict", "return", "short",
+   "signed", "sizeof", "static", "struct", "switch", "typedef", "union",
+   "unsigned", "void", "volatile", "while", NULL
+};
+
+static void usage(void)
+{
+   fprintf(stderr,
+	 "usage: ourfa_apigen [-p prefix] [-o basename] api.xml [function ...]\n"
+	 " -p   Prefix of generated identifiers (default: none)\n"
+	 " -o   Output files basename (default: ourfa_api)\n"
+	 );
+}
+
+static int gen_err(struct gen_func_t *gf, const char *fmt, ...)
+{
+   va_list ap;
+
+   va_start(ap, fmt);
+   vsnprintf(gf->err, sizeof(gf->err), fmt, ap);
+   va_end(ap);
+
+   return -1;
+}
+
+static void sanitize_name(char *dst, size_t dst_size, const char *src)
+{
+   size_t i;
+   const char **kw;
+
+   assert(dst_size > 2);
+   i = 0;
+   if (isdigit((unsigned char)src[0]))
+      dst[i++] = '_';
+   for (; *src != '\0' && i < dst_size-2; src++)
+      dst[i++] = isalnum((unsigned char)*src) ? *src : '_';
+   dst[i] = '\0';
+
+   for (kw = c_keywords; *kw; kw++) {
+      if (strcmp(dst, *kw) == 0) {
+	 dst[i++] = '_';
+	 dst[i] = '\0';
+	 break;
+      }
+   }
+}
+
+static int is_numeric(const char *s, long long *res)
+{
+   char *p_end;
+   long long val;
+
+   if ((s == NULL) || (s[0] == '\0'))
+      return 0;
+   errno = 0;
+   val = strtol(s, &p_end, 0);
+   if ((*p_end != '\0') || (errno == ERANGE))
+      return 0;
+   if (res)
+      *res = val;
+   return 1;
+}
+
+static int is_double(const char *s, double *res)
+{
+   char *p_end;
+   double val;
+
+   if ((s == NULL) || (s[0] == '\0'))
+      return 0;
+   errno = 0;
+   val = strtod(s, &p_end);
+   if ((*p_end != '\0') || (errno == ERANGE))
+      return 0;
+   if (res)
+      *res = val;
+   return 1;
+}
+
+/* Split array_index as ourfa_hash_parse_idx_list() does  */
+static int parse_idx(const char *idx, char res[][20], unsigned *cnt)
+{
+   unsigned len;
+
+   if ((idx == NULL) || (idx[0] == '\0'))
+      idx = "0";
+
+   *cnt = len = 0;
+   for (;; idx++) {
+      if ((*idx != '\0') && isspace((unsigned char)*idx))
+	 continue;
+      if ((*idx != ',') && (*idx != '\0')) {
+	 if (len+1 >= 18)
+	    return -1;
+	 res[*cnt][len++] = *idx;
+	 continue;
+      }
+      if ((*idx == '\0') && (len == 0))
+	 break;
+      if ((len == 0) || (*cnt+1 >= GEN_MAX_IDX))
+	 return -1;
+      res[*cnt][len] = '\0';
+      (*cnt)++;
+      len = 0;
+      if (*idx == '\0')
+	 break;
+   }
+
+   return *cnt > 0 ? 0 : -1;
+}
+
+static struct gen_field_t *find_field(const struct gen_rec_t *rec, const char *name)
+{
+   struct gen_field_t *f;
+
+   for (f=rec->fields; f; f=f->next) {
+      if (strcmp(f->name, name) == 0)
+	 return f;
+   }
+   return NULL;
+}
+
+static struct gen_field_t *find_field_any(const struct gen_rec_t *rec,
+      const char *name, const struct gen_rec_t **owner)
+{
+   struct gen_field_t *f;
+   const struct gen_rec_t *r;
+
+   f = find_field(rec, name);
+   if (f) {
+      if (owner)
+	 *owner = rec;
+      return f;
+   }
+   for (r=rec->children; r; r=r->next) {
+      f = find_field_any(r, name, owner);
+      if (f)
+	 return f;
+   }
+   return NULL;
+}
+
+static int subtree_writes(const ourfa_xmlapi_func_node_t *n, const char *name)
+{
+   for (; n; n=n->next) {
+      switch (n->type) {
+	 case OURFA_XMLAPI_NODE_INTEGER:
+	 case OURFA_XMLAPI_NODE_LONG:
+	 case OURFA_XMLAPI_NODE_DOUBLE:
+	 case OURFA_XMLAPI_NODE_STRING:
+	 case OURFA_XMLAPI_NODE_IP:
+	    if (strcmp(n->n.n_val.name, name) == 0)
+	       return 1;
+	    break;
+	 default:
+	    break;
+      }
+      if (subtree_writes(n->children, name))
+	 return 1;
+   }
+   return 0;
+}
+
+/* 'from' and 'count' of the loop: constant or integer root variable  */
+static int check_operand(struct gen_func_t *gf, const struct gen_rec_t *root,
+      const ourfa_xmlapi_func_node_t *loop, const char *op)
+{
+   const struct gen_field_t *f;
+
+   if (op == NULL)
+      return gen_err(gf, "for `%s`: no 'from' or 'count'", loop->n.n_for.name);
+   if (is_numeric(op, NULL))
+      return 0;
+   f = find_field(root, op);
+   if ((f == NULL)
+	 || ((f->type != OURFA_XMLAPI_NODE_INTEGER) && (f->type != OURFA_XMLAPI_NODE_LONG)))
+      return gen_err(gf, "for `%s`: '%s' is not an integer variable",
+	    loop->n.n_for.name, op);
+   if (subtree_writes(loop->children, op))
+      return gen_err(gf, "for `%s`: '%s' is modified in the loop",
+	    loop->n.n_for.name, op);
+   return 0;
+}
+
+static int build_rec(struct gen_func_t *gf, struct gen_rec_t *root,
+      struct gen_rec_t *rec, const ourfa_xmlapi_func_node_t *n, unsigned in_if);
+
+static int build_val(struct gen_func_t *gf, struct gen_rec_t *root,
+      struct gen_rec_t *rec, const ourfa_xmlapi_func_node_t *n, unsigned in_if)
+{
+   char idx[GEN_MAX_IDX][20];
+   unsigned cnt, i;
+   long long val;
+   struct gen_rec_t *target, *r;
+   const struct gen_rec_t *owner;
+   struct gen_field_t *f, **tail;
+
+   if (parse_idx(n->n.n_val.array_index, idx, &cnt) != 0)
+      return gen_err(gf, "%s: wrong array_index", n->n.n_val.name);
+
+   if ((cnt == 1) && is_numeric(idx[0], &val) && (val == 0))
+      target = root;
+   else {
+      if (cnt != rec->depth)
+	 return gen_err(gf, "%s(%s): unsupported array_index",
+	       n->n.n_val.name, n->n.n_val.array_index);
+      /* Index must be the list of counters of all enclosing loops  */
+      for (r=rec, i=cnt; r != root; r=r->parent, i--) {
+	 if (strcmp(idx[i-1], r->loop->n.n_for.name) != 0)
+	    return gen_err(gf, "%s(%s): unsupported array_index",
+		  n->n.n_val.name, n->n.n_val.array_index);
+      }
+      target = rec;
+   }
+
+   f = find_field_any(root, n->n.n_val.name, &owner);
+   if (f != NULL) {
+      if ((owner != target) || (f->type != n->type))
+	 return gen_err(gf, "%s: variable redefined", n->n.n_val.name);
+      return 0;
+   }
+
+   f = calloc(1, sizeof(*f));
+   if (f == NULL)
+      return gen_err(gf, "%s", strerror(errno));
+   f->name = n->n.n_val.name;
+   f->type = n->type;
+   f->defval = n->n.n_val.defval;
+   f->top_level = (target == root) && (rec == root) && !in_if;
+   for (tail=&target->fields; *tail; tail=&(*tail)->next);
+   *tail = f;
+
+   return 0;
+}
+
+static int build_for(struct gen_func_t *gf, struct gen_rec_t *root,
+      struct gen_rec_t *rec, const ourfa_xmlapi_func_node_t *n, unsigned in_if)
+{
+   struct gen_rec_t *r, *child, **tail;
+
+   if (n->n.n_for.name == NULL)
+      return gen_err(gf, "for: no name");
+   for (r=rec; r != root; r=r->parent) {
+      if (strcmp(r->loop->n.n_for.name, n->n.n_for.name) == 0)
+	 return gen_err(gf, "for `%s`: counter shadows enclosing loop",
+	       n->n.n_for.name);
+   }
+   if (check_operand(gf, root, n, n->n.n_for.from)
+	 || check_operand(gf, root, n, n->n.n_for.count))
+      return -1;
+
+   /* Loop without body has no visible effect  */
+   if (n->children == NULL)
+      return 0;
+
+   child = calloc(1, sizeof(*child));
+   if (child == NULL)
+      return gen_err(gf, "%s", strerror(errno));
+   child->loop = n;
+   child->parent = rec;
+   child->depth = rec->depth+1;
+   for (tail=&rec->children; *tail; tail=&(*tail)->next);
+   *tail = child;
+
+   return build_rec(gf, root, child, n->children, in_if);
+}
+
+static int build_if(struct gen_func_t *gf, struct gen_rec_t *root,
+      struct gen_rec_t *rec, const ourfa_xmlapi_func_node_t *n, unsigned in_if)
+{
+   const struct gen_field_t *f;
+   const char *var, *val;
+
+   var = n->n.n_if.variable;
+   val = n->n.n_if.value;
+   if ((var == NULL) || (val == NULL))
+      return gen_err(gf, "if: no variable or value");
+
+   f = find_field(root, var);
+   if ((f == NULL) || !f->top_level)
+      return gen_err(gf, "if: `%s` is not defined before the condition", var);
+
+   /* Value may be a name of variable  */
+   if (find_field_any(&gf->in, val, NULL) || find_field_any(&gf->out, val, NULL))
+      return gen_err(gf, "if %s: value `%s` is a variable", var, val);
+
+   if (n->n.n_if.condition == OURFA_XMLAPI_IF_GT) {
+      if ((f->type == OURFA_XMLAPI_NODE_STRING)
+	    || (f->type == OURFA_XMLAPI_NODE_IP)
+	    || !is_double(val, NULL))
+	 return gen_err(gf, "if %s: unsupported condition", var);
+   }else {
+      if ((f->type != OURFA_XMLAPI_NODE_STRING)
+	    && (f->type != OURFA_XMLAPI_NODE_INTEGER)
+	    && (f->type != OURFA_XMLAPI_NODE_LONG))
+	 return gen_err(gf, "if %s: unsupported condition", var);
+   }
+
+   return build_rec(gf, root, rec, n->children, in_if+1);
+}
+
+static int build_rec(struct gen_func_t *gf, struct gen_rec_t *root,
+      struct gen_rec_t *rec, const ourfa_xmlapi_func_node_t *n, unsigned in_if)
+{
+   int res;
+
+   for (; n; n=n->next) {
+      switch (n->type) {
+	 case OURFA_XMLAPI_NODE_INTEGER:
+	 case OURFA_XMLAPI_NODE_LONG:
+	 case OURFA_XMLAPI_NODE_DOUBLE:
+	 case OURFA_XMLAPI_NODE_STRING:
+	 case OURFA_XMLAPI_NODE_IP:
+	    res = build_val(gf, root, rec, n, in_if);
+	    break;
+	 case OURFA_XMLAPI_NODE_FOR:
+	    res = build_for(gf, root, rec, n, in_if);
+	    break;
+	 case OURFA_XMLAPI_NODE_IF:
+	    res = build_if(gf, root, rec, n, in_if);
+	    break;
+	 default:
+	    res = gen_err(gf, "unsupported node `%s`",
+		  ourfa_xmlapi_node_name_by_type(n->type));
+	    break;
+      }
+      if (res != 0)
+	 return res;
+   }
+
+   return 0;
+}
+
+/* Loop counters are stored in the hash by the interpreter  */
+static int check_counters(struct gen_func_t *gf, const struct gen_rec_t *rec)
+{
+   const struct gen_rec_t *r;
+
+   for (r=rec->children; r; r=r->next) {
+      if (find_field_any(&gf->in, r->loop->n.n_for.name, NULL)
+	    || find_field_any(&gf->out, r->loop->n.n_for.name, NULL))
+	 return gen_err(gf, "for `%s`: counter is a variable", r->loop->n.n_for.name);
+      if (check_counters(gf, r) != 0)
+	 return -1;
+   }
+   return 0;
+}
+
+static int rec_name_used(const struct gen_rec_t *rec, const char *name,
+      const struct gen_field_t *skip_f, const struct gen_rec_t *skip_r)
+{
+   const struct gen_field_t *f;
+   const struct gen_rec_t *r;
+   size_t len;
+
+   for (f=rec->fields; f; f=f->next) {
+      if ((f != skip_f) && (strcmp(f->cname, name) == 0))
+	 return 1;
+   }
+   for (r=rec->children; r; r=r->next) {
+      if ((r == skip_r) || (r->cname[0] == '\0'))
+	 continue;
+      len = strlen(r->cname);
+      if ((strcmp(r->cname, name) == 0)
+	    || ((strncmp(r->cname, name, len) == 0)
+	       && (strcmp(name+len, "_cnt") == 0)))
+	 return 1;
+   }
+   return 0;
+}
+
+/* Array of the loop and its counter member  */
+static int loop_name_used(const struct gen_rec_t *rec, const struct gen_rec_t *r)
+{
+   char cnt_name[GEN_NAME_SIZE+8];
+
+   snprintf(cnt_name, sizeof(cnt_name), "%s_cnt", r->cname);
+   return rec_name_used(rec, r->cname, NULL, r)
+      || rec_name_used(rec, cnt_name, NULL, r);
+}
+
+static int assign_names(struct gen_func_t *gf, struct gen_rec_t *rec)
+{
+   struct gen_field_t *f;
+   struct gen_rec_t *r;
+   char base[GEN_NAME_SIZE-8];
+   unsigned i;
+
+   for (f=rec->fields; f; f=f->next) {
+      sanitize_name(f->cname, sizeof(f->cname), f->name);
+      if (rec_name_used(rec, f->cname, f, NULL))
+	 return gen_err(gf, "%s: name conflict", f->name);
+   }
+
+   for (r=rec->children; r; r=r->next) {
+      sanitize_name(base, sizeof(base), r->loop->n.n_for.name);
+      snprintf(r->cname, sizeof(r->cname), "%s", base);
+      for (i=2; loop_name_used(rec, r); i++)
+	 snprintf(r->cname, sizeof(r->cname), "%s%u", base, i);
+      if (snprintf(r->tag, sizeof(r->tag), "%s_%s", rec->tag, r->cname)
+	    >= (int)sizeof(r->tag))
+	 return gen_err(gf, "for `%s`: name too long", r->loop->n.n_for.name);
+      if (assign_names(gf, r) != 0)
+	 return -1;
+   }
+
+   return 0;
+}
+
+static void free_rec(struct gen_rec_t *rec)
+{
+   struct gen_field_t *f, *f_next;
+   struct gen_rec_t *r, *r_next;
+
+   for (f=rec->fields; f; f=f_next) {
+      f_next = f->next;
+      free(f);
+   }
+   for (r=rec->children; r; r=r_next) {
+      r_next = r->next;
+      free_rec(r);
+      free(r);
+   }
+   rec->fields = NULL;
+   rec->children = NULL;
+}
+
+static void free_func(struct gen_func_t *gf)
+{
+   free_rec(&gf->in);
+   free_rec(&gf->out);
+   free(gf);
+}
+
+static struct gen_func_t *build_func(ourfa_xmlapi_func_t *f, const char *prefix)
+{
+   struct gen_func_t *gf;
+   char name[GEN_NAME_SIZE];
+
+   gf = calloc(1, sizeof(*gf));
+   if (gf == NULL)
+      return NULL;
+   gf->f = f;
+   sanitize_name(name, sizeof(name), f->name);
+   snprintf(gf->cname, sizeof(gf->cname), "%s%s", prefix, name);
+   snprintf(gf->in.tag, sizeof(gf->in.tag), "%s_in", gf->cname);
+   snprintf(gf->out.tag, sizeof(gf->out.tag), "%s_out", gf->cname);
+
+   if ((f->in == NULL) || (f->out == NULL))
+      gen_err(gf, "no input or output definition");
+   else if ((build_rec(gf, &gf->in, &gf->in, f->in->children, 0) == 0)
+	 && (build_rec(gf, &gf->out, &gf->out, f->out->children, 0) == 0)
+	 && (check_counters(gf, &gf->in) == 0)
+	 && (check_counters(gf, &gf->out) == 0)
+	 && (assign_names(gf, &gf->in) == 0))
+      assign_names(gf, &gf->out);
+
+   return gf;
+}
+
+/*
+ * Emitters
+ */
+
+static void indent(FILE *s, unsigned level)
+{
+   unsigned i;
+
+   fputs("   ", s);
+   for (i=0; i < level; i++)
+      fputs("   ", s);
+}
+
+static void emit_cstr(FILE *s, const char *str)
+{
+   const unsigned char *p;
+
+   fputc('"', s);
+   for (p=(const unsigned char *)str; *p; p++) {
+      if ((*p == '"') || (*p == '\\'))
+	 fprintf(s, "\\%c", *p);
+      else if (isprint(*p) && (*p != '?'))
+	 fputc(*p, s);
+      else
+	 fprintf(s, "\\%03o", *p);
+   }
+   fputc('"', s);
+}
+
+static void emit_xml_loop(FILE *s, const ourfa_xmlapi_func_node_t *loop)
+{
+   fprintf(s, "/* <for name=\"%s\" from=\"%s\" count=\"%s\"> */",
+	 loop->n.n_for.name, loop->n.n_for.from, loop->n.n_for.count);
+}
+
+static void emit_struct(FILE *s, const struct gen_rec_t *rec, enum gen_dir_t dir)
+{
+   const struct gen_field_t *f;
+   const struct gen_rec_t *r;
+
+   for (r=rec->children; r; r=r->next)
+      emit_struct(s, r, dir);
+
+   fprintf(s, "struct %s {\n", rec->tag);
+   if ((rec->fields == NULL) && (rec->children == NULL))
+      fprintf(s, "   int unused;\n");
+   for (f=rec->fields; f; f=f->next) {
+      switch (f->type) {
+	 case OURFA_XMLAPI_NODE_INTEGER:
+	    fprintf(s, "   int %s;", f->cname);
+	    break;
+	 case OURFA_XMLAPI_NODE_LONG:
+	    fprintf(s, "   long long %s;", f->cname);
+	    break;
+	 case OURFA_XMLAPI_NODE_DOUBLE:
+	    fprintf(s, "   double %s;", f->cname);
+	    break;
+	 case OURFA_XMLAPI_NODE_STRING:
+	    fprintf(s, "   %schar *%s;", dir == GEN_IN ? "const " : "", f->cname);
+	    break;
+	 case OURFA_XMLAPI_NODE_IP:
+	    fprintf(s, "   struct sockaddr_storage %s;", f->cname);
+	    break;
+	 default:
+	    assert(0);
+	    break;
+      }
+      if (strcmp(f->cname, f->name) != 0)
+	 fprintf(s, " /* %s */", f->name);
+      fputc('\n', s);
+   }
+   for (r=rec->children; r; r=r->next) {
+      fprintf(s, "   ");
+      emit_xml_loop(s, r->loop);
+      fprintf(s, "\n   unsigned %s_cnt;\n   %sstruct %s *%s;\n",
+	    r->cname, dir == GEN_IN ? "const " : "", r->tag, r->cname);
+   }
+   fprintf(s, "};\n\n");
+}
+
+/* Name of function id macro  */
+static void id_macro(char *dst, size_t dst_size, const struct gen_func_t *gf)
+{
+   unsigned i;
+
+   for (i=0; gf->cname[i] && i < dst_size-4; i++)
+      dst[i] = toupper((unsigned char)gf->cname[i]);
+   strcpy(&dst[i], "_ID");
+}
+
+static void emit_header(FILE *s, const struct gen_func_t *gf)
+{
+   char id[GEN_NAME_SIZE];
+
+   id_macro(id, sizeof(id), gf);
+   fprintf(s, "/* %s */\n", gf->f->name);
+   if (gf->f->id >= 0)
+      fprintf(s, "#define %s 0x%x\n\n", id, (unsigned)gf->f->id);
+   else
+      fprintf(s, "#define %s (-0x%x)\n\n", id, (unsigned)-gf->f->id);
+
+   emit_struct(s, &gf->in, GEN_IN);
+   emit_struct(s, &gf->out, GEN_OUT);
+
+   fprintf(s,
+	 "void %s_in_init(struct %s *in);\n"
+	 "int  %s_encode(ourfa_connection_t *conn, const struct %s *in);\n"
+	 "int  %s_decode(ourfa_connection_t *conn, struct %s *out);\n"
+	 "void %s_out_free(struct %s *out);\n"
+	 "int  %s(ourfa_connection_t *conn, const struct %s *in, struct %s *out);\n\n",
+	 gf->cname, gf->in.tag,
+	 gf->cname, gf->in.tag,
+	 gf->cname, gf->out.tag,
+	 gf->cname, gf->out.tag,
+	 gf->cname, gf->in.tag, gf->out.tag);
+}
+
+/* Structure member of value node as C expression  */
+static void field_ref(char *dst, size_t dst_size, const struct gen_rec_t *root,
+      const struct gen_rec_t *rec, enum gen_dir_t dir, const char *name)
+{
+   const struct gen_field_t *f;
+
+   f = find_field(root, name);
+   if (f != NULL)
+      snprintf(dst, dst_size, "%s->%s", dir == GEN_IN ? "in" : "out", f->cname);
+   else {
+      f = find_field(rec, name);
+      assert(f);
+      snprintf(dst, dst_size, "r%u->%s", rec->depth, f->cname);
+   }
+}
+
+static const struct gen_rec_t *rec_by_loop(const struct gen_rec_t *rec,
+      const ourfa_xmlapi_func_node_t *loop)
+{
+   const struct gen_rec_t *r;
+
+   for (r=rec->children; r; r=r->next) {
+      if (r->loop == loop)
+	 return r;
+   }
+   return NULL;
+}
+
+static void emit_cond(FILE *s, const struct gen_rec_t *root, enum gen_dir_t dir,
+      const ourfa_xmlapi_func_node_t *n)
+{
+   const struct gen_field_t *f;
+   char ref[GEN_NAME_SIZE+8];
+   char buf[64];
+   long long val;
+   double d;
+   int is_ne;
+
+   f = find_field(root, n->n.n_if.variable);
+   assert(f);
+   field_ref(ref, sizeof(ref), root, root, dir, n->n.n_if.variable);
+
+   if (n->n.n_if.condition == OURFA_XMLAPI_IF_GT) {
+      is_double(n->n.n_if.value, &d);
+      fprintf(s, "(double)%s > %.17g", ref, d);
+      return;
+   }
+
+   /* Interpreter compares string representation of the variable  */
+   is_ne = n->n.n_if.condition != OURFA_XMLAPI_IF_EQ;
+   switch (f->type) {
+      case OURFA_XMLAPI_NODE_STRING:
+	 fprintf(s, "%s(%s != NULL && strcmp(%s, ", is_ne ? "!" : "", ref, ref);
+	 emit_cstr(s, n->n.n_if.value);
+	 fprintf(s, ") == 0)");
+	 break;
+      case OURFA_XMLAPI_NODE_INTEGER:
+      case OURFA_XMLAPI_NODE_LONG:
+	 buf[0] = '\0';
+	 if (is_numeric(n->n.n_if.value, &val)) {
+	    if (f->type == OURFA_XMLAPI_NODE_INTEGER)
+	       snprintf(buf, sizeof(buf), "%i", (int)val);
+	    else
+	       snprintf(buf, sizeof(buf), "%lld", val);
+	 }
+	 if (strcmp(buf, n->n.n_if.value) != 0)
+	    fprintf(s, "%d", is_ne);
+	 else
+	    fprintf(s, "%s %s %sLL", ref, is_ne ? "!=" : "==", buf);
+	 break;
+      default:
+	 assert(0);
+	 break;
+   }
+}
+
+static void emit_operand(FILE *s, const struct gen_rec_t *root, enum gen_dir_t dir,
+      const char *op)
+{
+   char ref[GEN_NAME_SIZE+8];
+   long long val;
+
+   if (is_numeric(op, &val))
+      fprintf(s, "%lldLL", val);
+   else {
+      field_ref(ref, sizeof(ref), root, root, dir, op);
+      fprintf(s, "(long long)%s", ref);
+   }
+}
+
+static void emit_body(FILE *s, const struct gen_rec_t *root,
+      const struct gen_rec_t *rec, enum gen_dir_t dir,
+      const ourfa_xmlapi_func_node_t *n, unsigned level);
+
+static void emit_value(FILE *s, const struct gen_rec_t *root,
+      const struct gen_rec_t *rec, enum gen_dir_t dir,
+      const ourfa_xmlapi_func_node_t *n, unsigned level)
+{
+   char ref[GEN_NAME_SIZE+8];
+   const char *fn;
+
+   field_ref(ref, sizeof(ref), root, rec, dir, n->n.n_val.name);
+
+   switch (n->type) {
+      case OURFA_XMLAPI_NODE_INTEGER: fn = "int"; break;
+      case OURFA_XMLAPI_NODE_LONG: fn = "long"; break;
+      case OURFA_XMLAPI_NODE_DOUBLE: fn = "double"; break;
+      case OURFA_XMLAPI_NODE_STRING: fn = "string"; break;
+      case OURFA_XMLAPI_NODE_IP: fn = "ip"; break;
+      default:
+	 assert(0);
+	 fn = NULL;
+	 break;
+   }
+
+   if (dir == GEN_IN) {
+      if (n->type == OURFA_XMLAPI_NODE_STRING) {
+	 indent(s, level);
+	 fprintf(s, "if (%s == NULL) {\n", ref);
+	 indent(s, level+1);
+	 fprintf(s, "err = OURFA_ERROR_HASH;\n");
+	 indent(s, level+1);
+	 fprintf(s, "goto encode_err;\n");
+	 indent(s, level);
+	 fprintf(s, "}\n");
+      }
+      indent(s, level);
+      if (n->type == OURFA_XMLAPI_NODE_IP)
+	 fprintf(s, "err = ourfa_connection_write_ip(conn, OURFA_ATTR_DATA, "
+	       "(const struct sockaddr *)&%s);\n", ref);
+      else
+	 fprintf(s, "err = ourfa_connection_write_%s(conn, OURFA_ATTR_DATA, %s);\n",
+	       fn, ref);
+      indent(s, level);
+      fprintf(s, "if (err != OURFA_OK)\n");
+      indent(s, level+1);
+      fprintf(s, "return err;\n");
+   }else {
+      if (n->type == OURFA_XMLAPI_NODE_STRING) {
+	 indent(s, level);
+	 fprintf(s, "free(%s);\n", ref);
+	 indent(s, level);
+	 fprintf(s, "%s = NULL;\n", ref);
+      }
+      indent(s, level);
+      if (n->type == OURFA_XMLAPI_NODE_IP)
+	 fprintf(s, "err = ourfa_connection_read_ip(conn, OURFA_ATTR_DATA, "
+	       "(struct sockaddr *)&%s);\n", ref);
+      else
+	 fprintf(s, "err = ourfa_connection_read_%s(conn, OURFA_ATTR_DATA, &%s);\n",
+	       fn, ref);
+      indent(s, level);
+      fprintf(s, "if (err != OURFA_OK)\n");
+      indent(s, level+1);
+      fprintf(s, "goto decode_err;\n");
+   }
+}
+
+static void emit_loop(FILE *s, const struct gen_rec_t *root,
+      const struct gen_rec_t *rec, enum gen_dir_t dir,
+      const ourfa_xmlapi_func_node_t *n, unsigned level)
+{
+   const struct gen_rec_t *r;
+   char p[16];
+   unsigned d;
+
+   r = rec_by_loop(rec, n);
+   if (r == NULL) {
+      /* Empty loop  */
+      assert(n->children == NULL);
+      return;
+   }
+   d = r->depth;
+   if (rec->depth == 0)
+      snprintf(p, sizeof(p), "%s", dir == GEN_IN ? "in" : "out");
+   else
+      snprintf(p, sizeof(p), "r%u", rec->depth);
+
+   indent(s, level);
+   emit_xml_loop(s, n);
+   fputc('\n', s);
+   indent(s, level);
+   fprintf(s, "{\n");
+   indent(s, level+1);
+   fprintf(s, "long long count%u;\n", d);
+   indent(s, level+1);
+   fprintf(s, "unsigned k%u, n%u;\n", d, d);
+   indent(s, level+1);
+   fprintf(s, "%sstruct %s *r%u;\n\n", dir == GEN_IN ? "const " : "", r->tag, d);
+
+   indent(s, level+1);
+   fprintf(s, "count%u = ", d);
+   emit_operand(s, root, dir, n->n.n_for.count);
+   fprintf(s, ";\n");
+   indent(s, level+1);
+   fprintf(s, "if (count%u > 0x7fffffffLL) {\n", d);
+   indent(s, level+2);
+   fprintf(s, "err = OURFA_ERROR_OTHER;\n");
+   indent(s, level+2);
+   fprintf(s, "goto %s;\n", dir == GEN_IN ? "encode_err" : "decode_err");
+   indent(s, level+1);
+   fprintf(s, "}\n");
+   indent(s, level+1);
+   fprintf(s, "/* Body is executed at least once if count is not zero  */\n");
+   indent(s, level+1);
+   fprintf(s, "n%u = count%u > 0 ? (unsigned)count%u : (count%u != 0);\n",
+	 d, d, d, d);
+
+   if (dir == GEN_IN) {
+      indent(s, level+1);
+      fprintf(s, "if ((n%u > %s->%s_cnt) || ((n%u != 0) && (%s->%s == NULL))) {\n",
+	    d, p, r->cname, d, p, r->cname);
+      indent(s, level+2);
+      fprintf(s, "err = OURFA_ERROR_HASH;\n");
+      indent(s, level+2);
+      fprintf(s, "goto encode_err;\n");
+      indent(s, level+1);
+      fprintf(s, "}\n");
+   }else {
+      indent(s, level+1);
+      fprintf(s, "if (n%u != 0) {\n", d);
+      indent(s, level+2);
+      fprintf(s, "%s->%s = calloc(n%u, sizeof(%s->%s[0]));\n",
+	    p, r->cname, d, p, r->cname);
+      indent(s, level+2);
+      fprintf(s, "if (%s->%s == NULL) {\n", p, r->cname);
+      indent(s, level+3);
+      fprintf(s, "err = OURFA_ERROR_SYSTEM;\n");
+      indent(s, level+3);
+      fprintf(s, "goto decode_err;\n");
+      indent(s, level+2);
+      fprintf(s, "}\n");
+      indent(s, level+2);
+      fprintf(s, "%s->%s_cnt = n%u;\n", p, r->cname, d);
+      indent(s, level+1);
+      fprintf(s, "}\n");
+   }
+
+   indent(s, level+1);
+   fprintf(s, "for (k%u=0; k%u < n%u; k%u++) {\n", d, d, d, d);
+   indent(s, level+2);
+   fprintf(s, "r%u = &%s->%s[k%u];\n", d, p, r->cname, d);
+   emit_body(s, root, r, dir, n->children, level+2);
+   indent(s, level+1);
+   fprintf(s, "}\n");
+   indent(s, level);
+   fprintf(s, "}\n");
+}
+
+static void emit_body(FILE *s, const struct gen_rec_t *root,
+      const struct gen_rec_t *rec, enum gen_dir_t dir,
+      const ourfa_xmlapi_func_node_t *n, unsigned level)
+{
+   for (; n; n=n->next) {
+      switch (n->type) {
+	 case OURFA_XMLAPI_NODE_INTEGER:
+	 case OURFA_XMLAPI_NODE_LONG:
+	 case OURFA_XMLAPI_NODE_DOUBLE:
+	 case OURFA_XMLAPI_NODE_STRING:
+	 case OURFA_XMLAPI_NODE_IP:
+	    emit_value(s, root, rec, dir, n, level);
+	    break;
+	 case OURFA_XMLAPI_NODE_FOR:
+	    emit_loop(s, root, rec, dir, n, level);
+	    break;
+	 case OURFA_XMLAPI_NODE_IF:
+	    indent(s, level);
+	    fprintf(s, "if (");
+	    emit_cond(s, root, dir, n);
+	    fprintf(s, ") {\n");
+	    emit_body(s, root, rec, dir, n->children, level+1);
+	    indent(s, level);
+	    fprintf(s, "}\n");
+	    break;
+	 default:
+	    assert(0);
+	    break;
+      }
+   }
+}
+
+static int rec_has_heap(const struct gen_rec_t *rec)
+{
+   const struct gen_field_t *f;
+
+   if (rec->children != NULL)
+      return 1;
+   for (f=rec->fields; f; f=f->next) {
+      if (f->type == OURFA_XMLAPI_NODE_STRING)
+	 return 1;
+   }
+   return 0;
+}
+
+static void emit_free(FILE *s, const struct gen_rec_t *rec, const char *p,
+      unsigned level)
+{
+   const struct gen_field_t *f;
+   const struct gen_rec_t *r;
+   char rp[16];
+
+   for (f=rec->fields; f; f=f->next) {
+      if (f->type != OURFA_XMLAPI_NODE_STRING)
+	 continue;
+      indent(s, level);
+      fprintf(s, "free(%s->%s);\n", p, f->cname);
+   }
+
+   for (r=rec->children; r; r=r->next) {
+      if (rec_has_heap(r)) {
+	 snprintf(rp, sizeof(rp), "r%u", r->depth);
+	 indent(s, level);
+	 fprintf(s, "for (k%u=0; k%u < %s->%s_cnt; k%u++) {\n",
+	       r->depth, r->depth, p, r->cname, r->depth);
+	 indent(s, level+1);
+	 fprintf(s, "struct %s *%s = &%s->%s[k%u];\n",
+	       r->tag, rp, p, r->cname, r->depth);
+	 emit_free(s, r, rp, level+1);
+	 indent(s, level);
+	 fprintf(s, "}\n");
+      }
+      indent(s, level);
+      fprintf(s, "free(%s->%s);\n", p, r->cname);
+   }
+}
+
+/* Depths of loops iterated by emit_free()  */
+static unsigned free_depths(const struct gen_rec_t *rec)
+{
+   const struct gen_rec_t *r;
+   unsigned res;
+
+   res = 0;
+   for (r=rec->children; r; r=r->next) {
+      if (rec_has_heap(r))
+	 res |= (1u << r->depth) | free_depths(r);
+   }
+   return res;
+}
+
+static void emit_defaults(FILE *s, const struct gen_rec_t *rec)
+{
+   const struct gen_field_t *f;
+   long long val;
+   double d;
+
+   for (f=rec->fields; f; f=f->next) {
+      if (f->defval == NULL)
+	 continue;
+      switch (f->type) {
+	 case OURFA_XMLAPI_NODE_INTEGER:
+	 case OURFA_XMLAPI_NODE_LONG:
+	    if (strcmp(f->defval, "now()") == 0)
+	       fprintf(s, "   in->%s = OURFA_TIME_NOW;\n", f->cname);
+	    else if (strcmp(f->defval, "max_time()") == 0)
+	       fprintf(s, "   in->%s = OURFA_TIME_MAX;\n", f->cname);
+	    else if (is_numeric(f->defval, &val))
+	       fprintf(s, "   in->%s = %lld%s;\n", f->cname, val,
+		     f->type == OURFA_XMLAPI_NODE_LONG ? "LL" : "");
+	    else
+	       fprintf(s, "   /* %s: default '%s' is not supported  */\n",
+		     f->cname, f->defval);
+	    break;
+	 case OURFA_XMLAPI_NODE_DOUBLE:
+	    if (is_double(f->defval, &d))
+	       fprintf(s, "   in->%s = %.17g;\n", f->cname, d);
+	    else
+	       fprintf(s, "   /* %s: default '%s' is not supported  */\n",
+		     f->cname, f->defval);
+	    break;
+	 case OURFA_XMLAPI_NODE_STRING:
+	    fprintf(s, "   in->%s = ", f->cname);
+	    emit_cstr(s, f->defval);
+	    fprintf(s, ";\n");
+	    break;
+	 case OURFA_XMLAPI_NODE_IP:
+	    fprintf(s, "   ourfa_parse_ip(");
+	    emit_cstr(s, f->defval);
+	    fprintf(s, ", &in->%s);\n", f->cname);
+	    break;
+	 default:
+	    assert(0);
+	    break;
+      }
+   }
+}
+
+static void emit_source(FILE *s, const struct gen_func_t *gf)
+{
+   unsigned d, depths;
+   char id[GEN_NAME_SIZE];
+
+   fprintf(s, "/* %s */\n\n", gf->f->name);
+
+   /* init  */
+   fprintf(s, "void %s_in_init(struct %s *in)\n{\n", gf->cname, gf->in.tag);
+   fprintf(s, "   memset(in, 0, sizeof(*in));\n");
+   emit_defaults(s, &gf->in);
+   fprintf(s, "}\n\n");
+
+   /* encode  */
+   fprintf(s, "int %s_encode(ourfa_connection_t *conn, const struct %s *in)\n{\n",
+	 gf->cname, gf->in.tag);
+   if (gf->f->in->children == NULL) {
+      fprintf(s, "   (void)conn;\n   (void)in;\n\n");
+      fprintf(s, "   /* No input parameters: termination attribute is not sent  */\n");
+      fprintf(s, "   return OURFA_OK;\n}\n\n");
+   }else {
+      fprintf(s, "   int err;\n\n");
+      emit_body(s, &gf->in, &gf->in, GEN_IN, gf->f->in->children, 0);
+      fprintf(s, "\n   return ourfa_connection_write_int(conn, OURFA_ATTR_TERMINATION, 4);\n");
+      /* Strings and loops are checked before write  */
+      if (rec_has_heap(&gf->in)) {
+	 fprintf(s, "\nencode_err:\n");
+	 fprintf(s, "   /* Wrong input. Cancel the call  */\n");
+	 fprintf(s, "   ourfa_connection_purge_write(conn);\n");
+	 fprintf(s, "   if (ourfa_connection_write_int(conn, OURFA_ATTR_TERMINATION, 3) == OURFA_OK)\n");
+	 fprintf(s, "      ourfa_connection_flush_read(conn);\n");
+	 fprintf(s, "   return err;\n");
+      }
+      fprintf(s, "}\n\n");
+   }
+
+   /* decode  */
+   fprintf(s, "int %s_decode(ourfa_connection_t *conn, struct %s *out)\n{\n",
+	 gf->cname, gf->out.tag);
+   fprintf(s, "   int err;\n   int ret_code;\n\n");
+   fprintf(s, "   memset(out, 0, sizeof(*out));\n\n");
+   emit_body(s, &gf->out, &gf->out, GEN_OUT, gf->f->out->children, 0);
+   fprintf(s, "\n   err = ourfa_connection_read_int(conn, OURFA_ATTR_TERMINATION, &ret_code);\n");
+   fprintf(s, "   if (err != OURFA_OK)\n      goto decode_err;\n");
+   fprintf(s, "   ourfa_connection_flush_read(conn);\n\n");
+   fprintf(s, "   return OURFA_OK;\n\n");
+   fprintf(s, "decode_err:\n");
+   fprintf(s, "   if (err != OURFA_ERROR_NO_DATA)\n");
+   fprintf(s, "      ourfa_connection_flush_read(conn);\n");
+   fprintf(s, "   return err;\n}\n\n");
+
+   /* free  */
+   fprintf(s, "void %s_out_free(struct %s *out)\n{\n", gf->cname, gf->out.tag);
+   depths = free_depths(&gf->out);
+   if (depths != 0) {
+      for (d=1; d < 32; d++) {
+	 if (depths & (1u << d))
+	    fprintf(s, "   unsigned k%u;\n", d);
+      }
+      fputc('\n', s);
+   }
+   fprintf(s, "   if (out == NULL)\n      return;\n\n");
+   emit_free(s, &gf->out, "out", 0);
+   fprintf(s, "   memset(out, 0, sizeof(*out));\n}\n\n");
+
+   /* call  */
+   fprintf(s, "int %s(ourfa_connection_t *conn, const struct %s *in, struct %s *out)\n{\n",
+	 gf->cname, gf->in.tag, gf->out.tag);
+   fprintf(s, "   int err;\n\n");
+   fprintf(s, "   memset(out, 0, sizeof(*out));\n");
+   id_macro(id, sizeof(id), gf);
+   fprintf(s, "   err = ourfa_start_call_by_id(conn, %s);\n", id);
+   fprintf(s, "   if (err != OURFA_OK)\n      return err;\n");
+   fprintf(s, "   err = %s_encode(conn, in);\n", gf->cname);
+   fprintf(s, "   if (err != OURFA_OK)\n      return err;\n\n");
+   fprintf(s, "   return %s_decode(conn, out);\n}\n\n", gf->cname);
+}
+
+struct scan_ctx_t {
+   const char **names;
+   unsigned cnt;
+   unsigned size;
+};
+
+static void scan_func_name(void *payload, void *data, const xmlChar *name)
+{
+   struct scan_ctx_t *ctx;
+   const char **tmp;
+
+   (void)payload;
+   ctx = (struct scan_ctx_t *)data;
+   if (ctx->cnt == ctx->size) {
+      tmp = realloc(ctx->names, (ctx->size * 2 + 16) * sizeof(ctx->names[0]));
+      if (tmp == NULL)
+	 return;
+      ctx->names = tmp;
+      ctx->size = ctx->size * 2 + 16;
+   }
+   ctx->names[ctx->cnt++] = (const char *)name;
+}
+
+static int cmp_names(const void *a, const void *b)
+{
+   return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+int main(int argc, char **argv)
+{
+   const char *prefix, *basename, *api_file, *base_file;
+   char *h_name, *c_name;
+   char guard[GEN_NAME_SIZE];
+   ourfa_xmlapi_t *xmlapi;
+   ourfa_xmlapi_func_t *f;
+   struct scan_ctx_t names;
+   struct gen_func_t *gf, *gf_head, **gf_tail;
+   FILE *h, *c;
+   int i, res, explicit;
+   unsigned n;
+
+   prefix = "";
+   basename = "ourfa_api";
+   for (i=1; i < argc && argv[i][0] == '-'; i++) {
+      if ((strcmp(argv[i], "-p") == 0) && (i+1 < argc))
+	 prefix = argv[++i];
+      else if ((strcmp(argv[i], "-o") == 0) && (i+1 < argc))
+	 basename = argv[++i];
+      else {
+	 usage();
+	 return 1;
+      }
+   }
+   if (i >= argc) {
+      usage();
+      return 1;
+   }
+   api_file = argv[i++];
+
+   xmlapi = ourfa_xmlapi_new();
+   if (xmlapi == NULL)
+      return 1;
+   if (ourfa_xmlapi_load_apixml(xmlapi, api_file) != OURFA_OK) {
+      ourfa_xmlapi_free(xmlapi);
+      return 1;
+   }
+
+   memset(&names, 0, sizeof(names));
+   explicit = i < argc;
+   if (explicit) {
+      names.names = (const char **)&argv[i];
+      names.cnt = argc - i;
+   }else {
+      xmlHashScan(xmlapi->func_by_name, scan_func_name, &names);
+      qsort(names.names, names.cnt, sizeof(names.names[0]), cmp_names);
+   }
+
+   res = 0;
+   gf_head = NULL;
+   gf_tail = &gf_head;
+   for (n=0; n < names.cnt; n++) {
+      f = ourfa_xmlapi_func(xmlapi, names.names[n]);
+      if (f == NULL) {
+	 fprintf(stderr, "ourfa_apigen: function `%s` not found\n", names.names[n]);
+	 res = 1;
+	 continue;
+      }
+      gf = build_func(f, prefix);
+      if (gf == NULL) {
+	 fprintf(stderr, "ourfa_apigen: %s\n", strerror(errno));
+	 res = 1;
+	 break;
+      }
+      if (gf->err[0] != '\0') {
+	 fprintf(stderr, "ourfa_apigen: %s: %s %s\n", f->name,
+	       explicit ? "can not generate:" : "skipped:", gf->err);
+	 if (explicit)
+	    res = 1;
+	 free_func(gf);
+	 continue;
+      }
+      *gf_tail = gf;
+      gf_tail = &gf->next;
+   }
+   if (!explicit)
+      free(names.names);
+
+   h = c = NULL;
+   h_name = c_name = NULL;
+   if (res == 0) {
+      h_name = malloc(strlen(basename)+3);
+      c_name = malloc(strlen(basename)+3);
+      if ((h_name == NULL) || (c_name == NULL)) {
+	 fprintf(stderr, "ourfa_apigen: %s\n", strerror(errno));
+	 res = 1;
+      }else {
+	 sprintf(h_name, "%s.h", basename);
+	 sprintf(c_name, "%s.c", basename);
+      }
+   }
+   if (res == 0) {
+      h = fopen(h_name, "w");
+      c = h ? fopen(c_name, "w") : NULL;
+      if (c == NULL) {
+	 fprintf(stderr, "ourfa_apigen: %s: %s\n", h ? c_name : h_name, strerror(errno));
+	 res = 1;
+      }
+   }
+
+   if (res == 0) {
+      base_file = strrchr(basename, '/');
+      base_file = base_file ? base_file+1 : basename;
+      guard[0] = '_';
+      for (n=0; base_file[n] && n < sizeof(guard)-4; n++)
+	 guard[n+1] = isalnum((unsigned char)base_file[n]) ?
+	    toupper((unsigned char)base_file[n]) : '_';
+      guard[n+1] = '\0';
+
+      fprintf(h, "/* Generated by ourfa_apigen from %s. Do not edit.  */\n\n", api_file);
+      fprintf(h, "#ifndef %s_H\n#define %s_H\n\n", guard, guard);
+      fprintf(h,
+	    "/*\n"
+	    " * Each <for> loop is an array of row structures. Row k corresponds to\n"
+	    " * the loop counter value from+k. Strings of output structures are\n"
+	    " * allocated by *_decode() and freed by *_out_free(), which should be\n"
+	    " * called even if the call fails. Defaults are set by *_in_init() for\n"
+	    " * root parameters only.\n"
+	    " */\n\n");
+      fprintf(h,
+	    "#ifdef WIN32\n#include <ws2tcpip.h>\n#else\n"
+	    "#include <sys/types.h>\n#include <sys/socket.h>\n"
+	    "#include <netinet/in.h>\n#endif\n\n"
+	    "#include <stdarg.h>\n#include <stdio.h>\n#include <openssl/ssl.h>\n\n"
+	    "#include \"ourfa.h\"\n\n");
+      fprintf(c, "/* Generated by ourfa_apigen from %s. Do not edit.  */\n\n", api_file);
+      fprintf(c,
+	    "#ifdef WIN32\n#include <ws2tcpip.h>\n#else\n"
+	    "#include <sys/types.h>\n#include <sys/socket.h>\n"
+	    "#include <arpa/inet.h>\n#include <netinet/in.h>\n#endif\n\n"
+	    "#include <stdlib.h>\n#include <string.h>\n#include <time.h>\n"
+	    "#include <openssl/ssl.h>\n\n"
+	    "#include \"ourfa.h\"\n#include \"%s.h\"\n\n", base_file);
+
+      for (gf=gf_head; gf; gf=gf->next) {
+	 emit_header(h, gf);
+	 emit_source(c, gf);
+      }
+      fprintf(h, "#endif /* %s_H */\n", guard);
+   }
+
+   if (h && (fclose(h) != 0))
+      res = 1;
+   if (c && (fclose(c) != 0))
+      res = 1;
+   free(h_name);
+   free(c_name);
+
+   while (gf_head) {
+      gf = gf_head->next;
+      free_func(gf_head);
+      gf_head = gf;
+   }
+   ourfa_xmlapi_free(xmlapi);
+
+   return res;
+}
@@ -0,0 +1,892 @@
+/*-
+ * Copyright (c) 2009-2010 Alexey Illarionov <littlesavage@rambler.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Result cache of read-only functions.
+ *
+ * Entry key is the function id and fingerprint of the variables read by
+ * the <input> definition of the function. Entry is the set of variables
+ * the call has written to the globals hash. Values are shared with the
+ * caller's hashes and copied on write. Entries expire after TTL of the
+ * function and least recently used ones are evicted when the cache grows
+ * over its byte budget.
+ *
+ * Cache can be used from several threads, each with own connection.
+ * Identical calls made while the first one is in progress do not go to
+ * the server: callers wait for the first call and share its result.
+ *
+ * Shared cache keeps results of the same calls in a directory for other
+ * processes. Entry file is written once and replaced by rename(), so
+ * mapped snapshot of a reader is never modified. Callers of the same
+ * entry are serialized with a byte range lock of the lock file. Open file
+ * description locks are used where available, threads of one process are
+ * serialized by the table of locked bytes as well. Lock is waited for at
+ * most SHARED_CACHE_LOCK_WAIT seconds, then the call goes to the server.
+ */
+
+#ifdef WIN32
+#include <windows.h>
+#include <ws2tcpip.h>
+#include <io.h>
+#include <process.h>
+#else
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/ssl.h>
+#include <libxml/hash.h>
+
+#include "ourfa.h"
+#include "ourfa_private.h"
+
+#define CALL_CACHE_HASH_SIZE 64
+
+struct cache_entry_t {
+   /* LRU list, head is the most recently used entry  */
+   struct cache_entry_t *prev;
+   struct cache_entry_t *next;
+   int func_id;
+   time_t expire;
+   size_t size;
+   ourfa_hash_t *h;
+   char key[40];
+};
+
+/* Call in progress. Freed by the last of the caller and waiters */
+struct cache_flight_t {
+   char key[40];
+   unsigned waiters;
+   int done;
+   int res;
+   ourfa_hash_t *h; /* Variables written by the call  */
+};
+
+struct ourfa_call_cache_t {
+#ifdef WIN32
+   CRITICAL_SECTION lock;
+   CONDITION_VARIABLE flight_done;
+#else
+   pthread_mutex_t lock;
+   pthread_cond_t flight_done;
+#endif
+   struct _xmlHashTable *entries;
+   struct _xmlHashTable *flights;
+   struct _xmlHashTable *ttls;  /* Function name -> struct cache_ttl_t */
+   unsigned default_ttl;
+   size_t max_bytes;
+
+   struct cache_entry_t *head;
+   struct cache_entry_t *tail;
+
+   struct ourfa_call_cache_stats_t stats;
+};
+
+struct cache_ttl_t {
+   unsigned ttl;
+};
+
+#ifdef WIN32
+#define cache_lock(_c) EnterCriticalSection(&(_c)->lock)
+#define cache_unlock(_c) LeaveCriticalSection(&(_c)->lock)
+#define cache_wait(_c) SleepConditionVariableCS(&(_c)->flight_done, &(_c)->lock, INFINITE)
+#define cache_broadcast(_c) WakeAllConditionVariable(&(_c)->flight_done)
+#else
+#define cache_lock(_c) pthread_mutex_lock(&(_c)->lock)
+#define cache_unlock(_c) pthread_mutex_unlock(&(_c)->lock)
+#define cache_wait(_c) pthread_cond_wait(&(_c)->flight_done, &(_c)->lock)
+#define cache_broadcast(_c) pthread_cond_broadcast(&(_c)->flight_done)
+#endif
+
+static void flight_free(struct cache_flight_t *fl)
+{
+   ourfa_hash_free(fl->h);
+   free(fl);
+}
+
+static void lru_unlink(ourfa_call_cache_t *cache, struct cache_entry_t *e)
+{
+   if (e->prev)
+      e->prev->next = e->next;
+   else
+      cache->head = e->next;
+   if (e->next)
+      e->next->prev = e->prev;
+   else
+      cache->tail = e->prev;
+   e->prev = e->next = NULL;
+}
+
+static void lru_push(ourfa_call_cache_t *cache, struct cache_entry_t *e)
+{
+   e->prev = NULL;
+   e->next = cache->head;
+   if (cache->head)
+      cache->head->prev = e;
+   else
+      cache->tail = e;
+   cache->head = e;
+}
+
+static void entry_free(void *payload, const xmlChar *name)
+{
+   struct cache_entry_t *e;
+
+   if (name) {};
+   e = (struct cache_entry_t *)payload;
+   ourfa_hash_free(e->h);
+   free(e);
+}
+
+static void entry_remove(ourfa_call_cache_t *cache, struct cache_entry_t *e)
+{
+   lru_unlink(cache, e);
+   cache->stats.entries--;
+   cache->stats.bytes -= e->size;
+   xmlHashRemoveEntry(cache->entries, (const xmlChar *)e->key, entry_free);
+}
+
+static void ttl_free(void *payload, const xmlChar *name)
+{
+   if (name) {};
+   free(payload);
+}
+
+ourfa_call_cache_t *ourfa_call_cache_new(size_t max_bytes, unsigned default_ttl)
+{
+   ourfa_call_cache_t *cache;
+
+   cache = malloc(sizeof(*cache));
+   if (cache == NULL)
+      return NULL;
+
+   cache->entries = xmlHashCreate(CALL_CACHE_HASH_SIZE);
+   cache->flights = xmlHashCreate(CALL_CACHE_HASH_SIZE);
+   cache->ttls = xmlHashCreate(CALL_CACHE_HASH_SIZE);
+   if ((cache->entries == NULL) || (cache->flights == NULL)
+	 || (cache->ttls == NULL)) {
+      if (cache->entries)
+	 xmlHashFree(cache->entries, NULL);
+      if (cache->flights)
+	 xmlHashFree(cache->flights, NULL);
+      if (cache->ttls)
+	 xmlHashFree(cache->ttls, NULL);
+      free(cache);
+      return NULL;
+   }
+#ifdef WIN32
+   InitializeCriticalSection(&cache->lock);
+   InitializeConditionVariable(&cache->flight_done);
+#else
+   pthread_mutex_init(&cache->lock, NULL);
+   pthread_cond_init(&cache->flight_done, NULL);
+#endif
+   cache->default_ttl = default_ttl;
+   cache->max_bytes = max_bytes;
+   cache->head = cache->tail = NULL;
+   memset(&cache->stats, 0, sizeof(cache->stats));
+
+   return cache;
+}
+
+void ourfa_call_cache_free(ourfa_call_cache_t *cache)
+{
+   if (cache == NULL)
+      return;
+
+   /* No calls should be in progress  */
+   assert(xmlHashSize(cache->flights) == 0);
+
+   xmlHashFree(cache->entries, entry_free);
+   xmlHashFree(cache->flights, NULL);
+   xmlHashFree(cache->ttls, ttl_free);
+#ifdef WIN32
+   DeleteCriticalSection(&cache->lock);
+#else
+   pthread_mutex_destroy(&cache->lock);
+   pthread_cond_destroy(&cache->flight_done);
+#endif
+   free(cache);
+}
+
+int ourfa_call_cache_set_ttl(ourfa_call_cache_t *cache, const char *func,
+      unsigned ttl)
+{
+   struct cache_ttl_t *t;
+
+   if (cache == NULL)
+      return -1;
+
+   cache_lock(cache);
+   if (func == NULL) {
+      cache->default_ttl = ttl;
+      cache_unlock(cache);
+      return 0;
+   }
+
+   t = xmlHashLookup(cache->ttls, (const xmlChar *)func);
+   if (t == NULL) {
+      t = malloc(sizeof(*t));
+      if ((t == NULL)
+	    || (xmlHashAddEntry(cache->ttls, (const xmlChar *)func, t) != 0)) {
+	 cache_unlock(cache);
+	 free(t);
+	 return -1;
+      }
+   }
+   t->ttl = ttl;
+   cache_unlock(cache);
+
+   return 0;
+}
+
+void ourfa_call_cache_invalidate(ourfa_call_cache_t *cache,
+      ourfa_xmlapi_t *xmlapi, const char *func)
+{
+   struct cache_entry_t *e, *next;
+   ourfa_xmlapi_func_t *f;
+
+   if (cache == NULL)
+      return;
+
+   f = NULL;
+   if (func != NULL) {
+      f = xmlapi ? ourfa_xmlapi_func(xmlapi, func) : NULL;
+      if (f == NULL)
+	 return;
+   }
+
+   cache_lock(cache);
+   for (e=cache->head; e; e=next) {
+      next = e->next;
+      if ((f == NULL) || (e->func_id == f->id))
+	 entry_remove(cache, e);
+   }
+   cache_unlock(cache);
+}
+
+void ourfa_call_cache_stats(ourfa_call_cache_t *cache,
+      struct ourfa_call_cache_stats_t *res)
+{
+   assert(res);
+   if (cache == NULL)
+      memset(res, 0, sizeof(*res));
+   else {
+      cache_lock(cache);
+      *res = cache->stats;
+      cache_unlock(cache);
+   }
+}
+
+/* Fingerprint of the variables read by the input definition  */
+static unsigned long long input_fingerprint(ourfa_xmlapi_func_t *f,
+      ourfa_hash_t *globals)
+{
+   const struct ourfa_xmlapi_prog_t *prog;
+   const ourfa_xmlapi_func_node_t *n;
+   const char **loops;
+   unsigned long long fp;
+   unsigned pc, loops_cnt;
+
+   fp = ourfa_hash_fingerprint(NULL, NULL, 0);
+   prog = f->in->n.n_root.prog;
+
+   /* Loop counters are set by 'for' before they are used as indexes  */
+   loops = malloc((prog->insn_cnt + 1) * sizeof(loops[0]));
+   loops_cnt = 0;
+   for (pc=0; loops && (pc < prog->insn_cnt); pc++) {
+      if (prog->insn[pc].op == OURFA_XMLAPI_OP_FOR)
+	 loops[loops_cnt++] = prog->insn[pc].node->n.n_for.name;
+   }
+
+   for (pc=0; pc < prog->insn_cnt; pc++) {
+      n = prog->insn[pc].node;
+      switch (n->type) {
+	 case OURFA_XMLAPI_NODE_INTEGER:
+	 case OURFA_XMLAPI_NODE_STRING:
+	 case OURFA_XMLAPI_NODE_LONG:
+	 case OURFA_XMLAPI_NODE_DOUBLE:
+	 case OURFA_XMLAPI_NODE_IP:
+	    fp = ourfa_hash_fingerprint(globals, n->n.n_val.name, fp);
+	    fp = ourfa_hash_fingerprint_idx(globals, n->n.n_val.array_index,
+		  loops, loops_cnt, fp);
+	    break;
+	 case OURFA_XMLAPI_NODE_IF:
+	    fp = ourfa_hash_fingerprint(globals, n->n.n_if.variable, fp);
+	    break;
+	 case OURFA_XMLAPI_NODE_FOR:
+	    fp = ourfa_hash_fingerprint(globals, n->n.n_for.from, fp);
+	    fp = ourfa_hash_fingerprint(globals, n->n.n_for.count, fp);
+	    break;
+	 case OURFA_XMLAPI_NODE_SET:
+	    fp = ourfa_hash_fingerprint(globals, n->n.n_set.src, fp);
+	    fp = ourfa_hash_fingerprint_idx(globals, n->n.n_set.src_index,
+		  loops, loops_cnt, fp);
+	    fp = ourfa_hash_fingerprint_idx(globals, n->n.n_set.dst_index,
+		  loops, loops_cnt, fp);
+	    break;
+	 case OURFA_XMLAPI_NODE_ERROR:
+	    fp = ourfa_hash_fingerprint(globals, n->n.n_error.variable, fp);
+	    break;
+	 case OURFA_XMLAPI_NODE_ADD:
+	 case OURFA_XMLAPI_NODE_SUB:
+	 case OURFA_XMLAPI_NODE_DIV:
+	 case OURFA_XMLAPI_NODE_MUL:
+	    fp = ourfa_hash_fingerprint(globals, n->n.n_math.arg1, fp);
+	    fp = ourfa_hash_fingerprint(globals, n->n.n_math.arg2, fp);
+	    break;
+	 default:
+	    break;
+      }
+   }
+
+   free(loops);
+
+   return fp;
+}
+
+static unsigned func_ttl(ourfa_call_cache_t *cache, ourfa_xmlapi_func_t *f)
+{
+   const struct cache_ttl_t *t;
+
+   t = xmlHashLookup(cache->ttls, (const xmlChar *)f->name);
+   return t ? t->ttl : cache->default_ttl;
+}
+
+static void cache_add(ourfa_call_cache_t *cache, ourfa_xmlapi_func_t *f,
+      const char *key, time_t expire, ourfa_hash_t *h)
+{
+   struct cache_entry_t *e;
+
+   e = malloc(sizeof(*e));
+   if (e == NULL)
+      return;
+   e->h = ourfa_hash_clone(h);
+   if (e->h == NULL) {
+      free(e);
+      return;
+   }
+   e->func_id = f->id;
+   e->expire = expire;
+   e->size = sizeof(*e) + ourfa_hash_mem_size(e->h);
+   strcpy(e->key, key);
+
+   if (e->size > cache->max_bytes) {
+      entry_free(e, NULL);
+      return;
+   }
+
+   if (xmlHashAddEntry(cache->entries, (const xmlChar *)e->key, e) != 0) {
+      entry_free(e, NULL);
+      return;
+   }
+   lru_push(cache, e);
+   cache->stats.entries++;
+   cache->stats.bytes += e->size;
+
+   while (cache->stats.bytes > cache->max_bytes) {
+      assert(cache->tail && cache->tail != e);
+      entry_remove(cache, cache->tail);
+      cache->stats.evictions++;
+   }
+}
+
+/* Wait for the call in flight and take its result. Called locked */
+static int flight_join(ourfa_call_cache_t *cache, struct cache_flight_t *fl,
+      ourfa_hash_t *globals)
+{
+   int res;
+
+   fl->waiters++;
+   while (!fl->done)
+      cache_wait(cache);
+
+   res = fl->res;
+   if ((res == OURFA_OK)
+	 && ((fl->h == NULL) || (ourfa_hash_merge(globals, fl->h) != 0)))
+      res = OURFA_ERROR_SYSTEM;
+   else
+      cache->stats.coalesced++;
+
+   if (--fl->waiters == 0)
+      flight_free(fl);
+
+   return res;
+}
+
+int ourfa_call_cached(ourfa_call_cache_t *cache,
+      ourfa_connection_t *connection,
+      ourfa_xmlapi_t *xmlapi,
+      const char *func,
+      ourfa_hash_t *globals)
+{
+   ourfa_xmlapi_func_t *f;
+   struct cache_entry_t *e;
+   struct cache_flight_t *fl;
+   ourfa_hash_t *before, *h;
+   unsigned ttl;
+   time_t now;
+   int res;
+
+   if (cache == NULL)
+      return ourfa_call(connection, xmlapi, func, globals);
+
+   f = ourfa_xmlapi_func(xmlapi, func);
+   if ((f == NULL) || (f->script != NULL))
+      return ourfa_call(connection, xmlapi, func, globals);
+
+   fl = malloc(sizeof(*fl));
+   if (fl == NULL)
+      return ourfa_call(connection, xmlapi, func, globals);
+   snprintf(fl->key, sizeof(fl->key), "%d:%016llx", f->id,
+	 input_fingerprint(f, globals));
+   fl->waiters = 0;
+   fl->done = 0;
+   fl->res = OURFA_OK;
+   fl->h = NULL;
+
+   cache_lock(cache);
+
+   ttl = func_ttl(cache, f);
+   if (ttl == 0) {
+      cache_unlock(cache);
+      free(fl);
+      return ourfa_call(connection, xmlapi, func, globals);
+   }
+
+   now = time(NULL);
+   e = xmlHashLookup(cache->entries, (const xmlChar *)fl->key);
+   if (e != NULL) {
+      if ((e->expire > now) && (ourfa_hash_merge(globals, e->h) == 0)) {
+	 cache->stats.hits++;
+	 lru_unlink(cache, e);
+	 lru_push(cache, e);
+	 cache_unlock(cache);
+	 free(fl);
+	 return OURFA_OK;
+      }
+      entry_remove(cache, e);
+   }
+
+   /* Same call is in progress: share its result  */
+   if (xmlHashLookup(cache->flights, (const xmlChar *)fl->key) != NULL) {
+      res = flight_join(cache,
+	    xmlHashLookup(cache->flights, (const xmlChar *)fl->key), globals);
+      cache_unlock(cache);
+      free(fl);
+      return res;
+   }
+
+   cache->stats.misses++;
+   if (xmlHashAddEntry(cache->flights, (const xmlChar *)fl->key, fl) != 0) {
+      cache_unlock(cache);
+      free(fl);
+      return ourfa_call(connection, xmlapi, func, globals);
+   }
+   cache_unlock(cache);
+
+   h = NULL;
+   before = ourfa_hash_clone(globals);
+   res = ourfa_call(connection, xmlapi, func, globals);
+   if ((res == OURFA_OK) && (before != NULL))
+      h = ourfa_hash_diff(before, globals);
+   ourfa_hash_free(before);
+
+   cache_lock(cache);
+   xmlHashRemoveEntry(cache->flights, (const xmlChar *)fl->key, NULL);
+   if (h != NULL)
+      cache_add(cache, f, fl->key, now + (time_t)ttl, h);
+   fl->res = res;
+   fl->h = h;
+   fl->done = 1;
+   if (fl->waiters == 0)
+      flight_free(fl);
+   else
+      cache_broadcast(cache);
+   cache_unlock(cache);
+
+   return res;
+}
+
+/* Shared cache  */
+#define SHARED_CACHE_LOCK_FILE "lock"
+#define SHARED_CACHE_SUFFIX ".hsh"
+#define SHARED_CACHE_LOCK_RANGE 0x10000
+#define SHARED_CACHE_LOCK_WAIT 30
+
+struct ourfa_shared_cache_t {
+   char *dir;
+   unsigned long long scope_fp;
+   unsigned ttl;
+   int lock_fd;
+   off_t locked; /* Locked byte of lock file, -1 - not locked */
+   char key[40];
+};
+
+ourfa_shared_cache_t *ourfa_shared_cache_new(const char *dir,
+      const char *scope, unsigned ttl)
+{
+   ourfa_shared_cache_t *cache;
+   char *lock_fname;
+
+   if (dir == NULL)
+      return NULL;
+
+   cache = malloc(sizeof(*cache));
+   if (cache == NULL)
+      return NULL;
+   cache->dir = strdup(dir);
+   if (cache->dir == NULL) {
+      free(cache);
+      return NULL;
+   }
+   cache->scope_fp = ourfa_hash_fingerprint(NULL, scope ? scope : "", 0);
+   cache->ttl = ttl;
+   cache->locked = -1;
+   cache->key[0] = '\0';
+
+   lock_fname = NULL;
+   ourfa_asprintf(&lock_fname, "%s/%s", dir, SHARED_CACHE_LOCK_FILE);
+   cache->lock_fd = lock_fname ? open(lock_fname, O_RDWR | O_CREAT, 0600) : -1;
+   free(lock_fname);
+   if (cache->lock_fd < 0) {
+      free(cache->dir);
+      free(cache);
+      return NULL;
+   }
+
+   return cache;
+}
+
+#ifdef WIN32
+/* Not serialized: concurrent misses of the same entry all go to server */
+static int shared_cache_lock(ourfa_shared_cache_t *cache, off_t pos)
+{
+   cache->locked = pos;
+   return 0;
+}
+
+static void shared_cache_unlock(ourfa_shared_cache_t *cache)
+{
+   cache->locked = -1;
+}
+#else
+/*
+ * Bytes of the lock file locked by caches of this process. Entries are
+ * tagged with pid: child process inherits the table, not the locks
+ */
+struct locked_byte_t {
+   off_t pos;
+   pid_t pid;
+};
+static pthread_mutex_t locked_bytes_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct locked_byte_t *locked_bytes;
+static unsigned locked_bytes_cnt;
+static unsigned locked_bytes_size;
+
+/* Index of byte locked by this process or -1. Called locked */
+static int locked_byte_idx(off_t pos)
+{
+   unsigned i;
+   pid_t pid;
+
+   pid = getpid();
+   for (i=0; i < locked_bytes_cnt; i++) {
+      if ((locked_bytes[i].pos == pos) && (locked_bytes[i].pid == pid))
+	 return (int)i;
+   }
+   return -1;
+}
+
+/* Lock byte without waiting. Returns 0 - locked, 1 - busy, -1 - error */
+static int shared_cache_trylock(ourfa_shared_cache_t *cache, off_t pos)
+{
+   struct flock fl;
+   int res;
+
+   memset(&fl, 0, sizeof(fl));
+   fl.l_type = F_WRLCK;
+   fl.l_whence = SEEK_SET;
+   fl.l_start = pos;
+   fl.l_len = 1;
+
+   pthread_mutex_lock(&locked_bytes_lock);
+   if (locked_byte_idx(pos) >= 0) {
+      pthread_mutex_unlock(&locked_bytes_lock);
+      return 1;
+   }
+   if (locked_bytes_cnt == locked_bytes_size) {
+      struct locked_byte_t *tmp;
+      tmp = realloc(locked_bytes, (locked_bytes_size + 8) * sizeof(tmp[0]));
+      if (tmp == NULL) {
+	 pthread_mutex_unlock(&locked_bytes_lock);
+	 return -1;
+      }
+      locked_bytes = tmp;
+      locked_bytes_size += 8;
+   }
+
+#ifdef F_OFD_SETLK
+   res = fcntl(cache->lock_fd, F_OFD_SETLK, &fl);
+   /* Kernel without open file description locks  */
+   if ((res != 0) && (errno == EINVAL))
+      res = fcntl(cache->lock_fd, F_SETLK, &fl);
+#else
+   res = fcntl(cache->lock_fd, F_SETLK, &fl);
+#endif
+   if (res == 0) {
+      locked_bytes[locked_bytes_cnt].pos = pos;
+      locked_bytes[locked_bytes_cnt].pid = getpid();
+      locked_bytes_cnt++;
+   }
+   else
+      res = ((errno == EACCES) || (errno == EAGAIN) || (errno == EINTR)) ? 1 : -1;
+   pthread_mutex_unlock(&locked_bytes_lock);
+
+   return res;
+}
+
+static int shared_cache_lock(ourfa_shared_cache_t *cache, off_t pos)
+{
+   struct timespec delay;
+   time_t deadline;
+   int res;
+
+   deadline = time(NULL) + SHARED_CACHE_LOCK_WAIT;
+   delay.tv_sec = 0;
+   delay.tv_nsec = 20000000;
+   while ((res = shared_cache_trylock(cache, pos)) == 1) {
+      if (time(NULL) >= deadline)
+	 return -1;
+      nanosleep(&delay, NULL);
+   }
+   if (res != 0)
+      return -1;
+   cache->locked = pos;
+
+   return 0;
+}
+
+static void shared_cache_unlock(ourfa_shared_cache_t *cache)
+{
+   struct flock fl;
+   int i;
+
+   if (cache->locked < 0)
+      return;
+   memset(&fl, 0, sizeof(fl));
+   fl.l_type = F_UNLCK;
+   fl.l_whence = SEEK_SET;
+   fl.l_start = cache->locked;
+   fl.l_len = 1;
+
+   pthread_mutex_lock(&locked_bytes_lock);
+#ifdef F_OFD_SETLK
+   if ((fcntl(cache->lock_fd, F_OFD_SETLK, &fl) != 0) && (errno == EINVAL))
+      fcntl(cache->lock_fd, F_SETLK, &fl);
+#else
+   fcntl(cache->lock_fd, F_SETLK, &fl);
+#endif
+   i = locked_byte_idx(cache->locked);
+   if (i >= 0)
+      locked_bytes[i] = locked_bytes[--locked_bytes_cnt];
+   pthread_mutex_unlock(&locked_bytes_lock);
+   cache->locked = -1;
+}
+#endif
+
+void ourfa_shared_cache_release(ourfa_shared_cache_t *cache)
+{
+   if (cache == NULL)
+      return;
+   shared_cache_unlock(cache);
+   cache->key[0] = '\0';
+}
+
+void ourfa_shared_cache_free(ourfa_shared_cache_t *cache)
+{
+   if (cache == NULL)
+      return;
+   shared_cache_unlock(cache);
+   close(cache->lock_fd);
+   free(cache->dir);
+   free(cache);
+}
+
+/* Fresh entry or NULL  */
+static ourfa_hash_t *shared_cache_load(ourfa_shared_cache_t *cache,
+      const char *fname)
+{
+   struct stat st;
+
+   if ((stat(fname, &st) != 0)
+	 || (st.st_mtime + (time_t)cache->ttl <= time(NULL)))
+      return NULL;
+
+   return ourfa_hash_map(fname);
+}
+
+ourfa_hash_t *ourfa_shared_cache_get(ourfa_shared_cache_t *cache,
+      ourfa_xmlapi_t *xmlapi,
+      const char *func,
+      ourfa_hash_t *globals)
+{
+   ourfa_xmlapi_func_t *f;
+   ourfa_hash_t *res;
+   unsigned long long fp;
+   char *fname;
+
+   if (cache == NULL)
+      return NULL;
+
+   shared_cache_unlock(cache);
+   cache->key[0] = '\0';
+
+   f = ourfa_xmlapi_func(xmlapi, func);
+   if ((f == NULL) || (f->script != NULL) || (cache->ttl == 0))
+      return NULL;
+
+   fp = input_fingerprint(f, globals);
+   fp = ourfa_hash_fingerprint(NULL, f->name, fp ^ cache->scope_fp);
+   snprintf(cache->key, sizeof(cache->key), "%d-%016llx", f->id, fp);
+
+   fname = NULL;
+   ourfa_asprintf(&fname, "%s/%s" SHARED_CACHE_SUFFIX, cache->dir, cache->key);
+   if (fname == NULL)
+      return NULL;
+
+   res = shared_cache_load(cache, fname);
+   if (res == NULL) {
+      /* Wait for process fetching the same result and check again */
+      if (shared_cache_lock(cache, (off_t)(fp % SHARED_CACHE_LOCK_RANGE)) == 0) {
+	 res = shared_cache_load(cache, fname);
+	 if (res != NULL)
+	    shared_cache_unlock(cache);
+      }
+   }
+   free(fname);
+
+   return res;
+}
+
+#ifndef WIN32
+/* Remove expired entries  */
+static void shared_cache_purge(ourfa_shared_cache_t *cache)
+{
+   DIR *d;
+   struct dirent *de;
+   struct stat st;
+   size_t len;
+   char *fname;
+   time_t now;
+
+   d = opendir(cache->dir);
+   if (d == NULL)
+      return;
+
+   now = time(NULL);
+   while ((de = readdir(d)) != NULL) {
+      len = strlen(de->d_name);
+      if ((len <= sizeof(SHARED_CACHE_SUFFIX)-1)
+	    || (strcmp(de->d_name + len - (sizeof(SHARED_CACHE_SUFFIX)-1),
+		  SHARED_CACHE_SUFFIX) != 0))
+	 continue;
+      fname = NULL;
+      ourfa_asprintf(&fname, "%s/%s", cache->dir, de->d_name);
+      if (fname == NULL)
+	 break;
+      if ((stat(fname, &st) == 0)
+	    && (st.st_mtime + (time_t)cache->ttl <= now))
+	 unlink(fname);
+      free(fname);
+   }
+   closedir(d);
+}
+#endif
+
+int ourfa_shared_cache_put(ourfa_shared_cache_t *cache, ourfa_hash_t *res)
+{
+   char *fname, *tmp_fname;
+   int fd, err;
+
+   if ((cache == NULL) || (res == NULL) || (cache->key[0] == '\0'))
+      return -1;
+
+#ifndef WIN32
+   shared_cache_purge(cache);
+#endif
+
+   fname = tmp_fname = NULL;
+   ourfa_asprintf(&fname, "%s/%s" SHARED_CACHE_SUFFIX, cache->dir, cache->key);
+   ourfa_asprintf(&tmp_fname, "%s/%s.%d", cache->dir, cache->key, (int)getpid());
+   err = -1;
+   if ((fname == NULL) || (tmp_fname == NULL))
+      goto put_end;
+
+#ifdef WIN32
+   fd = open(tmp_fname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0600);
+#else
+   fd = open(tmp_fname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+#endif
+   if (fd < 0)
+      goto put_end;
+   err = ourfa_hash_save(res, fd);
+   if (close(fd) != 0)
+      err = -1;
+   if (err == 0) {
+#ifdef WIN32
+      if (!MoveFileEx(tmp_fname, fname, MOVEFILE_REPLACE_EXISTING))
+	 err = -1;
+#else
+      err = rename(tmp_fname, fname);
+#endif
+   }
+   if (err != 0)
+      unlink(tmp_fname);
+
+put_end:
+   free(fname);
+   free(tmp_fname);
+   shared_cache_unlock(cache);
+   cache->key[0] = '\0';
+
+   return err;
+}
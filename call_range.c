@@ -0,0 +1,478 @@
+/*-
+ * Copyright (c) 2009-2010 Alexey Illarionov <littlesavage@rambler.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Range split fetch: function with from/to input parameters is called
+ * for consecutive chunks of the range over several connections.
+ *
+ * Calls are multiplexed in one thread. Every idle connection gets the
+ * next chunk of the range, response is read when the connection becomes
+ * readable, so faster connections process more chunks. Results are
+ * merged into the caller's hash (or passed to callback) in range order.
+ */
+
+#ifdef WIN32
+#include <ws2tcpip.h>
+#define poll(fds, nfds, timeout) WSAPoll((fds), (nfds), (timeout))
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#endif
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/ssl.h>
+
+#include "ourfa.h"
+
+/* Output variable  */
+struct range_var_t {
+   const char *name;
+   int loop; /* Index of top level loop for row variables, -1 - other  */
+};
+
+/* Top level output loop  */
+struct range_loop_t {
+   const struct ourfa_xmlapi_insn_t *insn;
+   long long merged; /* Rows merged into result  */
+   long long from;   /* Current chunk: first row index and row count  */
+   long long rows;
+};
+
+struct range_chunk_t {
+   long long from;
+   long long to;
+   ourfa_hash_t *h;
+   unsigned done;
+};
+
+struct range_slot_t {
+   ourfa_connection_t *conn;
+   ourfa_func_call_ctx_t *fctx;
+   unsigned chunk;
+   unsigned long seq; /* Dispatch order. 0 - slot is idle  */
+};
+
+struct range_ctx_t {
+   ourfa_xmlapi_func_t *f;
+   ourfa_hash_t *globals;
+   ourfa_hash_t *base;  /* Copy of input globals, chunks are cloned from it  */
+   const char *from_param;
+   const char *to_param;
+
+   struct range_var_t *vars;
+   unsigned vars_cnt;
+   struct range_loop_t *loops;
+   unsigned loops_cnt;
+
+   struct range_chunk_t *chunks;
+   unsigned chunks_cnt;
+
+   ourfa_range_chunk_f *chunk_f;
+   void *user_ctx;
+};
+
+/* Compare first index of array_index with loop counter name  */
+static int is_row_index(const char *array_index, const char *counter)
+{
+   size_t len;
+
+   if ((array_index == NULL) || (counter == NULL))
+      return 0;
+
+   while (*array_index == ' ')
+      array_index++;
+   len = strcspn(array_index, ", ");
+
+   return (len == strlen(counter)) && (strncmp(array_index, counter, len) == 0);
+}
+
+static int range_load_output(struct range_ctx_t *ctx)
+{
+   const struct ourfa_xmlapi_prog_t *prog;
+   const ourfa_xmlapi_func_node_t *n;
+   unsigned pc, i, depth;
+   int cur_loop;
+
+   prog = ctx->f->out->n.n_root.prog;
+
+   ctx->vars = malloc(prog->insn_cnt * sizeof(ctx->vars[0]) + 1);
+   ctx->loops = malloc(prog->insn_cnt * sizeof(ctx->loops[0]) + 1);
+   if ((ctx->vars == NULL) || (ctx->loops == NULL))
+      return -1;
+
+   depth = 0;
+   cur_loop = -1;
+   for (pc=0; pc < prog->insn_cnt; pc++) {
+      n = prog->insn[pc].node;
+      switch (prog->insn[pc].op) {
+	 case OURFA_XMLAPI_OP_FOR:
+	    if (depth++ == 0) {
+	       cur_loop = ctx->loops_cnt++;
+	       ctx->loops[cur_loop].insn = &prog->insn[pc];
+	       ctx->loops[cur_loop].merged = 0;
+	    }
+	    break;
+	 case OURFA_XMLAPI_OP_ENDFOR:
+	    if (--depth == 0)
+	       cur_loop = -1;
+	    break;
+	 case OURFA_XMLAPI_OP_NODE:
+	    switch (n->type) {
+	       case OURFA_XMLAPI_NODE_INTEGER:
+	       case OURFA_XMLAPI_NODE_STRING:
+	       case OURFA_XMLAPI_NODE_LONG:
+	       case OURFA_XMLAPI_NODE_DOUBLE:
+	       case OURFA_XMLAPI_NODE_IP:
+		  break;
+	       default:
+		  continue;
+	    }
+	    if (n->n.n_val.name == NULL)
+	       break;
+	    for (i=0; i < ctx->vars_cnt; i++) {
+	       if (strcmp(ctx->vars[i].name, n->n.n_val.name) == 0)
+		  break;
+	    }
+	    if (i < ctx->vars_cnt)
+	       break;
+	    ctx->vars[i].name = n->n.n_val.name;
+	    ctx->vars[i].loop = -1;
+	    if ((cur_loop >= 0) && is_row_index(n->n.n_val.array_index,
+		     ctx->loops[cur_loop].insn->node->n.n_for.name))
+	       ctx->vars[i].loop = cur_loop;
+	    ctx->vars_cnt++;
+	    break;
+	 default:
+	    break;
+      }
+   }
+
+   return 0;
+}
+
+/* Integer values are stored as int when they fit, as the decoder does  */
+static int range_set_num(ourfa_hash_t *h, const char *key, long long val)
+{
+   if ((val >= INT_MIN) && (val <= INT_MAX))
+      return ourfa_hash_set_int(h, key, NULL, (int)val);
+   return ourfa_hash_set_long(h, key, NULL, val);
+}
+
+static long long range_operand_val(ourfa_hash_t *h,
+      const struct ourfa_xmlapi_operand_t *op)
+{
+   long long res;
+
+   if (op->var == NULL)
+      return op->val;
+   if (ourfa_hash_get_long(h, op->var, NULL, &res) != 0)
+      return 0;
+   return res;
+}
+
+/* Append result of the chunk to the globals hash  */
+static int range_merge(struct range_ctx_t *ctx, ourfa_hash_t *h)
+{
+   struct range_loop_t *l;
+   const char *count_var;
+   unsigned i;
+   long long count;
+
+   for (i=0; i < ctx->loops_cnt; i++) {
+      l = &ctx->loops[i];
+      l->from = range_operand_val(h, &l->insn->a.i_for.from);
+      count = range_operand_val(h, &l->insn->a.i_for.count);
+      /* Loop body is executed at least once with non-zero count  */
+      l->rows = count > 0 ? count : (count != 0 ? 1 : 0);
+   }
+
+   for (i=0; i < ctx->vars_cnt; i++) {
+      int res;
+      if (ctx->vars[i].loop < 0)
+	 res = ourfa_hash_copy_rows(ctx->globals, ctx->vars[i].name, 0,
+	       h, 0, UINT_MAX);
+      else {
+	 l = &ctx->loops[ctx->vars[i].loop];
+	 if (l->from < 0)
+	    continue;
+	 res = ourfa_hash_copy_rows(ctx->globals, ctx->vars[i].name,
+	       (unsigned)(l->from + l->merged),
+	       h, (unsigned)l->from, (unsigned)l->rows);
+      }
+      if (res != 0)
+	 return OURFA_ERROR_HASH;
+   }
+
+   /* Loop counts are totals of all chunks, counters are set as after
+    * the single call  */
+   for (i=0; i < ctx->loops_cnt; i++) {
+      l = &ctx->loops[i];
+      l->merged += l->rows;
+      count_var = l->insn->a.i_for.count.var;
+      if ((count_var != NULL)
+	    && range_set_num(ctx->globals, count_var, l->merged) != 0)
+	 return OURFA_ERROR_HASH;
+      if (ourfa_hash_set_long(ctx->globals, l->insn->node->n.n_for.name,
+	       NULL, l->from + l->merged) != 0)
+	 return OURFA_ERROR_HASH;
+   }
+
+   return OURFA_OK;
+}
+
+static int range_dispatch(struct range_ctx_t *ctx, struct range_slot_t *slot,
+      unsigned chunk_idx)
+{
+   struct range_chunk_t *chunk;
+   int res;
+
+   chunk = &ctx->chunks[chunk_idx];
+   chunk->h = ourfa_hash_clone(ctx->base);
+   if (chunk->h == NULL)
+      return OURFA_ERROR_SYSTEM;
+
+   if ((range_set_num(chunk->h, ctx->from_param, chunk->from) != 0)
+	 || (range_set_num(chunk->h, ctx->to_param, chunk->to) != 0))
+      return OURFA_ERROR_HASH;
+
+   slot->fctx = ourfa_func_call_ctx_new(ctx->f, chunk->h);
+   if (slot->fctx == NULL)
+      return OURFA_ERROR_SYSTEM;
+
+   res = ourfa_start_call(slot->fctx, slot->conn);
+   if (res == OURFA_OK)
+      res = ourfa_func_call_req(slot->fctx, slot->conn);
+   if (res != OURFA_OK) {
+      ourfa_func_call_ctx_free(slot->fctx);
+      slot->fctx = NULL;
+      return res;
+   }
+   slot->chunk = chunk_idx;
+
+   return OURFA_OK;
+}
+
+/* Find busy slot with response data available. pfds - slots_cnt entries  */
+static struct range_slot_t *range_wait(struct range_slot_t *slots,
+      unsigned slots_cnt, struct pollfd *pfds)
+{
+   struct range_slot_t *oldest;
+   unsigned i, pfds_cnt, timeout;
+   int fd;
+   BIO *bio;
+
+   oldest = NULL;
+   pfds_cnt = 0;
+   timeout = 0;
+   for (i=0; i < slots_cnt; i++) {
+      if (slots[i].seq == 0)
+	 continue;
+      if ((oldest == NULL) || (slots[i].seq < oldest->seq))
+	 oldest = &slots[i];
+      bio = ourfa_connection_bio(slots[i].conn);
+      if (bio == NULL)
+	 return &slots[i];
+      /* Data already decrypted by SSL  */
+      if (BIO_pending(bio) > 0)
+	 return &slots[i];
+      if ((BIO_get_fd(bio, &fd) < 0) || (fd < 0))
+	 return &slots[i];
+      pfds[pfds_cnt].fd = fd;
+      pfds[pfds_cnt].events = POLLIN;
+      pfds[pfds_cnt].revents = 0;
+      pfds_cnt++;
+      if (ourfa_connection_timeout(slots[i].conn) > timeout)
+	 timeout = ourfa_connection_timeout(slots[i].conn);
+   }
+
+   assert(oldest != NULL);
+
+   if (timeout > INT_MAX / 1000)
+      timeout = INT_MAX / 1000;
+   /* On timeout or error read the oldest call: read errors are reported
+    * by ourfa_func_call_resp()  */
+   if (poll(pfds, pfds_cnt, (int)timeout * 1000) <= 0)
+      return oldest;
+
+   /* pfds are in order of busy slots  */
+   pfds_cnt = 0;
+   for (i=0; i < slots_cnt; i++) {
+      if (slots[i].seq == 0)
+	 continue;
+      if (pfds[pfds_cnt++].revents != 0)
+	 return &slots[i];
+   }
+
+   return oldest;
+}
+
+int ourfa_call_range(ourfa_connection_t **conns,
+      unsigned conn_cnt,
+      ourfa_xmlapi_t *xmlapi,
+      const char *func,
+      ourfa_hash_t *globals,
+      const char *from_param,
+      const char *to_param,
+      long long from,
+      long long to,
+      long long chunk_size,
+      ourfa_range_chunk_f *chunk_f,
+      void *user_ctx)
+{
+   struct range_ctx_t ctx;
+   struct range_slot_t *slots, *slot;
+   struct pollfd *pfds;
+   unsigned i, next_chunk, next_merge, busy;
+   unsigned long seq;
+   unsigned long long chunks_cnt;
+   int err, res;
+
+   if ((conns == NULL) || (conn_cnt == 0) || (globals == NULL)
+	 || (from_param == NULL) || (to_param == NULL) || (chunk_size <= 0))
+      return OURFA_ERROR_OTHER;
+
+   memset(&ctx, 0, sizeof(ctx));
+   ctx.f = ourfa_xmlapi_func(xmlapi, func);
+   if (ctx.f == NULL)
+      return ourfa_connection_err_f(conns[0])(OURFA_ERROR_OTHER,
+	    ourfa_connection_err_ctx(conns[0]),
+	    "Function '%s' not found in API", func);
+   if ((ctx.f->script != NULL) || (ctx.f->out == NULL))
+      return ourfa_connection_err_f(conns[0])(OURFA_ERROR_NOT_IMPLEMENTED,
+	    ourfa_connection_err_ctx(conns[0]),
+	    "Function '%s' can not be split by range", func);
+
+   if (to <= from)
+      return OURFA_OK;
+
+   ctx.globals = globals;
+   ctx.from_param = from_param;
+   ctx.to_param = to_param;
+   ctx.chunk_f = chunk_f;
+   ctx.user_ctx = user_ctx;
+
+   slots = NULL;
+   pfds = NULL;
+   err = OURFA_ERROR_SYSTEM;
+
+   chunks_cnt = (unsigned long long)(to - from - 1) / (unsigned long long)chunk_size + 1;
+   if (chunks_cnt > UINT_MAX / sizeof(ctx.chunks[0]))
+      goto call_range_end;
+   ctx.chunks_cnt = (unsigned)chunks_cnt;
+   ctx.chunks = calloc(ctx.chunks_cnt, sizeof(ctx.chunks[0]));
+   slots = calloc(conn_cnt, sizeof(slots[0]));
+   pfds = calloc(conn_cnt, sizeof(pfds[0]));
+   ctx.base = ourfa_hash_clone(globals);
+   if ((ctx.chunks == NULL) || (slots == NULL) || (pfds == NULL)
+	 || (ctx.base == NULL))
+      goto call_range_end;
+   if (range_load_output(&ctx) != 0)
+      goto call_range_end;
+
+   for (i=0; i < ctx.chunks_cnt; i++) {
+      ctx.chunks[i].from = from + (long long)i * chunk_size;
+      ctx.chunks[i].to = ctx.chunks[i].from + chunk_size;
+      if (ctx.chunks[i].to > to)
+	 ctx.chunks[i].to = to;
+   }
+
+   err = OURFA_OK;
+   seq = 0;
+   busy = 0;
+   next_chunk = 0;
+   next_merge = 0;
+   for (i=0; i < conn_cnt; i++)
+      slots[i].conn = conns[i];
+
+   for (i=0; (i < conn_cnt) && (next_chunk < ctx.chunks_cnt); i++) {
+      err = range_dispatch(&ctx, &slots[i], next_chunk++);
+      if (err != OURFA_OK)
+	 break;
+      slots[i].seq = ++seq;
+      busy++;
+   }
+
+   while (busy > 0) {
+      slot = range_wait(slots, conn_cnt, pfds);
+      res = ourfa_func_call_resp(slot->fctx, slot->conn);
+      ourfa_func_call_ctx_free(slot->fctx);
+      slot->fctx = NULL;
+      slot->seq = 0;
+      busy--;
+      if (res != OURFA_OK) {
+	 if (err == OURFA_OK)
+	    err = res;
+	 continue;
+      }
+      /* After error only outstanding responses are read  */
+      if (err != OURFA_OK)
+	 continue;
+
+      ctx.chunks[slot->chunk].done = 1;
+      while ((next_merge < ctx.chunks_cnt) && ctx.chunks[next_merge].done) {
+	 struct range_chunk_t *chunk = &ctx.chunks[next_merge];
+	 if (chunk_f != NULL) {
+	    if (chunk_f(user_ctx, chunk->h, chunk->from, chunk->to) != 0)
+	       err = OURFA_ERROR_OTHER;
+	 }else
+	    err = range_merge(&ctx, chunk->h);
+	 ourfa_hash_free(chunk->h);
+	 chunk->h = NULL;
+	 next_merge++;
+	 if (err != OURFA_OK)
+	    break;
+      }
+
+      if ((err == OURFA_OK) && (next_chunk < ctx.chunks_cnt)) {
+	 err = range_dispatch(&ctx, slot, next_chunk++);
+	 if (err == OURFA_OK) {
+	    slot->seq = ++seq;
+	    busy++;
+	 }
+      }
+   }
+
+call_range_end:
+   if (ctx.chunks != NULL) {
+      for (i=0; i < ctx.chunks_cnt; i++)
+	 ourfa_hash_free(ctx.chunks[i].h);
+   }
+   free(ctx.chunks);
+   ourfa_hash_free(ctx.base);
+   free(ctx.vars);
+   free(ctx.loops);
+   free(slots);
+   free(pfds);
+
+   return err;
+}
@@ -26,13 +26,21 @@
 
 
 #ifdef WIN32
+#include <windows.h>
 #include <ws2tcpip.h>
 #include <stdint.h>
 #else
 #define _GNU_SOURCE
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
+#include <langinfo.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #endif
@@ -40,7 +48,9 @@
 #include <assert.h>
 #include <ctype.h>
 #include <openssl/err.h>
+#include <openssl/sha.h>
 #include <openssl/ssl.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -52,6 +62,7 @@
 #define DEFAULT_HOST "localhost"
 #define DEFAULT_PORT "11758"
 #define DEFAULT_TIMEOUT 30
+#define DEFAULT_CACHE_TTL 60
 #define STR_(x) #x
 #define STR(x) STR_(x)
 #define DEFAULT_HOST_PORT ( DEFAULT_HOST ":" DEFAULT_PORT )
@@ -76,7 +87,14 @@
 enum output_format_t {
    OUTPUT_FORMAT_XML,
    OUTPUT_FORMAT_HASH,
-   OUTPUT_FORMAT_BATCH
+   OUTPUT_FORMAT_BATCH,
+   OUTPUT_FORMAT_JSON,
+   OUTPUT_FORMAT_NDJSON,
+   OUTPUT_FORMAT_CSV
+};
+
+static const char *output_format_names[] = {
+   "xml", "hash", "batch", "json", "ndjson", "csv"
 };
 
 struct params_t {
@@ -92,8 +110,15 @@ struct params_t {
    char *ssl_key;
    char *config_file;
    char *data_file;
+   char *batch_file;
+   char *daemon_socket;
+   char *socket;
    char *action;
    char *session_id;
+   char *cache_dir;
+   char *cache_funcs;
+   unsigned cache_ttl;
+   unsigned jobs;
    struct sockaddr *session_ip;
    struct sockaddr_storage session_ip_buf;
    FILE *debug;
@@ -101,8 +126,15 @@ struct params_t {
    unsigned show_help;
    unsigned timeout;
    enum output_format_t output_format;
+   FILE *out;
+   /* Error messages: stderr or client of the daemon */
+   FILE *err;
+   /* Charset of command line parameters, NULL - current locale */
+   const char *charset;
    ourfa_hash_t *work_h;
    ourfa_hash_t *orig_h;
+   /* Index of the first system parameter in argv, 0 if none */
+   int sysparam_arg;
 };
 
 typedef int set_sysparam_f(struct params_t *params,
@@ -116,7 +148,8 @@ void *dump_new(
       ourfa_func_call_ctx_t *fctx,
       ourfa_connection_t *connection,
       FILE *stream,
-      unsigned dump_xml);
+      FILE *err_stream,
+      const char *format);
 void dump_free(void *dump);
 int dump_step(void *vdump);
 
@@ -192,6 +225,13 @@ static int help(ourfa_xmlapi_func_t *f)
 	 " %-10s %s\n"
 	 " %-10s %s\n"
 	 " %-10s %s\n"
+	 " %-10s %s\n"
+	 " %-10s %s\n"
+	 " %-10s %s\n"
+	 " %-10s %s\n"
+	 " %-10s %s\n"
+	 " %-10s %s\n"
+	 " %-10s %s\n"
 	 "\n",
 	 "-help", "This message",
 	 "-a", "Action name",
@@ -210,9 +250,16 @@ static int help(ourfa_xmlapi_func_t *f)
 	 "-dealer", "Login as dealer (not admin)",
 	 "-timeout", "Timeout in seconds (default: " STR(DEFAULT_TIMEOUT) ")",
 	 "-is_in_unicode", "Turn off conversion of command line arguments to unicode",
-	 "-o", "Output format: xml (default), batch, or hash",
+	 "-o", "Output format: xml (default), batch, hash, json, ndjson or csv",
 	 "-debug",      "Turn on debug",
-	 "-datafile", "Load array datas from file",
+	 "-datafile", "Load array datas from XML or CSV file",
+	 "-batch", "Run actions from file, one per line (- for stdin)",
+	 "-j", "Number of parallel connections in batch and daemon mode (default: 1)",
+	 "-daemon", "Serve actions on unix socket, keeping sessions open",
+	 "-socket", "Run action by daemon listening on unix socket",
+	 "-cache_dir", "Share results of read-only actions with other processes in dir",
+	 "-cache_funcs", "Comma-separated read-only actions shared by -cache_dir",
+	 "-cache_ttl", "Lifetime of shared results in seconds (default: " STR(DEFAULT_CACHE_TTL) ")",
 	 "-api", "URFA server API file (default: api.xml)",
 	 "-<param>[:idx]", "Set input parameter param(idx)"
 	 );
@@ -238,6 +285,9 @@ static int init_params(struct params_t *params)
    params->xml_dir = NULL;
    params->config_file = NULL;
    params->data_file = NULL;
+   params->batch_file = NULL;
+   params->daemon_socket = NULL;
+   params->socket = NULL;
    params->login_type = OURFA_LOGIN_SYSTEM;
    params->ssl_type = OURFA_SSL_TYPE_NONE;
    params->ssl_cert = NULL;
@@ -245,22 +295,26 @@ static int init_params(struct params_t *params)
    params->ssl_key = NULL;
    params->action = NULL;
    params->session_id = NULL;
+   params->cache_dir = NULL;
+   params->cache_funcs = NULL;
+   params->cache_ttl = DEFAULT_CACHE_TTL;
+   params->jobs = 1;
    params->debug = NULL;
    params->show_help = 0;
    params->is_in_unicode = 0;
    params->timeout = DEFAULT_TIMEOUT;
    params->output_format = OUTPUT_FORMAT_XML;
+   params->out = stdout;
+   params->err = stderr;
+   params->charset = NULL;
    params->work_h = ourfa_hash_new(0);
    if (params->work_h == NULL) {
       fprintf(stderr, "Cannot create hash\n");
       return -1;
    }
-   params->orig_h = ourfa_hash_new(0);
-   if(params->orig_h == NULL) {
-      ourfa_hash_free(params->work_h);
-      fprintf(stderr, "Cannot create hash\n");
-      return -1;
-   }
+   /* Copy-on-write clone of work_h, created after all parameters loaded */
+   params->orig_h = NULL;
+   params->sysparam_arg = 0;
 
    return 1;
 }
@@ -274,12 +328,17 @@ static void free_params(struct params_t *params)
    free(params->password);
    free(params->config_file);
    free(params->data_file);
+   free(params->batch_file);
+   free(params->daemon_socket);
+   free(params->socket);
    free(params->xml_api);
    free(params->xml_dir);
    free(params->ssl_cert);
    free(params->ssl_key);
    free(params->action);
    free(params->session_id);
+   free(params->cache_dir);
+   free(params->cache_funcs);
    ourfa_hash_free(params->work_h);
    ourfa_hash_free(params->orig_h);
 }
@@ -312,22 +371,21 @@ static int set_sysparam_output_format(struct params_t *params,
       unsigned UNUSED(is_config_file),
       void *UNUSED(data))
 {
+   unsigned i;
+
    if (val == NULL)
       return -1;
 
-   if (strcasecmp(val,"xml")==0)
-      params->output_format = OUTPUT_FORMAT_XML;
-   else if (strcasecmp(val, "batch")==0)
-      params->output_format = OUTPUT_FORMAT_BATCH;
-   else if (strcasecmp(val, "hash")==0)
-      params->output_format = OUTPUT_FORMAT_HASH;
-   else {
-      fprintf(stderr, "Unknown output format '%s'. "
-	    "Allowed values: xml, hash, batch\n", val);
-      return -1;
+   for (i = 0; i < sizeof(output_format_names)/sizeof(output_format_names[0]); i++) {
+      if (strcasecmp(val, output_format_names[i]) == 0) {
+	 params->output_format = (enum output_format_t)i;
+	 return 2;
+      }
    }
 
-   return 2;
+   fprintf(params->err, "Unknown output format '%s'. "
+	 "Allowed values: xml, hash, batch, json, ndjson, csv\n", val);
+   return -1;
 }
 
 static int set_sysparam_login_type_user(struct params_t *params,
@@ -386,7 +444,7 @@ static int set_sysparam_ssl(struct params_t *params,
    }else if ((strcasecmp(val,"rsa_cert")==0))  {
       params->ssl_type=OURFA_SSL_TYPE_RSA_CRT;
    }else {
-      fprintf(stderr, "Unknown SSL/TLS method '%s'. "
+      fprintf(params->err, "Unknown SSL/TLS method '%s'. "
 	    "Allowed methods: tlsv1, sslv3, cert, rsa_cert\n", val);
       return -1;
    }
@@ -403,7 +461,7 @@ static int set_sysparam_session_ip(struct params_t *params,
    if (val == NULL)
       return -1;
    if (ourfa_parse_ip(val, &params->session_ip_buf) < 0) {
-      fprintf(stderr, "Wrong IP\n");
+      fprintf(params->err, "Wrong IP\n");
       return -1;
    }else
       params->session_ip = (struct sockaddr *)&params->session_ip_buf;
@@ -426,7 +484,7 @@ static int set_sysparam_timeout(struct params_t *params,
    tmout = strtoul(val, &endv, 10);
 
    if (*endv != '\0') {
-      fprintf(stderr, "Wrong timeout `%s`\n", val);
+      fprintf(params->err, "Wrong timeout `%s`\n", val);
       return -1;
    }
 
@@ -435,6 +493,53 @@ static int set_sysparam_timeout(struct params_t *params,
    return 2;
 }
 
+static int set_sysparam_cache_ttl(struct params_t *params,
+      const char *UNUSED(name),
+      const char *val,
+      unsigned UNUSED(is_config_file),
+      void *UNUSED(data))
+{
+   char *endv;
+   unsigned ttl;
+
+   if (val == NULL || (val[0] == '\0'))
+      return -1;
+
+   ttl = strtoul(val, &endv, 10);
+
+   if (*endv != '\0') {
+      fprintf(params->err, "Wrong cache TTL `%s`\n", val);
+      return -1;
+   }
+
+   params->cache_ttl = ttl;
+
+   return 2;
+}
+
+static int set_sysparam_jobs(struct params_t *params,
+      const char *UNUSED(name),
+      const char *val,
+      unsigned UNUSED(is_config_file),
+      void *UNUSED(data))
+{
+   char *endv;
+   unsigned long jobs;
+
+   if (val == NULL || (val[0] == '\0'))
+      return -1;
+
+   jobs = strtoul(val, &endv, 10);
+
+   if ((*endv != '\0') || (jobs < 1) || (jobs > 256)) {
+      fprintf(params->err, "Wrong number of jobs `%s`\n", val);
+      return -1;
+   }
+
+   params->jobs = jobs;
+
+   return 2;
+}
 
 static int set_sysparam_show_help(struct params_t *params,
       const char *UNUSED(name),
@@ -487,6 +592,20 @@ static int load_system_param(struct params_t *params, const char *name, const ch
 	 (void *)&params->config_file},
       {"datafile", NULL,            set_sysparam_string,
 	 (void *)&params->data_file},
+      {"batch", NULL,            set_sysparam_string,
+	 (void *)&params->batch_file},
+      {"daemon", NULL,            set_sysparam_string,
+	 (void *)&params->daemon_socket},
+      {"socket", NULL,            set_sysparam_string,
+	 (void *)&params->socket},
+      {"cache_dir", NULL,            set_sysparam_string,
+	 (void *)&params->cache_dir},
+      {"cache_funcs", NULL,            set_sysparam_string,
+	 (void *)&params->cache_funcs},
+      {"cache_ttl", NULL,            set_sysparam_cache_ttl,
+	 NULL,},
+      {"j", NULL,            set_sysparam_jobs,
+	 NULL,},
       {"s", "session_key",   set_sysparam_string,
 	 (void *)&params->session_id,},
       {"c", NULL,            set_sysparam_string,
@@ -541,7 +660,7 @@ static int load_system_param(struct params_t *params, const char *name, const ch
    }
 
    if ((res >= 2) && (val == NULL)) {
-      fprintf(stderr, "Wrong parameter '%s': can not parse value\n", name);
+      fprintf(params->err, "Wrong parameter '%s': can not parse value\n", name);
       res = -1;
    }
 
@@ -665,10 +784,7 @@ static int load_config_file(struct params_t *params)
 
       /* add to hash  */
       if (ourfa_hash_get_string(params->work_h, param, NULL, NULL) != 0) {
-	 if (
-	       (ourfa_hash_set_string(params->work_h, param, NULL, val) != 0)
-	       || (ourfa_hash_set_string(params->orig_h, param, NULL, val) != 0)
-	    ) {
+	 if (ourfa_hash_set_string(params->work_h, param, NULL, val) != 0) {
 	    fprintf(stderr,  "Can not add '%s(%s)=%s' to hash\n",
 		  param,"0",val);
 	 }
@@ -694,9 +810,12 @@ static int load_command_line_params(int argc, char **argv, struct params_t *para
 
    iconv_t to_utf8;
 
-   to_utf8 = iconv_open("UTF-8", "");
+   to_utf8 = iconv_open("UTF-8", params->charset ? params->charset : "");
    if (to_utf8 == (iconv_t)(-1)) {
-      fprintf(stderr, "iconv error");
+      if (params->charset)
+	 fprintf(params->err, "Unsupported charset %s\n", params->charset);
+      else
+	 fprintf(params->err, "iconv error");
       return 1;
    }
 
@@ -731,13 +850,13 @@ static int load_command_line_params(int argc, char **argv, struct params_t *para
       name[res_idx]='\0';
 
       if (name[0] == '\0') {
-	 fprintf(stderr, "Wrong parameter '%s': cannot parse parameter name\n",
+	 fprintf(params->err, "Wrong parameter '%s': cannot parse parameter name\n",
 	       argv[i]);
 	 iconv_close(to_utf8);
 	 return 1;
       }
       if (res_idx == sizeof(name)-1) {
-	 fprintf(stderr, "Wrong parameter '%s': too long parameter name\n",
+	 fprintf(params->err, "Wrong parameter '%s': too long parameter name\n",
 	       argv[i]);
 	 iconv_close(to_utf8);
 	 return 1;
@@ -749,7 +868,7 @@ static int load_command_line_params(int argc, char **argv, struct params_t *para
       /* Read index */
       if (*p == ':') {
 	 if (p[0] == '\0') {
-	    fprintf(stderr, "Wrong parameter '%s': wrong index\n",
+	    fprintf(params->err, "Wrong parameter '%s': wrong index\n",
 		  argv[i]);
 	    iconv_close(to_utf8);
 	    return 1;
@@ -764,7 +883,7 @@ static int load_command_line_params(int argc, char **argv, struct params_t *para
 
 	 idx[res_idx]='\0';
 	 if (res_idx == sizeof(idx)-1) {
-	    fprintf(stderr, "Wrong parameter '%s': too long index name\n",
+	    fprintf(params->err, "Wrong parameter '%s': too long index name\n",
 		  argv[i]);
 	    iconv_close(to_utf8);
 	    return 1;
@@ -794,6 +913,8 @@ static int load_command_line_params(int argc, char **argv, struct params_t *para
 	 else {
 	    is_system_param = 1;
 	    incr_i = load_res-1;
+	    if (params->sysparam_arg == 0)
+	       params->sysparam_arg = i;
 	 }
       }
 
@@ -803,7 +924,7 @@ static int load_command_line_params(int argc, char **argv, struct params_t *para
 	 char *p_val;
 
 	 if (p==NULL) {
-	    fprintf(stderr, "Wrong parameter '%s': can not parse value\n",
+	    fprintf(params->err, "Wrong parameter '%s': can not parse value\n",
 		  argv[i]);
 	    iconv_close(to_utf8);
 	    return 1;
@@ -827,7 +948,7 @@ static int load_command_line_params(int argc, char **argv, struct params_t *para
 	    pbuf_siz = 6*inbytesleft+1;
 	    p_val = malloc(pbuf_siz);
 	    if (p_val == NULL) {
-	       fprintf(stderr, "malloc error");
+	       fprintf(params->err, "malloc error");
 	       iconv_close(to_utf8);
 	    }
 
@@ -850,7 +971,7 @@ static int load_command_line_params(int argc, char **argv, struct params_t *para
 		     pbuf_siz = pbuf_siz + inbytesleft + 1;
 		     newpbuf = realloc(p_val, pbuf_siz);
 		     if (newpbuf == NULL) {
-			fprintf(stderr, "realloc error");
+			fprintf(params->err, "realloc error");
 			free(p_val);
 			iconv_close(to_utf8);
 			return 1;
@@ -859,7 +980,7 @@ static int load_command_line_params(int argc, char **argv, struct params_t *para
 		     outbuf = &newpbuf[old_pbuf_siz];
 		     outbytesleft=pbuf_siz-old_pbuf_siz;
 		  }else {
-		     fprintf(stderr, "Wrong parameter '%s', can not convert value to UTF-8, `%u` %s\n",
+		     fprintf(params->err, "Wrong parameter '%s', can not convert value to UTF-8, `%u` %s\n",
 			   p_name, errno, strerror(errno));
 		     free(p_val);
 		     iconv_close(to_utf8);
@@ -874,7 +995,7 @@ static int load_command_line_params(int argc, char **argv, struct params_t *para
 	       assert(outbytesleft==0);
 	       newpbuf = realloc(p_val, pbuf_siz+1);
 	       if (newpbuf == NULL) {
-		  fprintf(stderr, "realloc error");
+		  fprintf(params->err, "realloc error");
 		  free(p_val);
 		  iconv_close(to_utf8);
 		  return 1;
@@ -884,10 +1005,8 @@ static int load_command_line_params(int argc, char **argv, struct params_t *para
 	    }
 	 }
 
-	 if ((hash_arr_push(params->work_h,
-		  p_name, idx, (*p == '\0') || (params->is_in_unicode) ? p : p_val) != 0)
-	       || (hash_arr_push(params->orig_h,
-		      p_name, idx, (*p == '\0') || (params->is_in_unicode) ? p : p_val) != 0)) {
+	 if (hash_arr_push(params->work_h,
+		  p_name, idx, (*p == '\0') || (params->is_in_unicode) ? p : p_val) != 0) {
 	    free(p_val);
 	    iconv_close(to_utf8);
 	    return 1;
@@ -902,258 +1021,275 @@ static int load_command_line_params(int argc, char **argv, struct params_t *para
    return 0;
 }
 
-int main(int argc, char **argv)
+/* Copy value of output node type between hashes  */
+static int copy_node_val(int type,
+      ourfa_hash_t *dst, const char *dst_key, const char *dst_idx,
+      ourfa_hash_t *src, const char *src_key, const char *src_idx)
 {
    int res;
-   ourfa_connection_t *connection;
-   ourfa_xmlapi_t *xmlapi;
-   ourfa_xmlapi_func_t *f;
-   char *host_port;
-
-   struct params_t params;
 
-   setlocale(LC_ALL, "");
-
-   if (init_params(&params) < 0)
-      return 1;
-
-   if (argc <= 1)
-      return usage();
+   res = -1;
+   switch (type) {
+      case OURFA_XMLAPI_NODE_INTEGER:
+	 {
+	    int val;
+	    if (ourfa_hash_get_int(src, src_key, src_idx, &val) == 0)
+	       res = ourfa_hash_set_int(dst, dst_key, dst_idx, val);
+	 }
+	 break;
+      case OURFA_XMLAPI_NODE_LONG:
+	 {
+	    long long val;
+	    if (ourfa_hash_get_long(src, src_key, src_idx, &val) == 0)
+	       res = ourfa_hash_set_long(dst, dst_key, dst_idx, val);
+	 }
+	 break;
+      case OURFA_XMLAPI_NODE_DOUBLE:
+	 {
+	    double val;
+	    if (ourfa_hash_get_double(src, src_key, src_idx, &val) == 0)
+	       res = ourfa_hash_set_double(dst, dst_key, dst_idx, val);
+	 }
+	 break;
+      case OURFA_XMLAPI_NODE_STRING:
+	 {
+	    char *val;
+	    if (ourfa_hash_get_string(src, src_key, src_idx, &val) == 0) {
+	       res = ourfa_hash_set_string(dst, dst_key, dst_idx, val);
+	       free(val);
+	    }
+	 }
+	 break;
+      case OURFA_XMLAPI_NODE_IP:
+	 {
+	    struct sockaddr_storage val;
+	    if (ourfa_hash_get_ip(src, src_key, src_idx, (struct sockaddr *)&val) == 0)
+	       res = ourfa_hash_set_ip(dst, dst_key, dst_idx, (struct sockaddr *)&val);
+	 }
+	 break;
+      default:
+	 break;
+   }
 
-   SSL_load_error_strings();
-   SSL_library_init();
+   return res;
+}
 
-   connection = NULL;
-   xmlapi = NULL;
-   f = NULL;
-   res=1;
+/*
+ * Received values of the call for shared cache. Values without array
+ * index are overwritten in loops, so all values are kept in order of
+ * receipt: one array per value type.
+ */
+static int record_node_val(ourfa_hash_t *rec, ourfa_func_call_ctx_t *fctx)
+{
+   const ourfa_xmlapi_func_node_t *n;
+   const char *type;
+   unsigned cnt;
+   char idx[20];
 
-   /*
-    * Priorities:
-    *   1. Command line (highest)
-    *   2. Data file
-    *   3. Config file (lowest)
-    */
+   n = fctx->cur;
+   if ((n->type < OURFA_XMLAPI_NODE_INTEGER) || (n->type > OURFA_XMLAPI_NODE_IP))
+      return 0;
 
-   /* Load system parameters: config filename,
-    * data filename, is_in_unicode
-    */
-   res = load_command_line_params(argc, argv, &params, 1);
-   if (res != 0)
-      goto main_end;
+   type = ourfa_xmlapi_node_name_by_type(n->type);
+   cnt = 0;
+   ourfa_hash_get_arr_size(rec, type, NULL, &cnt);
+   snprintf(idx, sizeof(idx), "%u", cnt);
 
-   /* Load params from command line  */
-   res = load_command_line_params(argc, argv, &params, 0);
-   if (res != 0)
-      goto main_end;
+   return copy_node_val(n->type, rec, type, idx, fctx->h, n->n.n_val.name,
+	 n->n.n_val.array_index ? n->n.n_val.array_index : "0");
+}
 
-   /* load data_file. Already loaded datas not touched */
-   if (params.data_file) {
-      char err_str[200];
-      fprintf(stderr, "Loading datafile %s\n", params.data_file);
-      if (load_datafile(params.data_file, params.work_h, err_str, sizeof(err_str)) != OURFA_OK) {
-	 fprintf(stderr, "Can not load datafile. %s\n", err_str);
-	 goto main_end;
-      }
+/* Print output of the function from values recorded by record_node_val() */
+static int dump_cached(struct params_t *params, ourfa_xmlapi_func_t *f,
+      ourfa_hash_t *rec)
+{
+   int state, res;
+   unsigned pos[OURFA_XMLAPI_NODE_IP+1];
+   ourfa_func_call_ctx_t *fctx;
+   const ourfa_xmlapi_func_node_t *n;
+   void *dump_ctx;
+   char idx[20];
+
+   fctx = ourfa_func_call_ctx_new(f, params->work_h);
+   if (fctx == NULL) {
+      fprintf(params->err, "malloc error");
+      return 1;
+   }
+   dump_ctx = dump_new(fctx, NULL,
+	 params->out, params->err, output_format_names[params->output_format]);
+   if (dump_ctx == NULL) {
+      fprintf(params->err, "malloc error");
+      ourfa_func_call_ctx_free(fctx);
+      return 1;
+   }
 
-      if (load_datafile(params.data_file, params.orig_h, err_str, sizeof(err_str)) != OURFA_OK) {
-	 fprintf(stderr, "Can not load datafile. %s\n", err_str);
-	 goto main_end;
+   memset(pos, 0, sizeof(pos));
+   state = ourfa_func_call_start(fctx, 0);
+   for (;;) {
+      n = fctx->cur;
+      if ((state == OURFA_FUNC_CALL_STATE_NODE)
+	    && (fctx->err == OURFA_OK)
+	    && (n->type >= OURFA_XMLAPI_NODE_INTEGER)
+	    && (n->type <= OURFA_XMLAPI_NODE_IP)) {
+	 snprintf(idx, sizeof(idx), "%u", pos[n->type]++);
+	 if (copy_node_val(n->type, params->work_h, n->n.n_val.name,
+		  n->n.n_val.array_index ? n->n.n_val.array_index : "0",
+		  rec, ourfa_xmlapi_node_name_by_type(n->type), idx) != 0) {
+	    fctx->err = OURFA_ERROR_HASH;
+	    fctx->func_ret_code = 1;
+	    snprintf(fctx->last_err_str, sizeof(fctx->last_err_str),
+		  "Cached result has no %s value for node %s",
+		  ourfa_xmlapi_node_name_by_type(n->type), n->n.n_val.name);
+	 }
       }
+      if (params->output_format != OUTPUT_FORMAT_HASH)
+	 dump_step(dump_ctx);
+      if (state == OURFA_FUNC_CALL_STATE_END)
+	 break;
+      state = ourfa_func_call_step(fctx);
    }
+   if (params->output_format == OUTPUT_FORMAT_HASH)
+      ourfa_hash_dump(params->work_h, params->out, "CALL FUNC %s END HASH:\n",
+	    f->name);
+   res = fctx->err != OURFA_OK ? fctx->func_ret_code : 0;
 
-   /* Load config file. Already loaded datas not touched */
-   if (load_config_file(&params) < 0)
-      goto main_end;
-
-   /* Reload system params from command line */
-   res = load_command_line_params(argc, argv, &params, 1);
-   if (res != 0)
-      goto main_end;
-
-   xmlapi = ourfa_xmlapi_new();
-   if (xmlapi == NULL) {
-      fprintf(stderr, "malloc error\n");
-      goto main_end;
-   }
+   dump_free(dump_ctx);
+   ourfa_func_call_ctx_free(fctx);
 
-   if (params.action) {
-      /* xmlapi file  */
-      char *xmlapi_fname = NULL;
-      char *script_file = NULL;
-      int action_len = strlen(params.action);
+   return res;
+}
 
-      ourfa_asprintf(&xmlapi_fname,
+/* Load script of the action if required. Returns function of the action */
+static ourfa_xmlapi_func_t *load_action(struct params_t *params,
+      ourfa_xmlapi_t *xmlapi, const char *action)
+{
+   ourfa_xmlapi_func_t *f;
+   char *script_file = NULL;
+   int action_len = strlen(action);
+
+   f = ourfa_xmlapi_func(xmlapi, action);
+   if (f != NULL)
+      return f;
+
+   if ((action_len > 5)
+	 &&  ((action[0] == 'r') || (action[0] == 'R'))
+	 &&  ((action[1] == 'p') || (action[1] == 'P'))
+	 &&  ((action[2] == 'c') || (action[2] == 'C'))
+	 &&  ((action[3] == 'f') || (action[3] == 'F'))
+	 &&  ((action[4] == '_'))) {
+      /* rpcf_ action  */
+   }else {
+      ourfa_asprintf(&script_file,
 #ifdef WIN32
-	    "%s\\%s",
+		      "%s\\%s.xml",
 #else
-	    "%s/%s",
+		      "%s/%s.xml",
 #endif
-	    params.xml_dir ? params.xml_dir : DEFAULT_XML_DIR,
-	    params.xml_api ? params.xml_api : "api.xml");
-
-      if (xmlapi_fname == NULL) {
-	 fprintf(stderr, "asprintf error\n");
-	 goto main_end;
-      }
-
-      fprintf(stderr,"Loading API XML: %s\n", xmlapi_fname);
-      if (ourfa_xmlapi_load_apixml(xmlapi, xmlapi_fname) != OURFA_OK) {
-	 free(xmlapi_fname);
-	 goto main_end;
+	    params->xml_dir ? params->xml_dir : DEFAULT_XML_DIR,
+	    action);
+      if (script_file == NULL) {
+	 fprintf(params->err, "asprintf error\n");
+	 return NULL;
       }
-      free(xmlapi_fname);
 
-      /* action  */
-      if ((action_len > 5)
-	    &&  ((params.action[0] == 'r') || (params.action[0] == 'R'))
-	    &&  ((params.action[1] == 'p') || (params.action[1] == 'P'))
-	    &&  ((params.action[2] == 'c') || (params.action[2] == 'C'))
-	    &&  ((params.action[3] == 'f') || (params.action[3] == 'F'))
-	    &&  ((params.action[4] == '_'))) {
-	 /* rpcf_ action  */
-      }else {
-	 ourfa_asprintf(&script_file, 
-#ifdef WIN32
-			 "%s\\%s.xml",
-#else
-			 "%s/%s.xml",
-#endif
-	       params.xml_dir ? params.xml_dir : DEFAULT_XML_DIR,
-	       params.action);
-	 if (script_file == NULL) {
-	    fprintf(stderr, "asprintf error\n");
-	    goto main_end;
-	 }
-
-	 fprintf(stderr,"Loading Script XML: %s\n", script_file);
-	 if (ourfa_xmlapi_load_script(xmlapi, script_file, params.action) != OURFA_OK) {
-	    free(script_file);
-	    goto main_end;
-	 }
+      fprintf(params->err,"Loading Script XML: %s\n", script_file);
+      if (ourfa_xmlapi_load_script(xmlapi, script_file, action) != OURFA_OK) {
 	 free(script_file);
+	 return NULL;
       }
-      f = ourfa_xmlapi_func(xmlapi, params.action);
-   }
-
-   if (params.show_help) {
-      help(f);
-      params.show_help=0;
-      goto main_end;
-   }
-
-   if (params.action == NULL) {
-      fprintf(stderr, "Action not defined\n");
-      goto main_end;
+      free(script_file);
+      f = ourfa_xmlapi_func(xmlapi, action);
    }
 
-   connection = ourfa_connection_new(NULL);
-   if (connection == NULL) {
-      fprintf(stderr, "Initialization error\n");
-      goto main_end;
-   }
+   if (f == NULL)
+      fprintf(params->err, "Function `%s` not found in API\n", action);
 
-   if (params.debug)
-      ourfa_connection_set_debug_stream(connection, params.debug);
+   return f;
+}
 
-   res = ourfa_connection_set_login(connection, params.login);
-   assert(res == OURFA_OK);
-   res = ourfa_connection_set_password(connection, params.password);
-   assert(res == OURFA_OK);
+/* Action is listed in -cache_funcs  */
+static int is_cached_func(const struct params_t *params, const char *name)
+{
+   const char *p, *end, *last;
+   size_t len;
 
-   /* Give higher priority to port number in host definition */
-   if ((params.port == NULL)
-	 || strchr(params.host ? params.host : DEFAULT_HOST_PORT, ':')) {
-      host_port = strdup(params.host ? params.host : DEFAULT_HOST_PORT);
-   }else {
-      ourfa_asprintf(&host_port, "%s:%s",
-	    params.host ? params.host : DEFAULT_HOST_PORT,
-	    params.port
-	    );
+   if (params->cache_funcs == NULL)
+      return 0;
+   len = strlen(name);
+   for (p = params->cache_funcs; ; p = end + 1) {
+      while (isspace(*p))
+	 p++;
+      end = strchr(p, ',');
+      if (end == NULL)
+	 end = p + strlen(p);
+      for (last = end; (last > p) && isspace(last[-1]); last--);
+      if (((size_t)(last - p) == len) && (strncmp(p, name, len) == 0))
+	 return 1;
+      if (*end == '\0')
+	 break;
    }
 
-   if (host_port == NULL) {
-      fprintf(stderr, "malloc error\n");
-      goto main_end;
-   }
+   return 0;
+}
 
-   res = ourfa_connection_set_hostname(connection, host_port);
-   assert(res == OURFA_OK);
-   free(host_port);
-   res = ourfa_connection_set_login_type(connection, params.login_type);
-   assert(res == OURFA_OK);
-   res = ourfa_connection_set_timeout(connection, params.timeout);
-   assert(res == OURFA_OK);
-   if (params.session_id) {
-      res = ourfa_connection_set_session_id(connection, params.session_id);
-      if (res != OURFA_OK)
-	 goto main_end;
-   }
-   if (params.session_ip) {
-      res = ourfa_connection_set_session_ip(connection, params.session_ip);
-      assert(res == OURFA_OK);
-   }
+/* Call action with params->work_h input. Returns 0 on success */
+static int call_action(struct params_t *params,
+      ourfa_connection_t *connection,
+      ourfa_shared_cache_t *shared_cache,
+      ourfa_xmlapi_t *xmlapi,
+      ourfa_xmlapi_func_t *f)
+{
+   int res;
+   ourfa_hash_t *rec;
 
-   if (params.ssl_type != OURFA_SSL_TYPE_NONE) {
-      ourfa_ssl_ctx_t *ssl_ctx = ourfa_connection_ssl_ctx(connection);
-      assert(ssl_ctx);
-      res = ourfa_ssl_ctx_set_ssl_type(ssl_ctx, params.ssl_type);
-      assert(res == OURFA_OK);
-      if (params.ssl_cert
-	    || (params.ssl_type == OURFA_SSL_TYPE_CRT)
-	    || (params.ssl_type == OURFA_SSL_TYPE_RSA_CRT)) {
-	 res = ourfa_ssl_ctx_load_cert(ssl_ctx, params.ssl_cert);
-	 if (res != OURFA_OK)
-	    goto main_end;
-      }
-      if (params.ssl_key
-	    || params.ssl_cert
-	    || (params.ssl_type == OURFA_SSL_TYPE_CRT)
-	    || (params.ssl_type == OURFA_SSL_TYPE_RSA_CRT)) {
-	 res = ourfa_ssl_ctx_load_private_key(ssl_ctx,
-	       params.ssl_key ? params.ssl_key : (params.ssl_cert ? params.ssl_cert : NULL),
-	       /* XXX  */ NULL);
-	 if (res != OURFA_OK)
-	    goto main_end;
-      }
+   if (params->debug) {
+      ourfa_xmlapi_dump_func_definitions(f, stderr);
+      ourfa_hash_dump(params->orig_h, params->debug, "INPUT HASH:\n", f->name);
    }
 
-   res=1;
-
-
-   if (f == NULL) {
-      fprintf(stderr, "Function `%s` not found in API\n", params.action);
-      goto main_end;
+   /* Result of the same call from other process: do not connect */
+   rec = NULL;
+   if (shared_cache && (f->script == NULL) && is_cached_func(params, f->name)) {
+      rec = ourfa_shared_cache_get(shared_cache, xmlapi, f->name,
+	    params->work_h);
+      if (rec != NULL) {
+	 res = dump_cached(params, f, rec);
+	 ourfa_hash_free(rec);
+	 return res;
+      }
+      rec = ourfa_hash_new(0);
    }
 
-   if (params.debug) {
-      ourfa_xmlapi_dump_func_definitions(f, stderr);
-      ourfa_hash_dump(params.orig_h, params.debug, "INPUT HASH:\n", params.action);
+   /* Connection is kept open between calls of the batch  */
+   if (!ourfa_connection_is_connected(connection)
+	 && (ourfa_connection_open(connection) != 0)) {
+      ourfa_shared_cache_release(shared_cache);
+      ourfa_hash_free(rec);
+      return 1;
    }
 
-   if (ourfa_connection_open(connection) != 0)
-      goto main_end;
-
-   /* Print numbers in result in C locale */
-   setlocale(LC_NUMERIC, "C");
-
+   res = 0;
    {
       int state;
       ourfa_script_call_ctx_t *sctx;
       void *dump_ctx;
 
-      sctx = ourfa_script_call_ctx_new(f, params.work_h);
+      sctx = ourfa_script_call_ctx_new(f, params->work_h);
       if (sctx == NULL) {
-	 fprintf(stderr, "malloc error");
-	 goto main_end;
+	 fprintf(params->err, "malloc error");
+	 ourfa_shared_cache_release(shared_cache);
+	 ourfa_hash_free(rec);
+	 return 1;
       }
       dump_ctx = dump_new(&sctx->func, connection,
-	    stdout, params.output_format == OUTPUT_FORMAT_XML ? 1 : 0);
+	    params->out, params->err, output_format_names[params->output_format]);
       if (dump_ctx == NULL) {
-	 fprintf(stderr, "malloc error");
-	 goto main_end;
+	 fprintf(params->err, "malloc error");
+	 ourfa_script_call_ctx_free(sctx);
+	 ourfa_shared_cache_release(shared_cache);
+	 ourfa_hash_free(rec);
+	 return 1;
       }
-
       ourfa_script_call_start(sctx);
       state = OURFA_SCRIPT_CALL_START;
       while(state != OURFA_SCRIPT_CALL_END) {
@@ -1165,13 +1301,20 @@ int main(int argc, char **argv)
 	    case OURFA_SCRIPT_CALL_START_RESP:
 	    case OURFA_SCRIPT_CALL_RESP:
 	    case OURFA_SCRIPT_CALL_END_RESP:
-	       if (params.debug
+	       if (rec
+		     && (sctx->func.state == OURFA_FUNC_CALL_STATE_NODE)
+		     && (sctx->func.err == OURFA_OK)
+		     && (record_node_val(rec, &sctx->func) != 0)) {
+		  ourfa_hash_free(rec);
+		  rec = NULL;
+	       }
+	       if (params->debug
 		     || (sctx->script.cur == NULL)
 		     || (sctx->script.cur->n.n_call.output != 0)) {
-		  switch (params.output_format) {
+		  switch (params->output_format) {
 		     case OUTPUT_FORMAT_HASH:
 			if (state == OURFA_SCRIPT_CALL_END_RESP)
-			   ourfa_hash_dump(params.work_h, stdout, "CALL FUNC %s END HASH:\n",
+			   ourfa_hash_dump(params->work_h, params->out, "CALL FUNC %s END HASH:\n",
 				 sctx->func.f->name);
 			break;
 		     default:
@@ -1184,9 +1327,9 @@ int main(int argc, char **argv)
 	       if (sctx->script.cur->type == OURFA_XMLAPI_NODE_PARAMETER) {
 		  /* Set parameter from original hash  */
 		  char *s1;
-		  if (ourfa_hash_get_string(params.orig_h,
+		  if (ourfa_hash_get_string(params->orig_h,
 			   sctx->script.cur->n.n_parameter.name, NULL, &s1) == 0) {
-		     if (ourfa_hash_set_string(params.work_h,
+		     if (ourfa_hash_set_string(params->work_h,
 			       sctx->script.cur->n.n_parameter.name, NULL, s1) != 0) {
 			sctx->script.err = OURFA_ERROR_HASH;
 			sctx->script.func_ret_code = 1;
@@ -1203,21 +1346,1402 @@ int main(int argc, char **argv)
 	       break;
 	 }
       }
-      if (params.debug)
-	 ourfa_hash_dump(params.work_h, stdout, "OUTPUT HASH:\n");
+      if (params->debug)
+	 ourfa_hash_dump(params->work_h, params->out, "OUTPUT HASH:\n");
       if (sctx->script.err != OURFA_OK) {
 	 res = sctx->script.func_ret_code;
 	 /* fprintf(stdout, "ERROR: %s\n", sctx->script.last_err_str); */
-      }
+      }else if (rec)
+	 ourfa_shared_cache_put(shared_cache, rec);
       dump_free(dump_ctx);
       ourfa_script_call_ctx_free(sctx);
    }
 
+   /* Call failed or result not recorded: let others call the server */
+   ourfa_shared_cache_release(shared_cache);
+   ourfa_hash_free(rec);
+
+   return res;
+}
+
+
+/* Read line of any length. Returns NULL on EOF  */
+static char *read_line(FILE *stream, char **buf, size_t *buf_size)
+{
+   size_t len;
+
+   len = 0;
+   for (;;) {
+      if (*buf_size - len < 2) {
+	 char *new_buf;
+	 new_buf = realloc(*buf, *buf_size ? 2 * *buf_size : 512);
+	 if (new_buf == NULL)
+	    return NULL;
+	 *buf = new_buf;
+	 *buf_size = *buf_size ? 2 * *buf_size : 512;
+      }
+      if (fgets(*buf + len, *buf_size - len, stream) == NULL)
+	 return len ? *buf : NULL;
+      len += strlen(*buf + len);
+      if ((len > 0) && ((*buf)[len-1] == '\n'))
+	 break;
+   }
+
+   return *buf;
+}
+
+/*
+ * Split line of the batch file into words in place. Words are separated
+ * by spaces, quotes and backslash as in shell. Returns number of words
+ * or -1 on error
+ */
+static int split_line(char *line, char ***words, size_t *words_size)
+{
+   char *src, *dst;
+   char quote;
+   int cnt;
+
+   cnt = 0;
+   src = line;
+   for (;;) {
+      while (isspace((unsigned char)*src))
+	 src++;
+      if ((*src == '\0') || ((cnt == 0) && (*src == '#')))
+	 break;
+
+      if ((size_t)cnt + 1 >= *words_size) {
+	 char **new_words;
+	 new_words = realloc(*words, (*words_size + 16) * sizeof(char *));
+	 if (new_words == NULL)
+	    return -1;
+	 *words = new_words;
+	 *words_size += 16;
+      }
+      (*words)[cnt++] = dst = src;
+
+      quote = '\0';
+      for (; *src != '\0'; src++) {
+	 if (quote == '\0') {
+	    if (isspace((unsigned char)*src))
+	       break;
+	    if ((*src == '"') || (*src == '\'')) {
+	       quote = *src;
+	       continue;
+	    }
+	 }else if (*src == quote) {
+	    quote = '\0';
+	    continue;
+	 }
+	 if ((*src == '\\') && (quote != '\'') && (src[1] != '\0'))
+	    src++;
+	 *dst++ = *src;
+      }
+      if (quote != '\0')
+	 return -1;
+      if (*src != '\0')
+	 src++;
+      *dst = '\0';
+   }
+
+   if (cnt > 0)
+      (*words)[cnt] = NULL;
+
+   return cnt;
+}
+
+/* Create connection with parameters of the client. Connection is not opened */
+static ourfa_connection_t *new_connection(struct params_t *params)
+{
+   int res;
+   ourfa_connection_t *connection;
+   char *host_port;
+
+   connection = ourfa_connection_new(NULL);
+   if (connection == NULL) {
+      fprintf(stderr, "Initialization error\n");
+      return NULL;
+   }
+
+   if (params->debug)
+      ourfa_connection_set_debug_stream(connection, params->debug);
+
+   res = ourfa_connection_set_login(connection, params->login);
+   assert(res == OURFA_OK);
+   res = ourfa_connection_set_password(connection, params->password);
+   assert(res == OURFA_OK);
+
+   /* Give higher priority to port number in host definition */
+   if ((params->port == NULL)
+	 || strchr(params->host ? params->host : DEFAULT_HOST_PORT, ':')) {
+      host_port = strdup(params->host ? params->host : DEFAULT_HOST_PORT);
+   }else {
+      ourfa_asprintf(&host_port, "%s:%s",
+	    params->host ? params->host : DEFAULT_HOST_PORT,
+	    params->port
+	    );
+   }
+
+   if (host_port == NULL) {
+      fprintf(stderr, "malloc error\n");
+      goto new_connection_err;
+   }
+
+   res = ourfa_connection_set_hostname(connection, host_port);
+   assert(res == OURFA_OK);
+   free(host_port);
+
+   res = ourfa_connection_set_login_type(connection, params->login_type);
+   assert(res == OURFA_OK);
+   res = ourfa_connection_set_timeout(connection, params->timeout);
+   assert(res == OURFA_OK);
+   if (params->session_id) {
+      res = ourfa_connection_set_session_id(connection, params->session_id);
+      if (res != OURFA_OK)
+	 goto new_connection_err;
+   }
+   if (params->session_ip) {
+      res = ourfa_connection_set_session_ip(connection, params->session_ip);
+      assert(res == OURFA_OK);
+   }
+
+   if (params->ssl_type != OURFA_SSL_TYPE_NONE) {
+      ourfa_ssl_ctx_t *ssl_ctx = ourfa_connection_ssl_ctx(connection);
+      assert(ssl_ctx);
+      res = ourfa_ssl_ctx_set_ssl_type(ssl_ctx, params->ssl_type);
+      assert(res == OURFA_OK);
+      if (params->ssl_cert
+	    || (params->ssl_type == OURFA_SSL_TYPE_CRT)
+	    || (params->ssl_type == OURFA_SSL_TYPE_RSA_CRT)) {
+	 res = ourfa_ssl_ctx_load_cert(ssl_ctx, params->ssl_cert);
+	 if (res != OURFA_OK)
+	    goto new_connection_err;
+      }
+      if (params->ssl_key
+	    || params->ssl_cert
+	    || (params->ssl_type == OURFA_SSL_TYPE_CRT)
+	    || (params->ssl_type == OURFA_SSL_TYPE_RSA_CRT)) {
+	 res = ourfa_ssl_ctx_load_private_key(ssl_ctx,
+	       params->ssl_key ? params->ssl_key : (params->ssl_cert ? params->ssl_cert : NULL),
+	       /* XXX  */ NULL);
+	 if (res != OURFA_OK)
+	    goto new_connection_err;
+      }
+   }
+
+   return connection;
+
+new_connection_err:
+   ourfa_connection_free(connection);
+   return NULL;
+}
+
+/*
+ * Results of read-only actions depend on server and session only. Results
+ * are shared only by processes with the same credentials: hash of password,
+ * certificate and key is a part of the scope
+ */
+static ourfa_shared_cache_t *new_shared_cache(struct params_t *params,
+      ourfa_connection_t *connection)
+{
+   ourfa_shared_cache_t *shared_cache;
+   unsigned char md[SHA256_DIGEST_LENGTH];
+   char cred[2*SHA256_DIGEST_LENGTH+1];
+   char *secret, *scope;
+   unsigned i;
+
+   secret = NULL;
+   ourfa_asprintf(&secret, "%s\n%s\n%s",
+	 params->password ? params->password : "",
+	 params->ssl_cert ? params->ssl_cert : "",
+	 params->ssl_key ? params->ssl_key : "");
+   if (secret == NULL) {
+      fprintf(stderr, "malloc error\n");
+      return NULL;
+   }
+   SHA256((unsigned char *)secret, strlen(secret), md);
+   memset(secret, 0, strlen(secret));
+   free(secret);
+   for (i=0; i < SHA256_DIGEST_LENGTH; i++)
+      snprintf(&cred[2*i], 3, "%02x", md[i]);
+
+   shared_cache = NULL;
+   scope = NULL;
+   ourfa_asprintf(&scope, "%s %s %u %s %s",
+	 ourfa_connection_hostname(connection),
+	 params->login ? params->login : "",
+	 params->login_type,
+	 params->session_id ? params->session_id : "",
+	 cred);
+   if (scope != NULL)
+      shared_cache = ourfa_shared_cache_new(params->cache_dir, scope,
+	    params->cache_ttl);
+   if (shared_cache == NULL)
+      fprintf(stderr, "Can not open cache dir %s\n", params->cache_dir);
+   free(scope);
+
+   return shared_cache;
+}
+
+enum batch_job_state_t {
+   BATCH_JOB_QUEUED,
+   BATCH_JOB_RUNNING,
+   BATCH_JOB_DONE
+};
+
+/* Call of one line of the batch file */
+struct batch_job_t {
+   struct batch_job_t *next;
+   unsigned long line_num;
+   char *action;
+   ourfa_xmlapi_func_t *f;
+   ourfa_hash_t *work_h;
+   ourfa_hash_t *orig_h;
+   FILE *out;  /* Output of the call until its turn. NULL: params->out */
+   enum batch_job_state_t state;
+   int res;
+};
+
+struct batch_t {
+   struct params_t *params;
+   ourfa_xmlapi_t *xmlapi;
+#ifdef WIN32
+   CRITICAL_SECTION lock;
+   CONDITION_VARIABLE changed;
+#else
+   pthread_mutex_t lock;
+   pthread_cond_t changed;
+#endif
+   /* Jobs in input order. Only head of the list is printed */
+   struct batch_job_t *head;
+   struct batch_job_t *tail;
+   unsigned pending;
+   unsigned finished;
+
+   /* Used by main thread only  */
+   unsigned long calls;
+   unsigned long failed;
+   unsigned long *failed_lines;
+   size_t failed_lines_cnt;
+   size_t failed_lines_size;
+};
+
+struct batch_worker_t {
+   struct batch_t *batch;
+   ourfa_connection_t *connection;
+   ourfa_shared_cache_t *shared_cache;
+#ifdef WIN32
+   HANDLE thread;
+#else
+   pthread_t thread;
+#endif
+};
+
+#ifdef WIN32
+#define batch_lock(_b) EnterCriticalSection(&(_b)->lock)
+#define batch_unlock(_b) LeaveCriticalSection(&(_b)->lock)
+#define batch_wait(_b) SleepConditionVariableCS(&(_b)->changed, &(_b)->lock, INFINITE)
+#define batch_broadcast(_b) WakeAllConditionVariable(&(_b)->changed)
+#else
+#define batch_lock(_b) pthread_mutex_lock(&(_b)->lock)
+#define batch_unlock(_b) pthread_mutex_unlock(&(_b)->lock)
+#define batch_wait(_b) pthread_cond_wait(&(_b)->changed, &(_b)->lock)
+#define batch_broadcast(_b) pthread_cond_broadcast(&(_b)->changed)
+#endif
+
+static void batch_job_free(struct batch_job_t *job)
+{
+   if (job == NULL)
+      return;
+   if (job->out)
+      fclose(job->out);
+   ourfa_hash_free(job->work_h);
+   ourfa_hash_free(job->orig_h);
+   free(job->action);
+   free(job);
+}
+
+/*
+ * Parse line of the batch file into job. Parameters of the line are
+ * added to the common parameters base_h. Job with wrong line is created
+ * finished with error. Returns NULL on malloc error
+ */
+static struct batch_job_t *batch_job_new(struct params_t *params,
+      ourfa_xmlapi_t *xmlapi,
+      ourfa_hash_t *base_h,
+      char **words,
+      int words_cnt,
+      unsigned long line_num)
+{
+   struct batch_job_t *job;
+   struct params_t line_params;
+
+   job = calloc(1, sizeof(*job));
+   if (job == NULL)
+      return NULL;
+   job->line_num = line_num;
+   job->state = BATCH_JOB_DONE;
+   job->res = 1;
+   job->action = strdup(words_cnt > 0 ? words[0] : "-");
+   if (job->action == NULL) {
+      free(job);
+      return NULL;
+   }
+
+   if (words_cnt < 0) {
+      fprintf(stderr, "Batch file line %lu: unbalanced quotes\n", line_num);
+      return job;
+   }
+
+   job->f = load_action(params, xmlapi, words[0]);
+   if (job->f == NULL)
+      return job;
+
+   if (init_params(&line_params) < 0) {
+      batch_job_free(job);
+      return NULL;
+   }
+   line_params.is_in_unicode = params->is_in_unicode;
+
+   job->work_h = ourfa_hash_clone(base_h);
+   if ((job->work_h == NULL)
+	 || (load_command_line_params(words_cnt, words, &line_params, 0) != 0))
+      fprintf(stderr, "Batch file line %lu: wrong parameters\n", line_num);
+   else if (line_params.sysparam_arg != 0)
+      /* Options of ourfa_client are common for all lines */
+      fprintf(stderr, "Batch file line %lu: option %s can not be used "
+	    "in batch file\n", line_num, words[line_params.sysparam_arg]);
+   else if ((ourfa_hash_merge(job->work_h, line_params.work_h) == 0)
+	 && ((job->orig_h = ourfa_hash_clone(job->work_h)) != NULL))
+      job->state = BATCH_JOB_QUEUED;
+   else
+      fprintf(stderr, "Batch file line %lu: wrong parameters\n", line_num);
+   free_params(&line_params);
+
+   return job;
+}
+
+static void batch_job_run(struct batch_t *batch,
+      struct batch_job_t *job,
+      ourfa_connection_t *connection,
+      ourfa_shared_cache_t *shared_cache)
+{
+   struct params_t job_params;
+
+   job_params = *batch->params;
+   job_params.work_h = job->work_h;
+   job_params.orig_h = job->orig_h;
+   if (job->out)
+      job_params.out = job->out;
+
+   job->res = call_action(&job_params, connection, shared_cache,
+	 batch->xmlapi, job->f);
+}
+
+/* Print output and status of finished job. Called by main thread  */
+static void batch_job_output(struct batch_t *batch, struct batch_job_t *job)
+{
+   FILE *out = batch->params->out;
+
+   if (job->out) {
+      char buf[8192];
+      size_t len;
+
+      rewind(job->out);
+      while ((len = fread(buf, 1, sizeof(buf), job->out)) > 0)
+	 fwrite(buf, 1, len, out);
+   }
+   fprintf(out, "STATUS %lu %s %i\n", job->line_num, job->action, job->res);
+   fflush(out);
+
+   batch->calls++;
+   if (job->res != 0) {
+      batch->failed++;
+      if (batch->failed_lines_cnt >= batch->failed_lines_size) {
+	 unsigned long *new_lines;
+	 new_lines = realloc(batch->failed_lines,
+	       (batch->failed_lines_size + 64) * sizeof(unsigned long));
+	 if (new_lines != NULL) {
+	    batch->failed_lines = new_lines;
+	    batch->failed_lines_size += 64;
+	 }
+      }
+      if (batch->failed_lines_cnt < batch->failed_lines_size)
+	 batch->failed_lines[batch->failed_lines_cnt++] = job->line_num;
+   }
+
+   batch_job_free(job);
+}
+
+/*
+ * Print finished jobs from head of the list in input order. Waits until
+ * no more than max_pending jobs left in the list
+ */
+static void batch_output(struct batch_t *batch, unsigned max_pending)
+{
+   struct batch_job_t *job;
+
+   batch_lock(batch);
+   for (;;) {
+      job = batch->head;
+      if ((job != NULL) && (job->state == BATCH_JOB_DONE)) {
+	 batch->head = job->next;
+	 if (batch->head == NULL)
+	    batch->tail = NULL;
+	 batch->pending--;
+	 batch_unlock(batch);
+	 batch_job_output(batch, job);
+	 batch_lock(batch);
+      }else if (batch->pending > max_pending)
+	 batch_wait(batch);
+      else
+	 break;
+   }
+   batch_unlock(batch);
+}
+
+/* Worker: runs queued jobs over its own connection  */
+#ifdef WIN32
+static DWORD WINAPI batch_worker(LPVOID arg)
+#else
+static void *batch_worker(void *arg)
+#endif
+{
+   struct batch_worker_t *worker = arg;
+   struct batch_t *batch = worker->batch;
+   struct batch_job_t *job;
+
+   batch_lock(batch);
+   for (;;) {
+      for (job = batch->head; job != NULL; job = job->next)
+	 if (job->state == BATCH_JOB_QUEUED)
+	    break;
+      if (job == NULL) {
+	 if (batch->finished)
+	    break;
+	 batch_wait(batch);
+	 continue;
+      }
+      job->state = BATCH_JOB_RUNNING;
+      batch_unlock(batch);
+      batch_job_run(batch, job, worker->connection, worker->shared_cache);
+      batch_lock(batch);
+      job->state = BATCH_JOB_DONE;
+      batch_broadcast(batch);
+   }
+   batch_unlock(batch);
+
+   return 0;
+}
+
+static int batch_worker_start(struct batch_worker_t *worker)
+{
+#ifdef WIN32
+   worker->thread = CreateThread(NULL, 0, batch_worker, worker, 0, NULL);
+   return worker->thread == NULL ? -1 : 0;
+#else
+   return pthread_create(&worker->thread, NULL, batch_worker, worker) == 0 ? 0 : -1;
+#endif
+}
+
+static void batch_worker_join(struct batch_worker_t *worker)
+{
+#ifdef WIN32
+   WaitForSingleObject(worker->thread, INFINITE);
+   CloseHandle(worker->thread);
+#else
+   pthread_join(worker->thread, NULL);
+#endif
+}
+
+/*
+ * Batch mode. Each line of the batch file: action and its parameters as
+ * in command line. Parameters of the command line, datafile and config
+ * file are used for all calls. Calls are made over one connection or,
+ * with -j N, over N connections at once. Output of the calls is printed
+ * in order of the lines.
+ */
+static int run_batch(struct params_t *params,
+      ourfa_connection_t *connection,
+      ourfa_shared_cache_t *shared_cache,
+      ourfa_xmlapi_t *xmlapi)
+{
+   FILE *stream;
+   struct batch_t batch;
+   struct batch_worker_t *workers;
+   struct batch_job_t *job;
+   char *line, **words;
+   size_t line_size, words_size;
+   unsigned long line_num;
+   unsigned i, started;
+   int words_cnt, res;
+
+   if (strcmp(params->batch_file, "-") == 0)
+      stream = stdin;
+   else {
+      stream = fopen(params->batch_file, "r");
+      if (stream == NULL) {
+	 fprintf(stderr, "Can not open batch file %s: %s\n",
+	       params->batch_file, strerror(errno));
+	 return 1;
+      }
+   }
+
+   workers = calloc(params->jobs, sizeof(*workers));
+   if (workers == NULL) {
+      fprintf(stderr, "malloc error\n");
+      if (stream != stdin)
+	 fclose(stream);
+      return 1;
+   }
+
+   memset(&batch, 0, sizeof(batch));
+   batch.params = params;
+   batch.xmlapi = xmlapi;
+#ifdef WIN32
+   InitializeCriticalSection(&batch.lock);
+   InitializeConditionVariable(&batch.changed);
+#else
+   pthread_mutex_init(&batch.lock, NULL);
+   pthread_cond_init(&batch.changed, NULL);
+#endif
+
+   /* First worker uses connection of the client  */
+   res = 0;
+   workers[0].connection = connection;
+   workers[0].shared_cache = shared_cache;
+   for (i = 0; i < params->jobs; i++) {
+      workers[i].batch = &batch;
+      if (i == 0)
+	 continue;
+      workers[i].connection = new_connection(params);
+      if (workers[i].connection == NULL) {
+	 res = 1;
+	 break;
+      }
+      if (shared_cache != NULL)
+	 workers[i].shared_cache = new_shared_cache(params, workers[i].connection);
+   }
+
+   started = 0;
+   if ((res == 0) && (params->jobs > 1)) {
+      for (started = 0; started < params->jobs; started++)
+	 if (batch_worker_start(&workers[started]) != 0)
+	    break;
+      if (started < params->jobs)
+	 fprintf(stderr, "Can not start thread. Running %u jobs\n",
+	       started ? started : 1);
+   }
+
+   line = NULL;
+   words = NULL;
+   line_size = words_size = 0;
+   line_num = 0;
+   while ((res == 0) && (read_line(stream, &line, &line_size) != NULL)) {
+      line_num++;
+      words_cnt = split_line(line, &words, &words_size);
+      if (words_cnt == 0)
+	 continue;
+
+      /* Script of the action is loaded to xmlapi used by running jobs */
+      if (started && (words_cnt > 0)
+	    && (ourfa_xmlapi_func(xmlapi, words[0]) == NULL))
+	 batch_output(&batch, 0);
+
+      job = batch_job_new(params, xmlapi, params->orig_h, words, words_cnt,
+	    line_num);
+      if (job == NULL) {
+	 fprintf(stderr, "malloc error\n");
+	 res = 1;
+	 break;
+      }
+
+      if (started == 0) {
+	 if (job->state == BATCH_JOB_QUEUED) {
+	    batch_job_run(&batch, job, connection, shared_cache);
+	    job->state = BATCH_JOB_DONE;
+	 }
+	 batch_job_output(&batch, job);
+	 continue;
+      }
+
+      if ((job->state == BATCH_JOB_QUEUED)
+	    && ((job->out = tmpfile()) == NULL)) {
+	 fprintf(stderr, "Can not create temporary file: %s\n", strerror(errno));
+	 job->state = BATCH_JOB_DONE;
+      }
+
+      batch_lock(&batch);
+      if (batch.tail)
+	 batch.tail->next = job;
+      else
+	 batch.head = job;
+      batch.tail = job;
+      batch.pending++;
+      batch_broadcast(&batch);
+      batch_unlock(&batch);
+
+      /* Keep each connection busy while previous output is printed  */
+      batch_output(&batch, 2 * started - 1);
+   }
+
+   if (ferror(stream)) {
+      fprintf(stderr, "Batch file %s not readable: %s\n",
+	    params->batch_file, strerror(errno));
+      res = 1;
+   }
+
+   batch_lock(&batch);
+   batch.finished = 1;
+   batch_broadcast(&batch);
+   batch_unlock(&batch);
+   batch_output(&batch, 0);
+   for (i = 0; i < started; i++)
+      batch_worker_join(&workers[i]);
+
+   if (batch.failed) {
+      size_t j;
+      fprintf(stderr, "Batch: %lu of %lu calls failed. Lines:",
+	    batch.failed, batch.calls);
+      for (j = 0; j < batch.failed_lines_cnt; j++)
+	 fprintf(stderr, " %lu", batch.failed_lines[j]);
+      fprintf(stderr, "\n");
+      res = 1;
+   }
+
+   for (i = 1; i < params->jobs; i++) {
+      ourfa_shared_cache_free(workers[i].shared_cache);
+      ourfa_connection_free(workers[i].connection);
+   }
+   free(workers);
+   free(batch.failed_lines);
+#ifdef WIN32
+   DeleteCriticalSection(&batch.lock);
+#else
+   pthread_mutex_destroy(&batch.lock);
+   pthread_cond_destroy(&batch.changed);
+#endif
+   free(line);
+   free(words);
+   if (stream != stdin)
+      fclose(stream);
+
+   return res;
+}
+
+#ifndef WIN32
+/*
+ * Daemon mode. Actions of thin clients (-socket) are accepted on unix
+ * socket and called over -j N sessions kept open between calls.
+ *
+ * Request: number of words, current directory of the client, charset of
+ * its locale and its command line, each word terminated by '\0'. Response: output of the
+ * action, '\0', exit code of the call, '\n' and error messages.
+ */
+#define DAEMON_MAX_WORDS 65536
+
+struct daemon_t {
+   struct params_t *params;
+   ourfa_xmlapi_t *xmlapi;
+   /* Scripts are loaded to xmlapi when no calls are running */
+   pthread_rwlock_t api_lock;
+   int sock;
+};
+
+struct daemon_worker_t {
+   struct daemon_t *daemon;
+   ourfa_connection_t *connection;
+   ourfa_shared_cache_t *shared_cache;
+   pthread_t thread;
+};
+
+static void free_words(char **words)
+{
+   char **w;
+
+   if (words == NULL)
+      return;
+   for (w = words; *w != NULL; w++)
+      free(*w);
+   free(words);
+}
+
+/* Read words of request. Returns number of words or -1 on error */
+static int daemon_read_request(FILE *in, char ***words)
+{
+   char *buf, *endp;
+   char **res;
+   size_t buf_size;
+   unsigned long cnt, i;
+
+   buf = NULL;
+   buf_size = 0;
+   if (getdelim(&buf, &buf_size, '\0', in) <= 0) {
+      free(buf);
+      return -1;
+   }
+   cnt = strtoul(buf, &endp, 10);
+   if ((*endp != '\0') || (cnt < 3) || (cnt > DAEMON_MAX_WORDS)) {
+      free(buf);
+      return -1;
+   }
+   free(buf);
+
+   res = calloc(cnt + 1, sizeof(char *));
+   if (res == NULL)
+      return -1;
+   for (i = 0; i < cnt; i++) {
+      buf_size = 0;
+      if (getdelim(&res[i], &buf_size, '\0', in) <= 0) {
+	 free_words(res);
+	 return -1;
+      }
+   }
+
+   *words = res;
+   return (int)cnt;
+}
+
+/* Library errors of the call are sent to the client. user_ctx: FILE */
+static int err_f_stream(int err_code, void *user_ctx, const char *fmt, ...)
+{
+   va_list ap;
+
+   if (fmt) {
+      va_start(ap, fmt);
+      vfprintf(user_ctx, fmt, ap);
+      va_end(ap);
+      if ((fmt[0] == '\0') || (fmt[strlen(fmt)-1] != '\n'))
+	 fputc('\n', user_ctx);
+   }else if (err_code == OURFA_ERROR_SYSTEM) {
+      fprintf(user_ctx, "%s\n", strerror(errno));
+   }else {
+      fprintf(user_ctx, "%s\n", ourfa_error_strerror(err_code));
+   }
+
+   return err_code;
+}
+
+/*
+ * Options of the daemon itself: server, session, API and cache are
+ * shared by all clients. Returns first option set by client or NULL.
+ */
+static const char *daemon_only_option(const struct params_t *req)
+{
+   if (req->host) return "-H";
+   if (req->port) return "-p";
+   if (req->login) return "-l";
+   if (req->password) return "-P";
+   if (req->config_file) return "-c";
+   if (req->login_type != OURFA_LOGIN_SYSTEM) return "-u/-dealer";
+   if (req->ssl_type != OURFA_SSL_TYPE_NONE) return "-S";
+   if (req->ssl_cert) return "-C";
+   if (req->ssl_key) return "-k";
+   if (req->session_id) return "-s";
+   if (req->session_ip) return "-i";
+   if (req->xml_dir) return "-x";
+   if (req->xml_api) return "-api";
+   if (req->batch_file) return "-batch";
+   if (req->daemon_socket) return "-daemon";
+   if (req->cache_dir) return "-cache_dir";
+   if (req->cache_funcs) return "-cache_funcs";
+   if (req->cache_ttl != DEFAULT_CACHE_TTL) return "-cache_ttl";
+   if (req->jobs != 1) return "-j";
+   if (req->timeout != DEFAULT_TIMEOUT) return "-timeout";
+   if (req->debug) return "-debug";
+   if (req->show_help) return "-help";
+
+   return NULL;
+}
+
+/*
+ * Call action of the request. words[0]: directory of the client,
+ * words[1]: charset of its locale
+ */
+static int daemon_call(struct daemon_worker_t *worker,
+      int words_cnt,
+      char **words,
+      FILE *out,
+      FILE *err)
+{
+   struct daemon_t *daemon = worker->daemon;
+   struct params_t req, call_params;
+   ourfa_xmlapi_func_t *f;
+   ourfa_hash_t *work_h, *orig_h;
+   ourfa_err_f_t *xmlapi_err_f;
+   void *xmlapi_err_ctx;
+   const char *opt;
+   int res;
+
+   if (init_params(&req) < 0)
+      return 1;
+   req.err = err;
+   req.charset = words[1];
+
+   res = 1;
+   work_h = orig_h = NULL;
+   if ((load_command_line_params(words_cnt - 2, words + 2, &req, 1) != 0)
+	 || (load_command_line_params(words_cnt - 2, words + 2, &req, 0) != 0))
+      goto daemon_call_end;
+
+   opt = daemon_only_option(&req);
+   if (opt != NULL) {
+      fprintf(err, "Option %s is set by daemon and can not be used with -socket\n",
+	    opt);
+      goto daemon_call_end;
+   }
+
+   if (req.action == NULL) {
+      fprintf(err, "Action not defined\n");
+      goto daemon_call_end;
+   }
+
+   /* Datafile of the client has higher priority than common parameters */
+   if (req.data_file) {
+      char err_str[200];
+      char *fname = NULL;
+
+      if (req.data_file[0] == '/')
+	 fname = strdup(req.data_file);
+      else
+	 ourfa_asprintf(&fname, "%s/%s", words[0], req.data_file);
+      if (fname == NULL) {
+	 fprintf(err, "malloc error\n");
+	 goto daemon_call_end;
+      }
+      if (load_datafile(fname, req.work_h, err_str, sizeof(err_str)) != OURFA_OK) {
+	 fprintf(err, "Can not load datafile %s. %s\n", fname, err_str);
+	 free(fname);
+	 goto daemon_call_end;
+      }
+      free(fname);
+   }
+
+   work_h = ourfa_hash_clone(daemon->params->orig_h);
+   if ((work_h == NULL)
+	 || (ourfa_hash_merge(work_h, req.work_h) != 0)
+	 || ((orig_h = ourfa_hash_clone(work_h)) == NULL)) {
+      fprintf(err, "Cannot create hash\n");
+      goto daemon_call_end;
+   }
+
+   call_params = *daemon->params;
+   call_params.work_h = work_h;
+   call_params.orig_h = orig_h;
+   call_params.output_format = req.output_format;
+   call_params.out = out;
+   call_params.err = err;
+
+   pthread_rwlock_rdlock(&daemon->api_lock);
+   f = ourfa_xmlapi_func(daemon->xmlapi, req.action);
+   if (f == NULL) {
+      pthread_rwlock_unlock(&daemon->api_lock);
+      pthread_rwlock_wrlock(&daemon->api_lock);
+      xmlapi_err_f = ourfa_xmlapi_err_f(daemon->xmlapi);
+      xmlapi_err_ctx = ourfa_xmlapi_err_ctx(daemon->xmlapi);
+      ourfa_xmlapi_set_err_f(daemon->xmlapi, err_f_stream, err);
+      f = load_action(&call_params, daemon->xmlapi, req.action);
+      ourfa_xmlapi_set_err_f(daemon->xmlapi, xmlapi_err_f, xmlapi_err_ctx);
+      pthread_rwlock_unlock(&daemon->api_lock);
+      pthread_rwlock_rdlock(&daemon->api_lock);
+      if (f != NULL)
+	 f = ourfa_xmlapi_func(daemon->xmlapi, req.action);
+   }
+   if (f != NULL)
+      res = call_action(&call_params, worker->connection,
+	    worker->shared_cache, daemon->xmlapi, f);
+   pthread_rwlock_unlock(&daemon->api_lock);
+
+daemon_call_end:
+   ourfa_hash_free(work_h);
+   ourfa_hash_free(orig_h);
+   free_params(&req);
+
+   return res;
+}
+
+static void daemon_serve(struct daemon_worker_t *worker, int fd)
+{
+   FILE *in, *out, *err;
+   char **words;
+   char *err_buf;
+   size_t err_size;
+   int words_cnt, out_fd, res;
+   ourfa_err_f_t *conn_err_f;
+   void *conn_err_ctx;
+   struct timeval tv;
+
+   /* Do not wait forever for request of stalled client */
+   tv.tv_sec = worker->daemon->params->timeout;
+   tv.tv_usec = 0;
+   setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+   in = fdopen(fd, "r");
+   if (in == NULL) {
+      close(fd);
+      return;
+   }
+   out_fd = dup(fd);
+   out = out_fd < 0 ? NULL : fdopen(out_fd, "w");
+   if (out == NULL) {
+      if (out_fd >= 0)
+	 close(out_fd);
+      fclose(in);
+      return;
+   }
+
+   err_buf = NULL;
+   err_size = 0;
+   err = open_memstream(&err_buf, &err_size);
+   if (err == NULL) {
+      fclose(out);
+      fclose(in);
+      return;
+   }
+
+   words = NULL;
+   words_cnt = daemon_read_request(in, &words);
+   if (words_cnt < 0) {
+      fprintf(err, "Wrong request from client\n");
+      res = 1;
+   }else {
+      conn_err_f = ourfa_connection_err_f(worker->connection);
+      conn_err_ctx = ourfa_connection_err_ctx(worker->connection);
+      ourfa_connection_set_err_f(worker->connection, err_f_stream, err);
+      res = daemon_call(worker, words_cnt, words, out, err);
+      ourfa_connection_set_err_f(worker->connection, conn_err_f, conn_err_ctx);
+   }
+
+   fclose(err);
+   fputc('\0', out);
+   fprintf(out, "%i\n", res);
+   if (err_size != 0)
+      fwrite(err_buf, 1, err_size, out);
+   fclose(out);
+   fclose(in);
+   free(err_buf);
+   free_words(words);
+}
+
+static void *daemon_worker(void *arg)
+{
+   struct daemon_worker_t *worker = arg;
+   int fd;
+
+   for (;;) {
+      fd = accept(worker->daemon->sock, NULL, NULL);
+      if (fd < 0) {
+	 if ((errno == EINTR) || (errno == ECONNABORTED))
+	    continue;
+	 fprintf(stderr, "accept error: %s\n", strerror(errno));
+	 break;
+      }
+      daemon_serve(worker, fd);
+   }
+
+   return NULL;
+}
+
+static int unix_socket_addr(const char *path, struct sockaddr_un *addr)
+{
+   if (strlen(path) >= sizeof(addr->sun_path)) {
+      fprintf(stderr, "Too long socket path %s\n", path);
+      return -1;
+   }
+   memset(addr, 0, sizeof(*addr));
+   addr->sun_family = AF_UNIX;
+   strcpy(addr->sun_path, path);
+
+   return 0;
+}
+
+static int run_daemon(struct params_t *params,
+      ourfa_connection_t *connection,
+      ourfa_shared_cache_t *shared_cache,
+      ourfa_xmlapi_t *xmlapi)
+{
+   struct daemon_t daemon;
+   struct daemon_worker_t *workers;
+   struct sockaddr_un addr;
+   struct stat st;
+   mode_t old_umask;
+   unsigned i, started;
+   int res;
+
+   if (unix_socket_addr(params->daemon_socket, &addr) != 0)
+      return 1;
+
+   /* Socket of running daemon is not removed */
+   daemon.sock = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (daemon.sock < 0) {
+      fprintf(stderr, "socket error: %s\n", strerror(errno));
+      return 1;
+   }
+   if (connect(daemon.sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+      fprintf(stderr, "Daemon is already listening on %s\n", params->daemon_socket);
+      close(daemon.sock);
+      return 1;
+   }
+   close(daemon.sock);
+   if ((lstat(params->daemon_socket, &st) == 0) && S_ISSOCK(st.st_mode))
+      unlink(params->daemon_socket);
+
+   daemon.sock = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (daemon.sock < 0) {
+      fprintf(stderr, "socket error: %s\n", strerror(errno));
+      return 1;
+   }
+   /* Sessions are available to owner of the daemon only */
+   old_umask = umask(0077);
+   res = bind(daemon.sock, (struct sockaddr *)&addr, sizeof(addr));
+   umask(old_umask);
+   if ((res != 0) || (listen(daemon.sock, 64) != 0)) {
+      fprintf(stderr, "Can not listen on %s: %s\n", params->daemon_socket,
+	    strerror(errno));
+      close(daemon.sock);
+      return 1;
+   }
+
+   workers = calloc(params->jobs, sizeof(*workers));
+   if (workers == NULL) {
+      fprintf(stderr, "malloc error\n");
+      close(daemon.sock);
+      unlink(params->daemon_socket);
+      return 1;
+   }
+
+   signal(SIGPIPE, SIG_IGN);
+   daemon.params = params;
+   daemon.xmlapi = xmlapi;
+   pthread_rwlock_init(&daemon.api_lock, NULL);
+
+   /* Log in all sessions before first call  */
+   res = 0;
+   workers[0].connection = connection;
+   workers[0].shared_cache = shared_cache;
+   for (i = 0; i < params->jobs; i++) {
+      workers[i].daemon = &daemon;
+      if (i != 0) {
+	 workers[i].connection = new_connection(params);
+	 if (workers[i].connection == NULL) {
+	    res = 1;
+	    break;
+	 }
+	 if (shared_cache != NULL)
+	    workers[i].shared_cache = new_shared_cache(params, workers[i].connection);
+      }
+      /* Session closed by server is opened again on next call */
+      ourfa_connection_set_auto_reconnect(workers[i].connection, 1);
+      if (ourfa_connection_open(workers[i].connection) != 0) {
+	 res = 1;
+	 break;
+      }
+   }
+
+   started = 0;
+   if (res == 0) {
+      fprintf(stderr, "Listening on %s\n", params->daemon_socket);
+      for (started = 1; started < params->jobs; started++)
+	 if (pthread_create(&workers[started].thread, NULL, daemon_worker,
+		  &workers[started]) != 0)
+	    break;
+      daemon_worker(&workers[0]);
+      res = 1;
+   }
+
+   /* Wake up workers blocked in accept() */
+   shutdown(daemon.sock, SHUT_RDWR);
+   for (i = 1; i < started; i++)
+      pthread_join(workers[i].thread, NULL);
+   close(daemon.sock);
+   unlink(params->daemon_socket);
+
+   for (i = 1; i < params->jobs; i++) {
+      ourfa_shared_cache_free(workers[i].shared_cache);
+      ourfa_connection_free(workers[i].connection);
+   }
+   free(workers);
+   pthread_rwlock_destroy(&daemon.api_lock);
+
+   return res;
+}
+
+/* Run action by daemon. Output of the action is copied to stdout */
+static int forward_call(const char *path, int argc, char **argv)
+{
+   struct sockaddr_un addr;
+   FILE *out;
+   char buf[8192];
+   char cwd[4096];
+   char code[32];
+   size_t code_len;
+   ssize_t len;
+   int sock, out_fd, i, in_code;
+
+   if (unix_socket_addr(path, &addr) != 0)
+      return 1;
+   if (getcwd(cwd, sizeof(cwd)) == NULL)
+      strcpy(cwd, ".");
+
+   sock = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (sock < 0) {
+      fprintf(stderr, "socket error: %s\n", strerror(errno));
+      return 1;
+   }
+   if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      fprintf(stderr, "Can not connect to daemon %s: %s\n", path, strerror(errno));
+      close(sock);
+      return 1;
+   }
+
+   out_fd = dup(sock);
+   out = out_fd < 0 ? NULL : fdopen(out_fd, "w");
+   if (out == NULL) {
+      fprintf(stderr, "fdopen error: %s\n", strerror(errno));
+      if (out_fd >= 0)
+	 close(out_fd);
+      close(sock);
+      return 1;
+   }
+   fprintf(out, "%i", argc + 2);
+   fputc('\0', out);
+   fputs(cwd, out);
+   fputc('\0', out);
+   /* Parameters are converted to UTF-8 by daemon */
+   fputs(nl_langinfo(CODESET), out);
+   fputc('\0', out);
+   for (i = 0; i < argc; i++) {
+      fputs(argv[i], out);
+      fputc('\0', out);
+   }
+   if (fclose(out) != 0) {
+      fprintf(stderr, "Can not send request to daemon %s: %s\n", path,
+	    strerror(errno));
+      close(sock);
+      return 1;
+   }
+
+   /* in_code: 0 - output, 1 - exit code, 2 - error messages */
+   in_code = 0;
+   code_len = 0;
+   for (;;) {
+      len = read(sock, buf, sizeof(buf));
+      if ((len < 0) && (errno == EINTR))
+	 continue;
+      if (len <= 0)
+	 break;
+      if (in_code == 0) {
+	 char *p = memchr(buf, '\0', len);
+	 if (p == NULL) {
+	    fwrite(buf, 1, len, stdout);
+	    continue;
+	 }
+	 fwrite(buf, 1, p - buf, stdout);
+	 in_code = 1;
+	 len -= p + 1 - buf;
+	 memmove(buf, p + 1, len);
+      }
+      if (in_code == 1) {
+	 char *p = memchr(buf, '\n', len);
+	 size_t code_part = p ? (size_t)(p - buf) : (size_t)len;
+	 if (code_part > sizeof(code) - 1 - code_len)
+	    code_part = sizeof(code) - 1 - code_len;
+	 memcpy(code + code_len, buf, code_part);
+	 code_len += code_part;
+	 if (p == NULL)
+	    continue;
+	 in_code = 2;
+	 len -= p + 1 - buf;
+	 memmove(buf, p + 1, len);
+      }
+      fwrite(buf, 1, len, stderr);
+   }
+   close(sock);
+   fflush(stdout);
+
+   if (!in_code) {
+      fprintf(stderr, "Daemon %s closed connection\n", path);
+      return 1;
+   }
+   code[code_len] = '\0';
+
+   return atoi(code);
+}
+#else
+static int run_daemon(struct params_t *UNUSED(params),
+      ourfa_connection_t *UNUSED(connection),
+      ourfa_shared_cache_t *UNUSED(shared_cache),
+      ourfa_xmlapi_t *UNUSED(xmlapi))
+{
+   fprintf(stderr, "Daemon mode is not supported on this platform\n");
+   return 1;
+}
+
+static int forward_call(const char *UNUSED(path), int UNUSED(argc),
+      char **UNUSED(argv))
+{
+   fprintf(stderr, "Daemon mode is not supported on this platform\n");
+   return 1;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+   int res;
+   ourfa_connection_t *connection;
+   ourfa_xmlapi_t *xmlapi;
+   ourfa_xmlapi_func_t *f;
+   ourfa_shared_cache_t *shared_cache;
+
+   struct params_t params;
+
+   setlocale(LC_ALL, "");
+
+   if (init_params(&params) < 0)
+      return 1;
+
+   if (argc <= 1)
+      return usage();
+
+   SSL_load_error_strings();
+   SSL_library_init();
+
+   connection = NULL;
+   xmlapi = NULL;
+   f = NULL;
+   shared_cache = NULL;
+   res=1;
+
+   /*
+    * Priorities:
+    *   1. Command line (highest)
+    *   2. Data file
+    *   3. Config file (lowest)
+    */
+
+   /* Load system parameters: config filename,
+    * data filename, is_in_unicode
+    */
+   res = load_command_line_params(argc, argv, &params, 1);
+   if (res != 0)
+      goto main_end;
+
+   /* Action is called by daemon: config, API and session are not needed */
+   if (params.socket && (params.daemon_socket == NULL)) {
+      res = forward_call(params.socket, argc, argv);
+      goto main_end;
+   }
+
+   /* Load params from command line  */
+   res = load_command_line_params(argc, argv, &params, 0);
+   if (res != 0)
+      goto main_end;
+
+   /* load data_file. Already loaded datas not touched */
+   if (params.data_file) {
+      char err_str[200];
+      fprintf(stderr, "Loading datafile %s\n", params.data_file);
+      if (load_datafile(params.data_file, params.work_h, err_str, sizeof(err_str)) != OURFA_OK) {
+	 fprintf(stderr, "Can not load datafile. %s\n", err_str);
+	 goto main_end;
+      }
+   }
+
+   /* Load config file. Already loaded datas not touched */
+   if (load_config_file(&params) < 0)
+      goto main_end;
+
+   /* Reload system params from command line */
+   res = load_command_line_params(argc, argv, &params, 1);
+   if (res != 0)
+      goto main_end;
+
+   /* Script run modifies work_h. Keep original input parameters */
+   params.orig_h = ourfa_hash_clone(params.work_h);
+   if (params.orig_h == NULL) {
+      fprintf(stderr, "Cannot create hash\n");
+      res = 1;
+      goto main_end;
+   }
+
+   xmlapi = ourfa_xmlapi_new();
+   if (xmlapi == NULL) {
+      fprintf(stderr, "malloc error\n");
+      goto main_end;
+   }
+   ourfa_xmlapi_set_cache(xmlapi, 1);
+
+   if (params.action || params.batch_file || params.daemon_socket) {
+      /* xmlapi file  */
+      char *xmlapi_fname = NULL;
+
+      ourfa_asprintf(&xmlapi_fname,
+#ifdef WIN32
+	    "%s\\%s",
+#else
+	    "%s/%s",
+#endif
+	    params.xml_dir ? params.xml_dir : DEFAULT_XML_DIR,
+	    params.xml_api ? params.xml_api : "api.xml");
+
+      if (xmlapi_fname == NULL) {
+	 fprintf(stderr, "asprintf error\n");
+	 goto main_end;
+      }
+
+      fprintf(stderr,"Loading API XML: %s\n", xmlapi_fname);
+      if (ourfa_xmlapi_load_apixml(xmlapi, xmlapi_fname) != OURFA_OK) {
+	 free(xmlapi_fname);
+	 goto main_end;
+      }
+      free(xmlapi_fname);
+   }
+
+   if (params.action) {
+      f = load_action(&params, xmlapi, params.action);
+      if (f == NULL) {
+	 res = 1;
+	 goto main_end;
+      }
+   }
+
+   if (params.show_help) {
+      help(f);
+      params.show_help=0;
+      goto main_end;
+   }
+
+   if ((params.action == NULL) && (params.batch_file == NULL)
+	 && (params.daemon_socket == NULL)) {
+      fprintf(stderr, "Action not defined\n");
+      goto main_end;
+   }
+
+   connection = new_connection(&params);
+   if (connection == NULL) {
+      res = 1;
+      goto main_end;
+   }
+
+   if (params.cache_dir && (params.cache_funcs == NULL))
+      fprintf(stderr, "-cache_dir without -cache_funcs: results are not shared\n");
+   if (params.cache_dir && params.cache_funcs
+	 && (params.batch_file || params.daemon_socket
+	    || (f && (f->script == NULL))))
+      shared_cache = new_shared_cache(&params, connection);
+
+   if (params.daemon_socket)
+      res = run_daemon(&params, connection, shared_cache, xmlapi);
+   else if (params.batch_file)
+      res = run_batch(&params, connection, shared_cache, xmlapi);
+   else
+      res = call_action(&params, connection, shared_cache, xmlapi, f);
+
 main_end:
    if (params.show_help)
       help(NULL);
 
    free_params(&params);
+   ourfa_shared_cache_free(shared_cache);
    ourfa_connection_free(connection);
    ourfa_xmlapi_free(xmlapi);
    /* xmlCleanupParser(); */
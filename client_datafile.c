@@ -43,107 +43,275 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <limits.h>
 #include <string.h>
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
+#include <libxml/xmlreader.h>
 
 #include <openssl/ssl.h>
 
 #include "ourfa.h"
+#include "ourfa_private.h"
 
 #define MAX_DIMENSION 20
+#define MAX_COLUMNS 1000
 
 /* client_dump.c  */
 int attrlist2str(unsigned *attr_list, size_t attr_list_cnt,
       char *dst, size_t dst_size);
 
-static int add_array(xmlNode *node, ourfa_hash_t *res_h, char *err_str, size_t er_str_size);
+enum data_type_t {
+   DATA_STRING,
+   DATA_INT,
+   DATA_LONG,
+   DATA_DOUBLE,
+   DATA_IP
+};
+
+struct data_val_t {
+   enum data_type_t type;
+   union {
+      char *s; /* malloc'ed  */
+      int i;
+      long long l;
+      double d;
+      struct sockaddr_storage ip;
+   } v;
+};
+
+static int load_xml(const char *file, ourfa_hash_t *res_h, char *err_str, size_t err_str_size);
+static int load_csv(FILE *f, ourfa_hash_t *res_h, char *err_str, size_t err_str_size);
+static int add_array(xmlTextReaderPtr reader, ourfa_hash_t *res_h, char *err_str, size_t er_str_size);
+
+static long reader_line(xmlTextReaderPtr reader)
+{
+   xmlNode *node;
+
+   node = xmlTextReaderCurrentNode(reader);
+   return node ? xmlGetLineNo(node) : -1;
+}
 
+/*
+ * Datafile is XML (<urfa><array>...) or CSV with a column per array.
+ * Values are stored with numeric indices as soon as they are read, so
+ * memory usage does not depend on size of the file
+ */
 int load_datafile(const char *file, ourfa_hash_t *res_h, char *err_str, size_t err_str_size)
 {
+   int c;
    int res;
-   xmlDoc *xmldoc;
-   xmlNode *cur_node, *urfa_root;
+   FILE *f;
 
    assert(res_h);
    assert(err_str);
 
    err_str[0]='\0';
+
+   f = fopen(file, "rb");
+   if (f == NULL) {
+      snprintf(err_str, err_str_size, "Can not open file: %s", strerror(errno));
+      return OURFA_ERROR_OTHER;
+   }
+
+   /* XML starts with '<' (after optional BOM)  */
+   c = getc(f);
+   if (c == 0xef) {
+      getc(f);
+      getc(f);
+      c = getc(f);
+   }
+   while ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n'))
+      c = getc(f);
+
+   if (c == '<') {
+      fclose(f);
+      return load_xml(file, res_h, err_str, err_str_size);
+   }
+
+   rewind(f);
+   res = load_csv(f, res_h, err_str, err_str_size);
+   fclose(f);
+
+   return res;
+}
+
+/* Nodes are freed by xmlTextReader as soon as they are processed  */
+static int load_xml(const char *file, ourfa_hash_t *res_h, char *err_str, size_t err_str_size)
+{
+   int res;
+   int ret;
+   xmlTextReaderPtr reader;
+
    res = OURFA_OK;
 
-   xmldoc = xmlReadFile(file, NULL, XML_PARSE_COMPACT);
-   if (xmldoc == NULL)
+   reader = xmlReaderForFile(file, NULL, XML_PARSE_COMPACT);
+   if (reader == NULL)
       return OURFA_ERROR_OTHER;
 
-   urfa_root = xmlDocGetRootElement(xmldoc);
-   if (urfa_root == NULL) {
-      snprintf(err_str, err_str_size, "Can not find XML Root Element");
+   /* Root element  */
+   while ((ret = xmlTextReaderRead(reader)) == 1) {
+      if (xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT)
+	 break;
+   }
+   if (ret != 1) {
+      if (ret == 0)
+	 snprintf(err_str, err_str_size, "Can not find XML Root Element");
       res = OURFA_ERROR_OTHER;
       goto load_file_end;
    }
 
-   if (xmlStrcasecmp(urfa_root->name, (const xmlChar *) "urfa") != 0) {
+   if (xmlStrcasecmp(xmlTextReaderConstName(reader), (const xmlChar *) "urfa") != 0) {
       snprintf(err_str, err_str_size, "Document of the wrong type, root node != urfa");
       res = OURFA_ERROR_OTHER;
       goto load_file_end;
    }
 
-   for (cur_node=urfa_root->children; cur_node; cur_node = cur_node->next) {
-      if (cur_node->type != XML_ELEMENT_NODE)
+   while ((ret = xmlTextReaderRead(reader)) == 1) {
+      if (xmlTextReaderDepth(reader) != 1)
 	 continue;
-      if (cur_node->name == NULL)
+      if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT)
 	 continue;
-      if (xmlStrcasecmp(cur_node->name, (const xmlChar *)"array") != 0) {
-	 snprintf(err_str, err_str_size, "Not array node on line %hu: '%s'",
-	       cur_node->line,
-	       (const char *)cur_node->content
+      if (xmlStrcasecmp(xmlTextReaderConstName(reader), (const xmlChar *)"array") != 0) {
+	 snprintf(err_str, err_str_size, "Not array node on line %li: '%s'",
+	       reader_line(reader),
+	       (const char *)xmlTextReaderConstName(reader)
 	       );
 	 break;
       }
 
-      res = add_array(cur_node, res_h, err_str, err_str_size);
+      res = add_array(reader, res_h, err_str, err_str_size);
       if (res != OURFA_OK)
 	 break;
    }
+   if (ret < 0)
+      res = OURFA_ERROR_OTHER;
 
 load_file_end:
-   if (xmldoc)
-      xmlFreeDoc(xmldoc);
+   xmlFreeTextReader(reader);
 
    return res;
 }
 
+static void data_val_free(struct data_val_t *val)
+{
+   if (val->type == DATA_STRING)
+      free(val->v.s);
+}
 
-static int add_array(xmlNode *arr_node, ourfa_hash_t *res_h, char *err_str, size_t err_str_size)
+/* val is freed  */
+static int set_value(ourfa_hash_t *res_h, const char *arr_name,
+      struct hash_val_t **col, unsigned *idx, unsigned dimension,
+      struct data_val_t *val)
 {
-   xmlNode *cur;
+   int res;
+   char idx_str[(MAX_DIMENSION+1)*11+1];
+
+   if (*col == NULL)
+      *col = ourfa_hash_col(res_h, arr_name);
+   if (*col != NULL) {
+      /* Already loaded data not touched  */
+      if (ourfa_hash_col_isset(*col, idx, dimension)) {
+	 data_val_free(val);
+	 return 0;
+      }
+      switch (val->type) {
+	 case DATA_STRING:
+	    res = ourfa_hash_col_set_string(*col, idx, dimension, val->v.s);
+	    break;
+	 case DATA_INT:
+	    res = ourfa_hash_col_set_int(*col, idx, dimension, val->v.i);
+	    break;
+	 case DATA_LONG:
+	    res = ourfa_hash_col_set_long(*col, idx, dimension, val->v.l);
+	    break;
+	 case DATA_DOUBLE:
+	    res = ourfa_hash_col_set_double(*col, idx, dimension, val->v.d);
+	    break;
+	 case DATA_IP:
+	 default:
+	    res = ourfa_hash_col_set_ip(*col, idx, dimension,
+		  (struct sockaddr *)&val->v.ip);
+	    break;
+      }
+      if (res == 0)
+	 return 0;
+   }
+
+   /* New variable or type of existing one differs  */
+   attrlist2str(idx, dimension, idx_str, sizeof(idx_str));
+   switch (val->type) {
+      case DATA_STRING:
+	 res = ourfa_hash_set_string(res_h, arr_name, idx_str, val->v.s);
+	 break;
+      case DATA_INT:
+	 res = ourfa_hash_set_int(res_h, arr_name, idx_str, val->v.i);
+	 break;
+      case DATA_LONG:
+	 res = ourfa_hash_set_long(res_h, arr_name, idx_str, val->v.l);
+	 break;
+      case DATA_DOUBLE:
+	 res = ourfa_hash_set_double(res_h, arr_name, idx_str, val->v.d);
+	 break;
+      case DATA_IP:
+      default:
+	 res = ourfa_hash_set_ip(res_h, arr_name, idx_str,
+	       (struct sockaddr *)&val->v.ip);
+	 break;
+   }
+   data_val_free(val);
+   if (res != 0)
+      return -1;
+   *col = ourfa_hash_col(res_h, arr_name);
+
+   return 0;
+}
+
+/* Reader is on start tag of array. Returns on end tag  */
+static int add_array(xmlTextReaderPtr reader, ourfa_hash_t *res_h, char *err_str, size_t err_str_size)
+{
+   int res;
+   int ret;
+   int arr_depth;
+   int have_node;
+   long arr_line;
    unsigned dimension;
    xmlChar *arr_name;
    xmlChar *dimension_str;
+   struct hash_val_t *col;
    unsigned idx[MAX_DIMENSION+1];
    char idx_str[(MAX_DIMENSION+1)*11+1];
-   unsigned nesting_level;
 
-   assert(arr_node);
+   assert(reader);
    assert(res_h);
    assert(err_str);
 
-   arr_name = NULL;
-
-   if (arr_node->children == NULL)
+   if (xmlTextReaderIsEmptyElement(reader))
       return OURFA_OK; /* empty array  */
 
-   arr_name = xmlGetProp(arr_node, (const xmlChar *)"name");
+   arr_depth = xmlTextReaderDepth(reader);
+   arr_line = reader_line(reader);
+   arr_name = xmlTextReaderGetAttribute(reader, (const xmlChar *)"name");
+   dimension_str = xmlTextReaderGetAttribute(reader, (const xmlChar *)"dimension");
+   col = NULL;
+   res = OURFA_ERROR_OTHER;
+
+   ret = xmlTextReaderRead(reader);
+   if (ret != 1)
+      goto add_array_end;
+   if ((xmlTextReaderNodeType(reader) == XML_READER_TYPE_END_ELEMENT)
+	 && (xmlTextReaderDepth(reader) == arr_depth)) {
+      res = OURFA_OK; /* empty array  */
+      goto add_array_end;
+   }
+
    if (arr_name == NULL) {
       snprintf(err_str, err_str_size,
-	    "Unnamed array. line: %hu",
-	    arr_node->line);
-      return OURFA_ERROR_OTHER;
+	    "Unnamed array. line: %li",
+	    arr_line);
+      goto add_array_end;
    }
 
-   dimension_str =  xmlGetProp(arr_node, (const xmlChar *)"dimension");
    if (dimension_str) {
       char *end;
       dimension = (unsigned)strtoul((const char *)dimension_str, &end, 10);
@@ -151,52 +319,98 @@ static int add_array(xmlNode *arr_node, ourfa_hash_t *res_h, char *err_str, size
 	    && (end[0] == '\0')
 	    && (dimension <= MAX_DIMENSION))) {
 	 snprintf(err_str, err_str_size,
-	       "Wrong dimension of array. Line: %hu",
-	       arr_node->line);
-	 xmlFree(dimension_str);
-	 xmlFree(arr_name);
-	 return OURFA_ERROR_OTHER;
+	       "Wrong dimension of array. Line: %li",
+	       arr_line);
+	 goto add_array_end;
       }
-      xmlFree(dimension_str);
    }else
       dimension = 1;
 
-   nesting_level=0;
-   idx[nesting_level]=0;
-   cur = arr_node->children;
-   while (cur != arr_node) {
-      int is_dim_node=0;
-      const xmlChar *content = NULL;
+   idx[0]=0;
+   /* First child is already read  */
+   have_node=1;
+   for (;;) {
+      int type;
+      unsigned nesting_level;
+      char *content;
+      struct data_val_t val;
+
+      if (!have_node) {
+	 ret = xmlTextReaderRead(reader);
+	 if (ret != 1)
+	    goto add_array_end;
+      }
+      have_node=0;
+
+      type = xmlTextReaderNodeType(reader);
+      if (type == XML_READER_TYPE_END_ELEMENT) {
+	 if (xmlTextReaderDepth(reader) == arr_depth)
+	    break;
+	 /* End of dim with nested dims  */
+	 nesting_level = (unsigned)(xmlTextReaderDepth(reader) - arr_depth - 1);
+	 idx[nesting_level]++;
+	 continue;
+      }
+      if (type != XML_READER_TYPE_ELEMENT)
+	 continue;
 
-      if ((cur->type != XML_ELEMENT_NODE) || (cur->name == NULL))
-	 goto move_to_next_node;
-      if (strcasecmp((const char *)cur->name, "dim") != 0) {
+      nesting_level = (unsigned)(xmlTextReaderDepth(reader) - arr_depth - 1);
+      if (xmlStrcasecmp(xmlTextReaderConstName(reader), (const xmlChar *)"dim") != 0) {
 	 snprintf(err_str, err_str_size,
-	       "Unexpected node %s. Line: %hu content: `%s`",
-	       cur->name, cur->line, cur->content ? (const char *)cur->content : ""
+	       "Unexpected node %s. Line: %li",
+	       (const char *)xmlTextReaderConstName(reader), reader_line(reader)
 	       );
-	 xmlFree(arr_name);
-	 return OURFA_ERROR_OTHER;
-      }else
-	 is_dim_node=1;
-
-      if (cur->children) {
-	 if (cur->children->type == XML_TEXT_NODE
-	       && (cur->children->children == NULL)
-	       && (cur->children->next == NULL))
-	    content = cur->children->content;
-	 else {
-	    cur = cur->children;
-	    nesting_level++;
-	    if (nesting_level >= MAX_DIMENSION) {
+	 goto add_array_end;
+      }
+
+      /* Value is a dim with one text node or without children. Adjacent
+       * text nodes are concatenated  */
+      content = NULL;
+      if (!xmlTextReaderIsEmptyElement(reader)) {
+	 size_t content_len = 0;
+
+	 for (;;) {
+	    const xmlChar *text;
+	    size_t len;
+	    char *tmp;
+
+	    ret = xmlTextReaderRead(reader);
+	    if (ret != 1) {
+	       free(content);
+	       goto add_array_end;
+	    }
+	    type = xmlTextReaderNodeType(reader);
+	    if ((type != XML_READER_TYPE_TEXT)
+		  && (type != XML_READER_TYPE_WHITESPACE)
+		  && (type != XML_READER_TYPE_SIGNIFICANT_WHITESPACE))
+	       break;
+	    text = xmlTextReaderConstValue(reader);
+	    len = text ? strlen((const char *)text) : 0;
+	    tmp = realloc(content, content_len + len + 1);
+	    if (tmp == NULL) {
+	       free(content);
+	       snprintf(err_str, err_str_size, "malloc error");
+	       goto add_array_end;
+	    }
+	    content = tmp;
+	    memcpy(content + content_len, text, len);
+	    content_len += len;
+	    content[content_len] = '\0';
+	 }
+
+	 if (type != XML_READER_TYPE_END_ELEMENT) {
+	    /* Nested dims  */
+	    free(content);
+	    if (nesting_level+1 >= MAX_DIMENSION) {
 	       snprintf(err_str, err_str_size,
-		     "Nesting level too deep. Line: %hu",
-		     cur->line
+		     "Nesting level too deep. Line: %li",
+		     reader_line(reader)
 		     );
-	       xmlFree(arr_name);
-	       return OURFA_ERROR_OTHER;
+	       goto add_array_end;
 	    }
-	    idx[nesting_level]=0;
+	    idx[nesting_level+1]=0;
+	    /* Process current node at the next iteration  */
+	    have_node=1;
 	    continue;
 	 }
       }
@@ -204,57 +418,376 @@ static int add_array(xmlNode *arr_node, ourfa_hash_t *res_h, char *err_str, size
       /* value  */
       if (nesting_level+1 != dimension) {
 	 snprintf(err_str, err_str_size,
-	       "Value on wrong nesting level (wrong array dimension). Line: %hu",
-	       cur->line);
-	 xmlFree(arr_name);
-	 return OURFA_ERROR_OTHER;
+	       "Value on wrong nesting level (wrong array dimension). Line: %li",
+	       reader_line(reader));
+	 free(content);
+	 goto add_array_end;
       }
-      attrlist2str(idx, dimension, idx_str, sizeof(idx_str));
-      if (ourfa_hash_get_string(res_h, (const char *)arr_name, idx_str, NULL) != 0) {
-	 if (ourfa_hash_set_string(res_h,
-		  (const char *)arr_name,
-		  idx_str,
-		  content ? (const char *)content : "" ) != 0) {
-	    snprintf(err_str, err_str_size,
-		  "Can not set hash value %s(%s)=`%s`. Line: %hu",
-		  (const char *)arr_name,
-		  idx_str,
-		  content ? (const char *)content : "",
-		  cur->line
-		  );
-	    xmlFree(arr_name);
-	    return OURFA_ERROR_OTHER;
+      if (content == NULL) {
+	 content = strdup("");
+	 if (content == NULL) {
+	    snprintf(err_str, err_str_size, "malloc error");
+	    goto add_array_end;
 	 }
       }
+      val.type = DATA_STRING;
+      val.v.s = content;
+      if (set_value(res_h, (const char *)arr_name, &col, idx, dimension, &val) != 0) {
+	 attrlist2str(idx, dimension, idx_str, sizeof(idx_str));
+	 snprintf(err_str, err_str_size,
+	       "Can not set hash value %s(%s). Line: %li",
+	       (const char *)arr_name,
+	       idx_str,
+	       reader_line(reader)
+	       );
+	 goto add_array_end;
+      }
+      idx[nesting_level]++;
+   }
 
-move_to_next_node:
-      if (cur->next != NULL) {
-	 cur = cur->next;
-	 if (is_dim_node)
-	    idx[nesting_level]++;
-      }else {
-	 /* Move UP a tree  */
-	 for(;;) {
-	    idx[nesting_level]=0;
-	    cur = cur->parent;
-
-	    if (cur == arr_node) {
-	       assert(nesting_level == 0);
-	       break;
-	    }
+   res = OURFA_OK;
+
+add_array_end:
+   xmlFree(dimension_str);
+   xmlFree(arr_name);
+   return res;
+}
+
+/*
+ * CSV datafile. First record is a header with a column per array:
+ * "name[:idx] [type]", type is one of string (default), int, long, double,
+ * ip. Rows are elements of arrays: value of row N goes to name(idx,N).
+ * Unquoted empty value ends the column, "" is an empty string.
+ */
+#define CSV_FIELD	1
+#define CSV_LAST_FIELD	2
+#define CSV_EOF		0
+
+struct csv_reader_t {
+   FILE *f;
+   unsigned long line;
+   size_t pos;
+   size_t len;
+   int quoted;
+   char *field;
+   size_t field_len;
+   size_t field_size;
+   char buf[65536];
+};
+
+struct csv_col_t {
+   char *name;
+   enum data_type_t type;
+   unsigned idx[MAX_DIMENSION+1];
+   unsigned dimension;
+   unsigned cnt;
+   int ended;
+   struct hash_val_t *col;
+};
 
-	    nesting_level--;
+static const char * const data_type_names[] = {
+   "string", "int", "long", "double", "ip", NULL
+};
 
-	    if (cur->next != NULL) {
-	       cur = cur->next;
-	       idx[nesting_level]++;
+static inline int csv_getc(struct csv_reader_t *r)
+{
+   if (r->pos == r->len) {
+      r->len = fread(r->buf, 1, sizeof(r->buf), r->f);
+      r->pos = 0;
+      if (r->len == 0)
+	 return EOF;
+   }
+   return (unsigned char)r->buf[r->pos++];
+}
+
+static inline int csv_putc(struct csv_reader_t *r, int c)
+{
+   if (r->field_len + 1 >= r->field_size) {
+      char *tmp;
+      size_t new_size;
+
+      new_size = r->field_size ? r->field_size * 2 : 256;
+      tmp = realloc(r->field, new_size);
+      if (tmp == NULL)
+	 return -1;
+      r->field = tmp;
+      r->field_size = new_size;
+   }
+   r->field[r->field_len++] = (char)c;
+   return 0;
+}
+
+/* Returns CSV_FIELD, CSV_LAST_FIELD (end of record), CSV_EOF or -1  */
+static int csv_read_field(struct csv_reader_t *r, char *err_str, size_t err_str_size)
+{
+   int c;
+
+   r->field_len = 0;
+   r->quoted = 0;
+
+   c = csv_getc(r);
+   if (c == EOF)
+      return CSV_EOF;
+
+   if (c == '"') {
+      r->quoted = 1;
+      for (;;) {
+	 c = csv_getc(r);
+	 if (c == EOF) {
+	    snprintf(err_str, err_str_size,
+		  "Unterminated quoted value. Line: %lu", r->line);
+	    return -1;
+	 }
+	 if (c == '"') {
+	    c = csv_getc(r);
+	    if (c != '"')
 	       break;
-	    }
-	 } /* for(;;)   */
+	 }else if (c == '\n')
+	    r->line++;
+	 if (csv_putc(r, c) != 0)
+	    goto malloc_err;
       }
-   } /* while (cur != arr_node) */
+   }
 
-   xmlFree(arr_name);
-   return OURFA_OK;
+   while ((c != ',') && (c != '\n') && (c != EOF)) {
+      if (c != '\r') {
+	 if (r->quoted) {
+	    snprintf(err_str, err_str_size,
+		  "Unexpected character after quoted value. Line: %lu", r->line);
+	    return -1;
+	 }
+	 if (csv_putc(r, c) != 0)
+	    goto malloc_err;
+      }
+      c = csv_getc(r);
+   }
+
+   if (csv_putc(r, '\0') != 0)
+      goto malloc_err;
+   r->field_len--;
+
+   if (c == ',')
+      return CSV_FIELD;
+   r->line++;
+   return CSV_LAST_FIELD;
+
+malloc_err:
+   snprintf(err_str, err_str_size, "malloc error");
+   return -1;
 }
 
+/* "name[:idx] [type]"  */
+static int csv_parse_header(ourfa_hash_t *res_h, struct csv_col_t *col,
+      char *s, char *err_str, size_t err_str_size)
+{
+   char *p;
+   char *idx;
+   char *type;
+   int idx_cnt;
+   unsigned i;
+
+   while ((*s == ' ') || (*s == '\t'))
+      s++;
+   p = s + strlen(s);
+   while ((p != s) && ((p[-1] == ' ') || (p[-1] == '\t')))
+      *--p = '\0';
+
+   type = strpbrk(s, " \t");
+   if (type != NULL) {
+      *type++ = '\0';
+      while ((*type == ' ') || (*type == '\t'))
+	 type++;
+   }
+   idx = strchr(s, ':');
+   if (idx != NULL)
+      *idx++ = '\0';
+
+   if (s[0] == '\0') {
+      snprintf(err_str, err_str_size, "Empty column name");
+      return -1;
+   }
+
+   col->type = DATA_STRING;
+   if (type != NULL) {
+      for (i=0; data_type_names[i] != NULL; i++) {
+	 if (strcasecmp(type, data_type_names[i]) == 0)
+	    break;
+      }
+      if (data_type_names[i] == NULL) {
+	 snprintf(err_str, err_str_size, "Unknown type `%s` of column %s",
+	       type, s);
+	 return -1;
+      }
+      col->type = (enum data_type_t)i;
+   }
+
+   idx_cnt = 0;
+   if ((idx != NULL) && (idx[0] != '\0')) {
+      idx_cnt = ourfa_hash_parse_idx_list(res_h, idx, col->idx, MAX_DIMENSION);
+      if (idx_cnt <= 0) {
+	 snprintf(err_str, err_str_size, "Wrong index `%s` of column %s",
+	       idx, s);
+	 return -1;
+      }
+   }
+   col->dimension = (unsigned)idx_cnt + 1;
+
+   col->name = strdup(s);
+   if (col->name == NULL) {
+      snprintf(err_str, err_str_size, "malloc error");
+      return -1;
+   }
+
+   return 0;
+}
+
+static int csv_parse_value(const char *s, enum data_type_t type,
+      struct data_val_t *val)
+{
+   val->type = type;
+   switch (type) {
+      case DATA_STRING:
+	 val->v.s = strdup(s);
+	 return val->v.s == NULL ? -1 : 0;
+      case DATA_INT:
+	 return ourfa_parse_int(s, &val->v.i);
+      case DATA_LONG:
+	 return ourfa_parse_long(s, &val->v.l);
+      case DATA_DOUBLE:
+	 return ourfa_parse_double(s, &val->v.d);
+      case DATA_IP:
+      default:
+	 if (ourfa_parse_ip(s, &val->v.ip) != 0)
+	    return -1;
+	 break;
+   }
+
+   return 0;
+}
+
+static int load_csv(FILE *f, ourfa_hash_t *res_h, char *err_str, size_t err_str_size)
+{
+   int ret;
+   int res;
+   unsigned i;
+   unsigned col_cnt;
+   struct csv_col_t *cols;
+   struct csv_reader_t *r;
+
+   res = OURFA_ERROR_OTHER;
+   cols = NULL;
+   col_cnt = 0;
+
+   r = malloc(sizeof(*r));
+   if (r == NULL) {
+      snprintf(err_str, err_str_size, "malloc error");
+      return OURFA_ERROR_OTHER;
+   }
+   r->f = f;
+   r->line = 1;
+   r->pos = r->len = 0;
+   r->field = NULL;
+   r->field_len = r->field_size = 0;
+
+   /* Header  */
+   do {
+      struct csv_col_t *tmp;
+
+      ret = csv_read_field(r, err_str, err_str_size);
+      if (ret < 0)
+	 goto load_csv_end;
+      if (ret == CSV_EOF) {
+	 if (col_cnt != 0)
+	    break;
+	 snprintf(err_str, err_str_size, "No header");
+	 goto load_csv_end;
+      }
+      /* Skip BOM  */
+      if ((col_cnt == 0) && (strncmp(r->field, "\xef\xbb\xbf", 3) == 0))
+	 memmove(r->field, r->field+3, r->field_len - 2);
+      if ((col_cnt == 0) && (ret == CSV_LAST_FIELD) && (r->field[0] == '\0'))
+	 continue;
+      if (col_cnt == MAX_COLUMNS) {
+	 snprintf(err_str, err_str_size, "Too many columns");
+	 goto load_csv_end;
+      }
+      tmp = realloc(cols, (col_cnt+1) * sizeof(cols[0]));
+      if (tmp == NULL) {
+	 snprintf(err_str, err_str_size, "malloc error");
+	 goto load_csv_end;
+      }
+      cols = tmp;
+      memset(&cols[col_cnt], 0, sizeof(cols[col_cnt]));
+      if (csv_parse_header(res_h, &cols[col_cnt], r->field,
+	       err_str, err_str_size) != 0) {
+	 goto load_csv_end;
+      }
+      col_cnt++;
+   } while ((col_cnt == 0) || (ret != CSV_LAST_FIELD));
+
+   /* Rows  */
+   for (;;) {
+      unsigned long line;
+
+      line = r->line;
+      i = 0;
+      do {
+	 struct csv_col_t *c;
+	 struct data_val_t val;
+
+	 ret = csv_read_field(r, err_str, err_str_size);
+	 if (ret < 0)
+	    goto load_csv_end;
+	 if (ret == CSV_EOF)
+	    break;
+	 /* Empty line  */
+	 if ((i == 0) && (ret == CSV_LAST_FIELD)
+	       && (r->field_len == 0) && !r->quoted)
+	    break;
+	 if (i == col_cnt) {
+	    snprintf(err_str, err_str_size, "Too many values. Line: %lu", line);
+	    goto load_csv_end;
+	 }
+	 c = &cols[i++];
+
+	 if ((r->field_len == 0) && !r->quoted) {
+	    c->ended = 1;
+	    continue;
+	 }
+	 if (c->ended) {
+	    snprintf(err_str, err_str_size,
+		  "Value after the end of column %s. Line: %lu", c->name, line);
+	    goto load_csv_end;
+	 }
+	 if (csv_parse_value(r->field, c->type, &val) != 0) {
+	    snprintf(err_str, err_str_size,
+		  "Wrong %s value `%s` of column %s. Line: %lu",
+		  data_type_names[c->type], r->field, c->name, line);
+	    goto load_csv_end;
+	 }
+	 c->idx[c->dimension-1] = c->cnt;
+	 if (set_value(res_h, c->name, &c->col, c->idx, c->dimension, &val) != 0) {
+	    snprintf(err_str, err_str_size,
+		  "Can not set hash value %s. Line: %lu", c->name, line);
+	    goto load_csv_end;
+	 }
+	 c->cnt++;
+      } while (ret != CSV_LAST_FIELD);
+
+      if (ret == CSV_EOF)
+	 break;
+      /* Missing values at the end of record  */
+      for (; (i != 0) && (i < col_cnt); i++)
+	 cols[i].ended = 1;
+   }
+
+   res = OURFA_OK;
+
+load_csv_end:
+   for (i=0; i < col_cnt; i++)
+      free(cols[i].name);
+   free(cols);
+   free(r->field);
+   free(r);
+   return res;
+}
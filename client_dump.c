@@ -40,8 +40,10 @@
 #endif
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <libxml/parser.h>
@@ -53,9 +55,16 @@
 
 enum dump_format_t {
    DUMP_FORMAT_XML,
-   DUMP_FORMAT_BATCH
+   DUMP_FORMAT_BATCH,
+   DUMP_FORMAT_JSON,
+   DUMP_FORMAT_NDJSON,
+   DUMP_FORMAT_CSV
 };
 
+#define DUMP_BUF_SIZE (64*1024)
+#define DUMP_MAX_LEVEL 64
+#define DUMP_VAL_BUF_SIZE 512
+
 static int dump_hash_fprintf(FILE *stream, unsigned tab_cnt, const char *fmt, ...);
 static int batch_print_val(ourfa_hash_t *h, FILE *stream,
       const char *name, const char *arr_idx, const char *val);
@@ -69,19 +78,55 @@ struct dump_t {
    ourfa_func_call_ctx_t *fctx;
    ourfa_connection_t *connection;
    FILE *stream;
+   /* csv: errors are not mixed with records  */
+   FILE *err_stream;
    enum dump_format_t dump_format;
    unsigned error_printed;
+
+   /* json, ndjson and csv are written to buf  */
+   char *buf;
+   size_t buf_len;
+   unsigned for_depth;
+   /* ndjson, csv: one record per row of top level loop  */
+   unsigned by_rows;
+
+   /* json: open objects and arrays, number of their members */
+   unsigned level;
+   unsigned level_skip;
+   char level_close[DUMP_MAX_LEVEL];
+   unsigned level_cnt[DUMP_MAX_LEVEL];
+
+   /* csv: columns of the table, loop of the rows or root node */
+   const ourfa_xmlapi_func_node_t *table;
+   const ourfa_xmlapi_func_node_t **columns;
+   unsigned columns_cnt;
+   unsigned columns_size;
+   unsigned in_table;
+   unsigned col;
+   unsigned nested_open;
+   unsigned field_vals;
+   unsigned item_vals;
 };
 
+static void out_flush(struct dump_t *dump);
+static void out_putc(struct dump_t *dump, char c);
+static void json_close(struct dump_t *dump);
+static int json_step(struct dump_t *dump);
+static int csv_step(struct dump_t *dump);
+static const char *node_value(struct dump_t *dump,
+      const ourfa_xmlapi_func_node_t *n, char *buf, size_t buf_size);
+
+/* format: xml, json, ndjson, csv. Other formats are printed as batch */
 void *dump_new(
       ourfa_func_call_ctx_t *fctx,
       ourfa_connection_t *connection,
       FILE *stream,
-      unsigned dump_xml)
+      FILE *err_stream,
+      const char *format)
 {
    struct dump_t *res;
 
-   res = malloc(sizeof(*res));
+   res = calloc(1, sizeof(*res));
    if (res == NULL)
       return NULL;
 
@@ -90,9 +135,29 @@ void *dump_new(
    res->fctx = fctx;
    res->connection = connection;
    res->stream = stream;
-   res->dump_format = dump_xml ? DUMP_FORMAT_XML : DUMP_FORMAT_BATCH;
+   res->err_stream = err_stream;
+   if (strcmp(format, "xml") == 0)
+      res->dump_format = DUMP_FORMAT_XML;
+   else if (strcmp(format, "json") == 0)
+      res->dump_format = DUMP_FORMAT_JSON;
+   else if (strcmp(format, "ndjson") == 0)
+      res->dump_format = DUMP_FORMAT_NDJSON;
+   else if (strcmp(format, "csv") == 0)
+      res->dump_format = DUMP_FORMAT_CSV;
+   else
+      res->dump_format = DUMP_FORMAT_BATCH;
+
+   if (res->dump_format >= DUMP_FORMAT_JSON) {
+      res->buf = malloc(DUMP_BUF_SIZE);
+      if (res->buf == NULL) {
+	 free(res);
+	 return NULL;
+      }
+   }
+
    res->tmp_doc = xmlNewDoc(NULL);
    if (res->tmp_doc == NULL) {
+      free(res->buf);
       free(res);
       return NULL;
    }
@@ -101,6 +166,7 @@ void *dump_new(
    res->tmp_buf = xmlBufferCreate();
    if (res->tmp_buf == NULL) {
       xmlFreeDoc(res->tmp_doc);
+      free(res->buf);
       free(res);
       return NULL;
    }
@@ -115,22 +181,46 @@ void dump_free(void *dump)
 
    if (res == NULL)
       return;
+   if (res->buf) {
+      /* Output interrupted by error  */
+      if ((res->level > 0) && (res->level_skip == 0)) {
+	 while (res->level > 0)
+	    json_close(res);
+	 out_putc(res, '\n');
+      }
+      out_flush(res);
+   }
    xmlFreeDoc(res->tmp_doc);
    xmlBufferFree(res->tmp_buf);
+   free(res->buf);
+   free(res->columns);
 
    free(dump);
 }
 
 int dump_step(void *vdump)
 {
-   char *s;
+   char buf[DUMP_VAL_BUF_SIZE];
+   const char *s;
    struct dump_t *dump;
    const char *node_type, *node_name, *arr_index;
    ourfa_xmlapi_func_node_t *n;
 
    dump = vdump;
 
-   if (!ourfa_connection_is_connected(dump->connection)) {
+   switch (dump->dump_format) {
+      case DUMP_FORMAT_JSON:
+      case DUMP_FORMAT_NDJSON:
+	 return json_step(dump);
+      case DUMP_FORMAT_CSV:
+	 return csv_step(dump);
+      default:
+	 break;
+   }
+
+   /* connection NULL - output of cached result  */
+   if ((dump->connection != NULL)
+	 && !ourfa_connection_is_connected(dump->connection)) {
 	fprintf(dump->stream, "ERROR: not connected\n");
 	return OURFA_ERROR_NOT_CONNECTED;
    }
@@ -172,7 +262,8 @@ int dump_step(void *vdump)
 		  char session_id[16*2+1];
 		  fprintf(dump->stream, "<?xml version=\"1.0\"?>\n<urfa>\n");
 
-		  if (ourfa_connection_session_id(dump->connection, session_id, sizeof(session_id)) > 0)
+		  if (dump->connection
+			&& (ourfa_connection_session_id(dump->connection, session_id, sizeof(session_id)) > 0))
 		     fprintf(dump->stream, "  <session key=\"%s\"/>\n", session_id);
 
 		  xmlBufferEmpty(dump->tmp_buf);
@@ -206,7 +297,8 @@ int dump_step(void *vdump)
 	       || (n->type == OURFA_XMLAPI_NODE_ERROR))
 	    break;
 
-	 if (ourfa_hash_get_string(dump->fctx->h, node_name, arr_index, &s) != 0 ) {
+	 s = node_value(dump, n, buf, sizeof(buf));
+	 if (s == NULL) {
 	    switch (dump->dump_format) {
 	       case DUMP_FORMAT_XML:
 		  xmlBufferEmpty(dump->tmp_buf);
@@ -242,7 +334,6 @@ int dump_step(void *vdump)
 		  assert(0);
 		  break;
 	    }
-	    free(s);
 	 }
 	 break;
       case OURFA_FUNC_CALL_STATE_STARTFOR:
@@ -452,3 +543,543 @@ static int batch_print_val(ourfa_hash_t *h, FILE *stream,
 }
 
 
+static void out_flush(struct dump_t *dump)
+{
+   if (dump->buf_len == 0)
+      return;
+   fwrite(dump->buf, 1, dump->buf_len, dump->stream);
+   dump->buf_len = 0;
+}
+
+static void out_write(struct dump_t *dump, const void *data, size_t len)
+{
+   if (dump->buf_len + len > DUMP_BUF_SIZE) {
+      out_flush(dump);
+      if (len > DUMP_BUF_SIZE) {
+	 fwrite(data, 1, len, dump->stream);
+	 return;
+      }
+   }
+   memcpy(dump->buf + dump->buf_len, data, len);
+   dump->buf_len += len;
+}
+
+static void out_putc(struct dump_t *dump, char c)
+{
+   if (dump->buf_len == DUMP_BUF_SIZE)
+      out_flush(dump);
+   dump->buf[dump->buf_len++] = c;
+}
+
+static void out_puts(struct dump_t *dump, const char *s)
+{
+   out_write(dump, s, strlen(s));
+}
+
+static int is_value_node(const ourfa_xmlapi_func_node_t *n)
+{
+   return (n->type >= OURFA_XMLAPI_NODE_INTEGER)
+      && (n->type <= OURFA_XMLAPI_NODE_IP);
+}
+
+/* Value of the node in the hash. NULL if not set */
+static const char *node_value(struct dump_t *dump,
+      const ourfa_xmlapi_func_node_t *n, char *buf, size_t buf_size)
+{
+   return ourfa_hash_peek_string(dump->fctx->h, n->n.n_val.name,
+	 n->n.n_val.array_index ? n->n.n_val.array_index : "0",
+	 buf, buf_size);
+}
+
+/* First loop of the output not nested in other loop  */
+static const ourfa_xmlapi_func_node_t *first_top_for(
+      const ourfa_xmlapi_func_node_t *parent)
+{
+   const ourfa_xmlapi_func_node_t *n, *res;
+
+   if (parent == NULL)
+      return NULL;
+
+   for (n = parent->children; n != NULL; n = n->next) {
+      if (n->type == OURFA_XMLAPI_NODE_FOR)
+	 return n;
+      if (n->type == OURFA_XMLAPI_NODE_IF) {
+	 res = first_top_for(n);
+	 if (res != NULL)
+	    return res;
+      }
+   }
+
+   return NULL;
+}
+
+/*
+ * Characters escaped in JSON strings: 'u' - \u00XX, other - backslash
+ * and the character. '\0' ends the string
+ */
+static const unsigned char json_escape[256] = {
+   'u','u','u','u','u','u','u','u','b','t','n','u','f','r','u','u',
+   'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+   0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+};
+
+static void json_string(struct dump_t *dump, const char *s)
+{
+   static const char hex[] = "0123456789abcdef";
+   const unsigned char *p, *run;
+   unsigned char c;
+   char esc[6];
+
+   out_putc(dump, '"');
+   for (p = run = (const unsigned char *)s; ; p++) {
+      c = *p;
+      if (json_escape[c] == 0)
+	 continue;
+      out_write(dump, run, p - run);
+      if (c == '\0')
+	 break;
+      if (json_escape[c] == 'u') {
+	 esc[0] = '\\';
+	 esc[1] = 'u';
+	 esc[2] = '0';
+	 esc[3] = '0';
+	 esc[4] = hex[c >> 4];
+	 esc[5] = hex[c & 0x0f];
+	 out_write(dump, esc, 6);
+      }else {
+	 esc[0] = '\\';
+	 esc[1] = json_escape[c];
+	 out_write(dump, esc, 2);
+      }
+      run = p + 1;
+   }
+   out_putc(dump, '"');
+}
+
+static int is_json_number(const char *s)
+{
+   if (*s == '-')
+      s++;
+   if (!isdigit((unsigned char)*s))
+      return 0;
+   while (isdigit((unsigned char)*s))
+      s++;
+   if (*s == '.') {
+      s++;
+      if (!isdigit((unsigned char)*s))
+	 return 0;
+      while (isdigit((unsigned char)*s))
+	 s++;
+   }
+   if ((*s == 'e') || (*s == 'E')) {
+      s++;
+      if ((*s == '+') || (*s == '-'))
+	 s++;
+      if (!isdigit((unsigned char)*s))
+	 return 0;
+      while (isdigit((unsigned char)*s))
+	 s++;
+   }
+
+   return *s == '\0';
+}
+
+/* Separator and name of the member of current object or array */
+static void json_member(struct dump_t *dump, const char *name)
+{
+   if (dump->level == 0)
+      return;
+   if (dump->level_cnt[dump->level-1]++ > 0)
+      out_putc(dump, ',');
+   if ((dump->level_close[dump->level-1] == '}') && (name != NULL)) {
+      json_string(dump, name);
+      out_putc(dump, ':');
+   }
+}
+
+static void json_open(struct dump_t *dump, const char *name, char open)
+{
+   if (dump->level_skip || (dump->level == DUMP_MAX_LEVEL)) {
+      dump->level_skip++;
+      return;
+   }
+   json_member(dump, name);
+   out_putc(dump, open);
+   dump->level_close[dump->level] = open == '{' ? '}' : ']';
+   dump->level_cnt[dump->level] = 0;
+   dump->level++;
+}
+
+static void json_close(struct dump_t *dump)
+{
+   if (dump->level_skip) {
+      dump->level_skip--;
+      return;
+   }
+   if (dump->level == 0)
+      return;
+   dump->level--;
+   out_putc(dump, dump->level_close[dump->level]);
+}
+
+static void json_value(struct dump_t *dump, const ourfa_xmlapi_func_node_t *n)
+{
+   char buf[DUMP_VAL_BUF_SIZE];
+   const char *s;
+
+   if (dump->level_skip)
+      return;
+
+   s = node_value(dump, n, buf, sizeof(buf));
+   json_member(dump, n->n.n_val.name);
+   if (s == NULL)
+      out_write(dump, "null", 4);
+   else if ((n->type != OURFA_XMLAPI_NODE_STRING)
+	 && (n->type != OURFA_XMLAPI_NODE_IP)
+	 && is_json_number(s))
+      out_puts(dump, s);
+   else
+      json_string(dump, s);
+}
+
+static void json_error(struct dump_t *dump, const char *err)
+{
+   if (dump->level_skip)
+      return;
+
+   if (dump->level == 0) {
+      out_puts(dump, "{\"error\":");
+      json_string(dump, err);
+      out_puts(dump, "}\n");
+   }else if (dump->level_close[dump->level-1] == ']') {
+      json_open(dump, NULL, '{');
+      json_member(dump, "error");
+      json_string(dump, err);
+      json_close(dump);
+   }else {
+      json_member(dump, "error");
+      json_string(dump, err);
+   }
+}
+
+/*
+ * json: one object per function call. ndjson: one object per row of top
+ * level loops, or per call if output has no loops
+ */
+static int json_step(struct dump_t *dump)
+{
+   const ourfa_xmlapi_func_node_t *n;
+   unsigned is_row;
+
+   if ((dump->connection != NULL)
+	 && !ourfa_connection_is_connected(dump->connection)) {
+      if (!dump->error_printed) {
+	 json_error(dump, "not connected");
+	 out_flush(dump);
+	 dump->error_printed = 1;
+      }
+      return OURFA_ERROR_NOT_CONNECTED;
+   }
+
+   if ((dump->fctx->err != OURFA_OK) && !dump->error_printed) {
+      json_error(dump, dump->fctx->last_err_str);
+      dump->error_printed = 1;
+      return 0;
+   }
+
+   n = dump->fctx->cur;
+   is_row = dump->by_rows && (dump->for_depth == 1);
+
+   switch (dump->fctx->state) {
+      case OURFA_FUNC_CALL_STATE_START:
+	 dump->level = dump->level_skip = 0;
+	 dump->for_depth = 0;
+	 dump->by_rows = (dump->dump_format == DUMP_FORMAT_NDJSON)
+	    && (first_top_for(dump->fctx->f->out) != NULL);
+	 if (dump->dump_format == DUMP_FORMAT_JSON) {
+	    json_open(dump, NULL, '{');
+	    json_member(dump, "function");
+	    json_string(dump, dump->fctx->f->name);
+	    json_open(dump, "output", '{');
+	 }else if (!dump->by_rows)
+	    json_open(dump, NULL, '{');
+	 break;
+      case OURFA_FUNC_CALL_STATE_NODE:
+	 if (!is_value_node(n))
+	    break;
+	 if (dump->by_rows && (dump->for_depth == 0))
+	    break;
+	 json_value(dump, n);
+	 break;
+      case OURFA_FUNC_CALL_STATE_STARTFOR:
+	 dump->for_depth++;
+	 if (!(dump->by_rows && (dump->for_depth == 1)))
+	    json_open(dump, n->n.n_for.name, '[');
+	 break;
+      case OURFA_FUNC_CALL_STATE_STARTFORSTEP:
+	 json_open(dump, NULL, '{');
+	 break;
+      case OURFA_FUNC_CALL_STATE_ENDFORSTEP:
+	 json_close(dump);
+	 if (is_row) {
+	    out_putc(dump, '\n');
+	    if (dump->buf_len > DUMP_BUF_SIZE / 2)
+	       out_flush(dump);
+	 }
+	 break;
+      case OURFA_FUNC_CALL_STATE_ENDFOR:
+	 if (!is_row)
+	    json_close(dump);
+	 if (dump->for_depth > 0)
+	    dump->for_depth--;
+	 break;
+      case OURFA_FUNC_CALL_STATE_END:
+	 if (dump->level > 0) {
+	    while ((dump->level > 0) && (dump->level_skip == 0))
+	       json_close(dump);
+	    out_putc(dump, '\n');
+	 }
+	 dump->level = dump->level_skip = 0;
+	 out_flush(dump);
+	 break;
+      default:
+	 break;
+   }
+
+   return 0;
+}
+
+/* Characters of CSV field to be quoted. '\0' ends the field */
+static const unsigned char csv_special[256] = {
+   1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+};
+
+/* Content of quoted field  */
+static void csv_quoted(struct dump_t *dump, const char *s)
+{
+   const char *q;
+
+   while ((q = strchr(s, '"')) != NULL) {
+      out_write(dump, s, q + 1 - s);
+      out_putc(dump, '"');
+      s = q + 1;
+   }
+   out_puts(dump, s);
+}
+
+static void csv_field(struct dump_t *dump, const char *s)
+{
+   const unsigned char *p;
+
+   for (p = (const unsigned char *)s; csv_special[*p] == 0; p++);
+   if (*p == '\0')
+      out_write(dump, s, p - (const unsigned char *)s);
+   else {
+      out_putc(dump, '"');
+      csv_quoted(dump, s);
+      out_putc(dump, '"');
+   }
+}
+
+/* Columns of the table: values and nested loops of the row  */
+static int csv_add_columns(struct dump_t *dump,
+      const ourfa_xmlapi_func_node_t *parent)
+{
+   const ourfa_xmlapi_func_node_t *n;
+
+   for (n = parent->children; n != NULL; n = n->next) {
+      if (n->type == OURFA_XMLAPI_NODE_IF) {
+	 if (csv_add_columns(dump, n) != 0)
+	    return -1;
+	 continue;
+      }
+      if (!is_value_node(n) && (n->type != OURFA_XMLAPI_NODE_FOR))
+	 continue;
+      if (dump->columns_cnt == dump->columns_size) {
+	 const ourfa_xmlapi_func_node_t **new_columns;
+	 new_columns = realloc(dump->columns,
+	       (dump->columns_size + 32) * sizeof(*new_columns));
+	 if (new_columns == NULL)
+	    return -1;
+	 dump->columns = new_columns;
+	 dump->columns_size += 32;
+      }
+      dump->columns[dump->columns_cnt++] = n;
+   }
+
+   return 0;
+}
+
+/* Separators up to the column of the node. Returns -1 if not a column */
+static int csv_place(struct dump_t *dump, const ourfa_xmlapi_func_node_t *n)
+{
+   unsigned k;
+
+   if ((dump->col < dump->columns_cnt) && (dump->columns[dump->col] == n))
+      k = dump->col;
+   else {
+      for (k = dump->col; k < dump->columns_cnt; k++)
+	 if (dump->columns[k] == n)
+	    break;
+      if (k == dump->columns_cnt)
+	 return -1;
+   }
+
+   for (; dump->col <= k; dump->col++)
+      if (dump->col > 0)
+	 out_putc(dump, ',');
+
+   return 0;
+}
+
+static void csv_end_record(struct dump_t *dump)
+{
+   if (dump->columns_cnt == 0)
+      return;
+   for (; dump->col < dump->columns_cnt; dump->col++)
+      if (dump->col > 0)
+	 out_putc(dump, ',');
+   out_putc(dump, '\n');
+   dump->col = 0;
+   if (dump->buf_len > DUMP_BUF_SIZE / 2)
+      out_flush(dump);
+}
+
+static void csv_start(struct dump_t *dump)
+{
+   const ourfa_xmlapi_func_node_t *out;
+   unsigned i;
+
+   out = dump->fctx->f->out;
+   dump->table = first_top_for(out);
+   dump->by_rows = dump->table != NULL;
+   if (dump->table == NULL)
+      dump->table = out;
+   dump->in_table = !dump->by_rows;
+   dump->columns_cnt = 0;
+   dump->col = 0;
+   dump->for_depth = 0;
+   dump->nested_open = 0;
+
+   if ((dump->table == NULL)
+	 || (csv_add_columns(dump, dump->table) != 0)) {
+      dump->columns_cnt = 0;
+      return;
+   }
+
+   /* Header  */
+   for (i = 0; i < dump->columns_cnt; i++) {
+      if (i > 0)
+	 out_putc(dump, ',');
+      csv_field(dump, dump->columns[i]->type == OURFA_XMLAPI_NODE_FOR
+	    ? dump->columns[i]->n.n_for.name
+	    : dump->columns[i]->n.n_val.name);
+   }
+   if (dump->columns_cnt > 0)
+      out_putc(dump, '\n');
+}
+
+/*
+ * csv: one record per row of the first top level loop, or one record if
+ * output has no loops. Nested loop is one column: values of the item are
+ * separated by ',', items by ';'
+ */
+static int csv_step(struct dump_t *dump)
+{
+   const ourfa_xmlapi_func_node_t *n;
+   char buf[DUMP_VAL_BUF_SIZE];
+   const char *s;
+   unsigned table_depth;
+
+   if ((dump->connection != NULL)
+	 && !ourfa_connection_is_connected(dump->connection)) {
+      if (!dump->error_printed) {
+	 fprintf(dump->err_stream, "ERROR: not connected\n");
+	 dump->error_printed = 1;
+      }
+      return OURFA_ERROR_NOT_CONNECTED;
+   }
+
+   if ((dump->fctx->err != OURFA_OK) && !dump->error_printed) {
+      fprintf(dump->err_stream, "ERROR: %s\n", dump->fctx->last_err_str);
+      dump->error_printed = 1;
+      return 0;
+   }
+
+   n = dump->fctx->cur;
+   table_depth = dump->by_rows ? 1 : 0;
+
+   switch (dump->fctx->state) {
+      case OURFA_FUNC_CALL_STATE_START:
+	 csv_start(dump);
+	 break;
+      case OURFA_FUNC_CALL_STATE_NODE:
+	 if (!dump->in_table || !is_value_node(n))
+	    break;
+	 s = node_value(dump, n, buf, sizeof(buf));
+	 if (dump->for_depth == table_depth) {
+	    if ((csv_place(dump, n) == 0) && (s != NULL))
+	       csv_field(dump, s);
+	 }else if (dump->nested_open && (s != NULL)) {
+	    if (dump->item_vals++ > 0)
+	       out_putc(dump, ',');
+	    dump->field_vals++;
+	    csv_quoted(dump, s);
+	 }
+	 break;
+      case OURFA_FUNC_CALL_STATE_STARTFOR:
+	 dump->for_depth++;
+	 if (dump->by_rows && (dump->for_depth == 1)) {
+	    dump->in_table = n == dump->table;
+	    break;
+	 }
+	 if (dump->in_table
+	       && (dump->for_depth == table_depth + 1)
+	       && (csv_place(dump, n) == 0)) {
+	    out_putc(dump, '"');
+	    dump->nested_open = 1;
+	    dump->field_vals = 0;
+	 }
+	 break;
+      case OURFA_FUNC_CALL_STATE_STARTFORSTEP:
+	 if (!dump->in_table)
+	    break;
+	 if (dump->by_rows && (dump->for_depth == 1))
+	    dump->col = 0;
+	 else if (dump->nested_open) {
+	    if (dump->field_vals > 0)
+	       out_putc(dump, ';');
+	    dump->item_vals = 0;
+	 }
+	 break;
+      case OURFA_FUNC_CALL_STATE_ENDFORSTEP:
+	 if (dump->in_table && dump->by_rows && (dump->for_depth == 1))
+	    csv_end_record(dump);
+	 break;
+      case OURFA_FUNC_CALL_STATE_ENDFOR:
+	 if (dump->in_table && dump->nested_open
+	       && (dump->for_depth == table_depth + 1)) {
+	    out_putc(dump, '"');
+	    dump->nested_open = 0;
+	 }
+	 if (dump->by_rows && (dump->for_depth == 1))
+	    dump->in_table = 0;
+	 if (dump->for_depth > 0)
+	    dump->for_depth--;
+	 break;
+      case OURFA_FUNC_CALL_STATE_END:
+	 if (!dump->by_rows)
+	    csv_end_record(dump);
+	 out_flush(dump);
+	 break;
+      default:
+	 break;
+   }
+
+   return 0;
+}
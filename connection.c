@@ -1021,18 +1021,15 @@ static int close_bio_with_err(ourfa_connection_t *connection, const char *err_st
 }
 
 
-int ourfa_start_call(ourfa_func_call_ctx_t *fctx,
-      ourfa_connection_t *connection)
+int ourfa_start_call_by_id(ourfa_connection_t *connection, int func_id)
 {
    int err;
 
-   err = OURFA_OK;
-
-   if ((connection == NULL) || (fctx == NULL))
+   if (connection == NULL)
       return OURFA_ERROR_SYSTEM;
 
    /* Start call */
-   err = ourfa_connection_start_func_call(connection, fctx->f->id);
+   err = ourfa_connection_start_func_call(connection, func_id);
    if (err != OURFA_OK) {
       if (!connection->auto_reconnect
 	    || ourfa_connection_is_connected(connection))
@@ -1042,7 +1039,7 @@ int ourfa_start_call(ourfa_func_call_ctx_t *fctx,
       err = ourfa_connection_open(connection);
       if (err != OURFA_OK)
 	 return err;
-      err = ourfa_connection_start_func_call(connection, fctx->f->id);
+      err = ourfa_connection_start_func_call(connection, func_id);
       if (err != OURFA_OK)
 	 return err;
    }
@@ -1050,10 +1047,41 @@ int ourfa_start_call(ourfa_func_call_ctx_t *fctx,
    return err;
 }
 
+int ourfa_start_call(ourfa_func_call_ctx_t *fctx,
+      ourfa_connection_t *connection)
+{
+   if ((connection == NULL) || (fctx == NULL))
+      return OURFA_ERROR_SYSTEM;
+
+   return ourfa_start_call_by_id(connection, fctx->f->id);
+}
+
 int ourfa_call(ourfa_connection_t *connection,
       ourfa_xmlapi_t *xmlapi,
       const char *func,
       ourfa_hash_t *globals)
+{
+   return ourfa_call_rows(connection, xmlapi, func, globals, NULL, NULL);
+}
+
+int ourfa_call_rows(ourfa_connection_t *connection,
+      ourfa_xmlapi_t *xmlapi,
+      const char *func,
+      ourfa_hash_t *globals,
+      const ourfa_row_cb_t *cb,
+      void *user_ctx)
+{
+   return ourfa_call_fields(connection, xmlapi, func, globals, NULL,
+	 cb, user_ctx);
+}
+
+int ourfa_call_fields(ourfa_connection_t *connection,
+      ourfa_xmlapi_t *xmlapi,
+      const char *func,
+      ourfa_hash_t *globals,
+      const char * const *fields,
+      const ourfa_row_cb_t *cb,
+      void *user_ctx)
 {
    ourfa_xmlapi_func_t *f;
    ourfa_func_call_ctx_t *fctx;
@@ -1068,6 +1096,18 @@ int ourfa_call(ourfa_connection_t *connection,
    if (fctx == NULL)
       return connection->printf_err(OURFA_ERROR_OTHER, connection->err_ctx, NULL);
 
+   if (ourfa_func_call_set_fields(fctx, fields) != 0) {
+      ourfa_func_call_ctx_free(fctx);
+      return connection->printf_err(OURFA_ERROR_OTHER, connection->err_ctx,
+	    "Can not select output fields of function '%s'", func);
+   }
+
+   if (ourfa_func_call_set_row_cb(fctx, cb, user_ctx) != 0) {
+      ourfa_func_call_ctx_free(fctx);
+      return connection->printf_err(OURFA_ERROR_NOT_IMPLEMENTED, connection->err_ctx,
+	    "Response of function '%s' can not be streamed", func);
+   }
+
    last_err = ourfa_start_call(fctx, connection);
 
    if (last_err != OURFA_OK) {
@@ -1339,6 +1379,14 @@ int ourfa_connection_read_string(ourfa_connection_t *conn, unsigned type, char *
    return OURFA_OK;
 }
 
+/* Move past attribute of given type without decoding its value  */
+int ourfa_connection_skip_attr(ourfa_connection_t *conn, unsigned type)
+{
+   const ourfa_attr_hdr_t *attr;
+
+   return read_attr_type(conn, &attr, type);
+}
+
 int ourfa_connection_flush_read(ourfa_connection_t *conn)
 {
   int res;
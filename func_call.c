@@ -77,6 +77,8 @@ static int init_func_call_ctx(ourfa_func_call_ctx_t *fctx,
    fctx->f = ourfa_xmlapi_func_ref(f);
    fctx->h = h;
    fctx->cur = NULL;
+   fctx->insn = NULL;
+   fctx->pc = 0;
    fctx->state = OURFA_FUNC_CALL_STATE_END;
    fctx->err = OURFA_OK;
    fctx->func_ret_code = 0;
@@ -85,17 +87,212 @@ static int init_func_call_ctx(ourfa_func_call_ctx_t *fctx,
    fctx->printf_err = ourfa_err_f_stderr;
    fctx->err_ctx = NULL;
 
+   fctx->row_cb = NULL;
+   fctx->row_ctx = NULL;
+   fctx->skip = NULL;
+
    return OURFA_OK;
 }
 
+/*
+ * Streaming is implemented by the decode plan only (see
+ * ourfa_func_call_decode()). Returns -1 if response of the function
+ * can not be decoded with plan.
+ */
+int ourfa_func_call_set_row_cb(ourfa_func_call_ctx_t *fctx,
+      const ourfa_row_cb_t *cb, void *user_ctx)
+{
+   if (fctx == NULL)
+      return -1;
+
+   if (cb != NULL) {
+      if ((fctx->f->script != NULL)
+	    || (fctx->f->out == NULL)
+	    || !fctx->f->out->n.n_root.prog->decodable)
+	 return -1;
+   }
+
+   fctx->row_cb = cb;
+   fctx->row_ctx = user_ctx;
+
+   return 0;
+}
+
 
 void ourfa_func_call_ctx_free(ourfa_func_call_ctx_t *fctx)
 {
-   if (fctx)
+   if (fctx) {
       ourfa_xmlapi_func_deref(fctx->f);
+      free(fctx->skip);
+   }
    free(fctx);
 }
 
+static int name_in_list(const char *name, const char * const *list, unsigned cnt)
+{
+   unsigned i;
+
+   for (i=0; i < cnt; i++) {
+      if ((list[i] != NULL) && (strcmp(name, list[i]) == 0))
+	 return 1;
+   }
+   return 0;
+}
+
+/* name is one of variables of comma separated list (array_index etc.)  */
+static int name_in_idx_list(const char *name, const char *idx_list)
+{
+   const char *p;
+   size_t i;
+
+   if (idx_list == NULL)
+      return 0;
+
+   for (p=idx_list; *p != '\0'; ) {
+      /* Compare one item of the list, spaces are ignored  */
+      for (i=0; (*p != ',') && (*p != '\0'); p++) {
+	 if (isspace((unsigned char)*p))
+	    continue;
+	 if ((i != (size_t)-1) && (name[i] == *p))
+	    i++;
+	 else
+	    i = (size_t)-1;
+      }
+      if ((i != 0) && (i != (size_t)-1) && (name[i] == '\0'))
+	 return 1;
+      if (*p == ',')
+	 p++;
+   }
+
+   return 0;
+}
+
+static int name_in_refs(const char *name, const char * const *refs, unsigned cnt)
+{
+   unsigned i;
+
+   for (i=0; i < cnt; i++) {
+      if (name_in_idx_list(name, refs[i]))
+	 return 1;
+   }
+   return 0;
+}
+
+/*
+ * Decode only listed output values, other values are skipped on the
+ * attribute level. Values used by conditions, loop counters, array
+ * indexes and other output nodes are decoded anyway. fields is NULL
+ * terminated, NULL resets the list.
+ */
+int ourfa_func_call_set_fields(ourfa_func_call_ctx_t *fctx,
+      const char * const *fields)
+{
+   const struct ourfa_xmlapi_prog_t *prog;
+   const ourfa_xmlapi_func_node_t *n;
+   const char **refs;
+   unsigned char *skip;
+   unsigned pc, refs_cnt, fields_cnt;
+
+   if (fctx == NULL)
+      return -1;
+
+   free(fctx->skip);
+   fctx->skip = NULL;
+
+   if (fields == NULL)
+      return 0;
+   if ((fctx->f->script != NULL) || (fctx->f->out == NULL))
+      return -1;
+
+   prog = fctx->f->out->n.n_root.prog;
+   for (fields_cnt=0; fields[fields_cnt]; fields_cnt++);
+
+   refs = malloc(3 * prog->insn_cnt * sizeof(refs[0]) + 1);
+   if (refs == NULL)
+      return -1;
+
+   /* Variables read by the output itself  */
+   refs_cnt = 0;
+   for (pc=0; pc < prog->insn_cnt; pc++) {
+      n = prog->insn[pc].node;
+      switch (prog->insn[pc].op) {
+	 case OURFA_XMLAPI_OP_IF:
+	    refs[refs_cnt++] = n->n.n_if.variable;
+	    refs[refs_cnt++] = n->n.n_if.value;
+	    break;
+	 case OURFA_XMLAPI_OP_FOR:
+	    refs[refs_cnt++] = prog->insn[pc].a.i_for.from.var;
+	    refs[refs_cnt++] = prog->insn[pc].a.i_for.count.var;
+	    break;
+	 case OURFA_XMLAPI_OP_NODE:
+	    switch (n->type) {
+	       case OURFA_XMLAPI_NODE_INTEGER:
+	       case OURFA_XMLAPI_NODE_STRING:
+	       case OURFA_XMLAPI_NODE_LONG:
+	       case OURFA_XMLAPI_NODE_DOUBLE:
+	       case OURFA_XMLAPI_NODE_IP:
+		  refs[refs_cnt++] = n->n.n_val.array_index;
+		  break;
+	       default:
+		  break;
+	    }
+	    break;
+	 case OURFA_XMLAPI_OP_SET:
+	    refs[refs_cnt++] = n->n.n_set.src;
+	    refs[refs_cnt++] = n->n.n_set.src_index;
+	    refs[refs_cnt++] = n->n.n_set.dst_index;
+	    break;
+	 case OURFA_XMLAPI_OP_ERROR:
+	    refs[refs_cnt++] = n->n.n_error.variable;
+	    break;
+	 case OURFA_XMLAPI_OP_PARAMETER:
+	    refs[refs_cnt++] = n->n.n_parameter.name;
+	    break;
+	 case OURFA_XMLAPI_OP_MATH:
+	    refs[refs_cnt++] = n->n.n_math.arg1;
+	    refs[refs_cnt++] = n->n.n_math.arg2;
+	    break;
+	 case OURFA_XMLAPI_OP_CALL:
+	    /* Called function can use any variable  */
+	    free(refs);
+	    return 0;
+	 default:
+	    break;
+      }
+   }
+
+   skip = calloc(1, prog->insn_cnt);
+   if (skip == NULL) {
+      free(refs);
+      return -1;
+   }
+
+   for (pc=0; pc < prog->insn_cnt; pc++) {
+      if (prog->insn[pc].op != OURFA_XMLAPI_OP_NODE)
+	 continue;
+      n = prog->insn[pc].node;
+      switch (n->type) {
+	 case OURFA_XMLAPI_NODE_INTEGER:
+	 case OURFA_XMLAPI_NODE_STRING:
+	 case OURFA_XMLAPI_NODE_LONG:
+	 case OURFA_XMLAPI_NODE_DOUBLE:
+	 case OURFA_XMLAPI_NODE_IP:
+	    if ((n->n.n_val.name != NULL)
+		  && !name_in_list(n->n.n_val.name, fields, fields_cnt)
+		  && !name_in_refs(n->n.n_val.name, refs, refs_cnt))
+	       skip[pc] = 1;
+	    break;
+	 default:
+	    break;
+      }
+   }
+
+   free(refs);
+   fctx->skip = skip;
+
+   return 0;
+}
+
 static int ourfa_parse_builtin_func(ourfa_hash_t *globals, const char *func, int *res)
 {
    if (func == NULL || func[0]=='\0')
@@ -140,6 +337,27 @@ static int ourfa_parse_builtin_func(ourfa_hash_t *globals, const char *func, int
    return 0;
 }
 
+static int ourfa_func_call_get_long_var_val(ourfa_func_call_ctx_t *fctx,
+      const char *prop, long long *res)
+{
+   long long val;
+   int int_val;
+
+   /* Buildin func?  */
+   if (ourfa_parse_builtin_func(fctx->h, prop, &int_val) == 0)
+      val = int_val;
+   else {
+      /* Global variable?  */
+      if (ourfa_hash_get_long(fctx->h, prop, NULL, &val) != 0)
+	 return OURFA_ERROR_HASH;
+   }
+
+   if (res)
+      *res = val;
+
+   return OURFA_OK;
+}
+
 static int ourfa_func_call_get_long_prop_val(ourfa_func_call_ctx_t *fctx,
       const char *prop, long long *res)
 {
@@ -152,17 +370,8 @@ static int ourfa_func_call_get_long_prop_val(ourfa_func_call_ctx_t *fctx,
    errno = 0;
    val = strtol(prop, &p_end, 0);
    /* Numeric?  */
-   if ((*p_end != '\0') || (errno == ERANGE)) {
-      int int_val;
-      /* Buildin func?  */
-      if (ourfa_parse_builtin_func(fctx->h, prop, &int_val) == 0)
-	 val = int_val;
-      else {
-	 /* Global variable?  */
-	 if (ourfa_hash_get_long(fctx->h, prop, NULL, &val) != 0)
-	    return OURFA_ERROR_HASH;
-      }
-   }
+   if ((*p_end != '\0') || (errno == ERANGE))
+      return ourfa_func_call_get_long_var_val(fctx, prop, res);
 
    if (res)
       *res = val;
@@ -170,6 +379,61 @@ static int ourfa_func_call_get_long_prop_val(ourfa_func_call_ctx_t *fctx,
    return OURFA_OK;
 }
 
+static int ourfa_func_call_get_operand_val(ourfa_func_call_ctx_t *fctx,
+      const struct ourfa_xmlapi_operand_t *op, long long *res)
+{
+   if (op->var == NULL) {
+      *res = op->val;
+      return OURFA_OK;
+   }
+   return ourfa_func_call_get_long_var_val(fctx, op->var, res);
+}
+
+/* Evaluate condition of 'if' instruction  */
+static int ourfa_func_call_if_res(ourfa_func_call_ctx_t *fctx,
+      const struct ourfa_xmlapi_insn_t *insn)
+{
+   char *s1, *s2;
+   int is_equal;
+   const ourfa_xmlapi_func_node_t *n;
+
+   n = insn->node;
+   if (n->n.n_if.condition == OURFA_XMLAPI_IF_GT) {
+      double d1, d2;
+      /* variable */
+      if (ourfa_hash_get_double(fctx->h, n->n.n_if.variable, NULL, &d1) != 0)
+	 d1 = 0;
+      /* value */
+      if (insn->a.i_if.is_const)
+	 d2 = insn->a.i_if.value;
+      else if (ourfa_hash_get_double(fctx->h, n->n.n_if.value, NULL, &d2) != 0) {
+	 long long val;
+	 if (ourfa_func_call_get_long_prop_val(fctx, n->n.n_if.value, &val) != OURFA_OK)
+	    d2 = 0;
+	 else
+	    d2 = (double)val;
+      }
+      return (d1 > d2);
+   }
+
+   if (ourfa_hash_get_string(fctx->h, n->n.n_if.variable, NULL, &s1) == 0) {
+      /* XXX: wrong comparsion of double type
+       *      n_if.value can be variable name or compared value
+       *      itself
+       */
+      if (ourfa_hash_get_string(fctx->h, n->n.n_if.value, NULL, &s2) == 0) {
+	 is_equal = (strcmp(s1, s2) == 0);
+	 free(s2);
+      }else
+	 is_equal = (strcmp(s1, n->n.n_if.value) == 0);
+      free(s1);
+   }else
+      /* Variable undefined Not equal */
+      is_equal = 0;
+
+   return n->n.n_if.condition == OURFA_XMLAPI_IF_EQ ? is_equal : !is_equal;
+}
+
 int ourfa_func_call_start(ourfa_func_call_ctx_t *fctx, unsigned is_req)
 {
    if (fctx==NULL)
@@ -184,6 +448,9 @@ int ourfa_func_call_start(ourfa_func_call_ctx_t *fctx, unsigned is_req)
       assert(fctx->f->out != NULL);
       fctx->cur = fctx->f->out;
    }
+   assert(fctx->cur->n.n_root.prog);
+   fctx->insn = fctx->cur->n.n_root.prog->insn;
+   fctx->pc = 0;
    fctx->state = OURFA_FUNC_CALL_STATE_START;
    fctx->err = OURFA_OK;
    fctx->func_ret_code = 1;
@@ -194,14 +461,21 @@ int ourfa_func_call_start(ourfa_func_call_ctx_t *fctx, unsigned is_req)
 
 int ourfa_func_call_step(ourfa_func_call_ctx_t *fctx)
 {
-   /* Move to next node  */
+   const struct ourfa_xmlapi_insn_t *insn;
+   unsigned pc;
+
+   insn = fctx->insn;
+   pc = fctx->pc;
+   assert(insn);
+
+   /* Move to next instruction  */
    switch (fctx->state) {
       case OURFA_FUNC_CALL_STATE_START:
 	 assert(fctx->cur->type == OURFA_XMLAPI_NODE_ROOT);
 	 assert(fctx->err == OURFA_OK);
-	 if (fctx->cur->children)
-	    fctx->cur = fctx->cur->children;
-	 else {
+	 pc = 0;
+	 if (insn[pc].op == OURFA_XMLAPI_OP_END) {
+	    fctx->pc = pc;
 	    fctx->state = OURFA_FUNC_CALL_STATE_END;
 	    return fctx->state;
 	 }
@@ -210,16 +484,19 @@ int ourfa_func_call_step(ourfa_func_call_ctx_t *fctx)
 	 {
 	    long long from, count;
 
-	    assert(fctx->cur->type == OURFA_XMLAPI_NODE_FOR);
+	    assert(insn[pc].op == OURFA_XMLAPI_OP_FOR);
 	    assert(fctx->err == OURFA_OK);
 
-	    fctx->err = ourfa_func_call_get_long_prop_val(fctx, fctx->cur->n.n_for.from, &from);
+	    /* On error continue from end of the loop  */
+	    fctx->pc = insn[pc].jmp;
+
+	    fctx->err = ourfa_func_call_get_operand_val(fctx, &insn[pc].a.i_for.from, &from);
 	    if (fctx->err != OURFA_OK) {
 	      setf_err(fctx, fctx->err, "Can not parse 'from' value of 'for' node");
 	      return (fctx->state = OURFA_FUNC_CALL_STATE_ENDFOR);
 	    }
 
-	    fctx->err = ourfa_func_call_get_long_prop_val(fctx, fctx->cur->n.n_for.count, &count);
+	    fctx->err = ourfa_func_call_get_operand_val(fctx, &insn[pc].a.i_for.count, &count);
 	    if (fctx->err != OURFA_OK) {
 	      setf_err(fctx, fctx->err, "Can not parse 'count' value of 'from' node");
 	      return (fctx->state = OURFA_FUNC_CALL_STATE_ENDFOR);
@@ -230,9 +507,11 @@ int ourfa_func_call_step(ourfa_func_call_ctx_t *fctx)
 	       return (fctx->state = OURFA_FUNC_CALL_STATE_ENDFOR);
 	    }
 
-	    if ((count != 0) && (fctx->cur->children != NULL))
+	    /* Empty loop body: end instruction follows the head  */
+	    if ((count != 0) && (insn[pc].jmp != pc+1)) {
+	       fctx->pc = pc;
 	       fctx->state = OURFA_FUNC_CALL_STATE_STARTFORSTEP;
-	    else
+	    }else
 	       fctx->state = OURFA_FUNC_CALL_STATE_ENDFOR;
 	    return fctx->state;
 	 }
@@ -240,52 +519,51 @@ int ourfa_func_call_step(ourfa_func_call_ctx_t *fctx)
       case OURFA_FUNC_CALL_STATE_STARTFORSTEP:
       case OURFA_FUNC_CALL_STATE_STARTIF:
       case OURFA_FUNC_CALL_STATE_STARTCALLPARAMS:
-	 assert(fctx->cur->children);
+	 assert(insn[pc].jmp != pc+1);
 	 assert(fctx->err == OURFA_OK);
-	 fctx->cur = fctx->cur->children;
+	 pc++;
 	 break;
       case OURFA_FUNC_CALL_STATE_NODE:
       case OURFA_FUNC_CALL_STATE_ENDIF:
       case OURFA_FUNC_CALL_STATE_ENDFOR:
       case OURFA_FUNC_CALL_STATE_ENDCALLPARAMS:
-	 if ((fctx->err == OURFA_OK) && fctx->cur->next != NULL)
-	    fctx->cur = fctx->cur->next;
-	 else {
-	    /* Move up a tree  */
-	    fctx->cur = fctx->cur->parent;
-	    assert(fctx->cur != NULL);
-	    switch (fctx->cur->type) {
-	       case OURFA_XMLAPI_NODE_IF:
-		  fctx->state = OURFA_FUNC_CALL_STATE_ENDIF;
-		  break;
-	       case OURFA_XMLAPI_NODE_FOR:
-		  fctx->state = OURFA_FUNC_CALL_STATE_ENDFORSTEP;
-		  break;
-	       case OURFA_XMLAPI_NODE_ROOT:
-		  fctx->state = OURFA_FUNC_CALL_STATE_END;
-		  break;
-	       case OURFA_XMLAPI_NODE_CALL:
-		  fctx->state = OURFA_FUNC_CALL_STATE_ENDCALLPARAMS;
-		  break;
-	       default:
-		  assert(0);
-		  break;
-	    }
-	    return fctx->state;
-	 } /* else  */
+	 pc = fctx->err == OURFA_OK ? pc+1 : insn[pc].up;
+	 switch (insn[pc].op) {
+	    case OURFA_XMLAPI_OP_ENDIF:
+	       fctx->state = OURFA_FUNC_CALL_STATE_ENDIF;
+	       break;
+	    case OURFA_XMLAPI_OP_ENDFOR:
+	       fctx->state = OURFA_FUNC_CALL_STATE_ENDFORSTEP;
+	       break;
+	    case OURFA_XMLAPI_OP_ENDCALL:
+	       fctx->state = OURFA_FUNC_CALL_STATE_ENDCALLPARAMS;
+	       break;
+	    case OURFA_XMLAPI_OP_END:
+	       fctx->state = OURFA_FUNC_CALL_STATE_END;
+	       break;
+	    default:
+	       /* Next node  */
+	       goto handle_insn;
+	 }
+	 /* Move up a tree  */
+	 fctx->pc = pc;
+	 fctx->cur = insn[pc].node;
+	 return fctx->state;
 	 break;
       case OURFA_FUNC_CALL_STATE_ENDFORSTEP:
 	 {
 	    long long from, count, i;
 	    int r0;
+	    unsigned head;
 
-	    assert(fctx->cur->type == OURFA_XMLAPI_NODE_FOR);
+	    assert(insn[pc].op == OURFA_XMLAPI_OP_ENDFOR);
 	    if (fctx->err != OURFA_OK)
 	       return (fctx->state = OURFA_FUNC_CALL_STATE_ENDFOR);
 
-	    r0 = ourfa_func_call_get_long_prop_val(fctx, fctx->cur->n.n_for.from, &from);
+	    head = insn[pc].jmp;
+	    r0 = ourfa_func_call_get_operand_val(fctx, &insn[head].a.i_for.from, &from);
 	    assert(r0 == OURFA_OK);
-	    r0 = ourfa_func_call_get_long_prop_val(fctx, fctx->cur->n.n_for.count, &count);
+	    r0 = ourfa_func_call_get_operand_val(fctx, &insn[head].a.i_for.count, &count);
 	    assert(r0 == OURFA_OK);
 	    r0 = ourfa_hash_get_long(fctx->h, fctx->cur->n.n_for.name, NULL, &i);
 	    assert(r0 == OURFA_OK);
@@ -298,7 +576,8 @@ int ourfa_func_call_step(ourfa_func_call_ctx_t *fctx)
 
 	    /* Next iteration  */
 	    if (i < from+count) {
-	       assert(fctx->cur->children);
+	       assert(insn[head].jmp != head+1);
+	       fctx->pc = head;
 	       fctx->state = OURFA_FUNC_CALL_STATE_STARTFORSTEP;
 	    }else
 	       fctx->state = OURFA_FUNC_CALL_STATE_ENDFOR;
@@ -306,7 +585,10 @@ int ourfa_func_call_step(ourfa_func_call_ctx_t *fctx)
 	 }
 	 break;
       case OURFA_FUNC_CALL_STATE_BREAK:
+	 /* Unwind nodes up to the loop one step at a time  */
+	 assert(insn[pc].op == OURFA_XMLAPI_OP_BREAK);
 	 if (fctx->cur->type == OURFA_XMLAPI_NODE_FOR) {
+	    fctx->pc = insn[pc].jmp;
 	    fctx->state = OURFA_FUNC_CALL_STATE_ENDFOR;
 	    return fctx->state;
 	 }else {
@@ -334,67 +616,31 @@ int ourfa_func_call_step(ourfa_func_call_ctx_t *fctx)
 	 break;
    }
 
+handle_insn:
    assert(fctx->err == OURFA_OK);
 
+   fctx->pc = pc;
+   fctx->cur = insn[pc].node;
+
    /* handle node  */
-   switch (fctx->cur->type) {
-      case OURFA_XMLAPI_NODE_INTEGER:
-      case OURFA_XMLAPI_NODE_STRING:
-      case OURFA_XMLAPI_NODE_LONG:
-      case OURFA_XMLAPI_NODE_DOUBLE:
-      case OURFA_XMLAPI_NODE_IP:
-      case OURFA_XMLAPI_NODE_MESSAGE:
+   switch (insn[pc].op) {
+      case OURFA_XMLAPI_OP_NODE:
 	 fctx->state = OURFA_FUNC_CALL_STATE_NODE;
 	 break;
-      case OURFA_XMLAPI_NODE_IF:
+      case OURFA_XMLAPI_OP_IF:
 	 {
-	    char *s1, *s2;
-	    int is_equal;
 	    int if_res;
 
-	    if (fctx->cur->n.n_if.condition == OURFA_XMLAPI_IF_GT) {
-	       double d1, d2;
-	       /* variable */
-	       if (ourfa_hash_get_double(fctx->h, fctx->cur->n.n_if.variable, NULL, &d1) != 0)
-		  d1 = 0;
-	       /* value */
-	       d2 = strtod(fctx->cur->n.n_if.value, &s1);
-	       if ((s1 == fctx->cur->n.n_if.value) || (*s1 != '\0')) {
-		  if (ourfa_hash_get_double(fctx->h, fctx->cur->n.n_if.value, NULL, &d2) != 0) {
-		     long long val;
-		     if (ourfa_func_call_get_long_prop_val(fctx, fctx->cur->n.n_if.value, &val) != OURFA_OK)
-			d2 = 0;
-		     else
-			d2 = (double)val;
-		  }
-	       }
-	       if_res = (d1 > d2);
-	    }else {
-	       if (ourfa_hash_get_string(fctx->h, fctx->cur->n.n_if.variable, NULL, &s1) == 0) {
-		  /* XXX: wrong comparsion of double type
-		   *      n_if.value can be variable name or compared value
-		   *      itself
-		   */
-		  if (ourfa_hash_get_string(fctx->h, fctx->cur->n.n_if.value, NULL, &s2) == 0) {
-		     is_equal = (strcmp(s1, s2) == 0);
-		     free(s2);
-		  }else
-		     is_equal = (strcmp(s1, fctx->cur->n.n_if.value) == 0);
-		  free(s1);
-	       }else
-		  /* Variable undefined Not equal */
-		  is_equal = 0;
-
-	       if_res = fctx->cur->n.n_if.condition == OURFA_XMLAPI_IF_EQ ? is_equal : !is_equal;
-	    }
-
-	    if (if_res && fctx->cur->children != NULL)
+	    if_res = ourfa_func_call_if_res(fctx, &insn[pc]);
+	    if (if_res && (insn[pc].jmp != pc+1))
 	       fctx->state = OURFA_FUNC_CALL_STATE_STARTIF;
-	    else
+	    else {
+	       fctx->pc = insn[pc].jmp;
 	       fctx->state = OURFA_FUNC_CALL_STATE_ENDIF;
+	    }
 	 }
 	 break;
-	 case OURFA_XMLAPI_NODE_SET:
+	 case OURFA_XMLAPI_OP_SET:
 	    if (fctx->cur->n.n_set.value) {
 	       if (ourfa_hash_set_string(
 			fctx->h,
@@ -420,13 +666,13 @@ int ourfa_func_call_step(ourfa_func_call_ctx_t *fctx)
 	    }
 	    fctx->state = OURFA_FUNC_CALL_STATE_NODE;
 	    break;
-	 case OURFA_XMLAPI_NODE_FOR:
+	 case OURFA_XMLAPI_OP_FOR:
 	    fctx->state = OURFA_FUNC_CALL_STATE_STARTFOR;
 	    break;
-	 case OURFA_XMLAPI_NODE_BREAK:
+	 case OURFA_XMLAPI_OP_BREAK:
 	    fctx->state = OURFA_FUNC_CALL_STATE_BREAK;
 	    break;
-	 case OURFA_XMLAPI_NODE_ERROR:
+	 case OURFA_XMLAPI_OP_ERROR:
 	    {
 	       char *s1;
 	       s1 = NULL;
@@ -444,13 +690,15 @@ int ourfa_func_call_step(ourfa_func_call_ctx_t *fctx)
 	       fctx->state = OURFA_FUNC_CALL_STATE_NODE;
 	    }
 	    break;
-	 case OURFA_XMLAPI_NODE_CALL:
-	    if (fctx->cur->children)
+	 case OURFA_XMLAPI_OP_CALL:
+	    if (insn[pc].jmp != pc+1)
 	       fctx->state = OURFA_FUNC_CALL_STATE_STARTCALLPARAMS;
-	    else
+	    else {
+	       fctx->pc = insn[pc].jmp;
 	       fctx->state = OURFA_FUNC_CALL_STATE_ENDCALLPARAMS;
+	    }
 	    break;
-	 case OURFA_XMLAPI_NODE_PARAMETER:
+	 case OURFA_XMLAPI_OP_PARAMETER:
 	    fctx->state = OURFA_FUNC_CALL_STATE_NODE;
 	    if (fctx->cur->n.n_parameter.value) {
 	       char *s1;
@@ -473,10 +721,7 @@ int ourfa_func_call_step(ourfa_func_call_ctx_t *fctx)
 	       }
 	    }
 	    break;
-	 case OURFA_XMLAPI_NODE_ADD:
-	 case OURFA_XMLAPI_NODE_SUB:
-	 case OURFA_XMLAPI_NODE_DIV:
-	 case OURFA_XMLAPI_NODE_MUL:
+	 case OURFA_XMLAPI_OP_MATH:
 	    {
 	       double arg1, arg2, dst;
 	       if (ourfa_hash_get_double(fctx->h,
@@ -526,10 +771,6 @@ int ourfa_func_call_step(ourfa_func_call_ctx_t *fctx)
 	       fctx->state = OURFA_FUNC_CALL_STATE_NODE;
 	    }
 	    break;
-	 case OURFA_XMLAPI_NODE_SHIFT:
-	 case OURFA_XMLAPI_NODE_REMOVE:
-	 case OURFA_XMLAPI_NODE_OUT:
-	    /* XXX */
 	 default:
 	    assert(0);
 	    break;
@@ -538,53 +779,34 @@ int ourfa_func_call_step(ourfa_func_call_ctx_t *fctx)
    return fctx->state;
 }
 
-int ourfa_func_call_req_step(ourfa_func_call_ctx_t *fctx,
-      ourfa_connection_t *conn)
+/* Value of input parameter  */
+struct input_val_t {
+   unsigned type;
+   union {
+      int i;
+      long long l;
+      double d;
+      char *s;
+      struct sockaddr_storage ip;
+   } v;
+   char *s_free;
+};
+
+/*
+ * Get value of input node n from hash: user value, builtin function or
+ * default value. Default values are stored in hash.
+ * Returns 0 on success, -1 on error (fctx->err is set)
+ */
+static int input_val(ourfa_func_call_ctx_t *fctx,
+      const ourfa_xmlapi_func_node_t *n,
+      const char *arr_index,
+      struct input_val_t *res)
 {
-   int state;
-   int old_err;
-   int socket_error = 0;
-   const char *node_name, *arr_index;
-   ourfa_xmlapi_func_node_t *n;
-
-   assert(fctx->cur);
-
-   old_err = fctx->err;
-   state = ourfa_func_call_step(fctx);
-
-   if (fctx->err != OURFA_OK) {
-      assert(fctx->f && fctx->f->in);
-      if (old_err == OURFA_OK && (fctx->f->in->children != NULL))
-	 /* Schema error. Send termination attribute. On error do nothing  */
-	 goto ourfa_func_call_req_step_end;
-      return state;
-   }
-
-   assert(fctx->err == OURFA_OK);
-
-   if (state == OURFA_FUNC_CALL_STATE_END) {
-      assert (fctx->cur->type == OURFA_XMLAPI_NODE_ROOT);
-      if (fctx->cur->children != NULL) {
-	 /* Send termination attribute
-	  * Do not send termination attribute if no input parameters found
-	 */
-	 fctx->err = ourfa_connection_write_int(conn, OURFA_ATTR_TERMINATION, 4);
-	 if (fctx->err != OURFA_OK)
-	    setf_err(fctx, fctx->err, "Can not send termination attribute");
-      }
-      return state;
-   }
-   else if (state != OURFA_FUNC_CALL_STATE_NODE)
-      return state;
+   const char *node_name;
 
-   n = fctx->cur;
-   if (state == OURFA_FUNC_CALL_STATE_NODE) {
-      node_name = n->n.n_val.name;
-      arr_index = n->n.n_val.array_index ? n->n.n_val.array_index : "0";
-   }else {
-      node_name = "";
-      arr_index = "";
-   }
+   node_name = n->n.n_val.name;
+   res->type = n->type;
+   res->s_free = NULL;
 
    switch (n->type) {
       case OURFA_XMLAPI_NODE_INTEGER:
@@ -600,7 +822,7 @@ int ourfa_func_call_req_step(ourfa_func_call_ctx_t *fctx,
 		     setf_err(fctx, OURFA_ERROR_HASH,
 			   "Wrong input parameter '%s'", node_name);
 		     free(s);
-		     break; /* switch  */
+		     return -1;
 		  }
 		  free(s);
 	       }else {
@@ -613,20 +835,17 @@ int ourfa_func_call_req_step(ourfa_func_call_ctx_t *fctx,
 		  else {
 		     setf_err(fctx, fctx->err,
 			   "Wrong input parameter '%s'", node_name);
-		     break; /* switch  */
+		     return -1;
 		  }
 	       }
 	       if (ourfa_hash_set_int(fctx->h, node_name, arr_index, val) != 0) {
 		  setf_err(fctx, OURFA_ERROR_HASH,
 			"Can not set hash value: `%s(%s)` => `%i`",
 			node_name, arr_index, val);
-		  break; /* switch  */
+		  return -1;
 	       }
 	    } /* if (ourfa_hash_get_int)  */
-
-	    fctx->err=ourfa_connection_write_int(conn, OURFA_ATTR_DATA, val);
-	    if (fctx->err != OURFA_OK)
-	       socket_error = 1;
+	    res->v.i = val;
 	 }
 	 break;
       case OURFA_XMLAPI_NODE_LONG:
@@ -643,7 +862,7 @@ int ourfa_func_call_req_step(ourfa_func_call_ctx_t *fctx,
 		     setf_err(fctx, OURFA_ERROR_HASH,
 			   "Wrong input parameter '%s'", node_name);
 		     free(s);
-		     break; /* switch  */
+		     return -1;
 		  }
 		  val = buildin_val;
 		  free(s);
@@ -653,19 +872,17 @@ int ourfa_func_call_req_step(ourfa_func_call_ctx_t *fctx,
 			n->n.n_val.defval, &val);
 		  if (fctx->err != OURFA_OK) {
 		     setf_err(fctx, fctx->err, "Wrong input parameter '%s'", node_name);
-		     break; /* switch  */
+		     return -1;
 		  }
 	       }
 	       if (ourfa_hash_set_long(fctx->h, node_name, arr_index, val) != 0) {
 		  setf_err(fctx, OURFA_ERROR_HASH,
 			"Can not set hash value: `%s(%s)` => `%lli`",
 			node_name, arr_index, val);
-		  break; /* switch  */
+		  return -1;
 	       }
 	    }
-	    fctx->err=ourfa_connection_write_long(conn, OURFA_ATTR_DATA, val);
-	    if (fctx->err != OURFA_OK)
-	       socket_error = 1;
+	    res->v.l = val;
 	 }
 	 break;
       case OURFA_XMLAPI_NODE_DOUBLE:
@@ -674,35 +891,29 @@ int ourfa_func_call_req_step(ourfa_func_call_ctx_t *fctx,
 
 	    /*  Get user value */
 	    if (ourfa_hash_get_double(fctx->h, node_name, arr_index, &val) != 0) {
-	       char *p_end;
-
 	       /*  Get default value */
 	       if (n->n.n_val.defval == NULL) {
 		  setf_err(fctx, OURFA_ERROR_HASH,
 			"Can not get default value for node `%s`", node_name);
-		  break; /* switch  */
+		  return -1;
 	       }
 
 	       /*  XXX: functions now(), max_time(), size() ??? */
-	       errno = 0;
-	       val = strtod(n->n.n_val.defval, &p_end);
-	       if (((*p_end != '\0') || errno == ERANGE)
+	       if ((ourfa_parse_double(n->n.n_val.defval, &val) != 0)
 		     && (ourfa_hash_get_double(fctx->h, n->n.n_val.defval,
 			   NULL, &val) != 0)) {
 		  setf_err(fctx, OURFA_ERROR_HASH,
 			"Wrong input parameter '%s' ('%s')", node_name, n->n.n_val.defval);
-		  break; /* switch  */
+		  return -1;
 	       }
 	       if (ourfa_hash_set_double(fctx->h, node_name, arr_index, val) != 0) {
 		  setf_err(fctx, OURFA_ERROR_HASH,
 			"Can not set hash value: `%s(%s)` => `%.3f`",
 			node_name, arr_index, val);
-		  break; /* switch  */
+		  return -1;
 	       }
 	    }
-	    fctx->err=ourfa_connection_write_double(conn, OURFA_ATTR_DATA, val);
-	    if (fctx->err != OURFA_OK)
-	       socket_error = 1;
+	    res->v.d = val;
 	 }
 	 break;
       case OURFA_XMLAPI_NODE_STRING:
@@ -718,88 +929,95 @@ int ourfa_func_call_req_step(ourfa_func_call_ctx_t *fctx,
 		  setf_err(fctx, OURFA_ERROR_HASH,
 			"Can not get default value for node `%s`",
 			node_name);
-		  break; /* switch  */
+		  return -1;
 	       }
 	       if (ourfa_hash_set_string(fctx->h, node_name, arr_index, n->n.n_val.defval) != 0) {
 		  setf_err(fctx, OURFA_ERROR_HASH,
 			"Can not set hash value: `%s(%s)` => `%s`",
 			node_name, arr_index,
 			n->n.n_val.defval);
-		  break; /* switch  */
+		  return -1;
 	       }
 	    }
-	    fctx->err = ourfa_connection_write_string(conn, OURFA_ATTR_DATA,
-		  val ? val : n->n.n_val.defval);
-	    if (fctx->err != OURFA_OK)
-	       socket_error = 1;
-	    free(val);
+	    res->s_free = val;
+	    res->v.s = val ? val : n->n.n_val.defval;
 	 }
 	 break;
       case OURFA_XMLAPI_NODE_IP:
 	 {
-	    struct sockaddr_storage val;
+	    struct sockaddr_storage *val;
+
+	    val = &res->v.ip;
 
 	    /*  Get user value */
-	    if (ourfa_hash_get_ip(fctx->h, node_name, arr_index, (struct sockaddr *)&val) != 0) {
+	    if (ourfa_hash_get_ip(fctx->h, node_name, arr_index, (struct sockaddr *)val) != 0) {
 
 	       /*  Get default value */
 	       if (n->n.n_val.defval == NULL) {
 		  setf_err(fctx, OURFA_ERROR_HASH,
 			"Can not get default value for node `%s`", node_name);
-		  break; /* switch  */
+		  return -1;
 	       }
 
-	       if ((ourfa_parse_ip(n->n.n_val.defval, &val) != 0)
+	       if ((ourfa_parse_ip(n->n.n_val.defval, val) != 0)
 		     && (ourfa_hash_get_ip(fctx->h, n->n.n_val.defval,
-			   NULL, (struct sockaddr *)&val) != 0)) {
+			   NULL, (struct sockaddr *)val) != 0)) {
 		  setf_err(fctx, OURFA_ERROR_HASH,
 			"Wrong input parameter '%s' ('%s')",
 			node_name,
 			n->n.n_val.defval);
-		  break; /* switch  */
+		  return -1;
 	       }
-	       if (ourfa_hash_set_ip(fctx->h, node_name, arr_index, (struct sockaddr *)&val) != 0) {
+	       if (ourfa_hash_set_ip(fctx->h, node_name, arr_index, (struct sockaddr *)val) != 0) {
 		  setf_err(fctx, OURFA_ERROR_HASH,
 			"Can not set hash value: %s(%s) = %s",
 			node_name, arr_index,
 			n->n.n_val.defval);
-		  break; /* switch  */
+		  return -1;
 	       }
 	    }
-	    fctx->err = ourfa_connection_write_ip(conn, OURFA_ATTR_DATA, (struct sockaddr *)&val);
-	    if (fctx->err != OURFA_OK)
-	       socket_error = 1;
 	 }
 	 break;
-      case OURFA_XMLAPI_NODE_SET:
-	 break;
       default:
 	 assert(0);
-	 break;
+	 return -1;
    } /* switch  */
 
-ourfa_func_call_req_step_end:
-   if (fctx->err != OURFA_OK && !socket_error) {
-      /* Schema error. Send termination attribute.
-       * ans flush server response
-       * XXX: Server may not send data and client blocks on flush_read()
-       */
-      ourfa_connection_purge_write(conn);
-      if (ourfa_connection_write_int(conn, OURFA_ATTR_TERMINATION, 3) == OURFA_OK)
-	 ourfa_connection_flush_read(conn);
+   return 0;
+}
+
+static int write_input_val(ourfa_connection_t *conn,
+      const struct input_val_t *val)
+{
+   switch (val->type) {
+      case OURFA_XMLAPI_NODE_INTEGER:
+	 return ourfa_connection_write_int(conn, OURFA_ATTR_DATA, val->v.i);
+      case OURFA_XMLAPI_NODE_LONG:
+	 return ourfa_connection_write_long(conn, OURFA_ATTR_DATA, val->v.l);
+      case OURFA_XMLAPI_NODE_DOUBLE:
+	 return ourfa_connection_write_double(conn, OURFA_ATTR_DATA, val->v.d);
+      case OURFA_XMLAPI_NODE_STRING:
+	 return ourfa_connection_write_string(conn, OURFA_ATTR_DATA, val->v.s);
+      case OURFA_XMLAPI_NODE_IP:
+	 return ourfa_connection_write_ip(conn, OURFA_ATTR_DATA,
+	       (const struct sockaddr *)&val->v.ip);
+      default:
+	 assert(0);
+	 break;
    }
 
-   return state;
+   return OURFA_ERROR_OTHER;
 }
 
-int ourfa_func_call_resp_step(ourfa_func_call_ctx_t *fctx,
+int ourfa_func_call_req_step(ourfa_func_call_ctx_t *fctx,
       ourfa_connection_t *conn)
 {
    int state;
    int old_err;
-   int func_ret_code;
-   const char *node_type, *node_name, *arr_index;
+   int socket_error = 0;
+   const char *arr_index;
    ourfa_xmlapi_func_node_t *n;
+   struct input_val_t val;
 
    assert(fctx->cur);
 
@@ -807,9 +1025,10 @@ int ourfa_func_call_resp_step(ourfa_func_call_ctx_t *fctx,
    state = ourfa_func_call_step(fctx);
 
    if (fctx->err != OURFA_OK) {
-      if (old_err == OURFA_OK)
-	 /* Schema error. Read data to termination attribute  */
-	 ourfa_connection_flush_read(conn);
+      assert(fctx->f && fctx->f->in);
+      if (old_err == OURFA_OK && (fctx->f->in->children != NULL))
+	 /* Schema error. Send termination attribute. On error do nothing  */
+	 goto ourfa_func_call_req_step_end;
       return state;
    }
 
@@ -817,28 +1036,102 @@ int ourfa_func_call_resp_step(ourfa_func_call_ctx_t *fctx,
 
    if (state == OURFA_FUNC_CALL_STATE_END) {
       assert (fctx->cur->type == OURFA_XMLAPI_NODE_ROOT);
-      /* Read termination attribute with error code  */
-      fctx->err  = ourfa_connection_read_int(conn, OURFA_ATTR_TERMINATION, &func_ret_code);
-      if (fctx->err != OURFA_OK)
-	 setf_err(fctx, fctx->err,
-	       "Can not receive termination attribute");
-      else
-	 ourfa_connection_flush_read(conn);
-      goto ourfa_func_call_resp_step_err;
-   }
-   else if (state != OURFA_FUNC_CALL_STATE_NODE)
-      return state;
-   else if ((fctx->cur->type == OURFA_XMLAPI_NODE_SET)
-	 || (fctx->cur->type == OURFA_XMLAPI_NODE_BREAK))
-      return state;
-
-   assert(state == OURFA_FUNC_CALL_STATE_NODE);
+      if (fctx->cur->children != NULL) {
+	 /* Send termination attribute
+	  * Do not send termination attribute if no input parameters found
+	 */
+	 fctx->err = ourfa_connection_write_int(conn, OURFA_ATTR_TERMINATION, 4);
+	 if (fctx->err != OURFA_OK)
+	    setf_err(fctx, fctx->err, "Can not send termination attribute");
+      }
+      return state;
+   }
+   else if (state != OURFA_FUNC_CALL_STATE_NODE)
+      return state;
+
+   n = fctx->cur;
+   if (n->type == OURFA_XMLAPI_NODE_SET)
+      return state;
+
+   arr_index = n->n.n_val.array_index ? n->n.n_val.array_index : "0";
+
+   if (input_val(fctx, n, arr_index, &val) == 0) {
+      fctx->err = write_input_val(conn, &val);
+      if (fctx->err != OURFA_OK)
+	 socket_error = 1;
+      free(val.s_free);
+   }
+
+ourfa_func_call_req_step_end:
+   if (fctx->err != OURFA_OK && !socket_error) {
+      /* Schema error. Send termination attribute.
+       * ans flush server response
+       * XXX: Server may not send data and client blocks on flush_read()
+       */
+      ourfa_connection_purge_write(conn);
+      if (ourfa_connection_write_int(conn, OURFA_ATTR_TERMINATION, 3) == OURFA_OK)
+	 ourfa_connection_flush_read(conn);
+   }
+
+   return state;
+}
+
+int ourfa_func_call_resp_step(ourfa_func_call_ctx_t *fctx,
+      ourfa_connection_t *conn)
+{
+   int state;
+   int old_err;
+   int func_ret_code;
+   const char *node_type, *node_name, *arr_index;
+   ourfa_xmlapi_func_node_t *n;
+
+   assert(fctx->cur);
+
+   old_err = fctx->err;
+   state = ourfa_func_call_step(fctx);
+
+   if (fctx->err != OURFA_OK) {
+      if (old_err == OURFA_OK)
+	 /* Schema error. Read data to termination attribute  */
+	 ourfa_connection_flush_read(conn);
+      return state;
+   }
+
+   assert(fctx->err == OURFA_OK);
+
+   if (state == OURFA_FUNC_CALL_STATE_END) {
+      assert (fctx->cur->type == OURFA_XMLAPI_NODE_ROOT);
+      /* Read termination attribute with error code  */
+      fctx->err  = ourfa_connection_read_int(conn, OURFA_ATTR_TERMINATION, &func_ret_code);
+      if (fctx->err != OURFA_OK)
+	 setf_err(fctx, fctx->err,
+	       "Can not receive termination attribute");
+      else
+	 ourfa_connection_flush_read(conn);
+      goto ourfa_func_call_resp_step_err;
+   }
+   else if (state != OURFA_FUNC_CALL_STATE_NODE)
+      return state;
+   else if ((fctx->cur->type == OURFA_XMLAPI_NODE_SET)
+	 || (fctx->cur->type == OURFA_XMLAPI_NODE_BREAK))
+      return state;
+
+   assert(state == OURFA_FUNC_CALL_STATE_NODE);
 
    n = fctx->cur;
    node_type = ourfa_xmlapi_node_name_by_type(n->type);
    node_name = n->n.n_val.name;
    arr_index = n->n.n_val.array_index ? n->n.n_val.array_index : "0";
 
+   if ((fctx->skip != NULL) && fctx->skip[fctx->pc]) {
+      fctx->err = ourfa_connection_skip_attr(conn, OURFA_ATTR_DATA);
+      if (fctx->err != OURFA_OK)
+	 setf_err(fctx, fctx->err,
+	       "Can not get %s value for node %s(%s)",
+	       node_type, node_name, arr_index);
+      goto ourfa_func_call_resp_step_err;
+   }
+
    switch (n->type) {
       case OURFA_XMLAPI_NODE_INTEGER:
 	 {
@@ -954,6 +1247,392 @@ ourfa_func_call_resp_step_err:
    return state;
 }
 
+static int row_cb_val(ourfa_func_call_ctx_t *fctx,
+      const ourfa_xmlapi_func_node_t *n, const void *val)
+{
+   const ourfa_row_cb_t *cb;
+   int res;
+
+   cb = fctx->row_cb;
+   res = 0;
+   switch (n->type) {
+      case OURFA_XMLAPI_NODE_INTEGER:
+	 if (cb->val_int)
+	    res = cb->val_int(fctx->row_ctx, n->n.n_val.name, *(const int *)val);
+	 break;
+      case OURFA_XMLAPI_NODE_LONG:
+	 if (cb->val_long)
+	    res = cb->val_long(fctx->row_ctx, n->n.n_val.name, *(const long long *)val);
+	 break;
+      case OURFA_XMLAPI_NODE_DOUBLE:
+	 if (cb->val_double)
+	    res = cb->val_double(fctx->row_ctx, n->n.n_val.name, *(const double *)val);
+	 break;
+      case OURFA_XMLAPI_NODE_STRING:
+	 if (cb->val_string)
+	    res = cb->val_string(fctx->row_ctx, n->n.n_val.name, *(char * const *)val);
+	 break;
+      case OURFA_XMLAPI_NODE_IP:
+	 if (cb->val_ip)
+	    res = cb->val_ip(fctx->row_ctx, n->n.n_val.name, (const struct sockaddr *)val);
+	 break;
+      default:
+	 assert(0);
+	 break;
+   }
+
+   if (res != 0)
+      setf_err(fctx, OURFA_ERROR_OTHER, "Call aborted by callback on node %s",
+	    n->n.n_val.name);
+
+   return res;
+}
+
+static int row_cb_row(ourfa_func_call_ctx_t *fctx,
+      const ourfa_xmlapi_func_node_t *n, unsigned depth, long long i, int is_end)
+{
+   int (*f)(void *user_ctx, const char *loop, unsigned depth, long long i);
+
+   f = is_end ? fctx->row_cb->row_end : fctx->row_cb->row_begin;
+   if (f == NULL)
+      return 0;
+
+   if (f(fctx->row_ctx, n->n.n_for.name, depth, i) != 0) {
+      setf_err(fctx, OURFA_ERROR_OTHER, "Call aborted by callback on loop %s",
+	    n->n.n_for.name);
+      return -1;
+   }
+
+   return 0;
+}
+
+/*
+ * Response decoder for functions without side-effect nodes
+ * (see compile_decode_plan() in xmlapi.c). Values are stored directly
+ * into variable arrays; loop counters are kept in local variables.
+ * Result is stored in fctx->err. Returns -1 if plan can not be used and
+ * response should be handled by ourfa_func_call_resp_step()
+ *
+ * With fctx->row_cb set values are also passed to callbacks. Rows of top
+ * level loops after the first one are stored in the hash at index from+1,
+ * so memory does not grow with the row count while variables of the
+ * first row stay where conditions and counters look them up.
+ */
+static int ourfa_func_call_decode(ourfa_func_call_ctx_t *fctx,
+      ourfa_connection_t *conn)
+{
+   const struct ourfa_xmlapi_prog_t *prog;
+   const struct ourfa_xmlapi_insn_t *insn;
+   ourfa_xmlapi_func_node_t *n;
+   struct hash_val_t **cols;
+   unsigned char *col_loaded;
+   long long loop_cnt[OURFA_XMLAPI_DECODE_MAX_DEPTH];
+   long long loop_from;
+   unsigned idx[OURFA_XMLAPI_DECODE_MAX_IDX];
+   const char *node_type, *node_name, *arr_index;
+   const ourfa_row_cb_t *cb;
+   unsigned pc, i, c;
+   int func_ret_code;
+
+   cb = fctx->row_cb;
+   loop_from = 0;
+   prog = fctx->cur->n.n_root.prog;
+   assert(prog && prog->decodable);
+   assert(fctx->state == OURFA_FUNC_CALL_STATE_START);
+
+   cols = calloc(1, prog->col_cnt * (sizeof(cols[0]) + 1) + 1);
+   if (cols == NULL)
+      return -1;
+   col_loaded = (unsigned char *)&cols[prog->col_cnt];
+
+   pc = 0;
+   for (;;) {
+      insn = &prog->insn[pc];
+      n = fctx->cur = insn->node;
+      switch (insn->op) {
+	 case OURFA_XMLAPI_OP_NODE:
+	    if ((fctx->skip != NULL) && fctx->skip[pc]) {
+	       fctx->err = ourfa_connection_skip_attr(conn, OURFA_ATTR_DATA);
+	       if (fctx->err != OURFA_OK) {
+		  setf_err(fctx, fctx->err,
+			"Can not get %s value for node %s(%s)",
+			ourfa_xmlapi_node_name_by_type(n->type),
+			n->n.n_val.name,
+			n->n.n_val.array_index ? n->n.n_val.array_index : "0");
+		  if (fctx->err != OURFA_ERROR_NO_DATA)
+		     ourfa_connection_flush_read(conn);
+		  goto decode_end;
+	       }
+	       pc++;
+	       break;
+	    }
+	    for (i=0; i < insn->a.i_val.idx_cnt; i++) {
+	       if (!insn->a.i_val.idx[i].is_loop)
+		  idx[i] = insn->a.i_val.idx[i].val;
+	       else if (cb && (insn->a.i_val.idx[i].val == 0)
+		     && (loop_cnt[0] > loop_from + 1))
+		  /* Streaming: rows of top level loop after the first one
+		   * share one slot  */
+		  idx[i] = (unsigned)(loop_from + 1);
+	       else
+		  idx[i] = (unsigned)loop_cnt[insn->a.i_val.idx[i].val];
+	    }
+	    c = insn->a.i_val.col;
+	    node_type = ourfa_xmlapi_node_name_by_type(n->type);
+	    node_name = n->n.n_val.name;
+	    arr_index = n->n.n_val.array_index ? n->n.n_val.array_index : "0";
+	    if (!col_loaded[c]) {
+	       cols[c] = ourfa_hash_col(fctx->h, node_name);
+	       col_loaded[c] = 1;
+	    }
+
+	    switch (n->type) {
+	       case OURFA_XMLAPI_NODE_INTEGER:
+		  {
+		     int val;
+
+		     fctx->err = ourfa_connection_read_int(conn, OURFA_ATTR_DATA, &val);
+		     if (fctx->err != OURFA_OK) {
+			setf_err(fctx, fctx->err,
+			      "Can not get %s value for node '%s(%s)'",
+			      node_type, node_name, arr_index);
+			break;
+		     }
+		     if (cb && (row_cb_val(fctx, n, &val) != 0))
+			break;
+		     if ((cols[c] != NULL)
+			   && ourfa_hash_col_set_int(cols[c], idx,
+			      insn->a.i_val.idx_cnt, val) == 0)
+			break;
+		     if (ourfa_hash_set_int(fctx->h, node_name, arr_index, val) != 0)
+			setf_err(fctx, OURFA_ERROR_HASH,
+			      "Can not set hash value: %s(%s) to %i",
+			      node_name, arr_index, val);
+		     cols[c] = ourfa_hash_col(fctx->h, node_name);
+		  }
+		  break;
+	       case OURFA_XMLAPI_NODE_LONG:
+		  {
+		     long long val;
+
+		     fctx->err = ourfa_connection_read_long(conn, OURFA_ATTR_DATA, &val);
+		     if (fctx->err != OURFA_OK) {
+			setf_err(fctx, fctx->err,
+			      "Can not get %s value for node %s(%s)",
+			      node_type, node_name, arr_index);
+			break;
+		     }
+		     if (cb && (row_cb_val(fctx, n, &val) != 0))
+			break;
+		     if ((cols[c] != NULL)
+			   && ourfa_hash_col_set_long(cols[c], idx,
+			      insn->a.i_val.idx_cnt, val) == 0)
+			break;
+		     if (ourfa_hash_set_long(fctx->h, node_name, arr_index, val) != 0)
+			setf_err(fctx, OURFA_ERROR_HASH,
+			      "Can not set hash value: %s(%s) to %lld",
+			      node_name, arr_index, val);
+		     cols[c] = ourfa_hash_col(fctx->h, node_name);
+		  }
+		  break;
+	       case OURFA_XMLAPI_NODE_DOUBLE:
+		  {
+		     double val;
+
+		     fctx->err = ourfa_connection_read_double(conn, OURFA_ATTR_DATA, &val);
+		     if (fctx->err != OURFA_OK) {
+			setf_err(fctx, fctx->err,
+			      "Cannot get %s value for node %s(%s)",
+			      node_type, node_name, arr_index);
+			break;
+		     }
+		     if (cb && (row_cb_val(fctx, n, &val) != 0))
+			break;
+		     if ((cols[c] != NULL)
+			   && ourfa_hash_col_set_double(cols[c], idx,
+			      insn->a.i_val.idx_cnt, val) == 0)
+			break;
+		     if (ourfa_hash_set_double(fctx->h, node_name, arr_index, val) != 0)
+			setf_err(fctx, OURFA_ERROR_HASH,
+			      "Cannot set hash value: %s(%s) to %.3f ",
+			      node_name, arr_index, val);
+		     cols[c] = ourfa_hash_col(fctx->h, node_name);
+		  }
+		  break;
+	       case OURFA_XMLAPI_NODE_STRING:
+		  {
+		     char *val;
+		     val = NULL;
+
+		     fctx->err = ourfa_connection_read_string(conn, OURFA_ATTR_DATA, &val);
+		     if (fctx->err != OURFA_OK) {
+			setf_err(fctx, fctx->err,
+			      "Cannot get %s value for node %s(%s)",
+			      node_type, node_name, arr_index);
+			free(val);
+			break;
+		     }
+		     if (cb && (row_cb_val(fctx, n, &val) != 0)) {
+			free(val);
+			break;
+		     }
+		     /* On success string is owned by the hash  */
+		     if ((cols[c] != NULL)
+			   && ourfa_hash_col_set_string(cols[c], idx,
+			      insn->a.i_val.idx_cnt, val) == 0)
+			break;
+		     if (ourfa_hash_set_string(fctx->h, node_name, arr_index, val) != 0)
+			setf_err(fctx, OURFA_ERROR_HASH,
+			      "Cannot set hash value to '%s' "
+			      "for node %s(%s)",
+			      val, node_name, arr_index);
+		     free(val);
+		     cols[c] = ourfa_hash_col(fctx->h, node_name);
+		  }
+		  break;
+	       case OURFA_XMLAPI_NODE_IP:
+		  {
+		     struct sockaddr_storage val;
+		     struct sockaddr *val_p = (struct sockaddr *)&val;
+
+		     fctx->err = ourfa_connection_read_ip(conn, OURFA_ATTR_DATA, val_p);
+		     if (fctx->err != OURFA_OK) {
+			setf_err(fctx, fctx->err,
+			      "Cannot get %s value for node %s(%s)",
+			      node_type, node_name, arr_index);
+			break;
+		     }
+		     if (cb && (row_cb_val(fctx, n, &val) != 0))
+			break;
+		     if ((cols[c] != NULL)
+			   && ourfa_hash_col_set_ip(cols[c], idx,
+			      insn->a.i_val.idx_cnt, val_p) == 0)
+			break;
+		     if (ourfa_hash_set_ip(fctx->h, node_name, arr_index, val_p) != 0) {
+			char ip[INET6_ADDRSTRLEN+1];
+			ourfa_ip_ntop(val_p, ip, sizeof(ip));
+			setf_err(fctx, OURFA_ERROR_HASH,
+			      "Cannot set hash value to %s "
+			      "for node %s(%s)",
+			      ip, node_name, arr_index);
+		     }
+		     cols[c] = ourfa_hash_col(fctx->h, node_name);
+		  }
+		  break;
+	       default:
+		  assert(0);
+		  break;
+	    }
+	    if (fctx->err != OURFA_OK) {
+	       if (fctx->err != OURFA_ERROR_NO_DATA)
+		  ourfa_connection_flush_read(conn);
+	       goto decode_end;
+	    }
+	    pc++;
+	    break;
+	 case OURFA_XMLAPI_OP_IF:
+	    if (ourfa_func_call_if_res(fctx, insn) && (insn->jmp != pc+1))
+	       pc++;
+	    else
+	       pc = insn->jmp + 1;
+	    break;
+	 case OURFA_XMLAPI_OP_ENDIF:
+	    pc++;
+	    break;
+	 case OURFA_XMLAPI_OP_FOR:
+	    {
+	       long long from, count;
+
+	       fctx->err = ourfa_func_call_get_operand_val(fctx, &insn->a.i_for.from, &from);
+	       if (fctx->err != OURFA_OK) {
+		  setf_err(fctx, fctx->err, "Can not parse 'from' value of 'for' node");
+		  ourfa_connection_flush_read(conn);
+		  goto decode_end;
+	       }
+	       fctx->err = ourfa_func_call_get_operand_val(fctx, &insn->a.i_for.count, &count);
+	       if (fctx->err != OURFA_OK) {
+		  setf_err(fctx, fctx->err, "Can not parse 'count' value of 'from' node");
+		  ourfa_connection_flush_read(conn);
+		  goto decode_end;
+	       }
+	       if (ourfa_hash_set_long(fctx->h, n->n.n_for.name, NULL, from)) {
+		  setf_err(fctx, OURFA_ERROR_HASH, "Can not set 'for' counter value");
+		  ourfa_connection_flush_read(conn);
+		  goto decode_end;
+	       }
+	       loop_cnt[insn->a.i_for.depth] = from;
+	       if (insn->a.i_for.depth == 0)
+		  loop_from = from;
+	       if ((count != 0) && (insn->jmp != pc+1)) {
+		  if (cb && row_cb_row(fctx, n, insn->a.i_for.depth, from, 0)) {
+		     ourfa_connection_flush_read(conn);
+		     goto decode_end;
+		  }
+		  pc++;
+	       }else
+		  pc = insn->jmp + 1;
+	    }
+	    break;
+	 case OURFA_XMLAPI_OP_ENDFOR:
+	    {
+	       long long from, count;
+	       int r0;
+	       const struct ourfa_xmlapi_insn_t *head;
+
+	       head = &prog->insn[insn->jmp];
+	       r0 = ourfa_func_call_get_operand_val(fctx, &head->a.i_for.from, &from);
+	       assert(r0 == OURFA_OK);
+	       r0 = ourfa_func_call_get_operand_val(fctx, &head->a.i_for.count, &count);
+	       assert(r0 == OURFA_OK);
+
+	       i = head->a.i_for.depth;
+	       if (cb && row_cb_row(fctx, n, i, loop_cnt[i], 1)) {
+		  ourfa_connection_flush_read(conn);
+		  goto decode_end;
+	       }
+	       loop_cnt[i]++;
+	       if (ourfa_hash_set_long(fctx->h, n->n.n_for.name, NULL, loop_cnt[i])){
+		  setf_err(fctx, OURFA_ERROR_HASH, "Cannot set 'for' counter value");
+		  ourfa_connection_flush_read(conn);
+		  goto decode_end;
+	       }
+	       if (loop_cnt[i] < from+count) {
+		  if (cb && row_cb_row(fctx, n, i, loop_cnt[i], 0)) {
+		     ourfa_connection_flush_read(conn);
+		     goto decode_end;
+		  }
+		  pc = insn->jmp + 1;
+	       }else
+		  pc++;
+	    }
+	    break;
+	 case OURFA_XMLAPI_OP_END:
+	    /* Read termination attribute with error code  */
+	    fctx->err  = ourfa_connection_read_int(conn, OURFA_ATTR_TERMINATION, &func_ret_code);
+	    if (fctx->err != OURFA_OK) {
+	       setf_err(fctx, fctx->err,
+		     "Can not receive termination attribute");
+	       if (fctx->err != OURFA_ERROR_NO_DATA)
+		  ourfa_connection_flush_read(conn);
+	    }else
+	       ourfa_connection_flush_read(conn);
+	    goto decode_end;
+	    break;
+	 default:
+	    assert(0);
+	    break;
+      }
+   }
+
+decode_end:
+   free(cols);
+   fctx->pc = prog->insn_cnt - 1;
+   fctx->cur = prog->insn[fctx->pc].node;
+   fctx->state = OURFA_FUNC_CALL_STATE_END;
+
+   return 0;
+}
+
 static int ourfa_func_call_reqresp(ourfa_func_call_ctx_t *fctx,
       ourfa_connection_t *conn, int is_req)
 {
@@ -970,7 +1649,18 @@ static int ourfa_func_call_reqresp(ourfa_func_call_ctx_t *fctx,
 
    f = is_req ? ourfa_func_call_req_step : ourfa_func_call_resp_step;
 
-   for (state=ourfa_func_call_start(fctx, is_req);
+   state = ourfa_func_call_start(fctx, is_req);
+   if (!is_req && fctx->cur->n.n_root.prog->decodable) {
+      if (ourfa_func_call_decode(fctx, conn) == 0)
+	 return fctx->err;
+      if (fctx->row_cb != NULL) {
+	 setf_err(fctx, OURFA_ERROR_SYSTEM, "Cannot allocate memory");
+	 ourfa_connection_flush_read(conn);
+	 return fctx->err;
+      }
+   }
+
+   for (;
 	 state != OURFA_FUNC_CALL_STATE_END;
 	 state = f(fctx, conn));
 
@@ -991,6 +1681,530 @@ int ourfa_func_call_req(ourfa_func_call_ctx_t *fctx,
 }
 
 
+/*
+ * Prepared calls.
+ * Request of the function is encoded once. Next calls patch values of
+ * the input parameters in packets of the previous request if 'if' and
+ * 'for' nodes of the input take the same branches. Template is used for
+ * decodable input programs only (value nodes, 'if' and 'for').
+ */
+struct prepared_slot_t {
+   ourfa_xmlapi_func_node_t *node;
+   char idx[OURFA_XMLAPI_DECODE_MAX_IDX*11+1];
+   ourfa_attr_hdr_t *attr;
+};
+
+struct prepared_loop_t {
+   const char *name;
+   long long val;
+};
+
+struct ourfa_prepared_call_t {
+   ourfa_xmlapi_func_t *f;
+   unsigned templatable;
+
+   /* Template */
+   unsigned valid;
+   unsigned long long ctl_fp;
+   ourfa_pkt_t **pkts;
+   unsigned pkts_cnt;
+   struct prepared_slot_t *slots;
+   unsigned slots_cnt;
+   unsigned slots_size;
+   struct prepared_loop_t *loops;
+   unsigned loops_cnt;
+
+   struct ourfa_prepared_call_stats_t stats;
+};
+
+static const char *prepared_ctl_name(const char *name, char *buf, size_t buf_size);
+static unsigned prepared_insn_ctl_names(const struct ourfa_xmlapi_insn_t *insn,
+      const char **names);
+static int prepared_ctl_fp_name(const struct ourfa_xmlapi_prog_t *prog,
+      ourfa_hash_t *h, const char *name, unsigned long long *fp);
+static int prepared_is_templatable(const struct ourfa_xmlapi_prog_t *prog);
+static unsigned long long prepared_ctl_fp(const struct ourfa_xmlapi_prog_t *prog,
+      ourfa_hash_t *h);
+static void prepared_reset(ourfa_prepared_call_t *pcall);
+static int prepared_build(ourfa_prepared_call_t *pcall,
+      ourfa_func_call_ctx_t *fctx);
+static int prepared_patch(ourfa_prepared_call_t *pcall,
+      ourfa_func_call_ctx_t *fctx);
+
+ourfa_prepared_call_t *ourfa_prepare_call(ourfa_xmlapi_t *xmlapi,
+      const char *func)
+{
+   ourfa_prepared_call_t *pcall;
+   ourfa_xmlapi_func_t *f;
+
+   f = ourfa_xmlapi_func(xmlapi, func);
+   if ((f == NULL) || (f->script != NULL) || (f->in == NULL))
+      return NULL;
+
+   pcall = calloc(1, sizeof(*pcall));
+   if (pcall == NULL)
+      return NULL;
+
+   pcall->f = ourfa_xmlapi_func_ref(f);
+   pcall->templatable = prepared_is_templatable(f->in->n.n_root.prog);
+
+   return pcall;
+}
+
+void ourfa_prepared_call_free(ourfa_prepared_call_t *pcall)
+{
+   if (pcall == NULL)
+      return;
+
+   prepared_reset(pcall);
+   free(pcall->pkts);
+   free(pcall->slots);
+   free(pcall->loops);
+   ourfa_xmlapi_func_deref(pcall->f);
+   free(pcall);
+}
+
+void ourfa_prepared_call_stats(ourfa_prepared_call_t *pcall,
+      struct ourfa_prepared_call_stats_t *res)
+{
+   if ((pcall == NULL) || (res == NULL))
+      return;
+   *res = pcall->stats;
+}
+
+int ourfa_prepared_call(ourfa_prepared_call_t *pcall,
+      ourfa_connection_t *connection,
+      ourfa_hash_t *globals)
+{
+   ourfa_func_call_ctx_t fctx;
+   unsigned long long fp;
+   unsigned i;
+   int last_err;
+
+   if ((pcall == NULL) || (connection == NULL) || (globals == NULL))
+      return OURFA_ERROR_OTHER;
+
+   init_func_call_ctx(&fctx, pcall->f, globals);
+   pcall->stats.calls++;
+
+   last_err = ourfa_start_call(&fctx, connection);
+   if (last_err != OURFA_OK) {
+      ourfa_xmlapi_func_deref(fctx.f);
+      return last_err;
+   }
+
+   /* Patch or encode template. On error encode request as usual  */
+   if (pcall->templatable) {
+      fctx.printf_err = ourfa_err_f_null;
+      fp = prepared_ctl_fp(pcall->f->in->n.n_root.prog, globals);
+      if (!pcall->valid
+	    || (pcall->ctl_fp != fp)
+	    || (prepared_patch(pcall, &fctx) != 0)) {
+	 pcall->stats.encoded++;
+	 if (prepared_build(pcall, &fctx) == 0)
+	    pcall->ctl_fp = fp;
+      }
+      fctx.printf_err = ourfa_err_f_stderr;
+   }
+
+   if (pcall->valid) {
+      last_err = OURFA_OK;
+      for (i=0; (last_err == OURFA_OK) && (i < pcall->pkts_cnt); i++)
+	 last_err = ourfa_connection_send_packet(connection, pcall->pkts[i],
+	       "SEND DATA ...\n");
+   }else {
+      if (!pcall->templatable)
+	 pcall->stats.encoded++;
+      last_err = ourfa_func_call_req(&fctx, connection);
+   }
+
+   if (last_err == OURFA_OK)
+      last_err = ourfa_func_call_resp(&fctx, connection);
+
+   ourfa_xmlapi_func_deref(fctx.f);
+
+   return last_err;
+}
+
+/* Variable name of operand of 'if' or 'for' node. NULL - constant  */
+static const char *prepared_ctl_name(const char *name, char *buf, size_t buf_size)
+{
+   int n;
+
+   if ((name == NULL) || (name[0] == '\0'))
+      return NULL;
+
+   if ((strcmp(name, "now()") == 0) || (strcmp(name, "max_time()") == 0))
+      return NULL;
+
+   /* size(array)  */
+   if (strncmp(name, "size(", 5) == 0) {
+      n = strcspn(name + 5, ",)");
+      if (((size_t)n + 1 > buf_size) || (name[5+n] != ')'))
+	 return "";
+      memcpy(buf, name + 5, n);
+      buf[n] = '\0';
+      return buf;
+   }
+
+   return name;
+}
+
+/* Variables of 'if' or 'for' instruction  */
+static unsigned prepared_insn_ctl_names(const struct ourfa_xmlapi_insn_t *insn,
+      const char **names)
+{
+   switch (insn->op) {
+      case OURFA_XMLAPI_OP_IF:
+	 names[0] = insn->node->n.n_if.variable;
+	 /* Value of 'if' can be the compared value itself  */
+	 names[1] = insn->a.i_if.is_const ? NULL : insn->node->n.n_if.value;
+	 return 2;
+      case OURFA_XMLAPI_OP_FOR:
+	 names[0] = insn->a.i_for.from.var;
+	 names[1] = insn->a.i_for.count.var;
+	 return 2;
+      default:
+	 break;
+   }
+   return 0;
+}
+
+/*
+ * Fingerprint of control variable. Input parameter with the same name
+ * can set variable to its default value: default value is added too.
+ * Returns -1 if variable can not be fingerprinted.
+ */
+static int prepared_ctl_fp_name(const struct ourfa_xmlapi_prog_t *prog,
+      ourfa_hash_t *h, const char *name, unsigned long long *fp)
+{
+   unsigned pc;
+   char buf[40], buf2[40];
+   const char *defval;
+
+   name = prepared_ctl_name(name, buf, sizeof(buf));
+   if (name == NULL)
+      return 0;
+   if (name[0] == '\0')
+      return -1;
+   *fp = ourfa_hash_fingerprint(h, name, *fp);
+
+   for (pc=0; pc < prog->insn_cnt; pc++) {
+      if ((prog->insn[pc].op != OURFA_XMLAPI_OP_NODE)
+	    || (strcmp(prog->insn[pc].node->n.n_val.name, name) != 0))
+	 continue;
+      defval = prepared_ctl_name(prog->insn[pc].node->n.n_val.defval,
+	    buf2, sizeof(buf2));
+      if (defval == NULL)
+	 continue;
+      if (defval[0] == '\0')
+	 return -1;
+      *fp = ourfa_hash_fingerprint(h, defval, *fp);
+   }
+
+   return 0;
+}
+
+/* Default values can not depend on loop counters  */
+static int prepared_is_templatable(const struct ourfa_xmlapi_prog_t *prog)
+{
+   unsigned pc, i, cnt;
+   unsigned long long fp;
+   char buf[40];
+   const char *names[2];
+
+   if (!prog->decodable)
+      return 0;
+
+   fp = 0;
+
+   for (pc=0; pc < prog->insn_cnt; pc++) {
+      cnt = prepared_insn_ctl_names(&prog->insn[pc], names);
+      for (i=0; i < cnt; i++) {
+	 if (prepared_ctl_fp_name(prog, NULL, names[i], &fp) != 0)
+	    return 0;
+      }
+      if (prog->insn[pc].op != OURFA_XMLAPI_OP_FOR)
+	 continue;
+      for (i=0; i < prog->insn_cnt; i++) {
+	 const char *defval;
+	 if (prog->insn[i].op != OURFA_XMLAPI_OP_NODE)
+	    continue;
+	 defval = prepared_ctl_name(prog->insn[i].node->n.n_val.defval,
+	       buf, sizeof(buf));
+	 if ((defval != NULL)
+	       && (strcmp(defval, prog->insn[pc].node->n.n_for.name) == 0))
+	    return 0;
+      }
+   }
+
+   return 1;
+}
+
+/*
+ * Fingerprint of variables 'if' and 'for' nodes and array indexes of
+ * values depend on. Slot indexes of the template are resolved with them.
+ */
+static unsigned long long prepared_ctl_fp(const struct ourfa_xmlapi_prog_t *prog,
+      ourfa_hash_t *h)
+{
+   unsigned pc, i, cnt;
+   unsigned long long fp;
+   const char *names[2];
+
+   fp = ourfa_hash_fingerprint(h, NULL, 0);
+   for (pc=0; pc < prog->insn_cnt; pc++) {
+      cnt = prepared_insn_ctl_names(&prog->insn[pc], names);
+      for (i=0; i < cnt; i++)
+	 prepared_ctl_fp_name(prog, h, names[i], &fp);
+      if (prog->insn[pc].op == OURFA_XMLAPI_OP_NODE)
+	 fp = ourfa_hash_fingerprint_idx(h,
+	       prog->insn[pc].node->n.n_val.array_index, NULL, 0, fp);
+   }
+
+   return fp;
+}
+
+static void prepared_reset(ourfa_prepared_call_t *pcall)
+{
+   unsigned i;
+
+   for (i=0; i < pcall->pkts_cnt; i++)
+      ourfa_pkt_free(pcall->pkts[i]);
+   pcall->pkts_cnt = 0;
+   pcall->slots_cnt = 0;
+   pcall->loops_cnt = 0;
+   pcall->valid = 0;
+}
+
+/* Add attribute to the last packet of the template  */
+static int prepared_add_attr(ourfa_prepared_call_t *pcall,
+      unsigned type, const struct input_val_t *val)
+{
+   size_t size;
+   ourfa_pkt_t *pkt;
+   int res;
+
+   switch (val->type) {
+      case OURFA_XMLAPI_NODE_INTEGER:
+	 size = 4;
+	 break;
+      case OURFA_XMLAPI_NODE_LONG:
+      case OURFA_XMLAPI_NODE_DOUBLE:
+	 size = 8;
+	 break;
+      case OURFA_XMLAPI_NODE_STRING:
+	 size = val->v.s ? strlen(val->v.s) : 0;
+	 break;
+      case OURFA_XMLAPI_NODE_IP:
+	 size = val->v.ip.ss_family == AF_INET6 ? 16 : 4;
+	 break;
+      default:
+	 return -1;
+   }
+
+   pkt = pcall->pkts_cnt ? pcall->pkts[pcall->pkts_cnt-1] : NULL;
+   if ((pkt == NULL) || (ourfa_pkt_space_left(pkt) < size)) {
+      ourfa_pkt_t **pkts;
+
+      pkts = realloc(pcall->pkts, (pcall->pkts_cnt+1) * sizeof(pkts[0]));
+      if (pkts == NULL)
+	 return -1;
+      pcall->pkts = pkts;
+      pkt = ourfa_pkt_new(OURFA_PKT_SESSION_DATA, "");
+      if (pkt == NULL)
+	 return -1;
+      if (ourfa_pkt_space_left(pkt) < size) {
+	 ourfa_pkt_free(pkt);
+	 return -1;
+      }
+      pcall->pkts[pcall->pkts_cnt++] = pkt;
+   }
+
+   switch (val->type) {
+      case OURFA_XMLAPI_NODE_INTEGER:
+	 res = ourfa_pkt_add_int(pkt, type, val->v.i);
+	 break;
+      case OURFA_XMLAPI_NODE_LONG:
+	 res = ourfa_pkt_add_long(pkt, type, val->v.l);
+	 break;
+      case OURFA_XMLAPI_NODE_DOUBLE:
+	 res = ourfa_pkt_add_double(pkt, type, val->v.d);
+	 break;
+      case OURFA_XMLAPI_NODE_STRING:
+	 res = ourfa_pkt_add_string(pkt, type, val->v.s);
+	 break;
+      default:
+	 res = ourfa_pkt_add_ip(pkt, type, (const struct sockaddr *)&val->v.ip);
+	 break;
+   }
+
+   return res;
+}
+
+/* Encode request into template packets  */
+static int prepared_build(ourfa_prepared_call_t *pcall,
+      ourfa_func_call_ctx_t *fctx)
+{
+   int state, res;
+   unsigned i, pkt_i;
+   const ourfa_attr_hdr_t *attr;
+   struct input_val_t val;
+   struct prepared_slot_t *slot;
+
+   prepared_reset(pcall);
+
+   for (state = ourfa_func_call_start(fctx, 1);
+	 state != OURFA_FUNC_CALL_STATE_END;
+	 state = ourfa_func_call_step(fctx)) {
+      if (fctx->err != OURFA_OK)
+	 return -1;
+
+      if (state == OURFA_FUNC_CALL_STATE_STARTFOR) {
+	 for (i=0; i < pcall->loops_cnt; i++) {
+	    if (strcmp(pcall->loops[i].name, fctx->cur->n.n_for.name) == 0)
+	       break;
+	 }
+	 if (i == pcall->loops_cnt) {
+	    struct prepared_loop_t *loops;
+	    loops = realloc(pcall->loops, (i+1) * sizeof(loops[0]));
+	    if (loops == NULL)
+	       return -1;
+	    pcall->loops = loops;
+	    pcall->loops[i].name = fctx->cur->n.n_for.name;
+	    pcall->loops_cnt++;
+	 }
+	 continue;
+      }
+
+      if (state != OURFA_FUNC_CALL_STATE_NODE)
+	 continue;
+
+      assert(fctx->insn[fctx->pc].op == OURFA_XMLAPI_OP_NODE);
+      if (pcall->slots_cnt == pcall->slots_size) {
+	 unsigned new_size;
+
+	 new_size = pcall->slots_size ? 2 * pcall->slots_size : 16;
+	 slot = realloc(pcall->slots, new_size * sizeof(slot[0]));
+	 if (slot == NULL)
+	    return -1;
+	 pcall->slots = slot;
+	 pcall->slots_size = new_size;
+      }
+      slot = &pcall->slots[pcall->slots_cnt];
+      slot->node = fctx->cur;
+      slot->attr = NULL;
+
+      /* Resolve loop counters of array index  */
+      {
+	 unsigned idx[OURFA_XMLAPI_DECODE_MAX_IDX];
+	 int idx_cnt;
+	 size_t len;
+
+	 idx_cnt = ourfa_hash_parse_idx_list(fctx->h,
+	       fctx->cur->n.n_val.array_index ? fctx->cur->n.n_val.array_index : "0",
+	       idx, OURFA_XMLAPI_DECODE_MAX_IDX);
+	 if (idx_cnt <= 0)
+	    return -1;
+	 len = 0;
+	 for (i=0; i < (unsigned)idx_cnt; i++)
+	    len += snprintf(&slot->idx[len], sizeof(slot->idx)-len,
+		  i ? ",%u" : "%u", idx[i]);
+      }
+
+      if (input_val(fctx, fctx->cur, slot->idx, &val) != 0)
+	 return -1;
+      res = prepared_add_attr(pcall, OURFA_ATTR_DATA, &val);
+      free(val.s_free);
+      if (res != 0)
+	 return -1;
+      pcall->slots_cnt++;
+   }
+
+   if (fctx->err != OURFA_OK)
+      return -1;
+
+   if (fctx->cur->children != NULL) {
+      val.type = OURFA_XMLAPI_NODE_INTEGER;
+      val.v.i = 4;
+      if (prepared_add_attr(pcall, OURFA_ATTR_TERMINATION, &val) != 0)
+	 return -1;
+   }
+
+   /* Attributes of the packets are not moved from now. Packets are
+    * owned by the template, values are patched in place */
+   slot = pcall->slots;
+   for (pkt_i=0; pkt_i < pcall->pkts_cnt; pkt_i++) {
+      for (attr = ourfa_pkt_get_all_attrs_list(pcall->pkts[pkt_i]);
+	    attr != NULL; attr = attr->next) {
+	 if (attr->attr_type != OURFA_ATTR_DATA)
+	    continue;
+	 assert(slot < &pcall->slots[pcall->slots_cnt]);
+	 (slot++)->attr = (ourfa_attr_hdr_t *)attr;
+      }
+   }
+   assert(slot == &pcall->slots[pcall->slots_cnt]);
+
+   for (i=0; i < pcall->loops_cnt; i++) {
+      if (ourfa_hash_get_long(fctx->h, pcall->loops[i].name, NULL,
+	       &pcall->loops[i].val) != 0)
+	 return -1;
+   }
+
+   pcall->valid = 1;
+
+   return 0;
+}
+
+/* Replace values of template with new ones  */
+static int prepared_patch(ourfa_prepared_call_t *pcall,
+      ourfa_func_call_ctx_t *fctx)
+{
+   unsigned i;
+   int res;
+   struct input_val_t val;
+   const struct prepared_slot_t *slot;
+
+   ourfa_func_call_start(fctx, 1);
+
+   for (i=0; i < pcall->slots_cnt; i++) {
+      slot = &pcall->slots[i];
+      fctx->cur = slot->node;
+      if (input_val(fctx, slot->node, slot->idx, &val) != 0)
+	 return -1;
+      switch (val.type) {
+	 case OURFA_XMLAPI_NODE_INTEGER:
+	    res = ourfa_pkt_set_int(slot->attr, val.v.i);
+	    break;
+	 case OURFA_XMLAPI_NODE_LONG:
+	    res = ourfa_pkt_set_long(slot->attr, val.v.l);
+	    break;
+	 case OURFA_XMLAPI_NODE_DOUBLE:
+	    res = ourfa_pkt_set_double(slot->attr, val.v.d);
+	    break;
+	 case OURFA_XMLAPI_NODE_STRING:
+	    res = ourfa_pkt_set_string(slot->attr, val.v.s);
+	    break;
+	 default:
+	    res = ourfa_pkt_set_ip(slot->attr, (const struct sockaddr *)&val.v.ip);
+	    break;
+      }
+      free(val.s_free);
+      /* Other size of value  */
+      if (res != 0)
+	 return -1;
+   }
+
+   /* Loop counters as after the encoding  */
+   for (i=0; i < pcall->loops_cnt; i++) {
+      if (ourfa_hash_set_long(fctx->h, pcall->loops[i].name, NULL,
+	       pcall->loops[i].val) != 0)
+	 return -1;
+   }
+
+   return 0;
+}
+
 ourfa_script_call_ctx_t *ourfa_script_call_ctx_new(
       ourfa_xmlapi_func_t *f,
       ourfa_hash_t *h)
@@ -1027,6 +2241,8 @@ int ourfa_script_call_start(ourfa_script_call_ctx_t *sctx)
       return -1;
 
    sctx->script.cur = sctx->script.f->script;
+   sctx->script.insn = sctx->script.cur ? sctx->script.cur->n.n_root.prog->insn : NULL;
+   sctx->script.pc = 0;
    sctx->script.state = OURFA_FUNC_CALL_STATE_START;
    sctx->state = OURFA_SCRIPT_CALL_START;
    init_func_call_ctx(&sctx->func, NULL, NULL);
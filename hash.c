@@ -30,19 +30,28 @@
 
 #ifdef WIN32
 #include <ws2tcpip.h>
+#include <stdint.h>
+#include <io.h>
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <stdint.h>
+#include <unistd.h>
 #endif
 
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef OURFA_HASH_XMLHASH
 #include <libxml/hash.h>
+#endif
 
 #include <openssl/ssl.h>
 
@@ -61,20 +70,79 @@ enum ourfa_elm_type_t {
    OURFA_ELM_IP
 };
 
+/* Memory mapped snapshot file (ourfa_hash_map())  */
+struct hash_map_t {
+   void *addr;
+   size_t size;
+   unsigned ref_cnt;
+};
+
 struct hash_val_t {
    enum ourfa_elm_type_t type;
+   /* Number of hashes sharing this variable. Used on top level values only.
+    * Changed atomically: values of cached results are shared between threads */
+   unsigned ref_cnt;
+   /* Not NULL: elements are read in place from mapped snapshot.
+    * Top level values hold reference to the map */
+   struct hash_map_t *map;
    size_t elm_cnt;
    size_t data_pool_size;
    void *data;
 };
 
+#ifdef OURFA_HASH_XMLHASH
+
+/* libxml2 xmlHash backend */
+struct ourfa_hash_t {
+   xmlHashTablePtr tbl;
+};
+
+#else
+
+/*
+ * Native open addressing table with linear probing.
+ * Keys shorter than HASH_INLINE_KEY_SIZE are stored inside the slot,
+ * full hash value is cached to skip most of key comparisons.
+ */
+#define HASH_INLINE_KEY_SIZE 24
+#define HASH_MIN_SIZE 16
+
+struct hash_entry_t {
+   struct hash_val_t *val; /* NULL - empty slot  */
+   unsigned hash;
+   unsigned key_len;
+   union {
+      char inl[HASH_INLINE_KEY_SIZE];
+      char *ptr;
+   } key;
+};
+
+struct ourfa_hash_t {
+   size_t size; /* Number of slots. Power of 2 */
+   size_t cnt;
+   struct hash_entry_t *entries;
+};
+
+#endif /* OURFA_HASH_XMLHASH */
+
+typedef void hash_scan_f(struct hash_val_t *val, const char *key, void *data);
+
 static size_t elm_size_by_type(enum ourfa_elm_type_t t);
 static struct hash_val_t *hash_val_new(enum ourfa_elm_type_t type, size_t size);
 static int convert_hashval2string(struct hash_val_t *val);
 static int increase_pool_size(struct hash_val_t *ha, size_t add);
 static void hash_val_clear(struct hash_val_t *val);
 static void hash_val_free(struct hash_val_t *val);
-static void hash_val_free_0(void * payload, xmlChar * name);
+static struct hash_val_t *hash_val_dup(const struct hash_val_t *val);
+static void hash_val_unref(struct hash_val_t *val);
+static void hash_map_unref(struct hash_map_t *map);
+
+static struct hash_val_t *hash_lookup(ourfa_hash_t *h, const char *key);
+static int hash_add(ourfa_hash_t *h, const char *key, struct hash_val_t *val);
+static void hash_replace(ourfa_hash_t *h, const char *key, struct hash_val_t *val);
+static void hash_remove(ourfa_hash_t *h, const char *key);
+static void hash_scan(ourfa_hash_t *h, hash_scan_f *f, void *data);
+static size_t hash_size(ourfa_hash_t *h);
 
 static struct hash_val_t *findncreate_arr_by_idx(ourfa_hash_t *h,
       enum ourfa_elm_type_t type,
@@ -82,17 +150,420 @@ static struct hash_val_t *findncreate_arr_by_idx(ourfa_hash_t *h,
       const char *arr_idx,
       unsigned do_not_create,
       unsigned *last_idx_res);
+static struct hash_val_t *hash_unshare(ourfa_hash_t *h, const char *key,
+      struct hash_val_t *hval);
+static struct hash_val_t *hash_val_by_idx(struct hash_val_t *hval,
+      enum ourfa_elm_type_t type,
+      const unsigned *idx_list,
+      unsigned idx_list_cnt,
+      unsigned do_not_create,
+      unsigned *last_idx_res);
+
+
+#ifdef OURFA_HASH_XMLHASH
+
+ourfa_hash_t *ourfa_hash_new(int size)
+{
+   ourfa_hash_t *h;
+
+   h = malloc(sizeof(*h));
+   if (h == NULL)
+      return NULL;
+   h->tbl = xmlHashCreate(size > 0 ? size : 10);
+   if (h->tbl == NULL) {
+      free(h);
+      return NULL;
+   }
+   return h;
+}
+
+static void hash_val_free_0(void *payload, const xmlChar *name)
+{
+   if (name) {};
+   hash_val_unref((struct hash_val_t *)payload);
+}
+
+void ourfa_hash_free(ourfa_hash_t *h)
+{
+   if (h == NULL)
+      return;
+
+   xmlHashFree(h->tbl, hash_val_free_0);
+   free(h);
+}
+
+static struct hash_val_t *hash_lookup(ourfa_hash_t *h, const char *key)
+{
+   return xmlHashLookup(h->tbl, (const xmlChar *)key);
+}
+
+static int hash_add(ourfa_hash_t *h, const char *key, struct hash_val_t *val)
+{
+   return xmlHashAddEntry(h->tbl, (const xmlChar *)key, val) == 0 ? 0 : -1;
+}
+
+static void hash_replace(ourfa_hash_t *h, const char *key, struct hash_val_t *val)
+{
+   xmlHashUpdateEntry(h->tbl, (const xmlChar *)key, val, NULL);
+}
+
+static void hash_remove(ourfa_hash_t *h, const char *key)
+{
+   xmlHashRemoveEntry(h->tbl, (const xmlChar *)key, hash_val_free_0);
+}
+
+static size_t hash_size(ourfa_hash_t *h)
+{
+   int res;
+
+   res = xmlHashSize(h->tbl);
+   return res > 0 ? (size_t)res : 0;
+}
+
+struct hash_scan_ctx_t {
+   hash_scan_f *f;
+   void *data;
+};
+
+static void hash_scan_0(void *payload, void *data, const xmlChar *name)
+{
+   struct hash_scan_ctx_t *ctx;
+
+   ctx = (struct hash_scan_ctx_t *)data;
+   ctx->f((struct hash_val_t *)payload, (const char *)name, ctx->data);
+}
+
+static void hash_scan(ourfa_hash_t *h, hash_scan_f *f, void *data)
+{
+   struct hash_scan_ctx_t ctx;
+
+   ctx.f = f;
+   ctx.data = data;
+   xmlHashScan(h->tbl, hash_scan_0, &ctx);
+}
+
+#else /* !OURFA_HASH_XMLHASH */
+
+/* FNV-1a  */
+static inline unsigned hash_key(const char *key, unsigned *len)
+{
+   const unsigned char *p;
+   unsigned res;
+
+   res = 2166136261U;
+   for (p=(const unsigned char *)key; *p != '\0'; p++) {
+      res ^= *p;
+      res *= 16777619U;
+   }
+   *len = (unsigned)(p - (const unsigned char *)key);
+
+   return res;
+}
+
+static inline const char *entry_key(const struct hash_entry_t *e)
+{
+   return e->key_len < HASH_INLINE_KEY_SIZE ? e->key.inl : e->key.ptr;
+}
+
+static inline void entry_free_key(struct hash_entry_t *e)
+{
+   if (e->key_len >= HASH_INLINE_KEY_SIZE)
+      free(e->key.ptr);
+}
+
+/* Returns slot with the key or empty slot where the key should be placed */
+static struct hash_entry_t *hash_find_slot(const ourfa_hash_t *h,
+      const char *key, unsigned hash, unsigned len)
+{
+   size_t i, mask;
+   struct hash_entry_t *e;
+
+   mask = h->size - 1;
+   for (i = hash & mask;; i = (i+1) & mask) {
+      e = &h->entries[i];
+      if (e->val == NULL)
+	 break;
+      if ((e->hash == hash)
+	    && (e->key_len == len)
+	    && (memcmp(entry_key(e), key, len) == 0))
+	 break;
+   }
+
+   return e;
+}
+
+static int hash_resize(ourfa_hash_t *h, size_t new_size)
+{
+   struct hash_entry_t *old;
+   size_t i, j, old_size, mask;
+
+   assert(new_size > h->cnt);
+   old = h->entries;
+   old_size = h->size;
+
+   h->entries = calloc(new_size, sizeof(h->entries[0]));
+   if (h->entries == NULL) {
+      h->entries = old;
+      return -1;
+   }
+   h->size = new_size;
+   mask = new_size - 1;
+
+   for (i=0; i < old_size; i++) {
+      if (old[i].val == NULL)
+	 continue;
+      for (j = old[i].hash & mask; h->entries[j].val != NULL; j = (j+1) & mask);
+      h->entries[j] = old[i];
+   }
+   free(old);
 
+   return 0;
+}
 
 ourfa_hash_t *ourfa_hash_new(int size)
 {
-   return xmlHashCreate(size ? size : 10);
+   ourfa_hash_t *h;
+   size_t slots;
+
+   /* Size hint: keep load factor below 3/4  */
+   for (slots=HASH_MIN_SIZE; size > 0 && slots < (size_t)size + size/3 + 1; slots *= 2);
+
+   h = malloc(sizeof(*h));
+   if (h == NULL)
+      return NULL;
+   h->entries = calloc(slots, sizeof(h->entries[0]));
+   if (h->entries == NULL) {
+      free(h);
+      return NULL;
+   }
+   h->size = slots;
+   h->cnt = 0;
+
+   return h;
+}
+
+void ourfa_hash_free(ourfa_hash_t *h)
+{
+   size_t i;
+
+   if (h == NULL)
+      return;
+
+   for (i=0; i < h->size; i++) {
+      if (h->entries[i].val == NULL)
+	 continue;
+      hash_val_unref(h->entries[i].val);
+      entry_free_key(&h->entries[i]);
+   }
+   free(h->entries);
+   free(h);
+}
+
+static struct hash_val_t *hash_lookup(ourfa_hash_t *h, const char *key)
+{
+   unsigned hash, len;
+
+   hash = hash_key(key, &len);
+   return hash_find_slot(h, key, hash, len)->val;
+}
+
+static int hash_add(ourfa_hash_t *h, const char *key, struct hash_val_t *val)
+{
+   unsigned hash, len;
+   struct hash_entry_t *e;
+
+   assert(val != NULL);
+
+   if ((h->cnt + 1) * 4 > h->size * 3) {
+      if (hash_resize(h, h->size * 2) != 0)
+	 return -1;
+   }
+
+   hash = hash_key(key, &len);
+   e = hash_find_slot(h, key, hash, len);
+   if (e->val != NULL)
+      return -1;
+
+   if (len < HASH_INLINE_KEY_SIZE)
+      memcpy(e->key.inl, key, len+1);
+   else {
+      e->key.ptr = malloc(len+1);
+      if (e->key.ptr == NULL)
+	 return -1;
+      memcpy(e->key.ptr, key, len+1);
+   }
+   e->hash = hash;
+   e->key_len = len;
+   e->val = val;
+   h->cnt++;
+
+   return 0;
+}
+
+static void hash_replace(ourfa_hash_t *h, const char *key, struct hash_val_t *val)
+{
+   unsigned hash, len;
+   struct hash_entry_t *e;
+
+   hash = hash_key(key, &len);
+   e = hash_find_slot(h, key, hash, len);
+   assert(e->val != NULL);
+   e->val = val;
+}
+
+static void hash_remove(ourfa_hash_t *h, const char *key)
+{
+   unsigned hash, len;
+   size_t i, j, k, mask;
+   struct hash_entry_t *e;
+
+   hash = hash_key(key, &len);
+   e = hash_find_slot(h, key, hash, len);
+   if (e->val == NULL)
+      return;
+
+   hash_val_unref(e->val);
+   entry_free_key(e);
+   h->cnt--;
+
+   /* Backward shift deletion, no tombstones  */
+   mask = h->size - 1;
+   i = (size_t)(e - h->entries);
+   for (j = (i+1) & mask; h->entries[j].val != NULL; j = (j+1) & mask) {
+      k = h->entries[j].hash & mask;
+      if ((j > i && (k <= i || k > j))
+	    || (j < i && (k <= i && k > j))) {
+	 h->entries[i] = h->entries[j];
+	 i = j;
+      }
+   }
+   h->entries[i].val = NULL;
+}
+
+static void hash_scan(ourfa_hash_t *h, hash_scan_f *f, void *data)
+{
+   size_t i;
+
+   for (i=0; i < h->size; i++) {
+      if (h->entries[i].val != NULL)
+	 f(h->entries[i].val, entry_key(&h->entries[i]), data);
+   }
+}
+
+static size_t hash_size(ourfa_hash_t *h)
+{
+   return h->cnt;
 }
 
+#endif /* OURFA_HASH_XMLHASH */
+
 static inline struct sockaddr *hash_ip_data(const struct hash_val_t *val, int idx) {
    return (struct sockaddr *)&((struct sockaddr_storage *)val->data)[idx];
 }
 
+/* Number element as string in C locale. Returns length or -1  */
+static int hash_num2str(const struct hash_val_t *val, unsigned idx,
+      char *buf, size_t buf_size)
+{
+   switch (val->type) {
+      case OURFA_ELM_INT:
+	 return ourfa_format_int(((int *)val->data)[idx], buf, buf_size);
+      case OURFA_ELM_LONG:
+	 return ourfa_format_long(((long long *)val->data)[idx], buf, buf_size);
+      case OURFA_ELM_DOUBLE:
+	 return ourfa_format_double(((double *)val->data)[idx], buf, buf_size);
+      default:
+	 break;
+   }
+
+   return -1;
+}
+
+static inline void hash_arr_store_int(struct hash_val_t *arr, unsigned last_idx, int val)
+{
+   unsigned i;
+
+   assert(arr->type == OURFA_ELM_INT);
+   assert(arr->data_pool_size > last_idx);
+
+   ((int *)arr->data)[last_idx] = val;
+
+   if (last_idx >=  arr->elm_cnt) {
+      for (i=arr->elm_cnt; i < last_idx; i++)
+	 ((int *)arr->data)[i] = 0;
+      arr->elm_cnt = last_idx+1;
+   }
+}
+
+static inline void hash_arr_store_long(struct hash_val_t *arr, unsigned last_idx, long long val)
+{
+   unsigned i;
+
+   assert(arr->type == OURFA_ELM_LONG);
+   assert(arr->data_pool_size > last_idx);
+
+   ((long long *)arr->data)[last_idx] = val;
+
+   if (last_idx >=  arr->elm_cnt) {
+      for (i=arr->elm_cnt; i < last_idx; i++)
+	 ((long long *)arr->data)[i] = 0;
+      arr->elm_cnt = last_idx+1;
+   }
+}
+
+static inline void hash_arr_store_double(struct hash_val_t *arr, unsigned last_idx, double val)
+{
+   unsigned i;
+
+   assert(arr->type == OURFA_ELM_DOUBLE);
+   assert(arr->data_pool_size > last_idx);
+
+   ((double *)arr->data)[last_idx] = val;
+
+   if (last_idx >=  arr->elm_cnt) {
+      for (i=arr->elm_cnt; i < last_idx; i++)
+	 ((double *)arr->data)[i] = 0;
+      arr->elm_cnt = last_idx+1;
+   }
+}
+
+/* val is owned by the array after the call  */
+static inline void hash_arr_store_string(struct hash_val_t *arr, unsigned last_idx, char *val)
+{
+   unsigned i;
+
+   assert(arr->type == OURFA_ELM_STRING);
+   assert(arr->data_pool_size > last_idx);
+
+   if (last_idx >= arr->elm_cnt) {
+      for (i=arr->elm_cnt; i <= last_idx; i++)
+	 ((char **)arr->data)[i] = NULL;
+      arr->elm_cnt = last_idx+1;
+   }
+
+   free(((char **)arr->data)[last_idx]);
+   ((char **)arr->data)[last_idx] = val;
+}
+
+static inline int hash_arr_store_ip(struct hash_val_t *arr, unsigned last_idx, const struct sockaddr *val)
+{
+   unsigned i;
+
+   assert(arr->type == OURFA_ELM_IP);
+   assert(arr->data_pool_size > last_idx);
+
+   if (ourfa_ip_copy(hash_ip_data(arr, last_idx), val) != 0)
+      return -1;
+
+   if (last_idx >= arr->elm_cnt) {
+      for (i=arr->elm_cnt; i < last_idx; i++)
+	 ourfa_ip_reset(hash_ip_data(arr, i));
+      arr->elm_cnt = last_idx+1;
+   }
+
+   return 0;
+}
+
 static struct hash_val_t *hash_val_new(enum ourfa_elm_type_t type, size_t size)
 {
    struct hash_val_t *res;
@@ -101,6 +572,8 @@ static struct hash_val_t *hash_val_new(enum ourfa_elm_type_t type, size_t size)
    if (res == NULL)
       return NULL;
    res->type = type;
+   res->ref_cnt = 1;
+   res->map = NULL;
    res->elm_cnt = 0;
    res->data_pool_size = 0;
    res->data = NULL;
@@ -120,8 +593,6 @@ static struct hash_val_t *findncreate_arr_by_idx(ourfa_hash_t *h,
       unsigned *last_idx_res
       )
 {
-   int i;
-   unsigned last_idx;
    struct hash_val_t *hval;
    unsigned idx_list[20];
    int idx_list_cnt;
@@ -141,7 +612,7 @@ static struct hash_val_t *findncreate_arr_by_idx(ourfa_hash_t *h,
    if (idx_list_cnt <= 0)
       return NULL;
 
-   hval = xmlHashLookup(h, (const xmlChar *)key);
+   hval = hash_lookup(h, key);
    if (hval == NULL) {
       if (do_not_create)
 	 return NULL;
@@ -154,7 +625,7 @@ static struct hash_val_t *findncreate_arr_by_idx(ourfa_hash_t *h,
 	 if (hval == NULL)
 	    return NULL;
 
-	 if (xmlHashAddEntry(h, (const xmlChar *)key, hval) != 0) {
+	 if (hash_add(h, key, hval) != 0) {
 	    hash_val_free(hval);
 	    return NULL;
 	 }
@@ -163,6 +634,42 @@ static struct hash_val_t *findncreate_arr_by_idx(ourfa_hash_t *h,
 
    assert(hval != NULL);
 
+   /* Variable shared with other hash or mapped from file.
+    * Copy it before write */
+   if (!do_not_create && ((ourfa_atomic_get(&hval->ref_cnt) > 1) || (hval->map != NULL))) {
+      hval = hash_unshare(h, key, hval);
+      if (hval == NULL)
+	 return NULL;
+   }
+
+   return hash_val_by_idx(hval, type, idx_list, (unsigned)idx_list_cnt,
+	 do_not_create, last_idx_res);
+}
+
+static struct hash_val_t *hash_unshare(ourfa_hash_t *h, const char *key,
+      struct hash_val_t *hval)
+{
+   struct hash_val_t *copy;
+
+   copy = hash_val_dup(hval);
+   if (copy == NULL)
+      return NULL;
+   hash_replace(h, key, copy);
+   hash_val_unref(hval);
+
+   return copy;
+}
+
+static struct hash_val_t *hash_val_by_idx(struct hash_val_t *hval,
+      enum ourfa_elm_type_t type,
+      const unsigned *idx_list,
+      unsigned idx_list_cnt,
+      unsigned do_not_create,
+      unsigned *last_idx_res)
+{
+   unsigned i;
+   unsigned last_idx;
+
    /*  create interrim arrays */
    for (i=0; i<idx_list_cnt-1; i++) {
       unsigned cur_idx;
@@ -229,7 +736,6 @@ int ourfa_hash_set_int(ourfa_hash_t *h, const char *key, const char *idx, int va
 {
    int res;
    unsigned last_idx;
-   unsigned i;
    struct hash_val_t *arr;
 
    if (h == NULL || key == NULL)
@@ -247,15 +753,7 @@ int ourfa_hash_set_int(ourfa_hash_t *h, const char *key, const char *idx, int va
    res = 0;
    switch (arr->type) {
       case OURFA_ELM_INT:
-	 assert(arr->data_pool_size > last_idx);
-
-	 ((int *)arr->data)[last_idx] = val;
-
-	 if (last_idx >=  arr->elm_cnt) {
-	    for (i=arr->elm_cnt; i < last_idx; i++)
-	       ((int *)arr->data)[i] = 0;
-	    arr->elm_cnt = last_idx+1;
-	 }
+	 hash_arr_store_int(arr, last_idx, val);
 	 break;
       case OURFA_ELM_LONG:
 	 res = ourfa_hash_set_long(h, key, idx, val);
@@ -265,8 +763,8 @@ int ourfa_hash_set_int(ourfa_hash_t *h, const char *key, const char *idx, int va
 	 break;
       case OURFA_ELM_STRING:
 	 {
-	    char str[80];
-	    snprintf(str, sizeof(str), "%i", val);
+	    char str[OURFA_NUM_STRLEN];
+	    ourfa_format_int(val, str, sizeof(str));
 	    res = ourfa_hash_set_string(h, key, idx, str);
 	 }
 	 break;
@@ -285,7 +783,6 @@ int ourfa_hash_set_long(ourfa_hash_t *h, const char *key, const char *idx, long
 {
    int res;
    unsigned last_idx;
-   unsigned i;
    struct hash_val_t *arr;
 
    if (h == NULL || key == NULL)
@@ -304,23 +801,15 @@ int ourfa_hash_set_long(ourfa_hash_t *h, const char *key, const char *idx, long
    res = 0;
    switch (arr->type) {
       case OURFA_ELM_LONG:
-	 assert(arr->data_pool_size > last_idx);
-
-	 ((long long *)arr->data)[last_idx] = val;
-
-	 if (last_idx >=  arr->elm_cnt) {
-	    for (i=arr->elm_cnt; i < last_idx; i++)
-	       ((long long *)arr->data)[i] = 0;
-	    arr->elm_cnt = last_idx+1;
-	 }
+	 hash_arr_store_long(arr, last_idx, val);
 	 break;
       case OURFA_ELM_DOUBLE:
 	 res = ourfa_hash_set_double(h, key, idx, val);
 	 break;
       case OURFA_ELM_STRING:
 	 {
-	    char str[80];
-	    snprintf(str, sizeof(str), "%lli", val);
+	    char str[OURFA_NUM_STRLEN];
+	    ourfa_format_long(val, str, sizeof(str));
 	    res = ourfa_hash_set_string(h, key, idx, str);
 	 }
 	 break;
@@ -340,7 +829,6 @@ int ourfa_hash_set_double(ourfa_hash_t *h, const char *key, const char *idx, dou
 {
    int res;
    unsigned last_idx;
-   unsigned i;
    struct hash_val_t *arr;
 
    if (h == NULL || key == NULL)
@@ -360,20 +848,13 @@ int ourfa_hash_set_double(ourfa_hash_t *h, const char *key, const char *idx, dou
    res = 0;
    switch (arr->type) {
       case OURFA_ELM_DOUBLE:
-	 assert(arr->data_pool_size > last_idx);
-
-	 ((double *)arr->data)[last_idx] = val;
-
-	 if (last_idx >=  arr->elm_cnt) {
-	    for (i=arr->elm_cnt; i < last_idx; i++)
-	       ((double *)arr->data)[i] = 0;
-	    arr->elm_cnt = last_idx+1;
-	 }
+	 hash_arr_store_double(arr, last_idx, val);
 	 break;
       case OURFA_ELM_STRING:
 	 {
-	    char str[80];
-	    snprintf(str, sizeof(str), "%f", val);
+	    char str[OURFA_NUM_STRLEN];
+	    if (ourfa_format_double(val, str, sizeof(str)) < 0)
+	       return -1;
 	    res = ourfa_hash_set_string(h, key, idx, str);
 	 }
 	 break;
@@ -393,7 +874,6 @@ int ourfa_hash_set_double(ourfa_hash_t *h, const char *key, const char *idx, dou
 int ourfa_hash_set_string(ourfa_hash_t *h, const char *key, const char *idx, const char *val)
 {
    unsigned last_idx;
-   unsigned i;
    struct hash_val_t *arr;
    char *val0;
 
@@ -417,16 +897,7 @@ int ourfa_hash_set_string(ourfa_hash_t *h, const char *key, const char *idx, con
       return -1;
    }
 
-   assert(arr->data_pool_size > last_idx);
-
-   if (last_idx >= arr->elm_cnt) {
-      for (i=arr->elm_cnt; i <= last_idx; i++)
-	 ((char **)arr->data)[i] = NULL;
-      arr->elm_cnt = last_idx+1;
-   }
-
-   free(((char **)arr->data)[last_idx]);
-   ((char **)arr->data)[last_idx] = val0;
+   hash_arr_store_string(arr, last_idx, val0);
 
    return 0;
 }
@@ -434,7 +905,6 @@ int ourfa_hash_set_string(ourfa_hash_t *h, const char *key, const char *idx, con
 int ourfa_hash_set_ip(ourfa_hash_t *h, const char *key, const char *idx, const struct sockaddr *val)
 {
    unsigned last_idx;
-   unsigned i;
    struct hash_val_t *arr;
 
    if (h == NULL || key == NULL)
@@ -453,16 +923,8 @@ int ourfa_hash_set_ip(ourfa_hash_t *h, const char *key, const char *idx, const s
 
    switch (arr->type) {
       case OURFA_ELM_IP:
-         assert(arr->data_pool_size > last_idx);
-
-         if (ourfa_ip_copy(hash_ip_data(arr, last_idx), val) != 0)
-            return -1;
-
-         if (last_idx >= arr->elm_cnt) {
-            for (i=arr->elm_cnt; i < last_idx; i++)
-               ourfa_ip_reset(hash_ip_data(arr, i));
-            arr->elm_cnt = last_idx+1;
-         }
+	 if (hash_arr_store_ip(arr, last_idx, val) != 0)
+	    return -1;
 	 break;
       case OURFA_ELM_STRING:
 	 {
@@ -486,12 +948,133 @@ int ourfa_hash_set_ip(ourfa_hash_t *h, const char *key, const char *idx, const s
    return 0;
 }
 
+/*
+ * Direct element access for precompiled response decoders.
+ * ourfa_hash_col() returns variable owned by this hash only, so the
+ * pointer stays valid until the variable is unset. Setters return
+ * non-zero if element can not be stored without type conversion, in
+ * that case caller should use ourfa_hash_set_*() by name.
+ */
+struct hash_val_t *ourfa_hash_col(ourfa_hash_t *h, const char *key)
+{
+   struct hash_val_t *hval;
+
+   if (h == NULL || key == NULL)
+      return NULL;
+
+   hval = hash_lookup(h, key);
+   if ((hval != NULL) && ((ourfa_atomic_get(&hval->ref_cnt) > 1) || (hval->map != NULL)))
+      hval = hash_unshare(h, key, hval);
+
+   return hval;
+}
+
+static inline struct hash_val_t *hash_col_arr(struct hash_val_t *col,
+      enum ourfa_elm_type_t type, const unsigned *idx, unsigned idx_cnt,
+      unsigned *last_idx)
+{
+   struct hash_val_t *arr;
+
+   assert(ourfa_atomic_get(&col->ref_cnt) == 1 && col->map == NULL);
+   if (idx_cnt == 0)
+      return NULL;
+   arr = hash_val_by_idx(col, type, idx, idx_cnt, 0, last_idx);
+   if ((arr == NULL) || (arr->type != type))
+      return NULL;
+
+   return arr;
+}
+
+int ourfa_hash_col_set_int(struct hash_val_t *col, const unsigned *idx,
+      unsigned idx_cnt, int val)
+{
+   unsigned last_idx;
+   struct hash_val_t *arr;
+
+   arr = hash_col_arr(col, OURFA_ELM_INT, idx, idx_cnt, &last_idx);
+   if (arr == NULL)
+      return -1;
+   hash_arr_store_int(arr, last_idx, val);
+
+   return 0;
+}
+
+int ourfa_hash_col_set_long(struct hash_val_t *col, const unsigned *idx,
+      unsigned idx_cnt, long long val)
+{
+   unsigned last_idx;
+   struct hash_val_t *arr;
+
+   arr = hash_col_arr(col, OURFA_ELM_LONG, idx, idx_cnt, &last_idx);
+   if (arr == NULL)
+      return -1;
+   hash_arr_store_long(arr, last_idx, val);
+
+   return 0;
+}
+
+int ourfa_hash_col_set_double(struct hash_val_t *col, const unsigned *idx,
+      unsigned idx_cnt, double val)
+{
+   unsigned last_idx;
+   struct hash_val_t *arr;
+
+   arr = hash_col_arr(col, OURFA_ELM_DOUBLE, idx, idx_cnt, &last_idx);
+   if (arr == NULL)
+      return -1;
+   hash_arr_store_double(arr, last_idx, val);
+
+   return 0;
+}
+
+/* On success val is owned by the hash  */
+int ourfa_hash_col_set_string(struct hash_val_t *col, const unsigned *idx,
+      unsigned idx_cnt, char *val)
+{
+   unsigned last_idx;
+   struct hash_val_t *arr;
+
+   arr = hash_col_arr(col, OURFA_ELM_STRING, idx, idx_cnt, &last_idx);
+   if (arr == NULL)
+      return -1;
+   hash_arr_store_string(arr, last_idx, val);
+
+   return 0;
+}
+
+int ourfa_hash_col_set_ip(struct hash_val_t *col, const unsigned *idx,
+      unsigned idx_cnt, const struct sockaddr *val)
+{
+   unsigned last_idx;
+   struct hash_val_t *arr;
+
+   arr = hash_col_arr(col, OURFA_ELM_IP, idx, idx_cnt, &last_idx);
+   if (arr == NULL)
+      return -1;
+
+   return hash_arr_store_ip(arr, last_idx, val);
+}
+
+/* Non-zero if element exists. Same check as ourfa_hash_get_string(..., NULL)  */
+int ourfa_hash_col_isset(struct hash_val_t *col, const unsigned *idx,
+      unsigned idx_cnt)
+{
+   unsigned last_idx;
+   struct hash_val_t *arr;
+
+   if ((col == NULL) || (idx_cnt == 0))
+      return 0;
+   arr = hash_val_by_idx(col, 0, idx, idx_cnt, 1, &last_idx);
+
+   return (arr != NULL) && (last_idx < arr->elm_cnt);
+}
+
 void ourfa_hash_unset(ourfa_hash_t *h, const char *key)
 {
    if (h == NULL || key == NULL)
       return;
 
-   xmlHashRemoveEntry(h, (const xmlChar *)key, hash_val_free_0);
+   hash_remove(h, key);
 }
 
 int ourfa_hash_get_int(ourfa_hash_t *h, const char *key, const char *idx, int *res)
@@ -544,20 +1127,17 @@ int ourfa_hash_get_long(ourfa_hash_t *h, const char *key, const char *idx, long
 	 break;
       case OURFA_ELM_STRING:
 	 {
-	    char *s, *p_end;
+	    char *s;
 	    double tmp;
 
 	    s = ((char **)arr->data)[last_idx];
-	    if ((s == NULL) || (s[0]=='\0'))
-	       retval=-1;
-	    else {
-	       errno=0;
-	       tmp = strtod(s, &p_end);
-	       if ((*p_end != '\0') || errno == ERANGE)
-		  retval = -1;
-	       else
-		  *res = (long long)tmp;
-	    }
+	    /* Integers are parsed exactly, not rounded to double  */
+	    if (ourfa_parse_long(s, res) == 0)
+	       break;
+	    if (ourfa_parse_double(s, &tmp) != 0)
+	       retval = -1;
+	    else
+	       *res = (long long)tmp;
 	 }
 	 break;
       case OURFA_ELM_ARRAY:
@@ -601,20 +1181,8 @@ int ourfa_hash_get_double(ourfa_hash_t *h, const char *key, const char *idx, dou
 	    *res = ((double *)arr->data)[last_idx];
 	 break;
       case OURFA_ELM_STRING:
-	 {
-	    char *s, *end_p;
-	    double tmp;
-
-	    s = ((char **)arr->data)[last_idx];
-	    if ((s == NULL) || (s[0]=='\0'))
-	       return -1;
-	    errno=0;
-	    tmp = ourfa_strtod_c(s, &end_p);
-	    if ((*end_p != '\0') || (errno==ERANGE))
-	       return -1;
-	    if (res)
-	       *res = tmp;
-	 }
+	 if (ourfa_parse_double(((char **)arr->data)[last_idx], res) != 0)
+	    return -1;
 	 break;
       default:
 	 return -1;
@@ -633,6 +1201,37 @@ int ourfa_hash_copy_val(ourfa_hash_t *h, const char *dst_key, const char *dst_id
    if (h == NULL || src_key == NULL || dst_key == NULL)
       return -1;
 
+   /*
+    * No indexes: dst(0) = src(0). If the result is the same as a copy of
+    * the whole one-element variable, share it, copy on write. INT is
+    * stored as LONG below, so it is copied
+    */
+   if ((src_idx == NULL || src_idx[0] == '\0')
+	 && (dst_idx == NULL || dst_idx[0] == '\0')) {
+      struct hash_val_t *dst_arr;
+
+      src_arr = hash_lookup(h, src_key);
+      if (src_arr == NULL)
+	 return -1;
+      dst_arr = hash_lookup(h, dst_key);
+      if ((src_arr->elm_cnt == 1)
+	    && (src_arr->type != OURFA_ELM_ARRAY)
+	    && (src_arr->type != OURFA_ELM_HASH)
+	    && (src_arr->type != OURFA_ELM_INT)
+	    && ((dst_arr == NULL)
+	       || ((dst_arr->type == src_arr->type) && (dst_arr->elm_cnt <= 1)))) {
+	 if (dst_arr == src_arr)
+	    return 0;
+	 ourfa_atomic_inc(&src_arr->ref_cnt);
+	 hash_remove(h, dst_key);
+	 if (hash_add(h, dst_key, src_arr) != 0) {
+	    hash_val_unref(src_arr);
+	    return -1;
+	 }
+	 return 0;
+      }
+   }
+
    src_arr = findncreate_arr_by_idx(h, 0, src_key, src_idx, 1, &last_idx);
 
    if (src_arr == NULL)
@@ -667,6 +1266,114 @@ int ourfa_hash_copy_val(ourfa_hash_t *h, const char *dst_key, const char *dst_id
    return res;
 }
 
+/*
+ * Copy up to cnt elements of src key starting from src_first to the same
+ * key of dst starting from dst_first. Nested arrays are copied
+ * recursively. Copies nothing if src has no such elements.
+ */
+int ourfa_hash_copy_rows(ourfa_hash_t *dst, const char *key, unsigned dst_first,
+      ourfa_hash_t *src, unsigned src_first, unsigned cnt)
+{
+   struct hash_val_t *s, *d;
+   size_t esize;
+   unsigned i, di;
+
+   if (dst == NULL || src == NULL || key == NULL)
+      return -1;
+
+   s = hash_lookup(src, key);
+   if ((s == NULL) || (src_first >= s->elm_cnt) || (cnt == 0))
+      return 0;
+   if (s->type == OURFA_ELM_HASH)
+      return -1;
+   if (cnt > s->elm_cnt - src_first)
+      cnt = s->elm_cnt - src_first;
+
+   d = hash_lookup(dst, key);
+   if (d == NULL) {
+      d = hash_val_new(s->type, dst_first+cnt);
+      if (d == NULL)
+	 return -1;
+      if (hash_add(dst, key, d) != 0) {
+	 hash_val_free(d);
+	 return -1;
+      }
+   }else if ((ourfa_atomic_get(&d->ref_cnt) > 1) || (d->map != NULL)) {
+      d = hash_unshare(dst, key, d);
+      if (d == NULL)
+	 return -1;
+   }
+
+   if (d->type != s->type) {
+      if (d->elm_cnt > dst_first)
+	 return -1;
+      hash_val_clear(d);
+      d->type = s->type;
+   }
+
+   if (d->data_pool_size < dst_first+cnt) {
+      if (increase_pool_size(d, dst_first+cnt-d->data_pool_size))
+	 return -1;
+   }
+
+   /* Undefined elements before the first copied one  */
+   esize = elm_size_by_type(d->type);
+   if (d->elm_cnt < dst_first) {
+      if (d->type == OURFA_ELM_IP) {
+	 for (i=d->elm_cnt; i < dst_first; i++)
+	    ourfa_ip_reset(hash_ip_data(d, i));
+      }else
+	 memset((char *)d->data + d->elm_cnt * esize, 0,
+	       (dst_first - d->elm_cnt) * esize);
+      d->elm_cnt = dst_first;
+   }
+
+   for (i=0; i < cnt; i++) {
+      di = dst_first + i;
+      switch (d->type) {
+	 case OURFA_ELM_ARRAY:
+	    {
+	       struct hash_val_t *sv, *dv;
+	       sv = ((struct hash_val_t **)s->data)[src_first+i];
+	       dv = NULL;
+	       if (sv != NULL) {
+		  dv = hash_val_dup(sv);
+		  if (dv == NULL)
+		     return -1;
+	       }
+	       if (di < d->elm_cnt)
+		  hash_val_free(((struct hash_val_t **)d->data)[di]);
+	       ((struct hash_val_t **)d->data)[di] = dv;
+	    }
+	    break;
+	 case OURFA_ELM_STRING:
+	    {
+	       const char *sv;
+	       char *dv;
+	       sv = ((char **)s->data)[src_first+i];
+	       dv = NULL;
+	       if (sv != NULL) {
+		  dv = strdup(sv);
+		  if (dv == NULL)
+		     return -1;
+	       }
+	       if (di < d->elm_cnt)
+		  free(((char **)d->data)[di]);
+	       ((char **)d->data)[di] = dv;
+	    }
+	    break;
+	 default:
+	    memcpy((char *)d->data + di * esize,
+		  (const char *)s->data + (src_first+i) * esize, esize);
+	    break;
+      }
+      if (di >= d->elm_cnt)
+	 d->elm_cnt = di+1;
+   }
+
+   return 0;
+}
+
 int ourfa_hash_get_ip(ourfa_hash_t *h, const char *key, const char *idx, struct sockaddr *res)
 {
    unsigned last_idx;
@@ -775,19 +1482,16 @@ int ourfa_hash_get_string(ourfa_hash_t *h,
 
    switch (arr->type) {
       case OURFA_ELM_INT:
-	 ourfa_asprintf(res, "%i", ((int *)arr->data)[last_idx]);
-	 if (*res != NULL)
-	    retval = 0;
-	 break;
       case OURFA_ELM_LONG:
-	 ourfa_asprintf(res, "%lli", ((long long *)arr->data)[last_idx]);
-	 if (*res != NULL)
-	    retval = 0;
-	 break;
       case OURFA_ELM_DOUBLE:
-	 ourfa_asprintf(res, "%f", ((double *)arr->data)[last_idx]);
-	 if (*res != NULL)
-	    retval = 0;
+	 {
+	    char str[OURFA_NUM_STRLEN];
+	    if (hash_num2str(arr, last_idx, str, sizeof(str)) >= 0) {
+	       *res = strdup(str);
+	       if (*res != NULL)
+		  retval = 0;
+	    }
+	 }
 	 break;
       case OURFA_ELM_STRING:
 	 {
@@ -821,13 +1525,61 @@ int ourfa_hash_get_string(ourfa_hash_t *h,
    return retval;
 }
 
-static void hash_dump_0(void *payload, void *data, xmlChar *name)
+/*
+ * Value as string without allocation. Numbers and addresses are printed
+ * to buf, strings are returned as is and are valid until the hash is
+ * changed. Returns NULL if value not found or buf is too small
+ */
+const char *ourfa_hash_peek_string(ourfa_hash_t *h,
+      const char *key,
+      const char *idx,
+      char *buf,
+      size_t buf_size)
 {
    struct hash_val_t *arr;
+   unsigned last_idx;
+   int len;
+
+   if (h == NULL || key == NULL || buf == NULL)
+      return NULL;
+
+   arr = findncreate_arr_by_idx(h, 0, key, idx, 1, &last_idx);
+   if (arr == NULL)
+      return NULL;
+
+   assert(arr->data_pool_size > last_idx);
+   if (last_idx >= arr->elm_cnt)
+      return NULL;
+
+   switch (arr->type) {
+      case OURFA_ELM_INT:
+      case OURFA_ELM_LONG:
+      case OURFA_ELM_DOUBLE:
+	 len = hash_num2str(arr, last_idx, buf, buf_size);
+	 break;
+      case OURFA_ELM_STRING:
+	 return ((char **)arr->data)[last_idx];
+      case OURFA_ELM_IP:
+	 if (ourfa_ip_ntop(hash_ip_data(arr, last_idx), buf, buf_size) != 0)
+	    return NULL;
+	 return buf;
+      case OURFA_ELM_ARRAY:
+      case OURFA_ELM_HASH:
+      default:
+	 return NULL;
+   }
+
+   if ((len < 0) || ((size_t)len >= buf_size))
+      return NULL;
+
+   return buf;
+}
+
+static void hash_dump_0(struct hash_val_t *arr, const char *name, void *data)
+{
    FILE *stream;
    unsigned idx;
 
-   arr = (struct hash_val_t *)payload;
    stream = (FILE *)data;
 
 
@@ -852,8 +1604,11 @@ static void hash_dump_0(void *payload, void *data, xmlChar *name)
 		  ((long long *)arr->data)[idx]);
 	    break;
 	 case OURFA_ELM_DOUBLE:
-	    fprintf(stream, "%-7s %-18s %.4f\n", "DOUBLE", name0,
-		  ((double *)arr->data)[idx]);
+	    {
+	       char num_s[OURFA_NUM_STRLEN];
+	       hash_num2str(arr, idx, num_s, sizeof(num_s));
+	       fprintf(stream, "%-7s %-18s %s\n", "DOUBLE", name0, num_s);
+	    }
 	    break;
 	 case OURFA_ELM_IP:
 	    {
@@ -878,7 +1633,7 @@ static void hash_dump_0(void *payload, void *data, xmlChar *name)
 	       if (tmp != NULL) {
 		  char tmp_name[40];
 		  snprintf(tmp_name, sizeof(tmp_name), "%s_%u", name, idx);
-		  hash_dump_0(tmp, stream, (xmlChar *)tmp_name);
+		  hash_dump_0(tmp, tmp_name, stream);
 	       }
 	    }
 	    break;
@@ -902,67 +1657,924 @@ void ourfa_hash_dump(ourfa_hash_t *h, FILE *stream, const char *annotation_fmt,
    vfprintf(stream, annotation_fmt, ap);
    va_end(ap);
 
-   xmlHashScan(h, hash_dump_0, stream);
+   hash_scan(h, hash_dump_0, stream);
    fprintf(stream,"\n");
 
    return;
 }
 
 
-static void hash_val_free_0(void * payload, xmlChar *name)
+/*
+ * Binary snapshots.
+ *
+ * File layout (native byte order, all records aligned to 8 bytes):
+ *   struct hash_file_hdr_t
+ *   keys_cnt times:
+ *     struct hash_file_key_t, key bytes, '\0', padding
+ *     value record:
+ *       struct hash_file_val_t, data_len bytes of payload:
+ *	   INT, LONG, DOUBLE: array of elements
+ *	   IP: array of struct sockaddr_storage
+ *	   STRING: elm_cnt times: uint32_t length (HASH_FILE_NULL_STR for
+ *	      undefined element), bytes, '\0', padding to 4 bytes
+ *	   ARRAY: elm_cnt value records
+ *
+ * Numbers and addresses of mapped snapshot are read in place.
+ */
+
+#define HASH_FILE_MAGIC "OURFAHSH"
+#define HASH_FILE_VERSION 1
+#define HASH_FILE_BYTE_ORDER 0x01020304
+#define HASH_FILE_NULL_STR 0xffffffff
+#define HASH_FILE_MAX_DEPTH 32
+
+#define HASH_FILE_ALIGN(x, a) (((x) + ((a)-1)) & ~((size_t)(a)-1))
+
+enum hash_file_type_t {
+   HASH_FILE_T_NULL=0,
+   HASH_FILE_T_ARRAY=1,
+   HASH_FILE_T_INT=2,
+   HASH_FILE_T_LONG=3,
+   HASH_FILE_T_DOUBLE=4,
+   HASH_FILE_T_STRING=5,
+   HASH_FILE_T_IP=6
+};
+
+struct hash_file_hdr_t {
+   char magic[8];
+   uint32_t version;
+   uint32_t byte_order;
+   uint32_t sockaddr_size;
+   uint16_t af_inet;
+   uint16_t af_inet6;
+   uint64_t keys_cnt;
+};
+
+struct hash_file_key_t {
+   uint32_t key_len;
+   uint32_t reserved;
+};
+
+struct hash_file_val_t {
+   uint32_t type;
+   uint32_t reserved;
+   uint64_t elm_cnt;
+   uint64_t data_len;
+};
+
+struct hash_writer_t {
+   int fd;
+   int err;
+   size_t len;
+   char buf[8192];
+};
+
+static void writer_flush(struct hash_writer_t *w)
 {
-   struct hash_val_t *val;
+   size_t written;
+
+   written = 0;
+   while (!w->err && (written < w->len)) {
+      int res;
+      res = write(w->fd, w->buf + written, (unsigned)(w->len - written));
+      if (res < 0) {
+	 if (errno == EINTR)
+	    continue;
+	 w->err = 1;
+      }else
+	 written += (size_t)res;
+   }
+   w->len = 0;
+}
 
-   if (name) {};
+static void writer_put(struct hash_writer_t *w, const void *data, size_t size)
+{
+   const char *p;
 
-   val = (struct hash_val_t *)payload;
-   hash_val_free(val);
+   p = (const char *)data;
+   while (size > 0 && !w->err) {
+      size_t n;
+      if (w->len == sizeof(w->buf))
+	 writer_flush(w);
+      n = sizeof(w->buf) - w->len;
+      if (n > size)
+	 n = size;
+      memcpy(w->buf + w->len, p, n);
+      w->len += n;
+      p += n;
+      size -= n;
+   }
 }
 
-void ourfa_hash_free(ourfa_hash_t *h)
+static void writer_pad(struct hash_writer_t *w, size_t size)
 {
-   if (h == NULL)
-      return;
+   static const char zero[8] = {0, 0, 0, 0, 0, 0, 0, 0};
 
-   xmlHashFree(h, hash_val_free_0);
+   assert(size <= sizeof(zero));
+   writer_put(w, zero, size);
 }
 
-static void hash_val_clear(struct hash_val_t *val)
+/* Payload size of the value record  */
+static size_t hash_file_data_len(const struct hash_val_t *val)
 {
-   unsigned i;
-   if (val == NULL)
-      return;
+   size_t i, res;
 
-   switch (val->type)
-   {
-      case OURFA_ELM_ARRAY:
-	 for (i=0; i<val->elm_cnt; i++) {
-	    struct hash_val_t *val0;
-	    val0 = ((struct hash_val_t **)val->data)[i];
-	    /*  XXX: check for unlimited recursion */
-	    hash_val_clear(val0);
-	    free(val0);
-	 }
+   res = 0;
+   switch (val->type) {
+      case OURFA_ELM_INT:
+      case OURFA_ELM_LONG:
+      case OURFA_ELM_DOUBLE:
+      case OURFA_ELM_IP:
+	 res = HASH_FILE_ALIGN(val->elm_cnt * elm_size_by_type(val->type), 8);
 	 break;
-      case OURFA_ELM_HASH:
-	 for (i=0; i<val->elm_cnt; i++) {
-	    ourfa_hash_t *val0;
-	    val0 = ((ourfa_hash_t **)val->data)[i];
-	    /*  XXX: check for unlimited recursion */
-	    ourfa_hash_free(val0);
+      case OURFA_ELM_STRING:
+	 for (i=0; i < val->elm_cnt; i++) {
+	    const char *str;
+	    str = ((char **)val->data)[i];
+	    res += HASH_FILE_ALIGN(sizeof(uint32_t)
+		  + (str ? strlen(str) + 1 : 0), 4);
 	 }
+	 res = HASH_FILE_ALIGN(res, 8);
 	 break;
-      case OURFA_ELM_STRING:
-	 for (i=0; i<val->elm_cnt; i++) {
-	    char *val0;
-	    val0 = ((char **)val->data)[i];
-	    free(val0);
+      case OURFA_ELM_ARRAY:
+	 for (i=0; i < val->elm_cnt; i++) {
+	    const struct hash_val_t *child;
+	    child = ((struct hash_val_t **)val->data)[i];
+	    res += sizeof(struct hash_file_val_t);
+	    if (child != NULL)
+	       res += hash_file_data_len(child);
 	 }
 	 break;
       default:
+	 assert(0);
+	 break;
+   }
+
+   return res;
+}
+
+static void hash_file_write_val(struct hash_writer_t *w,
+      const struct hash_val_t *val)
+{
+   struct hash_file_val_t rec;
+   size_t i, size;
+
+   memset(&rec, 0, sizeof(rec));
+   if (val == NULL) {
+      rec.type = HASH_FILE_T_NULL;
+      writer_put(w, &rec, sizeof(rec));
+      return;
+   }
+
+   switch (val->type) {
+      case OURFA_ELM_ARRAY:  rec.type = HASH_FILE_T_ARRAY; break;
+      case OURFA_ELM_INT:    rec.type = HASH_FILE_T_INT; break;
+      case OURFA_ELM_LONG:   rec.type = HASH_FILE_T_LONG; break;
+      case OURFA_ELM_DOUBLE: rec.type = HASH_FILE_T_DOUBLE; break;
+      case OURFA_ELM_STRING: rec.type = HASH_FILE_T_STRING; break;
+      case OURFA_ELM_IP:     rec.type = HASH_FILE_T_IP; break;
+      case OURFA_ELM_HASH:
+      default:
+	 w->err = 1;
+	 return;
+   }
+   rec.elm_cnt = val->elm_cnt;
+   rec.data_len = hash_file_data_len(val);
+   writer_put(w, &rec, sizeof(rec));
+
+   switch (val->type) {
+      case OURFA_ELM_INT:
+      case OURFA_ELM_LONG:
+      case OURFA_ELM_DOUBLE:
+      case OURFA_ELM_IP:
+	 size = val->elm_cnt * elm_size_by_type(val->type);
+	 writer_put(w, val->data, size);
+	 writer_pad(w, HASH_FILE_ALIGN(size, 8) - size);
+	 break;
+      case OURFA_ELM_STRING:
+	 size = 0;
+	 for (i=0; i < val->elm_cnt; i++) {
+	    const char *str;
+	    uint32_t len;
+	    size_t rec_len;
+
+	    str = ((char **)val->data)[i];
+	    if (str == NULL) {
+	       len = HASH_FILE_NULL_STR;
+	       rec_len = sizeof(len);
+	       writer_put(w, &len, sizeof(len));
+	    }else {
+	       len = (uint32_t)strlen(str);
+	       rec_len = sizeof(len) + len + 1;
+	       writer_put(w, &len, sizeof(len));
+	       writer_put(w, str, len + 1);
+	       writer_pad(w, HASH_FILE_ALIGN(rec_len, 4) - rec_len);
+	    }
+	    size += HASH_FILE_ALIGN(rec_len, 4);
+	 }
+	 writer_pad(w, HASH_FILE_ALIGN(size, 8) - size);
+	 break;
+      case OURFA_ELM_ARRAY:
+	 for (i=0; i < val->elm_cnt; i++)
+	    hash_file_write_val(w, ((struct hash_val_t **)val->data)[i]);
+	 break;
+      default:
+	 assert(0);
+	 break;
+   }
+}
+
+static void hash_save_0(struct hash_val_t *val, const char *key, void *data)
+{
+   struct hash_writer_t *w;
+   struct hash_file_key_t rec;
+   size_t size;
+
+   w = (struct hash_writer_t *)data;
+
+   memset(&rec, 0, sizeof(rec));
+   rec.key_len = (uint32_t)strlen(key);
+   writer_put(w, &rec, sizeof(rec));
+   size = rec.key_len + 1;
+   writer_put(w, key, size);
+   writer_pad(w, HASH_FILE_ALIGN(size, 8) - size);
+
+   hash_file_write_val(w, val);
+}
+
+int ourfa_hash_save(ourfa_hash_t *h, int fd)
+{
+   struct hash_writer_t *w;
+   struct hash_file_hdr_t hdr;
+   int res;
+
+   if (h == NULL || fd < 0)
+      return -1;
+
+   w = malloc(sizeof(*w));
+   if (w == NULL)
+      return -1;
+   w->fd = fd;
+   w->err = 0;
+   w->len = 0;
+
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, HASH_FILE_MAGIC, sizeof(hdr.magic));
+   hdr.version = HASH_FILE_VERSION;
+   hdr.byte_order = HASH_FILE_BYTE_ORDER;
+   hdr.sockaddr_size = sizeof(struct sockaddr_storage);
+   hdr.af_inet = AF_INET;
+   hdr.af_inet6 = AF_INET6;
+   hdr.keys_cnt = hash_size(h);
+   writer_put(w, &hdr, sizeof(hdr));
+
+   hash_scan(h, hash_save_0, w);
+   writer_flush(w);
+
+   res = w->err ? -1 : 0;
+   free(w);
+
+   return res;
+}
+
+/* Builds value from record at *offset.  */
+static struct hash_val_t *hash_file_map_val(struct hash_map_t *map,
+      size_t *offset, unsigned depth, int *err)
+{
+   const struct hash_file_val_t *rec;
+   struct hash_val_t *res;
+   size_t data_off, end, elm_size;
+   const char *base;
+
+   *err = -1;
+   base = (const char *)map->addr;
+
+   if ((depth > HASH_FILE_MAX_DEPTH)
+	 || (map->size - *offset < sizeof(*rec)))
+      return NULL;
+   rec = (const struct hash_file_val_t *)(base + *offset);
+   data_off = *offset + sizeof(*rec);
+   if ((rec->data_len > map->size - data_off)
+	 || (rec->data_len % 8 != 0))
+      return NULL;
+   end = data_off + (size_t)rec->data_len;
+
+   if (rec->type == HASH_FILE_T_NULL) {
+      if (rec->data_len != 0)
+	 return NULL;
+      *offset = end;
+      *err = 0;
+      return NULL;
+   }
+
+   res = malloc(sizeof(*res));
+   if (res == NULL)
+      return NULL;
+   res->ref_cnt = 1;
+   res->map = map;
+   res->elm_cnt = 0;
+   res->data_pool_size = 0;
+   res->data = NULL;
+
+   switch (rec->type) {
+      case HASH_FILE_T_INT:    res->type = OURFA_ELM_INT; break;
+      case HASH_FILE_T_LONG:   res->type = OURFA_ELM_LONG; break;
+      case HASH_FILE_T_DOUBLE: res->type = OURFA_ELM_DOUBLE; break;
+      case HASH_FILE_T_IP:     res->type = OURFA_ELM_IP; break;
+      case HASH_FILE_T_STRING: res->type = OURFA_ELM_STRING; break;
+      case HASH_FILE_T_ARRAY:  res->type = OURFA_ELM_ARRAY; break;
+      default:
+	 free(res);
+	 return NULL;
+   }
+
+   elm_size = elm_size_by_type(res->type);
+   if (rec->elm_cnt > (rec->data_len > 0 ? rec->data_len : 1)) {
+      /* Each element takes at least 4 bytes  */
+      free(res);
+      return NULL;
+   }
+
+   switch (res->type) {
+      case OURFA_ELM_INT:
+      case OURFA_ELM_LONG:
+      case OURFA_ELM_DOUBLE:
+      case OURFA_ELM_IP:
+	 if (HASH_FILE_ALIGN(rec->elm_cnt * elm_size, 8) != rec->data_len)
+	    goto map_val_err;
+	 res->data = (void *)(base + data_off);
+	 res->elm_cnt = res->data_pool_size = (size_t)rec->elm_cnt;
+	 break;
+      case OURFA_ELM_STRING:
+	 {
+	    size_t i, off;
+
+	    res->data = malloc((size_t)(rec->elm_cnt ? rec->elm_cnt : 1) * elm_size);
+	    if (res->data == NULL)
+	       goto map_val_err;
+	    res->data_pool_size = (size_t)rec->elm_cnt;
+	    off = data_off;
+	    for (i=0; i < rec->elm_cnt; i++) {
+	       uint32_t len;
+	       if (end - off < sizeof(len))
+		  goto map_val_err;
+	       memcpy(&len, base + off, sizeof(len));
+	       if (len == HASH_FILE_NULL_STR) {
+		  ((char **)res->data)[i] = NULL;
+		  off += sizeof(len);
+	       }else {
+		  if ((len >= end - off - sizeof(len))
+			|| (base[off + sizeof(len) + len] != '\0'))
+		     goto map_val_err;
+		  ((char **)res->data)[i] = (char *)(base + off + sizeof(len));
+		  off += HASH_FILE_ALIGN(sizeof(len) + len + 1, 4);
+	       }
+	       res->elm_cnt = i+1;
+	    }
+	    if (HASH_FILE_ALIGN(off, 8) != end)
+	       goto map_val_err;
+	 }
+	 break;
+      case OURFA_ELM_ARRAY:
+	 {
+	    size_t i, off;
+	    int child_err;
+
+	    res->data = malloc((size_t)(rec->elm_cnt ? rec->elm_cnt : 1) * elm_size);
+	    if (res->data == NULL)
+	       goto map_val_err;
+	    res->data_pool_size = (size_t)rec->elm_cnt;
+	    off = data_off;
+	    for (i=0; i < rec->elm_cnt; i++) {
+	       struct hash_file_val_t *child_rec;
+	       if (end - off < sizeof(*child_rec))
+		  goto map_val_err;
+	       ((struct hash_val_t **)res->data)[i] = hash_file_map_val(map,
+		     &off, depth+1, &child_err);
+	       if (child_err)
+		  goto map_val_err;
+	       res->elm_cnt = i+1;
+	       if (off > end)
+		  goto map_val_err;
+	    }
+	    if (off != end)
+	       goto map_val_err;
+	 }
+	 break;
+      default:
+	 assert(0);
+	 break;
+   }
+
+   *offset = end;
+   *err = 0;
+   return res;
+
+map_val_err:
+   hash_val_free(res);
+   return NULL;
+}
+
+static void hash_map_unref(struct hash_map_t *map)
+{
+   if (map == NULL)
+      return;
+
+   assert(ourfa_atomic_get(&map->ref_cnt) > 0);
+   if (ourfa_atomic_dec(&map->ref_cnt) != 0)
+      return;
+
+#ifdef WIN32
+   free(map->addr);
+#else
+   munmap(map->addr, map->size);
+#endif
+   free(map);
+}
+
+static struct hash_map_t *hash_map_open(const char *path)
+{
+   struct hash_map_t *map;
+   int fd;
+#ifdef WIN32
+   size_t readed;
+   long size;
+#else
+   struct stat st;
+#endif
+
+   map = malloc(sizeof(*map));
+   if (map == NULL)
+      return NULL;
+   map->ref_cnt = 1;
+
+#ifdef WIN32
+   fd = open(path, O_RDONLY | O_BINARY);
+   if (fd < 0) {
+      free(map);
+      return NULL;
+   }
+   size = lseek(fd, 0, SEEK_END);
+   map->size = size > 0 ? (size_t)size : 0;
+   map->addr = malloc(map->size ? map->size : 1);
+   if ((size < 0) || (map->addr == NULL) || (lseek(fd, 0, SEEK_SET) != 0)) {
+      free(map->addr);
+      close(fd);
+      free(map);
+      return NULL;
+   }
+   for (readed=0; readed < map->size;) {
+      int res;
+      res = read(fd, (char *)map->addr + readed, (unsigned)(map->size - readed));
+      if (res <= 0) {
+	 free(map->addr);
+	 close(fd);
+	 free(map);
+	 return NULL;
+      }
+      readed += (size_t)res;
+   }
+   close(fd);
+#else
+   fd = open(path, O_RDONLY);
+   if (fd < 0) {
+      free(map);
+      return NULL;
+   }
+   if ((fstat(fd, &st) != 0)
+	 || (st.st_size < (off_t)sizeof(struct hash_file_hdr_t))) {
+      close(fd);
+      free(map);
+      return NULL;
+   }
+   map->size = (size_t)st.st_size;
+   map->addr = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (map->addr == MAP_FAILED) {
+      free(map);
+      return NULL;
+   }
+#endif
+
+   return map;
+}
+
+ourfa_hash_t *ourfa_hash_map(const char *path)
+{
+   struct hash_map_t *map;
+   const struct hash_file_hdr_t *hdr;
+   ourfa_hash_t *res;
+   size_t offset;
+   uint64_t i;
+
+   if (path == NULL)
+      return NULL;
+
+   map = hash_map_open(path);
+   if (map == NULL)
+      return NULL;
+
+   res = NULL;
+   hdr = (const struct hash_file_hdr_t *)map->addr;
+   if ((map->size < sizeof(*hdr))
+	 || (memcmp(hdr->magic, HASH_FILE_MAGIC, sizeof(hdr->magic)) != 0)
+	 || (hdr->version != HASH_FILE_VERSION)
+	 || (hdr->byte_order != HASH_FILE_BYTE_ORDER)
+	 || (hdr->sockaddr_size != sizeof(struct sockaddr_storage))
+	 || (hdr->af_inet != AF_INET)
+	 || (hdr->af_inet6 != AF_INET6)
+	 || (hdr->keys_cnt > map->size / sizeof(struct hash_file_key_t)))
+      goto hash_map_end;
+
+   res = ourfa_hash_new((int)hdr->keys_cnt);
+   if (res == NULL)
+      goto hash_map_end;
+
+   offset = sizeof(*hdr);
+   for (i=0; i < hdr->keys_cnt; i++) {
+      const struct hash_file_key_t *key_rec;
+      const char *key;
+      struct hash_val_t *val;
+      int err;
+
+      if (map->size - offset < sizeof(*key_rec))
+	 break;
+      key_rec = (const struct hash_file_key_t *)((char *)map->addr + offset);
+      offset += sizeof(*key_rec);
+      key = (const char *)map->addr + offset;
+      if ((key_rec->key_len >= map->size - offset)
+	    || (key[key_rec->key_len] != '\0'))
+	 break;
+      offset += HASH_FILE_ALIGN((size_t)key_rec->key_len + 1, 8);
+      if (offset > map->size)
+	 break;
+
+      val = hash_file_map_val(map, &offset, 0, &err);
+      if (val == NULL)
+	 break;
+      ourfa_atomic_inc(&map->ref_cnt);
+      if (hash_add(res, key, val) != 0) {
+	 hash_val_unref(val);
+	 break;
+      }
+   }
+
+   if (i != hdr->keys_cnt) {
+      ourfa_hash_free(res);
+      res = NULL;
+   }
+
+hash_map_end:
+   hash_map_unref(map);
+   return res;
+}
+
+struct hash_clone_ctx_t {
+   ourfa_hash_t *res;
+   int err;
+};
+
+static void hash_clone_0(struct hash_val_t *val, const char *key, void *data)
+{
+   struct hash_clone_ctx_t *ctx;
+
+   ctx = (struct hash_clone_ctx_t *)data;
+   if (ctx->err)
+      return;
+
+   if (hash_add(ctx->res, key, val) != 0) {
+      ctx->err = 1;
+      return;
+   }
+   ourfa_atomic_inc(&val->ref_cnt);
+}
+
+ourfa_hash_t *ourfa_hash_clone(ourfa_hash_t *h)
+{
+   struct hash_clone_ctx_t ctx;
+   size_t size;
+
+   if (h == NULL)
+      return NULL;
+
+   size = hash_size(h);
+   ctx.res = ourfa_hash_new(size > 0 ? (int)size : 0);
+   if (ctx.res == NULL)
+      return NULL;
+   ctx.err = 0;
+
+   hash_scan(h, hash_clone_0, &ctx);
+   if (ctx.err) {
+      ourfa_hash_free(ctx.res);
+      return NULL;
+   }
+
+   return ctx.res;
+}
+
+struct hash_diff_ctx_t {
+   ourfa_hash_t *before;
+   ourfa_hash_t *res;
+   int err;
+};
+
+static void hash_diff_0(struct hash_val_t *val, const char *key, void *data)
+{
+   struct hash_diff_ctx_t *ctx;
+
+   ctx = (struct hash_diff_ctx_t *)data;
+   if (ctx->err || (hash_lookup(ctx->before, key) == val))
+      return;
+
+   if (hash_add(ctx->res, key, val) != 0) {
+      ctx->err = 1;
+      return;
+   }
+   ourfa_atomic_inc(&val->ref_cnt);
+}
+
+/*
+ * Variables of after, that are not shared with before: set or changed
+ * after before was cloned from the same hash. Values are shared.
+ */
+ourfa_hash_t *ourfa_hash_diff(ourfa_hash_t *before, ourfa_hash_t *after)
+{
+   struct hash_diff_ctx_t ctx;
+
+   if (before == NULL || after == NULL)
+      return NULL;
+
+   ctx.before = before;
+   ctx.res = ourfa_hash_new(0);
+   if (ctx.res == NULL)
+      return NULL;
+   ctx.err = 0;
+
+   hash_scan(after, hash_diff_0, &ctx);
+   if (ctx.err) {
+      ourfa_hash_free(ctx.res);
+      return NULL;
+   }
+
+   return ctx.res;
+}
+
+static void hash_merge_0(struct hash_val_t *val, const char *key, void *data)
+{
+   struct hash_clone_ctx_t *ctx;
+
+   ctx = (struct hash_clone_ctx_t *)data;
+   if (ctx->err)
+      return;
+
+   hash_remove(ctx->res, key);
+   if (hash_add(ctx->res, key, val) != 0) {
+      ctx->err = 1;
+      return;
+   }
+   ourfa_atomic_inc(&val->ref_cnt);
+}
+
+/* Set all variables of src in dst. Values are shared, copy on write */
+int ourfa_hash_merge(ourfa_hash_t *dst, ourfa_hash_t *src)
+{
+   struct hash_clone_ctx_t ctx;
+
+   if (dst == NULL || src == NULL)
+      return -1;
+
+   ctx.res = dst;
+   ctx.err = 0;
+   hash_scan(src, hash_merge_0, &ctx);
+
+   return ctx.err ? -1 : 0;
+}
+
+/* FNV-1a 64  */
+static unsigned long long fp_bytes(unsigned long long fp, const void *data,
+      size_t size)
+{
+   const unsigned char *p;
+   size_t i;
+
+   p = (const unsigned char *)data;
+   for (i=0; i < size; i++) {
+      fp ^= p[i];
+      fp *= 1099511628211ULL;
+   }
+   return fp;
+}
+
+static unsigned long long fp_val(unsigned long long fp,
+      const struct hash_val_t *val)
+{
+   size_t i;
+   unsigned type;
+   long long l;
+
+   /* int and long with the same value are the same input  */
+   type = val->type == OURFA_ELM_INT ? OURFA_ELM_LONG : val->type;
+   fp = fp_bytes(fp, &type, sizeof(type));
+   fp = fp_bytes(fp, &val->elm_cnt, sizeof(val->elm_cnt));
+
+   for (i=0; i < val->elm_cnt; i++) {
+      switch (val->type) {
+	 case OURFA_ELM_ARRAY:
+	    if (((struct hash_val_t **)val->data)[i] != NULL)
+	       fp = fp_val(fp, ((struct hash_val_t **)val->data)[i]);
+	    else
+	       fp = fp_bytes(fp, "", 1);
+	    break;
+	 case OURFA_ELM_INT:
+	    l = ((int *)val->data)[i];
+	    fp = fp_bytes(fp, &l, sizeof(l));
+	    break;
+	 case OURFA_ELM_LONG:
+	    fp = fp_bytes(fp, &((long long *)val->data)[i], sizeof(long long));
+	    break;
+	 case OURFA_ELM_DOUBLE:
+	    fp = fp_bytes(fp, &((double *)val->data)[i], sizeof(double));
+	    break;
+	 case OURFA_ELM_STRING:
+	    if (((char **)val->data)[i] != NULL)
+	       fp = fp_bytes(fp, ((char **)val->data)[i],
+		     strlen(((char **)val->data)[i]) + 1);
+	    else
+	       fp = fp_bytes(fp, "", 1);
+	    break;
+	 case OURFA_ELM_IP:
+	    {
+	       const struct sockaddr *sa;
+	       sa = hash_ip_data(val, (int)i);
+	       fp = fp_bytes(fp, &sa->sa_family, sizeof(sa->sa_family));
+	       if (sa->sa_family == AF_INET)
+		  fp = fp_bytes(fp, &((const struct sockaddr_in *)sa)->sin_addr,
+			sizeof(struct in_addr));
+	       else if (sa->sa_family == AF_INET6)
+		  fp = fp_bytes(fp, &((const struct sockaddr_in6 *)sa)->sin6_addr,
+			sizeof(struct in6_addr));
+	    }
+	    break;
+	 case OURFA_ELM_HASH:
+	 default:
+	    /* Nested hashes are never used as input  */
+	    break;
+      }
+   }
+
+   return fp;
+}
+
+/* Mix name and value of the variable into fingerprint fp  */
+unsigned long long ourfa_hash_fingerprint(ourfa_hash_t *h, const char *key,
+      unsigned long long fp)
+{
+   struct hash_val_t *val;
+
+   if (fp == 0)
+      fp = 14695981039346656037ULL;
+   if (key == NULL)
+      return fp;
+
+   fp = fp_bytes(fp, key, strlen(key) + 1);
+   val = h ? hash_lookup(h, key) : NULL;
+   if (val == NULL)
+      return fp_bytes(fp, "", 1);
+
+   return fp_val(fp, val);
+}
+
+/*
+ * Mix variables of index list ("i,2,j") into fingerprint fp. Numbers and
+ * names listed in skip (loop counters, set before they are read) are
+ * skipped. Items are parsed as in ourfa_hash_parse_idx_list()
+ */
+unsigned long long ourfa_hash_fingerprint_idx(ourfa_hash_t *h,
+      const char *idx_list, const char * const *skip, unsigned skip_cnt,
+      unsigned long long fp)
+{
+   char cur_idx_s[20];
+   char *cur_idx_p;
+   const char *p;
+   unsigned i;
+
+   if (fp == 0)
+      fp = ourfa_hash_fingerprint(NULL, NULL, 0);
+   if (idx_list == NULL)
+      return fp;
+
+   cur_idx_p = &cur_idx_s[0];
+   for (p=idx_list; ; p++) {
+      if (isspace(*p))
+	 continue;
+      if ((*p != ',') && (*p != '\0')) {
+	 if (cur_idx_p != &cur_idx_s[sizeof(cur_idx_s)-1])
+	    *cur_idx_p++ = *p;
+	 continue;
+      }
+
+      *cur_idx_p = '\0';
+      if ((cur_idx_s[0] != '\0') && !isdigit(cur_idx_s[0])) {
+	 for (i=0; i < skip_cnt; i++) {
+	    if ((skip[i] != NULL) && (strcmp(skip[i], cur_idx_s) == 0))
+	       break;
+	 }
+	 if (i == skip_cnt)
+	    fp = ourfa_hash_fingerprint(h, cur_idx_s, fp);
+      }
+      cur_idx_p = &cur_idx_s[0];
+      if (*p == '\0')
+	 break;
+   }
+
+   return fp;
+}
+
+static size_t hash_val_mem_size(const struct hash_val_t *val)
+{
+   size_t i, res;
+
+   res = sizeof(*val);
+   if (val->map != NULL)
+      return res;
+
+   res += val->data_pool_size * elm_size_by_type(val->type);
+   for (i=0; i < val->elm_cnt; i++) {
+      if ((val->type == OURFA_ELM_ARRAY)
+	    && (((struct hash_val_t **)val->data)[i] != NULL))
+	 res += hash_val_mem_size(((struct hash_val_t **)val->data)[i]);
+      else if ((val->type == OURFA_ELM_STRING)
+	    && (((char **)val->data)[i] != NULL))
+	 res += strlen(((char **)val->data)[i]) + 1;
+      else if ((val->type == OURFA_ELM_HASH)
+	    && (((ourfa_hash_t **)val->data)[i] != NULL))
+	 res += ourfa_hash_mem_size(((ourfa_hash_t **)val->data)[i]);
+   }
+
+   return res;
+}
+
+static void hash_mem_size_0(struct hash_val_t *val, const char *key, void *data)
+{
+   *(size_t *)data += hash_val_mem_size(val) + strlen(key) + 1;
+}
+
+/* Approximate memory used by variables of the hash  */
+size_t ourfa_hash_mem_size(ourfa_hash_t *h)
+{
+   size_t res;
+
+   if (h == NULL)
+      return 0;
+
+   res = sizeof(*h);
+   hash_scan(h, hash_mem_size_0, &res);
+
+   return res;
+}
+
+static void hash_val_clear(struct hash_val_t *val)
+{
+   unsigned i;
+   if (val == NULL)
+      return;
+
+   switch (val->type)
+   {
+      case OURFA_ELM_ARRAY:
+	 for (i=0; i<val->elm_cnt; i++) {
+	    struct hash_val_t *val0;
+	    val0 = ((struct hash_val_t **)val->data)[i];
+	    /*  XXX: check for unlimited recursion */
+	    hash_val_clear(val0);
+	    free(val0);
+	 }
+	 break;
+      case OURFA_ELM_HASH:
+	 for (i=0; i<val->elm_cnt; i++) {
+	    ourfa_hash_t *val0;
+	    val0 = ((ourfa_hash_t **)val->data)[i];
+	    /*  XXX: check for unlimited recursion */
+	    ourfa_hash_free(val0);
+	 }
+	 break;
+      case OURFA_ELM_STRING:
+	 if (val->map != NULL)
+	    break;
+	 for (i=0; i<val->elm_cnt; i++) {
+	    char *val0;
+	    val0 = ((char **)val->data)[i];
+	    free(val0);
+	 }
+	 break;
+      default:
+	 /* Mapped numbers and addresses are not copied */
+	 if (val->map != NULL)
+	    val->data = NULL;
 	 break;
    }
    free(val->data);
+   val->map=NULL;
    val->data=NULL;
    val->data_pool_size=0;
    val->elm_cnt=0;
@@ -977,6 +2589,81 @@ static void hash_val_free(struct hash_val_t *val)
    return;
 }
 
+static void hash_val_unref(struct hash_val_t *val)
+{
+   if (val == NULL)
+      return;
+
+   assert(ourfa_atomic_get(&val->ref_cnt) > 0);
+   if (ourfa_atomic_dec(&val->ref_cnt) == 0) {
+      struct hash_map_t *map;
+      map = val->map;
+      hash_val_free(val);
+      hash_map_unref(map);
+   }
+}
+
+/* Deep copy of the value */
+static struct hash_val_t *hash_val_dup(const struct hash_val_t *val)
+{
+   struct hash_val_t *res;
+   size_t i;
+
+   res = hash_val_new(val->type, val->elm_cnt);
+   if (res == NULL)
+      return NULL;
+
+   switch (val->type) {
+      case OURFA_ELM_ARRAY:
+	 for (i=0; i < val->elm_cnt; i++) {
+	    struct hash_val_t *src, *dst;
+	    src = ((struct hash_val_t **)val->data)[i];
+	    dst = NULL;
+	    if (src != NULL) {
+	       dst = hash_val_dup(src);
+	       if (dst == NULL) {
+		  hash_val_free(res);
+		  return NULL;
+	       }
+	    }
+	    ((struct hash_val_t **)res->data)[i] = dst;
+	    res->elm_cnt = i+1;
+	 }
+	 break;
+      case OURFA_ELM_STRING:
+	 for (i=0; i < val->elm_cnt; i++) {
+	    const char *src;
+	    char *dst;
+	    src = ((char **)val->data)[i];
+	    dst = NULL;
+	    if (src != NULL) {
+	       dst = strdup(src);
+	       if (dst == NULL) {
+		  hash_val_free(res);
+		  return NULL;
+	       }
+	    }
+	    ((char **)res->data)[i] = dst;
+	    res->elm_cnt = i+1;
+	 }
+	 break;
+      case OURFA_ELM_INT:
+      case OURFA_ELM_LONG:
+      case OURFA_ELM_DOUBLE:
+      case OURFA_ELM_IP:
+	 if (val->elm_cnt)
+	    memcpy(res->data, val->data, val->elm_cnt * elm_size_by_type(val->type));
+	 res->elm_cnt = val->elm_cnt;
+	 break;
+      case OURFA_ELM_HASH:
+      default:
+	 hash_val_free(res);
+	 return NULL;
+   }
+
+   return res;
+}
+
 static int convert_hashval2string(struct hash_val_t *val)
 {
    struct hash_val_t *tmp;
@@ -1003,15 +2690,13 @@ static int convert_hashval2string(struct hash_val_t *val)
 
    while (tmp->elm_cnt < val->elm_cnt) {
       char *str = NULL;
+      char num_s[OURFA_NUM_STRLEN];
       switch (val->type) {
 	 case OURFA_ELM_INT:
-	    ourfa_asprintf(&str, "%i", ((int *)val->data)[tmp->elm_cnt]);
-	    break;
 	 case OURFA_ELM_LONG:
-	    ourfa_asprintf(&str, "%lli", ((long long *)val->data)[tmp->elm_cnt]);
-	    break;
 	 case OURFA_ELM_DOUBLE:
-	    ourfa_asprintf(&str, "%f", ((double *)val->data)[tmp->elm_cnt]);
+	    if (hash_num2str(val, tmp->elm_cnt, num_s, sizeof(num_s)) >= 0)
+	       str = strdup(num_s);
 	    break;
 	 case OURFA_ELM_IP:
 	    str = malloc(INET6_ADDRSTRLEN);
@@ -1046,6 +2731,9 @@ static int increase_pool_size(struct hash_val_t *ha, size_t add)
       size_t new_size;
 
       new_size = (ha->data_pool_size + (add ? add : DEFAULT_ARRAY_SIZE) + 1);
+      /* Arrays usually grow by one element. Avoid quadratic copying  */
+      if (new_size < ha->data_pool_size * 2)
+	 new_size = ha->data_pool_size * 2;
       new = realloc(ha->data, new_size * elm_size_by_type(ha->type));
       if (new == NULL)
 	 return -1;
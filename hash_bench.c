@@ -0,0 +1,140 @@
+/*-
+ * Copyright (c) 2009-2010 Alexey Illarionov <littlesavage@rambler.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * ourfa_hash_t microbenchmark: set / get / lookup-miss on variable names
+ * typical for URFA functions.
+ *
+ * Usage: hash_bench [iterations]
+ */
+
+#ifdef WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <openssl/ssl.h>
+
+#include "ourfa.h"
+
+static const char *names[] = {
+   "user_id", "login", "password", "full_name", "basic_account",
+   "account_id", "is_blocked", "balance", "credit", "vat_rate",
+   "sale_tax_rate", "int_status", "tariff_id", "tariff_name",
+   "discount_period_id", "service_id", "service_type", "slink_id",
+   "ip_address", "mask", "mac", "iptraffic_login", "unabon", "unprepay",
+   "parent_id", "group_id", "house_id", "flat_number", "entrance",
+   "floor", "district", "building", "home_telephone", "mobile_telephone",
+   "work_telephone", "actual_address", "juridical_address", "email",
+   "passport", "comments", "bank_id", "bank_account", "personal_manager",
+   "connect_date", "create_date", "last_change_date", "who_create",
+   "who_change", "is_juridical", "jur_address_id", "act_address_id",
+   "parameters_count", "parameter_id", "parameter_value",
+   "accounts_count", "users_count", "result", "error", "i", "j"
+};
+
+static const char *miss_names[] = {
+   "user_id1", "logins", "Password", "full_nam", "basic_accounts",
+   "account", "blocked", "balanc", "credits", "vat",
+   "tariff", "service", "slink", "ip", "parent", "group", "house",
+   "flat", "telephone", "address", "comment", "bank", "manager",
+   "date", "who", "juridical", "parameters", "accounts", "users", "k"
+};
+
+#define NAMES_CNT (sizeof(names)/sizeof(names[0]))
+#define MISS_CNT (sizeof(miss_names)/sizeof(miss_names[0]))
+
+static double elapsed_ns(clock_t start, unsigned long ops)
+{
+   return (double)(clock() - start) * 1.0e9 / CLOCKS_PER_SEC / (double)ops;
+}
+
+int main(int argc, char **argv)
+{
+   ourfa_hash_t *h;
+   unsigned long iter, n;
+   unsigned i;
+   long long val, sum;
+   clock_t start;
+   double set_ns, get_ns, miss_ns;
+
+   iter = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+   if (iter == 0)
+      iter = 1;
+
+   sum = 0;
+   set_ns = get_ns = miss_ns = 0;
+
+   start = clock();
+   for (n=0; n < iter; n++) {
+      h = ourfa_hash_new(0);
+      if (h == NULL) {
+	 fprintf(stderr, "ourfa_hash_new() failed\n");
+	 return 1;
+      }
+      for (i=0; i < NAMES_CNT; i++)
+	 ourfa_hash_set_long(h, names[i], NULL, (long long)i);
+      ourfa_hash_free(h);
+   }
+   set_ns = elapsed_ns(start, iter * NAMES_CNT);
+
+   h = ourfa_hash_new(NAMES_CNT);
+   for (i=0; i < NAMES_CNT; i++)
+      ourfa_hash_set_long(h, names[i], NULL, (long long)i);
+
+   start = clock();
+   for (n=0; n < iter; n++) {
+      for (i=0; i < NAMES_CNT; i++) {
+	 if (ourfa_hash_get_long(h, names[i], NULL, &val) == 0)
+	    sum += val;
+      }
+   }
+   get_ns = elapsed_ns(start, iter * NAMES_CNT);
+
+   start = clock();
+   for (n=0; n < iter; n++) {
+      for (i=0; i < MISS_CNT; i++) {
+	 if (ourfa_hash_get_long(h, miss_names[i], NULL, &val) == 0)
+	    sum += val;
+      }
+   }
+   miss_ns = elapsed_ns(start, iter * MISS_CNT);
+   ourfa_hash_free(h);
+
+   printf("%-12s %10.1f ns/op\n", "set", set_ns);
+   printf("%-12s %10.1f ns/op\n", "get", get_ns);
+   printf("%-12s %10.1f ns/op\n", "lookup-miss", miss_ns);
+   printf("checksum %lli\n", sum);
+
+   return 0;
+}
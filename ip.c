@@ -102,16 +102,69 @@ int ourfa_ip_ntop(const struct sockaddr *sa, char *dst, socklen_t dst_size) {
    return 0;
 }
 
+/*
+ * Dotted quad without leading zeros, the most common form of address in
+ * input data. Other forms are parsed by ourfa_parse_ip() as before:
+ * inet_aton() treats octets with leading zeros as octal.
+ * Returns 0 on success
+ */
+static inline int parse_ipv4_fast(const char *str, in_addr_t *res)
+{
+   unsigned i;
+   unsigned c;
+   unsigned octet;
+   in_addr_t addr;
+
+   addr = 0;
+   for (i=0; i<4; i++) {
+      if (i != 0) {
+	 if (*str != '.')
+	    return -1;
+	 str++;
+      }
+      octet = (unsigned char)*str - '0';
+      if (octet > 9)
+	 return -1;
+      str++;
+      c = (unsigned char)*str - '0';
+      if (c <= 9) {
+	 if (octet == 0)
+	    return -1;
+	 octet = octet * 10 + c;
+	 str++;
+	 c = (unsigned char)*str - '0';
+	 if (c <= 9) {
+	    octet = octet * 10 + c;
+	    if (octet > 255)
+	       return -1;
+	    str++;
+	 }
+      }
+      addr = (addr << 8) | octet;
+   }
+   if (*str != '\0')
+      return -1;
+
+   *res = htonl(addr);
+   return 0;
+}
+
 int ourfa_parse_ip(const char *str, struct sockaddr_storage *res)
 {
    char *p_end;
    long long_val;
+   in_addr_t ipv4;
    struct in_addr ipv4_buf;
    struct in6_addr ipv6_buf;
 
    if (str == NULL || (str[0]=='\0') || res == NULL)
       return -1;
 
+   if (parse_ipv4_fast(str, &ipv4) == 0) {
+      ourfa_ip_set((struct sockaddr *)res, ipv4);
+      return 0;
+   }
+
    /* Dirty hack for ourfa-perl. */
    if (strlen(str) == 4) {
       /* String is a binary in_addr_t  */
@@ -161,7 +214,7 @@ int ourfa_parse_ip(const char *str, struct sockaddr_storage *res)
       return 0;
    }
 #else
-   if (inet_aton(str, &ipv4_buf) == 0) {
+   if (inet_aton(str, &ipv4_buf) != 0) {
       ourfa_ip_set((struct sockaddr *)res, ipv4_buf.s_addr);
       return 0;
    }
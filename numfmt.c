@@ -0,0 +1,401 @@
+/*-
+ * Copyright (c) 2016 Alexey Illarionov <littlesavage@rambler.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+ /* Locale-independent formatting and parsing of numbers */
+
+#ifdef WIN32
+#include <ws2tcpip.h>
+#include <stdint.h>
+#include <locale.h>
+#include <stdio.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#endif
+
+#include <errno.h>
+#include <float.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/ssl.h>
+
+#include "ourfa.h"
+#include "ourfa_private.h"
+
+static const char digits2[201] =
+   "00010203040506070809"
+   "10111213141516171819"
+   "20212223242526272829"
+   "30313233343536373839"
+   "40414243444546474849"
+   "50515253545556575859"
+   "60616263646566676869"
+   "70717273747576777879"
+   "80818283848586878889"
+   "90919293949596979899";
+
+/* Digits of val ending at end. Returns pointer to the first digit */
+static char *format_u64(char *end, unsigned long long val)
+{
+   char *p;
+   unsigned v32, i;
+
+   p = end;
+   /* Two digits per division, 32-bit division when value fits */
+   while (val > UINT_MAX) {
+      i = (unsigned)(val % 100) * 2;
+      val /= 100;
+      *--p = digits2[i+1];
+      *--p = digits2[i];
+   }
+   v32 = (unsigned)val;
+   while (v32 >= 100) {
+      i = (v32 % 100) * 2;
+      v32 /= 100;
+      *--p = digits2[i+1];
+      *--p = digits2[i];
+   }
+   if (v32 >= 10) {
+      *--p = digits2[v32*2+1];
+      *--p = digits2[v32*2];
+   }else
+      *--p = (char)('0' + v32);
+
+   return p;
+}
+
+static int copy_num(char *dst, size_t dst_size, const char *src, size_t len)
+{
+   if ((dst == NULL) || (len >= dst_size))
+      return -1;
+   memcpy(dst, src, len);
+   dst[len] = '\0';
+
+   return (int)len;
+}
+
+int ourfa_format_long(long long val, char *dst, size_t dst_size)
+{
+   char buf[OURFA_NUM_STRLEN];
+   char *p;
+   unsigned long long u;
+
+   u = val < 0 ? 0ULL - (unsigned long long)val : (unsigned long long)val;
+   p = format_u64(buf + sizeof(buf), u);
+   if (val < 0)
+      *--p = '-';
+
+   return copy_num(dst, dst_size, p, buf + sizeof(buf) - p);
+}
+
+int ourfa_format_int(int val, char *dst, size_t dst_size)
+{
+   return ourfa_format_long(val, dst, dst_size);
+}
+
+/*
+ * Values with up to 15 significant digits, 1e-6 <= |val| < 1e15, without
+ * bigint arithmetic. If m / 10^k is exactly val, "m e-k" is read back as
+ * val, and no other string of up to 15 digits is, so it is the shortest.
+ * Returns length or -1 if val is not such value
+ */
+static int format_double_short(double val, char *dst, size_t dst_size)
+{
+   /* Exact in double  */
+   static const double p10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+      1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+      1e19, 1e20, 1e21};
+   char buf[OURFA_NUM_STRLEN];
+   char *p, *digits;
+   double a, scaled;
+   unsigned long long m;
+   unsigned k;
+   int ndigits;
+
+   a = val < 0 ? -val : val;
+   if (!((a >= 1e-6) && (a < 1e15)))
+      return -1;
+
+   for (k = 0; ; k++) {
+      /* a * 1e21 >= 1e15 */
+      scaled = a * p10[k];
+      if (scaled >= 1e15)
+	 return -1;
+      m = (unsigned long long)scaled;
+      if (((double)m == scaled) && ((double)m / p10[k] == a))
+	 break;
+   }
+
+   digits = format_u64(buf + sizeof(buf), m);
+   ndigits = (int)(buf + sizeof(buf) - digits);
+   p = buf;
+   if (val < 0)
+      *p++ = '-';
+   if (k == 0) {
+      memmove(p, digits, ndigits);
+      p += ndigits;
+   }else if (ndigits > (int)k) {
+      memmove(p, digits, ndigits - k);
+      p += ndigits - k;
+      *p++ = '.';
+      memmove(p, digits + ndigits - k, k);
+      p += k;
+   }else {
+      *p++ = '0';
+      *p++ = '.';
+      for (; ndigits < (int)k; k--)
+	 *p++ = '0';
+      memmove(p, digits, ndigits);
+      p += ndigits;
+   }
+
+   return copy_num(dst, dst_size, buf, p - buf);
+}
+
+#ifndef WIN32
+/* Bigint pool of dtoa.c is shared by all its calls  */
+static pthread_mutex_t dtoa_lock = PTHREAD_MUTEX_INITIALIZER;
+
+double ourfa_strtod_c(const char *s00, char **se)
+{
+   double res;
+   int err;
+
+   pthread_mutex_lock(&dtoa_lock);
+   errno = 0;
+   res = ourfa_dtoa_strtod(s00, se);
+   err = errno;
+   pthread_mutex_unlock(&dtoa_lock);
+   errno = err;
+
+   return res;
+}
+
+/*
+ * Shortest digits that are read back as the same value (dtoa() mode 0).
+ * Plain notation for 1e-6 <= |val| < 1e21, exponential otherwise
+ */
+int ourfa_format_double(double val, char *dst, size_t dst_size)
+{
+   char buf[OURFA_NUM_STRLEN];
+   char *digits, *digits_end, *p;
+   int decpt, sign, ndigits, i;
+
+   i = format_double_short(val, buf, sizeof(buf));
+   if (i >= 0)
+      return copy_num(dst, dst_size, buf, i);
+
+   pthread_mutex_lock(&dtoa_lock);
+   digits = ourfa_dtoa(val, 0, 0, &decpt, &sign, &digits_end);
+   if (digits == NULL) {
+      pthread_mutex_unlock(&dtoa_lock);
+      return -1;
+   }
+
+   p = buf;
+   if (decpt == 9999) {
+      /* Infinity or NaN. Written as printf() does */
+      if (digits[0] == 'I') {
+	 if (sign)
+	    *p++ = '-';
+	 memcpy(p, "inf", 3);
+      }else
+	 memcpy(p, "nan", 3);
+      p += 3;
+      ourfa_freedtoa(digits);
+      pthread_mutex_unlock(&dtoa_lock);
+      return copy_num(dst, dst_size, buf, p - buf);
+   }
+
+   if (sign)
+      *p++ = '-';
+   ndigits = (int)(digits_end - digits);
+
+   if ((decpt > 0) && (decpt <= 21)) {
+      if (ndigits <= decpt) {
+	 /* 123, 1200 */
+	 memcpy(p, digits, ndigits);
+	 p += ndigits;
+	 for (i = ndigits; i < decpt; i++)
+	    *p++ = '0';
+      }else {
+	 /* 1.25 */
+	 memcpy(p, digits, decpt);
+	 p += decpt;
+	 *p++ = '.';
+	 memcpy(p, digits + decpt, ndigits - decpt);
+	 p += ndigits - decpt;
+      }
+   }else if ((decpt <= 0) && (decpt > -6)) {
+      /* 0.00125 */
+      *p++ = '0';
+      *p++ = '.';
+      for (i = decpt; i < 0; i++)
+	 *p++ = '0';
+      memcpy(p, digits, ndigits);
+      p += ndigits;
+   }else {
+      /* 1.25e-07, 1e+21 */
+      *p++ = digits[0];
+      if (ndigits > 1) {
+	 *p++ = '.';
+	 memcpy(p, digits + 1, ndigits - 1);
+	 p += ndigits - 1;
+      }
+      *p++ = 'e';
+      if (decpt - 1 < 0) {
+	 *p++ = '-';
+	 i = 1 - decpt;
+      }else {
+	 *p++ = '+';
+	 i = decpt - 1;
+      }
+      if (i < 10)
+	 *p++ = '0';
+      ndigits = i >= 100 ? 3 : (i >= 10 ? 2 : 1);
+      format_u64(p + ndigits, (unsigned)i);
+      p += ndigits;
+   }
+   ourfa_freedtoa(digits);
+   pthread_mutex_unlock(&dtoa_lock);
+
+   return copy_num(dst, dst_size, buf, p - buf);
+}
+#else
+/* No dtoa.c on WIN32: shortest of %.15g - %.17g, that is read back  */
+int ourfa_format_double(double val, char *dst, size_t dst_size)
+{
+   static _locale_t c_locale = NULL;
+   char buf[OURFA_NUM_STRLEN];
+   int prec, len;
+
+   len = format_double_short(val, buf, sizeof(buf));
+   if (len >= 0)
+      return copy_num(dst, dst_size, buf, len);
+
+   if (c_locale == NULL)
+      c_locale = _create_locale(LC_NUMERIC, "C");
+
+   len = -1;
+   for (prec = 15; prec <= 17; prec++) {
+      len = _snprintf_l(buf, sizeof(buf), "%.*g", c_locale, prec, val);
+      if ((len < 0) || ((size_t)len >= sizeof(buf)))
+	 return -1;
+      if (ourfa_strtod_c(buf, NULL) == val)
+	 break;
+   }
+
+   return copy_num(dst, dst_size, buf, len);
+}
+#endif
+
+/* Leading white space is skipped as by strtod() and strtol()  */
+static const char *skip_space(const char *str)
+{
+   while ((*str != '\0') && (strchr(" \t\n\v\f\r", *str) != NULL))
+      str++;
+   return str;
+}
+
+/* Decimal integer: optional leading white space, sign and digits only  */
+int ourfa_parse_long(const char *str, long long *res)
+{
+   const char *p;
+   unsigned long long val, limit;
+   unsigned d;
+   int neg;
+
+   if (str == NULL)
+      return -1;
+
+   p = skip_space(str);
+   neg = 0;
+   if ((*p == '-') || (*p == '+'))
+      neg = (*p++ == '-');
+
+   limit = neg ? (unsigned long long)LLONG_MAX + 1 : (unsigned long long)LLONG_MAX;
+   val = 0;
+   do {
+      d = (unsigned)(*p - '0');
+      if (d > 9)
+	 return -1;
+      if (val > (limit - d) / 10)
+	 return -1;
+      val = val * 10 + d;
+   } while (*++p != '\0');
+
+   if (res)
+      *res = neg ? (long long)(0ULL - val) : (long long)val;
+
+   return 0;
+}
+
+int ourfa_parse_int(const char *str, int *res)
+{
+   long long val;
+
+   if ((ourfa_parse_long(str, &val) != 0)
+	 || (val < INT_MIN) || (val > INT_MAX))
+      return -1;
+   if (res)
+      *res = (int)val;
+
+   return 0;
+}
+
+/*
+ * Rest of the string after leading white space is a number in C locale.
+ * Hex numbers are accepted as by strtod(). Overflow and underflow to 0
+ * are errors
+ */
+int ourfa_parse_double(const char *str, double *res)
+{
+   char *end;
+   double val;
+
+   if (str == NULL)
+      return -1;
+   str = skip_space(str);
+   if (str[0] == '\0')
+      return -1;
+
+   errno = 0;
+   val = ourfa_strtod_c(str, &end);
+   if (*end != '\0')
+      return -1;
+   /* Denormals are set with ERANGE too */
+   if ((errno == ERANGE) && ((val == 0) || (val > DBL_MAX) || (val < -DBL_MAX)))
+      return -1;
+   if (res)
+      *res = val;
+
+   return 0;
+}
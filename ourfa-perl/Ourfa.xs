@@ -414,7 +414,14 @@ static int ourfa_exec(pMY_CXT_ ourfa_connection_t *conn,
 			    SV *tmp;
 			    if (ourfa_hash_get_long(sctx->func.h,
 				     node_name, arr_index, &val) == 0 ) {
-			       tmp = newSVnv(val);
+#if IVSIZE >= 8
+			       tmp = newSViv((IV)val);
+#else
+			       /* Exact decimal string instead of rounded NV */
+			       char num_s[OURFA_NUM_STRLEN];
+			       ourfa_format_long(val, num_s, sizeof(num_s));
+			       tmp = newSVpv(num_s, 0);
+#endif
 			       if (hv_store((HV *)s[s_top], node_name, strlen(node_name), tmp, 0)==NULL) {
 				  SvREFCNT_dec(tmp);
 				  sctx->func.err = OURFA_ERROR_HASH;
@@ -435,13 +442,15 @@ static int ourfa_exec(pMY_CXT_ ourfa_connection_t *conn,
 				     node_name, arr_index, &val) == 0 ) {
 			       tmp = newSVnv(val);
 			       if (hv_store((HV *)s[s_top], node_name, strlen(node_name), tmp, 0)==NULL) {
+				  char num_s[OURFA_NUM_STRLEN];
 				  SvREFCNT_dec(tmp);
 				  sctx->func.err = OURFA_ERROR_HASH;
 				  sctx->func.func_ret_code = 1;
+				  ourfa_format_double(val, num_s, sizeof(num_s));
 				  snprintf(sctx->func.last_err_str,
 					sizeof(sctx->func.last_err_str),
-					"Can not set hash: %s = %.3f",
-					node_name, val);
+					"Can not set hash: %s = %s",
+					node_name, num_s);
 			       }
 			    }
 			 }
@@ -1215,6 +1224,31 @@ ourfa_xmlapi_load_script(xmlapi, file_name, function_name)
       if (RETVAL != OURFA_OK)
 	    croak("%s: %s\n", "Ourfa::Xmlapi::load_script", ourfa_error_strerror(RETVAL));
 
+void
+ourfa_xmlapi_set_cache(xmlapi, enable)
+   ourfa_xmlapi_t *xmlapi
+   int enable
+
+void
+ourfa_xmlapi_set_lazy(xmlapi, enable)
+   ourfa_xmlapi_t *xmlapi
+   int enable
+
+int
+ourfa_xmlapi_freeze(xmlapi)
+   ourfa_xmlapi_t *xmlapi
+   POSTCALL:
+      if (RETVAL != OURFA_OK)
+	    croak("%s: %s\n", "Ourfa::Xmlapi::freeze", ourfa_error_strerror(RETVAL));
+
+unsigned
+ourfa_xmlapi_ref_cnt(xmlapi)
+   ourfa_xmlapi_t *xmlapi
+   CODE:
+      RETVAL = xmlapi->ref_cnt;
+   OUTPUT:
+      RETVAL
+
 const char *
 ourfa_xmlapi_node_name_by_type(type)
    int type
@@ -1353,12 +1387,90 @@ ourfa_xmlapi_func_node_type(fn)
 #XXX: union n
 
 void
-ourfa_xmlapi_func_node_DESTROY(f)
-      ourfa_xmlapi_func_t *f
+ourfa_xmlapi_func_node_DESTROY(fn)
+      ourfa_xmlapi_func_node_t *fn
    CODE:
       PR("Now in Ourfa::Xmlapi::Func::Node::DESTROY\n");
-      ourfa_xmlapi_func_deref(f);
+      ourfa_xmlapi_func_deref(fn->func);
+
+
+
+MODULE = Ourfa PACKAGE = Ourfa::Hash PREFIX = ourfa_hash_
+
+ourfa_hash_t *
+ourfa_hash_new(CLASS, h=NO_INIT)
+   const char * CLASS
+   HV *h
+   PREINIT:
+      dMY_CXT;
+   CODE:
+      PERL_UNUSED_VAR(CLASS);
+      if (items <= 1)
+	 h = NULL;
+      if (hv2ourfah(aMY_CXT_ h, &RETVAL) <= 0)
+	    croak("Can not parse input parameters\n");
+   OUTPUT:
+      RETVAL
+
+void
+ourfa_hash_dump(h, stream)
+   ourfa_hash_t *h
+   FILE *stream
+   CODE:
+      ourfa_hash_dump(h, stream, "%s", "");
+
+ourfa_hash_t *
+ourfa_hash_clone(h)
+   ourfa_hash_t *h
+   CODE:
+      RETVAL = ourfa_hash_clone(h);
+      if (RETVAL == NULL)
+	 croak("%s: %s\n", "Ourfa::Hash::clone", "Can not clone hash");
+   OUTPUT:
+      RETVAL
+
+void
+ourfa_hash_save(h, fname)
+   ourfa_hash_t *h
+   const char *fname
+   PREINIT:
+      int fd, res;
+   CODE:
+      fd = PerlLIO_open3(fname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+      if (fd < 0)
+	 croak("%s: %s: %s\n", "Ourfa::Hash::save", fname, strerror(errno));
+      res = ourfa_hash_save(h, fd);
+      if ((PerlLIO_close(fd) != 0) || (res != 0))
+	 croak("%s: %s: %s\n", "Ourfa::Hash::save", fname, "Can not save hash");
+
+ourfa_hash_t *
+ourfa_hash_map(CLASS, fname)
+   const char * CLASS
+   const char *fname
+   CODE:
+      PERL_UNUSED_VAR(CLASS);
+      RETVAL = ourfa_hash_map(fname);
+      if (RETVAL == NULL)
+	 croak("%s: %s: %s\n", "Ourfa::Hash::map", fname, "Can not map hash");
+   OUTPUT:
+      RETVAL
 
+void
+ourfa_hash_set_string(h, key, idx, val)
+   ourfa_hash_t *h
+   const char *key
+   const char *idx
+   const char *val
+   CODE:
+      if (ourfa_hash_set_string(h, key, idx, val) != 0)
+	 croak("%s: Can not set %s(%s)\n", "Ourfa::Hash::set_string", key, idx);
+
+void
+ourfa_hash_DESTROY(h)
+      ourfa_hash_t *h
+   CODE:
+      PR("Now in Ourfa::Hash::DESTROY\n");
+      ourfa_hash_free(h);
 
 
 MODULE = Ourfa PACKAGE = Ourfa::FuncCall PREFIX = ourfa_func_call_
@@ -1368,12 +1480,19 @@ ourfa_func_call_new(CLASS, f, h)
    const char * CLASS
    ourfa_xmlapi_func_t *f
    ourfa_hash_t *h
+   PREINIT:
+      ourfa_hash_t *ctx_h;
    CODE:
       PERL_UNUSED_VAR(CLASS);
-      RETVAL=ourfa_func_call_ctx_new(f, h);
-      if (RETVAL == NULL)
+      /* Context owns its copy: Ourfa::Hash can be destroyed first */
+      ctx_h = ourfa_hash_clone(h);
+      if (ctx_h == NULL)
 	    croak("malloc error\n");
-      else
+      RETVAL=ourfa_func_call_ctx_new(f, ctx_h);
+      if (RETVAL == NULL) {
+	    ourfa_hash_free(ctx_h);
+	    croak("malloc error\n");
+      }else
 	 RETVAL->printf_err = ourfa_err_f_warn;
    OUTPUT:
       RETVAL
@@ -1397,6 +1516,17 @@ ourfa_func_call_resp_step(fctx, connection)
    ourfa_func_call_ctx_t *fctx
    ourfa_connection_t *connection
 
+void
+ourfa_func_call_start_call(fctx, connection)
+   ourfa_func_call_ctx_t *fctx
+   ourfa_connection_t *connection
+   PREINIT:
+      int res;
+   CODE:
+      res = ourfa_start_call(fctx, connection);
+      if (res != OURFA_OK)
+	    croak("%s: %s\n", "Ourfa::Func::Call::start_call", ourfa_error_strerror(res));
+
 NO_OUTPUT int
 ourfa_func_call_req(fctx, connection)
    ourfa_func_call_ctx_t *fctx
@@ -1433,7 +1563,9 @@ ourfa_hash_t *
 ourfa_func_call_hash(fctx)
    ourfa_func_call_ctx_t *fctx
    CODE:
-      RETVAL=fctx->h;
+      RETVAL=ourfa_hash_clone(fctx->h);
+      if (RETVAL == NULL)
+	    croak("malloc error\n");
    OUTPUT:
       RETVAL
 
@@ -1450,9 +1582,61 @@ ourfa_func_call_cur_node(fctx)
 void
 ourfa_func_call_DESTROY(fctx)
       ourfa_func_call_ctx_t *fctx
+   PREINIT:
+      ourfa_hash_t *h;
    CODE:
       PR("Now in Ourfa::Func::Call::DESTROY\n");
+      h = fctx->h;
       ourfa_func_call_ctx_free(fctx);
+      ourfa_hash_free(h);
+
+
+MODULE = Ourfa PACKAGE = Ourfa::PreparedCall PREFIX = ourfa_prepared_call_
+
+ourfa_prepared_call_t *
+ourfa_prepared_call_new(CLASS, xmlapi, func)
+   const char * CLASS
+   ourfa_xmlapi_t *xmlapi
+   const char *func
+   CODE:
+      PERL_UNUSED_VAR(CLASS);
+      RETVAL=ourfa_prepare_call(xmlapi, func);
+      if (RETVAL == NULL)
+	    croak("Can not prepare call of function %s\n", func);
+   OUTPUT:
+      RETVAL
+
+void
+ourfa_prepared_call_call(pcall, connection, h)
+   ourfa_prepared_call_t *pcall
+   ourfa_connection_t *connection
+   ourfa_hash_t *h
+   PREINIT:
+      int res;
+   CODE:
+      res = ourfa_prepared_call(pcall, connection, h);
+      if (res != OURFA_OK)
+	    croak("%s: %s\n", "Ourfa::PreparedCall::call", ourfa_error_strerror(res));
+
+HV *
+ourfa_prepared_call_stats(pcall)
+   ourfa_prepared_call_t *pcall
+   PREINIT:
+      struct ourfa_prepared_call_stats_t stats;
+   CODE:
+      ourfa_prepared_call_stats(pcall, &stats);
+      RETVAL = (HV *)sv_2mortal((SV *)newHV());
+      hv_store(RETVAL, "calls", 5, newSVnv((NV)stats.calls), 0);
+      hv_store(RETVAL, "encoded", 7, newSVnv((NV)stats.encoded), 0);
+   OUTPUT:
+      RETVAL
+
+void
+ourfa_prepared_call_DESTROY(pcall)
+      ourfa_prepared_call_t *pcall
+   CODE:
+      PR("Now in Ourfa::PreparedCall::DESTROY\n");
+      ourfa_prepared_call_free(pcall);
 
 
 MODULE = Ourfa PACKAGE = Ourfa::ScriptCall PREFIX = ourfa_script_call_
@@ -13,7 +13,9 @@ use Ourfa::Connection;
 use Ourfa::Xmlapi;
 use Ourfa::Xmlapi::Func;
 use Ourfa::Xmlapi::Func::Node;
+use Ourfa::Hash;
 use Ourfa::FuncCall;
+use Ourfa::PreparedCall;
 use Ourfa::ScriptCall;
 
 our @ISA = qw(Exporter);
@@ -0,0 +1,12 @@
+package Ourfa::PreparedCall;
+
+use 5.008008;
+use strict;
+use warnings;
+use Carp;
+
+our $VERSION = '530002.0.0';
+
+
+1;
+
@@ -1,6 +1,6 @@
 use strict;
 use warnings;
-use Test::More tests => 23;
+use Test::More tests => 41;
 use Socket;
 use Data::Dumper;
 BEGIN { use_ok('Ourfa');
@@ -13,6 +13,9 @@ isa_ok($xmlapi, "Ourfa::Xmlapi", "xmlapi is object of Ourfa::Xmlapi");
 can_ok($xmlapi, qw/
    load_apixml
    load_script
+   set_cache
+   set_lazy
+   freeze
    node_name_by_type
    node_type_by_name
    func
@@ -59,5 +62,55 @@ for(my $i=0; $i<5; $i++) {
    isa_ok($test2->xmlapi, "Ourfa::Xmlapi", "xmlapi ref cnt");
 }
 
+#lazy load
+$xmlapi = Ourfa::Xmlapi->new();
+$xmlapi->set_cache(0);
+$xmlapi->set_lazy(1);
+eval { $xmlapi->load_apixml("t/data/api1.xml"); };
+ok(!$@, "lazy load api xml");
+$test3 = $xmlapi->func('rpcf_test3');
+isa_ok($test3, "Ourfa::Xmlapi::Func", "lazy rpcf_test3");
+is($test3->id, -0xaaaa, "lazy test3 id");
+is($xmlapi->func('rpcf_test4'), undef, "lazy test4");
 
+#frozen
+$xmlapi = Ourfa::Xmlapi->new();
+$xmlapi->set_cache(0);
+$xmlapi->set_lazy(1);
+eval { $xmlapi->load_apixml("t/data/api1.xml"); };
+eval { $xmlapi->load_script("t/data/func1.xml", "func1"); };
+eval { $xmlapi->freeze; };
+ok(!$@, "freeze");
+eval { $xmlapi->load_script("t/data/func1.xml", "func1"); };
+ok($@, "load after freeze");
+$test3 = $xmlapi->func('rpcf_test3');
+isa_ok($test3, "Ourfa::Xmlapi::Func", "frozen rpcf_test3");
+is($test3->id, -0xaaaa, "frozen test3 id");
+isa_ok($xmlapi->func('func1'), "Ourfa::Xmlapi::Func", "frozen func1");
+eval { $xmlapi->freeze; };
+ok(!$@, "freeze twice");
+my $ref_cnt = $xmlapi->ref_cnt;
+my $fc = Ourfa::FuncCall->new($test3, Ourfa::Hash->new());
+$fc->start(1);
+is($xmlapi->ref_cnt, $ref_cnt, "frozen function call is not counted");
+$fc = undef;
+is($xmlapi->ref_cnt, $ref_cnt, "frozen function call is not counted after free");
+$test3 = undef;
 
+#functions taken before freeze
+$xmlapi = Ourfa::Xmlapi->new();
+$xmlapi->set_cache(0);
+eval { $xmlapi->load_apixml("t/data/api1.xml"); };
+eval { $xmlapi->load_script("t/data/func1.xml", "func1"); };
+$test3 = $xmlapi->func('rpcf_test3');
+$script = $xmlapi->func('func1');
+my $test3_out = $test3->out;
+eval { $xmlapi->freeze; };
+ok(!$@, "freeze with taken functions");
+is($test3->id, -0xaaaa, "test3 id after freeze");
+is($test3_out->children->type, OURFA_XMLAPI_NODE_INTEGER, "test3 output after freeze");
+$xmlapi = undef;
+is($test3->id, -0xaaaa, "test3 id after xmlapi destroyed");
+isa_ok($test3->xmlapi, "Ourfa::Xmlapi", "frozen xmlapi is kept by function");
+isa_ok($script->script, "Ourfa::Xmlapi::Func::Node", "script after freeze");
+$test3 = $test3_out = $script = undef;
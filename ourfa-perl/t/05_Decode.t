@@ -0,0 +1,168 @@
+use strict;
+use warnings;
+use Test::More;
+use Socket;
+use IO::Socket::INET;
+use File::Temp qw/tempfile/;
+use POSIX ();
+use Ourfa;
+
+# Response of rpcf_test_decode is decoded by the precompiled plan
+# (FuncCall->resp) and by the step interpreter (FuncCall->resp_step).
+# Both must leave the same values in the hash.
+
+Ourfa->enable_ipv6(0);
+
+my $listen = IO::Socket::INET->new(
+   Listen => 5,
+   LocalAddr => '127.0.0.1',
+   LocalPort => 0,
+   Proto => 'tcp',
+   ReuseAddr => 1
+);
+plan skip_all => "Can not listen on localhost: $!" unless $listen;
+
+my @cnts = (0, 1, 7, 300);
+plan tests => 2 + 3 * scalar(@cnts);
+
+sub attr { pack('nn', $_[0], length($_[1]) + 4) . $_[1] }
+sub pkt { my $b = join('', @_[1..$#_]); pack('CCn', $_[0], 0x23, length($b) + 4) . $b }
+sub val { attr(0x500, $_[0]) }
+sub term { attr(0x400, pack('N', 0)) }
+
+sub readn {
+   my ($c, $n) = @_;
+   my $buf = '';
+   while (length($buf) < $n) {
+      my $r = sysread($c, $buf, $n - length($buf), length($buf));
+      return undef unless $r;
+   }
+   return $buf;
+}
+
+sub read_pkt {
+   my $c = shift;
+   my $hdr = readn($c, 4);
+   return unless defined $hdr;
+   my ($code, $ver, $len) = unpack('CCn', $hdr);
+   my $body = readn($c, $len - 4);
+   my @attrs;
+   while (length($body)) {
+      my ($type, $size) = unpack('nn', $body);
+      push @attrs, [$type, substr($body, 4, $size - 4)];
+      $body = substr($body, $size);
+   }
+   return ($code, @attrs);
+}
+
+sub send_data {
+   my ($c, @attrs) = @_;
+   # Several packets to check the packet boundaries
+   while (my @part = splice(@attrs, 0, 40)) {
+      syswrite($c, pkt(0xc8, @part));
+   }
+}
+
+sub serve {
+   my $c = shift;
+   syswrite($c, pkt(0xc0, attr(0x600, 'x' x 16)));
+   read_pkt($c);
+   syswrite($c, pkt(0xc2));
+   while (1) {
+      my ($code, @attrs) = read_pkt($c);
+      last if !defined($code) || $code != 0xc9;
+      syswrite($c, pkt(0xc8, attr(0x300, $attrs[0][1])));
+      my @in;
+      while (1) {
+	 ($code, @attrs) = read_pkt($c);
+	 return unless defined $code;
+	 push @in, @attrs;
+	 last if grep { $_->[0] == 0x400 } @attrs;
+      }
+      my $cnt = unpack('N', $in[0][1]);
+      my @out = (val(pack('N', $cnt)));
+      for (my $r = 0; $r < $cnt; $r++) {
+	 my $n = $r % 3;
+	 push @out, val(pack('NN', $r >> 16, ($r * 65537) & 0xffffffff));
+	 push @out, val("login$r");
+	 push @out, val(pack('N', $n));
+	 push @out, val(pack('d>', $r + $_ / 4)) foreach (1..$n);
+	 push @out, val("note$r") if $n == 0;
+	 push @out, val(inet_aton("10.0." . ($r >> 8) . "." . ($r & 0xff)));
+      }
+      push @out, val("footer"), term();
+      send_data($c, @out);
+   }
+}
+
+my $port = $listen->sockport;
+my $pid = fork();
+BAIL_OUT("fork: $!") unless defined $pid;
+if ($pid == 0) {
+   # Do not outlive killed test
+   alarm(120);
+   while (my $c = $listen->accept) {
+      serve($c);
+      close($c);
+   }
+   POSIX::_exit(0);
+}
+close($listen);
+
+END {
+   local $?;
+   if ($pid) {
+      kill('TERM', $pid);
+      waitpid($pid, 0);
+   }
+}
+
+my $xmlapi = Ourfa::Xmlapi->new();
+$xmlapi->set_cache(0);
+eval { $xmlapi->load_apixml("t/data/api2.xml"); };
+ok(!$@, "load api xml");
+my $f = $xmlapi->func('rpcf_test_decode');
+isa_ok($f, "Ourfa::Xmlapi::Func", "rpcf_test_decode");
+
+my $conn = Ourfa::Connection->new();
+$conn->hostname("127.0.0.1:$port");
+$conn->timeout(10);
+$conn->open();
+
+sub hash_dump {
+   my $h = shift;
+   my ($fh, $fname) = tempfile(UNLINK => 1);
+   $h->dump($fh);
+   close($fh);
+   open($fh, '<', $fname) or die "$fname: $!";
+   local $/;
+   my $res = <$fh>;
+   close($fh);
+   return $res;
+}
+
+foreach my $cnt (@cnts) {
+   my $in = Ourfa::Hash->new({cnt => $cnt});
+
+   my $fc = Ourfa::FuncCall->new($f, $in);
+   $fc->start_call($conn);
+   $fc->req($conn);
+   $fc->resp($conn);
+   my $plan_dump = hash_dump($fc->hash);
+
+   $fc = Ourfa::FuncCall->new($f, $in);
+   $fc->start_call($conn);
+   $fc->req($conn);
+   $fc->start(0);
+   my $state;
+   do {
+      $state = $fc->resp_step($conn);
+   } while ($state != OURFA_FUNC_CALL_STATE_END);
+   my $step_dump = hash_dump($fc->hash);
+
+   like($plan_dump, qr/footer/, "$cnt rows: response decoded");
+   like($plan_dump, ($cnt ? qr/login/ : qr/^(?!.*login)/s), "$cnt rows: rows decoded");
+   is($plan_dump, $step_dump, "$cnt rows: plan and interpreter results are equal");
+}
+
+$conn->close();
@@ -0,0 +1,168 @@
+use strict;
+use warnings;
+use Test::More;
+use IO::Socket::INET;
+use File::Temp qw/tempfile/;
+use POSIX ();
+use Ourfa;
+
+# Request of rpcf_test_prepared is patched by Ourfa::PreparedCall when
+# the input shape is the same and encoded again otherwise. The server
+# returns received input: it must be the same as the input of the
+# request encoded from scratch by Ourfa::FuncCall.
+
+Ourfa->enable_ipv6(0);
+
+my $listen = IO::Socket::INET->new(
+   Listen => 5,
+   LocalAddr => '127.0.0.1',
+   LocalPort => 0,
+   Proto => 'tcp',
+   ReuseAddr => 1
+);
+plan skip_all => "Can not listen on localhost: $!" unless $listen;
+
+my @inputs = (
+   {cnt => 2, s => ['aa', 'bb'], v => [1, 2], x => [10, 20], flag => 0},
+   # Same shape: patched
+   {cnt => 2, s => ['cc', 'dd'], v => [3, 4], x => [30, 40], flag => 0},
+   {cnt => 2, s => ['ee', 'ff'], v => [5, 6], x => [50, 60], flag => 0},
+   # Loop counter left by the previous call
+   {cnt => 2, s => ['ee', 'ff'], v => [5, 6], x => [50, 60], i => 2, flag => 0},
+   # Other size of string
+   {cnt => 2, s => ['eee', 'ff'], v => [5, 6], x => [50, 60], flag => 0},
+   # Other branch of 'if'
+   {cnt => 2, s => ['eee', 'ff'], v => [5, 6], x => [50, 60], flag => 1, d => 2.5},
+   # Other count of 'for'
+   {cnt => 3, s => ['a', 'b', 'c'], v => [7, 8, 9], x => [50, 60], flag => 1, d => 3.5},
+   {cnt => 3, s => ['d', 'e', 'f'], v => [1, 2, 3], x => [70, 80], flag => 1, d => 4.5},
+);
+plan tests => 4 + scalar(@inputs);
+
+sub attr { pack('nn', $_[0], length($_[1]) + 4) . $_[1] }
+sub pkt { my $b = join('', @_[1..$#_]); pack('CCn', $_[0], 0x23, length($b) + 4) . $b }
+
+sub readn {
+   my ($c, $n) = @_;
+   my $buf = '';
+   while (length($buf) < $n) {
+      my $r = sysread($c, $buf, $n - length($buf), length($buf));
+      return undef unless $r;
+   }
+   return $buf;
+}
+
+sub read_pkt {
+   my $c = shift;
+   my $hdr = readn($c, 4);
+   return unless defined $hdr;
+   my ($code, $ver, $len) = unpack('CCn', $hdr);
+   my $body = readn($c, $len - 4);
+   my @attrs;
+   while (length($body)) {
+      my ($type, $size) = unpack('nn', $body);
+      push @attrs, [$type, substr($body, 4, $size - 4)];
+      $body = substr($body, $size);
+   }
+   return ($code, @attrs);
+}
+
+sub serve {
+   my $c = shift;
+   syswrite($c, pkt(0xc0, attr(0x600, 'x' x 16)));
+   read_pkt($c);
+   syswrite($c, pkt(0xc2));
+   while (1) {
+      my ($code, @attrs) = read_pkt($c);
+      last if !defined($code) || $code != 0xc9;
+      syswrite($c, pkt(0xc8, attr(0x300, $attrs[0][1])));
+      my @in;
+      while (1) {
+	 ($code, @attrs) = read_pkt($c);
+	 return unless defined $code;
+	 push @in, @attrs;
+	 last if grep { $_->[0] == 0x400 } @attrs;
+      }
+      my $req = join(' ', map { sprintf('%x:%s', $_->[0], unpack('H*', $_->[1])) } @in);
+      syswrite($c, pkt(0xc8, attr(0x500, $req), attr(0x400, pack('N', 0))));
+   }
+}
+
+my $port = $listen->sockport;
+my $pid = fork();
+BAIL_OUT("fork: $!") unless defined $pid;
+if ($pid == 0) {
+   # Do not outlive killed test
+   alarm(120);
+   while (my $c = $listen->accept) {
+      serve($c);
+      close($c);
+   }
+   POSIX::_exit(0);
+}
+close($listen);
+
+END {
+   local $?;
+   if ($pid) {
+      kill('TERM', $pid);
+      waitpid($pid, 0);
+   }
+}
+
+my $xmlapi = Ourfa::Xmlapi->new();
+$xmlapi->set_cache(0);
+eval { $xmlapi->load_apixml("t/data/api2.xml"); };
+ok(!$@, "load api xml");
+my $f = $xmlapi->func('rpcf_test_prepared');
+
+my $conn = Ourfa::Connection->new();
+$conn->hostname("127.0.0.1:$port");
+$conn->timeout(10);
+$conn->open();
+
+sub req_of {
+   my $h = shift;
+   my ($fh, $fname) = tempfile(UNLINK => 1);
+   $h->dump($fh);
+   close($fh);
+   open($fh, '<', $fname) or die "$fname: $!";
+   local $/;
+   my $buf = <$fh>;
+   close($fh);
+   return $buf =~ /^\S+\s+req\s+(.*?)\s*$/m ? $1 : undef;
+}
+
+sub encoded_req {
+   my $fc = Ourfa::FuncCall->new($f, Ourfa::Hash->new(shift));
+   $fc->start_call($conn);
+   $fc->req($conn);
+   $fc->resp($conn);
+   return req_of($fc->hash);
+}
+
+my $pcall = Ourfa::PreparedCall->new($xmlapi, 'rpcf_test_prepared');
+my $n = 0;
+foreach my $in (@inputs) {
+   my $h = Ourfa::Hash->new($in);
+   $pcall->call($conn, $h);
+   my $patched = req_of($h);
+
+   my $encoded = encoded_req($in);
+
+   $n++;
+   ok(defined($patched) && ($patched eq $encoded), "call $n: prepared request is equal to encoded one")
+      or diag("prepared: " . ($patched // 'undef') . "\nencoded:  " . ($encoded // 'undef'));
+}
+
+my $stats = $pcall->stats;
+is($stats->{calls}, scalar(@inputs), "all calls counted");
+ok($stats->{encoded} < $stats->{calls}, "template is patched");
+
+# Numbers given as strings may have leading white space or be hex
+my $plain = encoded_req({cnt => 2, s => ['a', 'b'], v => [1, 16], x => [10, 20], flag => 1, d => 2.5});
+my $padded = encoded_req({cnt => ' 2', s => ['a', 'b'], v => ["\t1", '0x10'], x => [' 10', '20'], flag => 1, d => ' 2.5'});
+ok(defined($plain) && defined($padded) && ($plain eq $padded), "numbers with leading white space and hex are parsed")
+   or diag("plain:  " . ($plain // 'undef') . "\npadded: " . ($padded // 'undef'));
+
+$conn->close();
@@ -0,0 +1,81 @@
+use strict;
+use warnings;
+use Test::More tests => 14;
+use File::Temp qw/tempfile/;
+use Ourfa;
+
+# Copy-on-write clones and mapped snapshots of Ourfa::Hash must give the
+# same values as the source and must not change each other on write.
+
+sub hash_dump {
+   my $h = shift;
+   my ($fh, $fname) = tempfile(UNLINK => 1);
+   $h->dump($fh);
+   close($fh);
+   open($fh, '<', $fname) or die "$fname: $!";
+   local $/;
+   my $res = <$fh>;
+   close($fh);
+   return $res;
+}
+
+# undef elements: NULL strings and NULL children of nested arrays
+my $src = {
+   str => 'value',
+   num => 12,
+   dbl => 2.5,
+   s => ['a', undef, 'c', undef, 'e'],
+   n => [[1, 2], undef, [undef, 5], undef, [7]],
+   row => [{login => 'u1', id => 1}, undef, {login => 'u3', id => 3}],
+};
+
+my $h = Ourfa::Hash->new($src);
+my $before = hash_dump($h);
+like($before, qr/u3/, "source hash dumped");
+
+# Clone, write to the clone
+my $clone = $h->clone;
+is(hash_dump($clone), $before, "clone is equal to source");
+$clone->set_string('s', '1', 'changed');
+$clone->set_string('new', '0', 'added');
+is(hash_dump($h), $before, "write to clone does not change source");
+like(hash_dump($clone), qr/changed/, "clone is changed");
+$h->set_string('str', '0', 'source changed');
+unlike(hash_dump($clone), qr/source changed/, "write to source does not change clone");
+$h->set_string('str', '0', 'value');
+
+# Clone outlives the source
+$clone = $h->clone;
+$h = undef;
+is(hash_dump($clone), $before, "clone is intact after source freed");
+
+# Save and map
+my ($fh, $fname) = tempfile(UNLINK => 1);
+close($fh);
+eval { $clone->save($fname); };
+ok(!$@, "save hash") or diag($@);
+my $mapped = Ourfa::Hash->map($fname);
+isa_ok($mapped, "Ourfa::Hash", "mapped hash");
+is(hash_dump($mapped), $before, "mapped hash is equal to saved one");
+
+# Write to mapped hash copies the value: mapping is read-only, the file
+# is not changed
+$mapped->set_string('s', '1', 'mapped changed');
+$mapped->set_string('n', '2,0', '6');
+like(hash_dump($mapped), qr/mapped changed/, "mapped hash is changed");
+is(hash_dump(Ourfa::Hash->map($fname)), $before, "file is not changed by write to mapped hash");
+
+# Clone of mapped hash outlives it
+$mapped = Ourfa::Hash->map($fname);
+my $mclone = $mapped->clone;
+$mapped = undef;
+is(hash_dump($mclone), $before, "clone is intact after mapped hash freed");
+
+# Snapshot of mapped hash
+my ($fh2, $fname2) = tempfile(UNLINK => 1);
+close($fh2);
+$mclone->save($fname2);
+is(hash_dump(Ourfa::Hash->map($fname2)), $before, "mapped hash saved again");
+
+eval { Ourfa::Hash->map($fname . ".none"); };
+ok($@, "map of missing file fails");
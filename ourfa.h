@@ -105,7 +105,7 @@ typedef enum {
 } ourfa_attr_data_type_t;
 
 typedef struct ourfa_pkt_t ourfa_pkt_t;
-typedef struct _xmlHashTable ourfa_hash_t;
+typedef struct ourfa_hash_t ourfa_hash_t;
 typedef struct ourfa_ssl_ctx_t ourfa_ssl_ctx_t;
 typedef struct ourfa_connection_t ourfa_connection_t;
 typedef struct ourfa_xmlapi_t ourfa_xmlapi_t;
@@ -123,6 +123,26 @@ typedef struct ourfa_attr_hdr_t {
 
 typedef int ourfa_err_f_t (int err_code, void *user_ctx, const char *fmt, ...);
 
+/*
+ * Streaming response callbacks. row_begin/row_end are called on each
+ * iteration of <for> loops of the function output, depth is 0 for top
+ * level loops. val_* are called for each received value. Any of them can
+ * be NULL. Non-zero return value aborts the call.
+ * Rows of top level loops after the first one overwrite each other in
+ * the hash, so memory use does not depend on the number of rows.
+ * Supported for functions with decode plan only (no set, error, call
+ * and other side-effect nodes in output).
+ */
+typedef struct ourfa_row_cb_t {
+   int (*row_begin)(void *user_ctx, const char *loop, unsigned depth, long long i);
+   int (*row_end)(void *user_ctx, const char *loop, unsigned depth, long long i);
+   int (*val_int)(void *user_ctx, const char *name, int val);
+   int (*val_long)(void *user_ctx, const char *name, long long val);
+   int (*val_double)(void *user_ctx, const char *name, double val);
+   int (*val_string)(void *user_ctx, const char *name, const char *val);
+   int (*val_ip)(void *user_ctx, const char *name, const struct sockaddr *val);
+} ourfa_row_cb_t;
+
 unsigned ourfa_lib_version();
 
 /* Packet */
@@ -192,6 +212,13 @@ int ourfa_pkt_get_double (const ourfa_attr_hdr_t *attr, double *res);
 int ourfa_pkt_get_string (const ourfa_attr_hdr_t *attr, char **res);
 int ourfa_pkt_get_ip     (const ourfa_attr_hdr_t *attr, struct sockaddr *res);
 
+/* Replace value of attribute with value of the same size */
+int ourfa_pkt_set_int    (ourfa_attr_hdr_t *attr, int val);
+int ourfa_pkt_set_long   (ourfa_attr_hdr_t *attr, long long val);
+int ourfa_pkt_set_double (ourfa_attr_hdr_t *attr, double val);
+int ourfa_pkt_set_string (ourfa_attr_hdr_t *attr, const char *val);
+int ourfa_pkt_set_ip     (ourfa_attr_hdr_t *attr, const struct sockaddr *val);
+
 const char *ourfa_pkt_attr_type2str(unsigned attr_type);
 unsigned    ourfa_pkt_is_valid_attr_type(unsigned attr_type);
 const char *ourfa_pkt_code2str(unsigned pkt_code);
@@ -203,6 +230,9 @@ void ourfa_pkt_dump(const ourfa_pkt_t *pkt, FILE *stream, const char *annotation
 /* IN/out parameters  */
 ourfa_hash_t *ourfa_hash_new(int size);
 void ourfa_hash_free(ourfa_hash_t *h);
+ourfa_hash_t *ourfa_hash_clone(ourfa_hash_t *h);
+int ourfa_hash_save(ourfa_hash_t *h, int fd);
+ourfa_hash_t *ourfa_hash_map(const char *path);
 int ourfa_hash_set_int(ourfa_hash_t *h, const char *key, const char *idx, int val);
 int ourfa_hash_set_long(ourfa_hash_t *h, const char *key, const char *idx, long long val);
 int ourfa_hash_set_double(ourfa_hash_t *h, const char *key, const char *idx, double val);
@@ -210,6 +240,8 @@ int ourfa_hash_set_string(ourfa_hash_t *h, const char *key, const char *idx, con
 int ourfa_hash_set_ip(ourfa_hash_t *h, const char *key, const char *idx, const struct sockaddr *val);
 int ourfa_hash_copy_val(ourfa_hash_t *h, const char *dst_key, const char *dst_idx,
       const char *src_key, const char *src_idx);
+int ourfa_hash_copy_rows(ourfa_hash_t *dst, const char *key, unsigned dst_first,
+      ourfa_hash_t *src, unsigned src_first, unsigned cnt);
 void ourfa_hash_unset(ourfa_hash_t *h, const char *key);
 
 int ourfa_hash_get_int(ourfa_hash_t *h, const char *key, const char *idx, int *res);
@@ -217,6 +249,8 @@ int ourfa_hash_get_long(ourfa_hash_t *h, const char *key, const char *idx, long
 int ourfa_hash_get_double(ourfa_hash_t *h, const char *key, const char *idx, double *res);
 int ourfa_hash_get_string(ourfa_hash_t *h, const char *key, const char *idx, char **res);
 int ourfa_hash_get_ip(ourfa_hash_t *h, const char *key, const char *idx, struct sockaddr *res);
+const char *ourfa_hash_peek_string(ourfa_hash_t *h, const char *key, const char *idx,
+      char *buf, size_t buf_size);
 int ourfa_hash_get_arr_size(ourfa_hash_t *h, const char *key, const char *idx, unsigned *res);
 void ourfa_hash_dump(ourfa_hash_t *h, FILE *stream, const char *annotation_fmt, ...);
 int ourfa_hash_parse_idx_list(ourfa_hash_t *h, const char *idx_list,
@@ -230,6 +264,15 @@ void ourfa_ip_set(struct sockaddr *dst, in_addr_t ip);
 int ourfa_ip_ntop(const struct sockaddr *sa, char *dst, socklen_t dst_size);
 int ourfa_parse_ip(const char *str, struct sockaddr_storage *res);
 
+/* Numbers in C locale. Doubles are written as shortest round-trip string */
+#define OURFA_NUM_STRLEN 32
+int ourfa_format_int(int val, char *dst, size_t dst_size);
+int ourfa_format_long(long long val, char *dst, size_t dst_size);
+int ourfa_format_double(double val, char *dst, size_t dst_size);
+int ourfa_parse_int(const char *str, int *res);
+int ourfa_parse_long(const char *str, long long *res);
+int ourfa_parse_double(const char *str, double *res);
+
 /* SSL CTX  */
 ourfa_ssl_ctx_t *ourfa_ssl_ctx_new();
 void  ourfa_ssl_ctx_free(ourfa_ssl_ctx_t *ctx);
@@ -301,6 +344,7 @@ int   ourfa_connection_read_long(ourfa_connection_t *conn, unsigned type, long l
 int   ourfa_connection_read_double(ourfa_connection_t *conn, unsigned type, double *val);
 int   ourfa_connection_read_string(ourfa_connection_t *conn, unsigned type, char **val);
 int   ourfa_connection_read_ip(ourfa_connection_t *conn, unsigned type, struct sockaddr *val);
+int   ourfa_connection_skip_attr(ourfa_connection_t *conn, unsigned type);
 
 int   ourfa_connection_write_attr(ourfa_connection_t *conn, unsigned type,
       size_t size, const void *data);
@@ -322,12 +366,132 @@ const ourfa_attr_hdr_t *ourfa_connection_rbuf_cur_attr(ourfa_connection_t *conn)
 const char *ourfa_login_type2str(unsigned login_type);
 unsigned    ourfa_is_valid_login_type(unsigned login_type);
 
+int ourfa_connection_start_func_call(ourfa_connection_t *connection, int func_id);
+int ourfa_start_call_by_id(ourfa_connection_t *connection, int func_id);
 int ourfa_start_call(ourfa_func_call_ctx_t *fctx,
       ourfa_connection_t *connection);
 int ourfa_call(ourfa_connection_t *connection,
       ourfa_xmlapi_t *xmlapi,
       const char *func,
       ourfa_hash_t *globals);
+int ourfa_call_rows(ourfa_connection_t *connection,
+      ourfa_xmlapi_t *xmlapi,
+      const char *func,
+      ourfa_hash_t *globals,
+      const ourfa_row_cb_t *cb,
+      void *user_ctx);
+/*
+ * Same, output values not listed in NULL terminated fields are not stored
+ * (see ourfa_func_call_set_fields()). NULL - all values.
+ */
+int ourfa_call_fields(ourfa_connection_t *connection,
+      ourfa_xmlapi_t *xmlapi,
+      const char *func,
+      ourfa_hash_t *globals,
+      const char * const *fields,
+      const ourfa_row_cb_t *cb,
+      void *user_ctx);
+
+/*
+ * Call function with from/to input parameters for chunks of [from, to)
+ * range over conn_cnt connections. Chunk results are merged into globals
+ * in range order: rows of top level loops are appended, loop counts are
+ * summed up. If chunk_f is not NULL, it is called in range order for
+ * result of each chunk instead.
+ */
+typedef int ourfa_range_chunk_f(void *user_ctx, ourfa_hash_t *h,
+      long long from, long long to);
+int ourfa_call_range(ourfa_connection_t **conns,
+      unsigned conn_cnt,
+      ourfa_xmlapi_t *xmlapi,
+      const char *func,
+      ourfa_hash_t *globals,
+      const char *from_param,
+      const char *to_param,
+      long long from,
+      long long to,
+      long long chunk_size,
+      ourfa_range_chunk_f *chunk_f,
+      void *user_ctx);
+
+/*
+ * Result cache of read-only functions (call_cache.c).
+ * ourfa_call_cached() returns result of the previous call of the function
+ * with the same input variables if it is not older than TTL of the
+ * function. TTL 0 - function is not cached (default_ttl is used for
+ * functions without own TTL). Scripts are never cached. max_bytes - memory
+ * budget, least recently used results are evicted. Use one cache per
+ * server and login: results depend on access rights.
+ * Cache is thread safe. Concurrent calls with the same input are sent to
+ * the server once, other callers get the same result (or error code).
+ */
+typedef struct ourfa_call_cache_t ourfa_call_cache_t;
+struct ourfa_call_cache_stats_t {
+   unsigned long long hits;
+   unsigned long long misses;
+   unsigned long long evictions;
+   unsigned long long coalesced; /* Callers served by a call in progress */
+   unsigned entries;
+   size_t bytes;
+};
+ourfa_call_cache_t *ourfa_call_cache_new(size_t max_bytes, unsigned default_ttl);
+void ourfa_call_cache_free(ourfa_call_cache_t *cache);
+int  ourfa_call_cache_set_ttl(ourfa_call_cache_t *cache, const char *func,
+      unsigned ttl);
+/* func NULL - drop all results  */
+void ourfa_call_cache_invalidate(ourfa_call_cache_t *cache,
+      ourfa_xmlapi_t *xmlapi, const char *func);
+void ourfa_call_cache_stats(ourfa_call_cache_t *cache,
+      struct ourfa_call_cache_stats_t *res);
+int ourfa_call_cached(ourfa_call_cache_t *cache,
+      ourfa_connection_t *connection,
+      ourfa_xmlapi_t *xmlapi,
+      const char *func,
+      ourfa_hash_t *globals);
+
+/*
+ * Prepared calls (func_call.c).
+ * Request of the function is encoded once, next calls with the same
+ * input shape patch values of the parameters in place. Request is encoded
+ * again when 'if' or 'for' nodes of the input depend on changed variables
+ * or size of a value changes. Input with other nodes is always encoded.
+ */
+typedef struct ourfa_prepared_call_t ourfa_prepared_call_t;
+struct ourfa_prepared_call_stats_t {
+   unsigned long long calls;
+   unsigned long long encoded; /* Requests encoded without template */
+};
+ourfa_prepared_call_t *ourfa_prepare_call(ourfa_xmlapi_t *xmlapi,
+      const char *func);
+void ourfa_prepared_call_free(ourfa_prepared_call_t *pcall);
+void ourfa_prepared_call_stats(ourfa_prepared_call_t *pcall,
+      struct ourfa_prepared_call_stats_t *res);
+int ourfa_prepared_call(ourfa_prepared_call_t *pcall,
+      ourfa_connection_t *connection,
+      ourfa_hash_t *globals);
+
+/*
+ * Result cache shared between processes (call_cache.c).
+ * Results are hash snapshots (ourfa_hash_save()) in directory dir, one
+ * file per function and input variables. scope - server, login and other
+ * connection parameters results depend on.
+ * ourfa_shared_cache_get() returns mapped result not older than ttl
+ * seconds. Otherwise returns NULL and holds lock of the entry: other
+ * processes and threads asking for the same result wait until
+ * ourfa_shared_cache_put() stores result of the call,
+ * ourfa_shared_cache_release() or ourfa_shared_cache_free() is called.
+ * Lock is waited for at most 30 seconds.
+ */
+typedef struct ourfa_shared_cache_t ourfa_shared_cache_t;
+ourfa_shared_cache_t *ourfa_shared_cache_new(const char *dir,
+      const char *scope, unsigned ttl);
+void ourfa_shared_cache_free(ourfa_shared_cache_t *cache);
+ourfa_hash_t *ourfa_shared_cache_get(ourfa_shared_cache_t *cache,
+      ourfa_xmlapi_t *xmlapi,
+      const char *func,
+      ourfa_hash_t *globals);
+int ourfa_shared_cache_put(ourfa_shared_cache_t *cache, ourfa_hash_t *res);
+void ourfa_shared_cache_release(ourfa_shared_cache_t *cache);
 
 /* Error  */
 const char *ourfa_error_strerror(int err_code);
@@ -346,9 +510,14 @@ void            ourfa_xmlapi_free(ourfa_xmlapi_t *api);
 int             ourfa_xmlapi_set_err_f(ourfa_xmlapi_t *xmlapi, ourfa_err_f_t *f, void *user_ctx);
 ourfa_err_f_t  *ourfa_xmlapi_err_f(ourfa_xmlapi_t *xmlapi);
 void           *ourfa_xmlapi_err_ctx(ourfa_xmlapi_t *xmlapi);
+int             ourfa_xmlapi_set_cache(ourfa_xmlapi_t *xmlapi, int enable);
+int             ourfa_xmlapi_set_lazy(ourfa_xmlapi_t *xmlapi, int enable);
+int             ourfa_xmlapi_freeze(ourfa_xmlapi_t *xmlapi);
 
 const char     *ourfa_xmlapi_node_name_by_type(int node_type);
 int             ourfa_xmlapi_node_type_by_name(const char *node_name);
+/* Thread-safe, lazy loads are serialized. Loading files and freeze must
+ * not run concurrently with it */
 ourfa_xmlapi_func_t  *ourfa_xmlapi_func(ourfa_xmlapi_t *api, const char *name);
 ourfa_xmlapi_func_t *ourfa_xmlapi_func_ref(ourfa_xmlapi_func_t  *func);
 void            ourfa_xmlapi_func_deref(ourfa_xmlapi_func_t  *func);
@@ -362,6 +531,29 @@ struct ourfa_xmlapi_t {
 
    unsigned ref_cnt;
 
+   /* Precompiled cache: 1 - load definitions from/save to <file>.cache */
+   unsigned use_cache;
+   struct ourfa_xmlapi_image_t *images;
+
+   /* Lazy mode: api.xml functions are parsed on first ourfa_xmlapi_func() */
+   unsigned use_lazy;
+   struct ourfa_xmlapi_lazy_t *lazy;
+
+   /* Definition nodes and programs are allocated from the arena,
+    * strings are interned in the dictionary. Both freed with xmlapi */
+   struct ourfa_xmlapi_arena_t *arena;
+   struct _xmlDict *dict;
+
+   /* Frozen: definitions are read-only in one block, its functions are
+    * not reference counted and xmlapi is kept until exit.
+    * See ourfa_xmlapi_freeze() */
+   unsigned frozen;
+   /* Definitions replaced by freeze while xmlapi was referenced: functions
+    * taken before freeze still use them and are counted */
+   struct ourfa_xmlapi_image_t *old_images;
+   struct ourfa_xmlapi_arena_t *old_arena;
+   struct _xmlDict *old_dict;
+
    ourfa_err_f_t *printf_err;
    void *err_ctx;
 };
@@ -460,9 +652,80 @@ struct ourfa_xmlapi_func_node_t {
       struct {
 	 char *var;
       } n_out;
+      struct {
+	 struct ourfa_xmlapi_prog_t *prog;
+      } n_root;
    } n;
 };
 
+/* Compiled function definition  */
+enum ourfa_xmlapi_op_t {
+   OURFA_XMLAPI_OP_NODE,       /* INTEGER, STRING, LONG, DOUBLE, IP, MESSAGE */
+   OURFA_XMLAPI_OP_IF,
+   OURFA_XMLAPI_OP_SET,
+   OURFA_XMLAPI_OP_FOR,
+   OURFA_XMLAPI_OP_BREAK,
+   OURFA_XMLAPI_OP_ERROR,
+   OURFA_XMLAPI_OP_CALL,
+   OURFA_XMLAPI_OP_PARAMETER,
+   OURFA_XMLAPI_OP_MATH,
+   OURFA_XMLAPI_OP_ENDIF,
+   OURFA_XMLAPI_OP_ENDFOR,
+   OURFA_XMLAPI_OP_ENDCALL,
+   OURFA_XMLAPI_OP_END
+};
+
+/* Numeric attribute: constant or name of variable / builtin function */
+struct ourfa_xmlapi_operand_t {
+   const char *var; /* NULL - constant */
+   long long val;
+};
+
+/* Limits of response decode plan (ourfa_xmlapi_prog_t.decodable) */
+#define OURFA_XMLAPI_DECODE_MAX_IDX   4
+#define OURFA_XMLAPI_DECODE_MAX_DEPTH 8
+
+struct ourfa_xmlapi_insn_t {
+   enum ourfa_xmlapi_op_t op;
+   /* IF, FOR, CALL: index of the block end instruction
+    * ENDIF, ENDFOR, ENDCALL: index of the block head
+    * BREAK: index of ENDFOR of the enclosing loop
+    */
+   unsigned jmp;
+   /* Index of the end instruction of the enclosing block */
+   unsigned up;
+   ourfa_xmlapi_func_node_t *node;
+   union {
+      struct {
+	 struct ourfa_xmlapi_operand_t from;
+	 struct ourfa_xmlapi_operand_t count;
+	 unsigned depth; /* decodable programs only */
+      } i_for;
+      struct {
+	 unsigned is_const;
+	 double value;
+      } i_if;
+      /* Value nodes of decodable programs */
+      struct {
+	 unsigned col; /* Variable slot  */
+	 unsigned idx_cnt;
+	 struct {
+	    unsigned is_loop; /* 1 - val is depth of FOR, 0 - constant */
+	    unsigned val;
+	 } idx[OURFA_XMLAPI_DECODE_MAX_IDX];
+      } i_val;
+   } a;
+};
+
+struct ourfa_xmlapi_prog_t {
+   unsigned insn_cnt;
+   /* Only typed values, FOR and IF: response can be decoded
+    * without the step machine */
+   unsigned decodable;
+   unsigned col_cnt;
+   struct ourfa_xmlapi_insn_t insn[];
+};
+
 struct ourfa_xmlapi_func_t {
    ourfa_xmlapi_t *xmlapi;
    int id;
@@ -495,6 +758,8 @@ struct ourfa_func_call_ctx_t {
       OURFA_FUNC_CALL_STATE_END
    } state;
    ourfa_xmlapi_func_node_t *cur;
+   const struct ourfa_xmlapi_insn_t *insn;
+   unsigned pc;
 
    unsigned err;
 
@@ -503,6 +768,12 @@ struct ourfa_func_call_ctx_t {
 
    ourfa_err_f_t *printf_err;
    void *err_ctx;
+
+   const ourfa_row_cb_t *row_cb;
+   void *row_ctx;
+
+   /* Output instructions with values not requested by caller */
+   unsigned char *skip;
 };
 
 struct ourfa_script_call_ctx_t {
@@ -525,6 +796,10 @@ struct ourfa_script_call_ctx_t {
 ourfa_func_call_ctx_t *ourfa_func_call_ctx_new(struct ourfa_xmlapi_func_t *f,
       ourfa_hash_t *h);
 void ourfa_func_call_ctx_free(ourfa_func_call_ctx_t *fctx);
+int ourfa_func_call_set_row_cb(ourfa_func_call_ctx_t *fctx,
+      const ourfa_row_cb_t *cb, void *user_ctx);
+int ourfa_func_call_set_fields(ourfa_func_call_ctx_t *fctx,
+      const char * const *fields);
 
 int ourfa_func_call_start(ourfa_func_call_ctx_t *fctx, unsigned is_req);
 int ourfa_func_call_step(ourfa_func_call_ctx_t *fctx);
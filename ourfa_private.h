@@ -30,8 +30,69 @@
 /* Locale-insensitive strtod */
 extern double ourfa_strtod_c(const char *s00, char **se);
 
+#ifndef WIN32
+/* dtoa.c, renamed at build time. Not thread-safe, used under lock in numfmt.c */
+extern double ourfa_dtoa_strtod(const char *s00, char **se);
+extern char *ourfa_dtoa(double d, int mode, int ndigits,
+      int *decpt, int *sign, char **rve);
+extern void ourfa_freedtoa(char *s);
+#endif
+
+/* Reference counters of objects shared between threads */
+#ifdef _MSC_VER
+#define ourfa_atomic_inc(p) ((unsigned)InterlockedIncrement((volatile LONG *)(p)))
+#define ourfa_atomic_dec(p) ((unsigned)InterlockedDecrement((volatile LONG *)(p)))
+#define ourfa_atomic_get(p) (*(volatile unsigned *)(p))
+#else
+#define ourfa_atomic_inc(p) __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define ourfa_atomic_dec(p) __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#define ourfa_atomic_get(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#endif
+
 /* asprintf */
 int ourfa_asprintf( char **ret, const char *format, ... );
 int ourfa_vasprintf( char **ret, const char *format, va_list ap);
 
+/* Direct element access for precompiled decoders (hash.c) */
+struct hash_val_t;
+struct hash_val_t *ourfa_hash_col(ourfa_hash_t *h, const char *key);
+int ourfa_hash_col_set_int(struct hash_val_t *col, const unsigned *idx,
+      unsigned idx_cnt, int val);
+int ourfa_hash_col_set_long(struct hash_val_t *col, const unsigned *idx,
+      unsigned idx_cnt, long long val);
+int ourfa_hash_col_set_double(struct hash_val_t *col, const unsigned *idx,
+      unsigned idx_cnt, double val);
+int ourfa_hash_col_set_string(struct hash_val_t *col, const unsigned *idx,
+      unsigned idx_cnt, char *val);
+int ourfa_hash_col_set_ip(struct hash_val_t *col, const unsigned *idx,
+      unsigned idx_cnt, const struct sockaddr *val);
+int ourfa_hash_col_isset(struct hash_val_t *col, const unsigned *idx,
+      unsigned idx_cnt);
+
+/* Shared values of hashes (hash.c)  */
+ourfa_hash_t *ourfa_hash_diff(ourfa_hash_t *before, ourfa_hash_t *after);
+int ourfa_hash_merge(ourfa_hash_t *dst, ourfa_hash_t *src);
+unsigned long long ourfa_hash_fingerprint(ourfa_hash_t *h, const char *key,
+      unsigned long long fp);
+unsigned long long ourfa_hash_fingerprint_idx(ourfa_hash_t *h,
+      const char *idx_list, const char * const *skip, unsigned skip_cnt,
+      unsigned long long fp);
+size_t ourfa_hash_mem_size(ourfa_hash_t *h);
+
+/* Precompiled XML API cache (xmlapi_cache.c) */
+struct ourfa_xmlapi_image_t {
+   struct ourfa_xmlapi_image_t *next;
+   char *data;
+   size_t size;
+   ourfa_xmlapi_func_t **funcs;
+   unsigned funcs_cnt;
+};
+int ourfa_xmlapi_image_save(const char *cache_file, const char *src_file,
+      ourfa_xmlapi_func_t * const *funcs, unsigned funcs_cnt);
+struct ourfa_xmlapi_image_t *ourfa_xmlapi_image_load(const char *cache_file,
+      const char *src_file);
+struct ourfa_xmlapi_image_t *ourfa_xmlapi_image_pack(
+      ourfa_xmlapi_func_t * const *funcs, unsigned funcs_cnt);
+void ourfa_xmlapi_image_free(struct ourfa_xmlapi_image_t *img);
+
 #endif  /* _OURFA_PRIVATE_H */
@@ -120,6 +120,9 @@ static int attr_list_insert_tail(struct attr_list_t *l,
 static int set_err(ourfa_pkt_t *pkt, const char *fmt, ...);
 static int increase_pkt_data_pool_size(ourfa_pkt_t *pkt, size_t add_size);
 static struct attr_list_t *list_by_attr_type(ourfa_pkt_t *pkt, unsigned attr_type);
+static void encode_u64(uint8_t *v, uint64_t v0);
+static int encode_ip(unsigned type, const struct sockaddr *ip,
+      uint8_t *v, size_t *size);
 
 static ourfa_pkt_t *pkt_new(unsigned pkt_code)
 {
@@ -274,14 +277,8 @@ int ourfa_pkt_add_string(ourfa_pkt_t *pkt, unsigned type, const char *val)
    return ourfa_pkt_add_attr(pkt, type, len, (const void *)val);
 }
 
-int ourfa_pkt_add_long(ourfa_pkt_t *pkt, unsigned type, long long val)
+static void encode_u64(uint8_t *v, uint64_t v0)
 {
-   uint8_t v[8];
-   unsigned long long v0 = (unsigned long long)val;
-
-   if (pkt == NULL)
-      return -1;
-
    v[0] = (v0 >> 56) & 0xff;
    v[1] = (v0 >> 48) & 0xff;
    v[2] = (v0 >> 40) & 0xff;
@@ -290,6 +287,41 @@ int ourfa_pkt_add_long(ourfa_pkt_t *pkt, unsigned type, long long val)
    v[5] = (v0 >> 16) & 0xff;
    v[6] = (v0 >> 8) & 0xff;
    v[7] = v0 & 0xff;
+}
+
+static int encode_ip(unsigned type, const struct sockaddr *ip,
+      uint8_t *v, size_t *size)
+{
+   if (ip->sa_family == AF_INET) {
+      const struct sockaddr_in *ip4 = (const struct sockaddr_in *)ip;
+      uint32_t v4;
+
+      /* XXX: OURFA_ATTR_SESSION_IP must be the same byte order as UTM server  */
+      if (type != OURFA_ATTR_SESSION_IP)
+         v4 = ip4->sin_addr.s_addr & 0xffffffff;
+      else
+         v4 = ntohl(ip4->sin_addr.s_addr & 0xffffffff);
+      memcpy(v, &v4, PKT_IP4_DATA_SIZE);
+      *size = PKT_IP4_DATA_SIZE;
+   } else if (ip->sa_family == AF_INET6) {
+      const struct sockaddr_in6 *ip6 = (const struct sockaddr_in6 *)ip;
+      memcpy(v, ip6->sin6_addr.s6_addr, PKT_IP6_DATA_SIZE);
+      *size = PKT_IP6_DATA_SIZE;
+   } else {
+      return -1;
+   }
+
+   return 0;
+}
+
+int ourfa_pkt_add_long(ourfa_pkt_t *pkt, unsigned type, long long val)
+{
+   uint8_t v[8];
+
+   if (pkt == NULL)
+      return -1;
+
+   encode_u64(v, (unsigned long long)val);
 
    return ourfa_pkt_add_attr(pkt, type, 8, (const void *)&v);
 }
@@ -303,38 +335,92 @@ int ourfa_pkt_add_double(ourfa_pkt_t *pkt, unsigned type, double val)
    }tmp0;
 
    tmp0.d = val;
-
-   v[0] = (tmp0.u >> 56) & 0xff;
-   v[1] = (tmp0.u >> 48) & 0xff;
-   v[2] = (tmp0.u >> 40) & 0xff;
-   v[3] = (tmp0.u >> 32) & 0xff;
-   v[4] = (tmp0.u >> 24) & 0xff;
-   v[5] = (tmp0.u >> 16) & 0xff;
-   v[6] = (tmp0.u >> 8) & 0xff;
-   v[7] = tmp0.u & 0xff;
+   encode_u64(v, tmp0.u);
 
    return ourfa_pkt_add_attr(pkt, type, sizeof(tmp0.u), (const void *)v);
 }
 
 int ourfa_pkt_add_ip(ourfa_pkt_t *pkt, unsigned type, const struct sockaddr *ip)
 {
-   if (ip->sa_family == AF_INET) {
-      const struct sockaddr_in *ip4 = (const struct sockaddr_in *)ip;
-      uint32_t v;
+   uint8_t v[PKT_IP6_DATA_SIZE];
+   size_t size;
 
-      /* XXX: OURFA_ATTR_SESSION_IP must be the same byte order as UTM server  */
-      if (type != OURFA_ATTR_SESSION_IP)
-         v = ip4->sin_addr.s_addr & 0xffffffff;
-      else
-         v = ntohl(ip4->sin_addr.s_addr & 0xffffffff);
-      return ourfa_pkt_add_attr(pkt, type, PKT_IP4_DATA_SIZE, (const void *)&v);
-   } else if (ip->sa_family == AF_INET6) {
-      const struct sockaddr_in6 *ip6 = (const struct sockaddr_in6 *)ip;
-      return ourfa_pkt_add_attr(pkt, type, PKT_IP6_DATA_SIZE,
-            (const void *)ip6->sin6_addr.s6_addr);
-   } else {
+   if (encode_ip(type, ip, v, &size) != 0)
       return -1;
-   }
+
+   return ourfa_pkt_add_attr(pkt, type, size, (const void *)v);
+}
+
+/*
+ * Replace value of attribute in place (prepared requests).
+ * Returns -1 if new value has other size.
+ */
+int ourfa_pkt_set_int(ourfa_attr_hdr_t *attr, int val)
+{
+   uint32_t v;
+
+   if ((attr == NULL) || (attr->data_length != 4))
+      return -1;
+
+   v = htonl((unsigned)val & 0xffffffff);
+   memcpy(attr->data, &v, 4);
+
+   return 0;
+}
+
+int ourfa_pkt_set_long(ourfa_attr_hdr_t *attr, long long val)
+{
+   if ((attr == NULL) || (attr->data_length != 8))
+      return -1;
+
+   encode_u64((uint8_t *)attr->data, (unsigned long long)val);
+
+   return 0;
+}
+
+int ourfa_pkt_set_double(ourfa_attr_hdr_t *attr, double val)
+{
+   union {
+      uint64_t u;
+      double d;
+   }tmp0;
+
+   if ((attr == NULL) || (attr->data_length != 8))
+      return -1;
+
+   tmp0.d = val;
+   encode_u64((uint8_t *)attr->data, tmp0.u);
+
+   return 0;
+}
+
+int ourfa_pkt_set_string(ourfa_attr_hdr_t *attr, const char *val)
+{
+   size_t len;
+
+   len = val ? strlen(val) : 0;
+   if ((attr == NULL) || (attr->data_length != len))
+      return -1;
+
+   if (len != 0)
+      memcpy(attr->data, val, len);
+
+   return 0;
+}
+
+int ourfa_pkt_set_ip(ourfa_attr_hdr_t *attr, const struct sockaddr *ip)
+{
+   uint8_t v[PKT_IP6_DATA_SIZE];
+   size_t size;
+
+   if ((attr == NULL)
+	 || (encode_ip(attr->attr_type, ip, v, &size) != 0)
+	 || (attr->data_length != size))
+      return -1;
+
+   memcpy(attr->data, v, size);
+
+   return 0;
 }
 
 size_t ourfa_pkt_space_left(const ourfa_pkt_t *pkt)
@@ -49,6 +49,7 @@
 #include <openssl/ssl.h>
 
 #include "ourfa.h"
+#include "ourfa_private.h"
 
 #ifdef WIN32
 #define DEFAULT_SSL_CERT "C:\\Program Files\\NetUP\\UTM5\\admin.crt"
@@ -108,9 +109,9 @@ void ourfa_ssl_ctx_free(ourfa_ssl_ctx_t *ctx)
    if (ctx == NULL)
       return;
 
-   assert(ctx->ref_cnt > 0);
+   assert(ourfa_atomic_get(&ctx->ref_cnt) > 0);
 
-   if (--ctx->ref_cnt == 0) {
+   if (ourfa_atomic_dec(&ctx->ref_cnt) == 0) {
       free(ctx->cert);
       free(ctx->key);
       free(ctx->cert_pass);
@@ -124,7 +125,7 @@ void ourfa_ssl_ctx_free(ourfa_ssl_ctx_t *ctx)
 ourfa_ssl_ctx_t *ourfa_ssl_ctx_ref(ourfa_ssl_ctx_t *ctx)
 {
    assert(ctx);
-   ctx->ref_cnt++;
+   ourfa_atomic_inc(&ctx->ref_cnt);
    return ctx;
 }
 
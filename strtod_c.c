@@ -44,6 +44,6 @@ double ourfa_strtod_c(const char *s00, char **se)
    return _strtod_l(s00, se, c_locale);
 }
 #else
-/* dtoa.c used */
+/* dtoa.c used (numfmt.c) */
 #endif
 
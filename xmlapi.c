@@ -42,15 +42,25 @@
 #include <libgen.h>
 #endif
 
+#include <sys/stat.h>
+
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
 
+#ifndef WIN32
+#include <pthread.h>
+#endif
+
 #include <openssl/ssl.h>
 
 #include <libxml/parser.h>
+#include <libxml/parserInternals.h>
+#include <libxml/SAX2.h>
 #include <libxml/tree.h>
+#include <libxml/dict.h>
 
 #include "ourfa.h"
 #include "ourfa_private.h"
@@ -62,6 +72,54 @@
 #endif
 #define FUNC_BY_NAME_HASH_SIZE 180
 
+/* Lazy load writes func_by_name and swaps libxml error handler: lookups
+ * of lazy xmlapi are serialized */
+#ifdef WIN32
+static SRWLOCK lazy_lock = SRWLOCK_INIT;
+#define lazy_lock_acquire() AcquireSRWLockExclusive(&lazy_lock)
+#define lazy_lock_release() ReleaseSRWLockExclusive(&lazy_lock)
+#else
+static pthread_mutex_t lazy_lock = PTHREAD_MUTEX_INITIALIZER;
+#define lazy_lock_acquire() pthread_mutex_lock(&lazy_lock)
+#define lazy_lock_release() pthread_mutex_unlock(&lazy_lock)
+#endif
+
+/* Function of api.xml not loaded yet  */
+struct lazy_func_t {
+   int id;
+   /* Position of '>' of the start tag and length up to the end of the
+    * end tag of the <function> element */
+   unsigned long start;
+   unsigned long len;
+};
+
+struct ourfa_xmlapi_lazy_t {
+   struct _xmlHashTable *funcs;
+   long long mtime;
+   long long size;
+};
+
+/* Chunk of the definitions arena */
+struct ourfa_xmlapi_arena_t {
+   struct ourfa_xmlapi_arena_t *next;
+   size_t size;
+   size_t used;
+};
+
+#define ARENA_CHUNK_SIZE 65536
+#define ARENA_ALIGN(_s) (((_s) + 7) & ~(size_t)7)
+
+/* State of SAX scan of api.xml  */
+struct lazy_scan_t {
+   ourfa_xmlapi_t *xmlapi;
+   xmlParserCtxtPtr ctxt;
+   unsigned depth;
+   char *name; /* Name of current function, NULL - skip */
+   int id;
+   unsigned long start;
+   int res;
+};
+
 struct t_nodes {
       char **dst;
       char *name;
@@ -94,7 +152,6 @@ static const struct {
    {OURFA_XMLAPI_NODE_OUT,       "out"}
 };
 
-static void xmlapi_func_free(void * payload, xmlChar *name);
 static void xml_generic_error_func(void *ctx, const char *msg, ...);
 static void xml_structured_error_func(void *ctx, xmlErrorPtr error);
 static ourfa_xmlapi_func_node_t *load_func_def(xmlNode *xml_root, ourfa_xmlapi_t *api, ourfa_xmlapi_func_t *f);
@@ -102,7 +159,17 @@ static int get_xml_attributes(xmlNode *xml_node,
       struct t_nodes *nodes,
       unsigned size,
       ourfa_xmlapi_t *api);
-static void free_func_def(ourfa_xmlapi_func_node_t *def);
+static void *xmlapi_alloc(ourfa_xmlapi_t *xmlapi, size_t size);
+static void arena_free(struct ourfa_xmlapi_arena_t *arena);
+static char *xmlapi_strdup(ourfa_xmlapi_t *xmlapi, const char *s);
+static int compile_func_def(ourfa_xmlapi_func_node_t *root, ourfa_xmlapi_t *xmlapi);
+static void compile_decode_plan(struct ourfa_xmlapi_prog_t *prog);
+static int load_cache(ourfa_xmlapi_t *xmlapi, const char *file, const char *func_name);
+static int lazy_scan(ourfa_xmlapi_t *xmlapi);
+static ourfa_xmlapi_func_t *lazy_load_func(ourfa_xmlapi_t *xmlapi, const char *name);
+static void lazy_free(struct ourfa_xmlapi_lazy_t *lazy);
+static void save_cache(ourfa_xmlapi_t *xmlapi, const char *file,
+      ourfa_xmlapi_func_t * const *funcs, unsigned funcs_cnt);
 void dump_func_definitions(ourfa_xmlapi_func_t *f, FILE *stream);
 
 
@@ -119,11 +186,28 @@ ourfa_xmlapi_t *ourfa_xmlapi_new()
    res->printf_err = ourfa_err_f_stderr;
    res->err_ctx = res;
    res->ref_cnt = 1;
+   res->use_cache = 0;
+   res->images = NULL;
+   res->use_lazy = 0;
+   res->lazy = NULL;
+   res->arena = NULL;
+   res->frozen = 0;
+   res->old_images = NULL;
+   res->old_arena = NULL;
+   res->old_dict = NULL;
 
    xmlSetStructuredErrorFunc(res, xml_structured_error_func);
 
+   res->dict = xmlDictCreate();
+   if (res->dict == NULL) {
+      free(res);
+      xmlSetStructuredErrorFunc(NULL, NULL);
+      return NULL;
+   }
+
    res->func_by_name = xmlHashCreate(FUNC_BY_NAME_HASH_SIZE);
    if (res->func_by_name == NULL) {
+      xmlDictFree(res->dict);
       free(res);
       res = NULL;
    }
@@ -153,10 +237,24 @@ int ourfa_xmlapi_set_err_f(ourfa_xmlapi_t *xmlapi, ourfa_err_f_t *f, void *user_
    return OURFA_OK;
 }
 
+int ourfa_xmlapi_set_cache(ourfa_xmlapi_t *xmlapi, int enable)
+{
+   assert(xmlapi);
+   xmlapi->use_cache = enable ? 1 : 0;
+   return OURFA_OK;
+}
+
+int ourfa_xmlapi_set_lazy(ourfa_xmlapi_t *xmlapi, int enable)
+{
+   assert(xmlapi);
+   xmlapi->use_lazy = enable ? 1 : 0;
+   return OURFA_OK;
+}
+
 ourfa_xmlapi_t *ourfa_xmlapi_ref(ourfa_xmlapi_t *xmlapi)
 {
    assert(xmlapi);
-   xmlapi->ref_cnt++;
+   ourfa_atomic_inc(&xmlapi->ref_cnt);
    return xmlapi;
 }
 
@@ -164,25 +262,78 @@ void ourfa_xmlapi_free(ourfa_xmlapi_t *api)
 {
    if (api == NULL)
       return;
-   assert(api->ref_cnt > 0);
+   assert(ourfa_atomic_get(&api->ref_cnt) > 0);
 
-   if (--api->ref_cnt == 0) {
+   if (ourfa_atomic_dec(&api->ref_cnt) == 0) {
       if (api->func_by_name)
-	 xmlHashFree(api->func_by_name, xmlapi_func_free);
+	 xmlHashFree(api->func_by_name, NULL);
+      ourfa_xmlapi_image_free(api->images);
+      lazy_free(api->lazy);
+      arena_free(api->arena);
+      if (api->dict)
+	 xmlDictFree(api->dict);
+      ourfa_xmlapi_image_free(api->old_images);
+      arena_free(api->old_arena);
+      if (api->old_dict)
+	 xmlDictFree(api->old_dict);
       free(api->file);
       free(api);
    }
 }
 
+static int parse_func_id(const char *str, int *id)
+{
+   char *p_end;
+
+   errno=0;
+   *id = (int)strtol(str, &p_end, 0);
+   if ((str[0] == '\0') || (*p_end != '\0') || errno == ERANGE)
+      return -1;
+   return 0;
+}
+
+/* Load input and output definitions of the function from the <function> node */
+static int load_func_io(ourfa_xmlapi_t *xmlapi, ourfa_xmlapi_func_t *f, xmlNode *func_node)
+{
+   xmlNode *n, *f_in, *f_out;
+
+   /* Find input and output parameters  */
+   f_in = f_out = NULL;
+   for (n=func_node->children; n; n=n->next) {
+      if ((n->type != XML_ELEMENT_NODE)
+	    || (n->name == NULL))
+	 continue;
+
+      if (xmlStrcasecmp(n->name, (const xmlChar *)"input") == 0)
+	 f_in = n;
+      else if (xmlStrcasecmp(n->name, (const xmlChar *)"output") == 0)
+	 f_out = n;
+      else {
+	 xmlapi->printf_err(OURFA_ERROR_XML,
+	       xmlapi->err_ctx,
+	       "Unknown node name `%s` for function `%s`. file: `%s` line: %hu content: `%s`",
+	       (const char *)n->name, f->name, xmlapi->file, func_node->line, (const char *)func_node->content);
+      }
+   } /* for */
+
+   /* Load function definitions  */
+   f->in = load_func_def(f_in, xmlapi, f);
+   if (f->in == NULL)
+      return OURFA_ERROR_XML;
+   f->out = load_func_def(f_out, xmlapi, f);
+   if (f->out == NULL)
+      return OURFA_ERROR_XML;
+
+   return OURFA_OK;
+}
+
 int ourfa_xmlapi_load_apixml(ourfa_xmlapi_t *xmlapi,  const char *file)
 {
    xmlDoc *xmldoc;
-   xmlNode *urfa_root, *cur_node, *n;
-   xmlNode *f_in, *f_out;
+   xmlNode *urfa_root, *cur_node;
    ourfa_xmlapi_func_t *f;
 
    xmlChar *prop_func_id;
-   char *p_end;
    int res;
 
    LIBXML_TEST_VERSION
@@ -191,6 +342,10 @@ int ourfa_xmlapi_load_apixml(ourfa_xmlapi_t *xmlapi,  const char *file)
    xmldoc = NULL;
    res = OURFA_OK;
 
+   if (xmlapi->frozen)
+      return xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
+	    "XML API is frozen");
+
    if (xmlapi->file != NULL) {
       return xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
 	    "File `%s` already loaded", xmlapi->file);
@@ -206,6 +361,22 @@ int ourfa_xmlapi_load_apixml(ourfa_xmlapi_t *xmlapi,  const char *file)
       goto load_file_end;
    }
 
+   if (xmlapi->use_cache && (load_cache(xmlapi, xmlapi->file, NULL) == 0))
+      return OURFA_OK;
+
+   if (xmlapi->use_lazy) {
+      res = lazy_scan(xmlapi);
+      /* Non UTF-8 file: offsets unknown, load all functions  */
+      if (res != OURFA_ERROR_NOT_IMPLEMENTED) {
+	 if (res != OURFA_OK) {
+	    free(xmlapi->file);
+	    xmlapi->file = NULL;
+	 }
+	 return res;
+      }
+      res = OURFA_OK;
+   }
+
    xmlSetStructuredErrorFunc(xmlapi, xml_structured_error_func);
 
    xmldoc = xmlReadFile(xmlapi->file, NULL, XML_PARSE_COMPACT);
@@ -247,7 +418,7 @@ int ourfa_xmlapi_load_apixml(ourfa_xmlapi_t *xmlapi,  const char *file)
       }
 
       len = strlen((const char *)prop_func_name);
-      f = (ourfa_xmlapi_func_t *)malloc(sizeof(*f)+len+2);
+      f = (ourfa_xmlapi_func_t *)xmlapi_alloc(xmlapi, sizeof(*f)+len+2);
       if (f == NULL) {
 	 res = xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
 	 xmlFree(prop_func_name);
@@ -265,63 +436,32 @@ int ourfa_xmlapi_load_apixml(ourfa_xmlapi_t *xmlapi,  const char *file)
 	       xmlapi->err_ctx,
 	       "ID not defined for function `%s`. file: `%s` line: %hu content: `%s`",
 	       f->name, xmlapi->file, cur_node->line, (const char *)cur_node->content);
-	 xmlapi_func_free(f, NULL);
 	 continue;
       }
-      errno=0;
-      f->id = (int)strtol((const char *)prop_func_id, &p_end, 0);
-      if ((*p_end != '\0') || errno == ERANGE) {
+      if (parse_func_id((const char *)prop_func_id, &f->id) != 0) {
 	 xmlapi->printf_err(
 	       OURFA_ERROR_XML,
 	       xmlapi->err_ctx,
 	       "Wrong ID for function `%s`. file: `%s` line: %hu content: `%s`",
 	       f->name, xmlapi->file, cur_node->line, (const char *)cur_node->content);
 	 xmlFree(prop_func_id);
-	 xmlapi_func_free(f, NULL);
 	 continue;
       }
       xmlFree(prop_func_id);
 
-      /* Find input and output parameters  */
-      f_in = f_out = NULL;
-      for (n=cur_node->children; n; n=n->next) {
-	 if ((n->type != XML_ELEMENT_NODE)
-	       || (n->name == NULL))
-	    continue;
-
-	 if (xmlStrcasecmp(n->name, (const xmlChar *)"input") == 0)
-	    f_in = n;
-	 else if (xmlStrcasecmp(n->name, (const xmlChar *)"output") == 0)
-	    f_out = n;
-	 else {
-	    xmlapi->printf_err(OURFA_ERROR_XML,
-		  xmlapi->err_ctx,
-		  "Unknown node name `%s` for function `%s`. file: `%s` line: %hu content: `%s`",
-		  (const char *)n->name, f->name, xmlapi->file, cur_node->line, (const char *)cur_node->content);
-	 }
-      } /* for */
-
-      /* Load function definitions  */
-      f->in = load_func_def(f_in, xmlapi, f);
-      if (f->in == NULL) {
-	 xmlapi_func_free(f, NULL);
-	 continue;
-      }
-      f->out = load_func_def(f_out, xmlapi, f);
-      if (f->out == NULL) {
-	 xmlapi_func_free(f, NULL);
+      if (load_func_io(xmlapi, f, cur_node) != OURFA_OK)
 	 continue;
-      }
 
-      if (xmlHashUpdateEntry(xmlapi->func_by_name, (const xmlChar *)f->name, f, xmlapi_func_free) < 0) {
+      if (xmlHashUpdateEntry(xmlapi->func_by_name, (const xmlChar *)f->name, f, NULL) < 0) {
 	 res = xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
 	       "Can not add function `%s` to hash. file: `%s` line: %hu content: `%s`",
 	       f->name, xmlapi->file, cur_node->line, (const char *)cur_node->content);
-	 xmlapi_func_free(f, NULL);
 	 break;
       }
    } /* foreach function  */
 
+   if ((res == OURFA_OK) && xmlapi->use_cache)
+      save_cache(xmlapi, xmlapi->file, NULL, 0);
 
    /* TODO: function by id  */
 
@@ -353,6 +493,10 @@ int ourfa_xmlapi_load_script(ourfa_xmlapi_t *xmlapi,  const char *file,
    assert(xmlapi);
    assert(file);
 
+   if (xmlapi->frozen)
+      return xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
+	    "XML API is frozen");
+
    xmldoc = NULL;
    res = OURFA_OK;
 
@@ -384,7 +528,7 @@ int ourfa_xmlapi_load_script(ourfa_xmlapi_t *xmlapi,  const char *file,
    }
 
    funcname_len = strlen(func_name);
-   f = (ourfa_xmlapi_func_t *)malloc(sizeof(*f)+funcname_len+2);
+   f = (ourfa_xmlapi_func_t *)xmlapi_alloc(xmlapi, sizeof(*f)+funcname_len+2);
    if (f == NULL) {
       res = xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
       free(file_dup);
@@ -405,6 +549,9 @@ int ourfa_xmlapi_load_script(ourfa_xmlapi_t *xmlapi,  const char *file,
       f->name[funcname_len-4] = '\0';
    }
 
+   if (xmlapi->use_cache && (load_cache(xmlapi, file, f->name) == 0))
+      return OURFA_OK;
+
    xmlSetStructuredErrorFunc(xmlapi, xml_structured_error_func);
 
    assert(xmlapi->func_by_name);
@@ -430,37 +577,558 @@ int ourfa_xmlapi_load_script(ourfa_xmlapi_t *xmlapi,  const char *file,
       goto load_script_end;
    }
 
-   if (xmlHashUpdateEntry(xmlapi->func_by_name, (const xmlChar *)f->name, f, xmlapi_func_free) < 0) {
+   if (xmlHashUpdateEntry(xmlapi->func_by_name, (const xmlChar *)f->name, f, NULL) < 0) {
       res = xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
 	    "Can not add function `%s` to hash.",
 	    f->name);
-      xmlapi_func_free(f, NULL);
       goto load_script_end;
    }
 
+   if (xmlapi->use_cache)
+      save_cache(xmlapi, file, &f, 1);
+
 load_script_end:
    xmlSetStructuredErrorFunc(NULL, NULL);
    if (xmldoc)
       xmlFreeDoc(xmldoc);
-   if ((res != OURFA_OK) && f )
-      xmlapi_func_free(f, NULL);
 
    return res;
 }
 
-static void xmlapi_func_free(void * payload, xmlChar *name)
+static void lazy_func_free(void *payload, const xmlChar *name)
+{
+   if (name) {};
+   free(payload);
+}
+
+static void lazy_free(struct ourfa_xmlapi_lazy_t *lazy)
+{
+   if (lazy == NULL)
+      return;
+   if (lazy->funcs)
+      xmlHashFree(lazy->funcs, lazy_func_free);
+   free(lazy);
+}
+
+static unsigned long lazy_scan_pos(xmlParserCtxtPtr ctxt)
+{
+   return ctxt->input->consumed
+      + (unsigned long)(ctxt->input->cur - ctxt->input->base);
+}
+
+static char *lazy_scan_attr(int nb_attributes, const xmlChar **attributes,
+      const char *name, int *not_found)
+{
+   int i;
+   char *res;
+   size_t len;
+
+   for (i=0; i < nb_attributes; i++) {
+      if (xmlStrcmp(attributes[i*5], (const xmlChar *)name) != 0)
+	 continue;
+      len = (size_t)(attributes[i*5+4] - attributes[i*5+3]);
+      res = malloc(len+1);
+      if (res == NULL)
+	 return NULL;
+      memcpy(res, attributes[i*5+3], len);
+      res[len] = '\0';
+      return res;
+   }
+   *not_found = 1;
+   return NULL;
+}
+
+static void lazy_scan_start(void *ctx, const xmlChar *localname,
+      const xmlChar *prefix, const xmlChar *URI,
+      int nb_namespaces, const xmlChar **namespaces,
+      int nb_attributes, int nb_defaulted, const xmlChar **attributes)
+{
+   struct lazy_scan_t *scan;
+   ourfa_xmlapi_t *xmlapi;
+   char *id;
+   int not_found;
+
+   if (prefix || URI || nb_namespaces || namespaces || nb_defaulted) {};
+
+   scan = (struct lazy_scan_t *)ctx;
+   xmlapi = scan->xmlapi;
+   scan->depth++;
+
+   if (scan->res != OURFA_OK)
+      return;
+
+   if (scan->depth == 1) {
+      if (xmlStrcasecmp(localname, (const xmlChar *) "urfa") != 0) {
+	 scan->res = xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
+	       "Document of the wrong type, root node != urfa");
+	 xmlStopParser(scan->ctxt);
+      }
+      return;
+   }
+
+   if ((scan->depth != 2)
+	 || (xmlStrcasecmp(localname, (const xmlChar *)"function") != 0))
+      return;
+
+   not_found = 0;
+   scan->name = lazy_scan_attr(nb_attributes, attributes, "name", &not_found);
+   if (scan->name == NULL) {
+      if (not_found)
+	 xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
+	       "Unnamed function found. file: `%s` line: %i",
+	       xmlapi->file, xmlSAX2GetLineNumber(scan->ctxt));
+      else {
+	 scan->res = xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
+	 xmlStopParser(scan->ctxt);
+      }
+      return;
+   }
+
+   id = lazy_scan_attr(nb_attributes, attributes, "id", &not_found);
+   if ((id == NULL) || (parse_func_id(id, &scan->id) != 0)) {
+      xmlapi->printf_err(OURFA_ERROR_XML,
+	    xmlapi->err_ctx,
+	    "%s ID for function `%s`. file: `%s` line: %i",
+	    id == NULL ? "Not defined" : "Wrong",
+	    scan->name, xmlapi->file, xmlSAX2GetLineNumber(scan->ctxt));
+      free(scan->name);
+      scan->name = NULL;
+   }
+   free(id);
+
+   scan->start = lazy_scan_pos(scan->ctxt);
+}
+
+static void lazy_scan_end(void *ctx, const xmlChar *localname,
+      const xmlChar *prefix, const xmlChar *URI)
+{
+   struct lazy_scan_t *scan;
+   struct lazy_func_t *lf;
+
+   if (localname || prefix || URI) {};
+
+   scan = (struct lazy_scan_t *)ctx;
+
+   if ((scan->depth-- != 2) || (scan->name == NULL))
+      return;
+
+   lf = malloc(sizeof(*lf));
+   if (lf == NULL) {
+      scan->res = scan->xmlapi->printf_err(OURFA_ERROR_SYSTEM,
+	    scan->xmlapi->err_ctx, NULL);
+      xmlStopParser(scan->ctxt);
+   }else {
+      lf->id = scan->id;
+      lf->start = scan->start;
+      lf->len = lazy_scan_pos(scan->ctxt) - scan->start;
+      if (xmlHashUpdateEntry(scan->xmlapi->lazy->funcs,
+	       (const xmlChar *)scan->name, lf, lazy_func_free) < 0) {
+	 free(lf);
+	 scan->res = scan->xmlapi->printf_err(OURFA_ERROR_XML, scan->xmlapi->err_ctx,
+	       "Can not add function `%s` to hash.", scan->name);
+	 xmlStopParser(scan->ctxt);
+      }
+   }
+
+   free(scan->name);
+   scan->name = NULL;
+}
+
+/* Record names, ids and positions of api.xml functions without building
+ * the document tree.
+ * Returns OURFA_ERROR_NOT_IMPLEMENTED if file is not in UTF-8: positions of
+ * the parser are in the converted text then */
+static int lazy_scan(ourfa_xmlapi_t *xmlapi)
+{
+   xmlSAXHandler sax;
+   xmlSAXHandlerPtr old_sax;
+   struct lazy_scan_t scan;
+   struct stat st;
+   int res;
+
+   if (stat(xmlapi->file, &st) != 0)
+      return xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx,
+	    "Can not stat file `%s`: %s", xmlapi->file, strerror(errno));
+
+   xmlapi->lazy = malloc(sizeof(*xmlapi->lazy));
+   if (xmlapi->lazy == NULL)
+      return xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
+   xmlapi->lazy->mtime = (long long)st.st_mtime;
+   xmlapi->lazy->size = (long long)st.st_size;
+   xmlapi->lazy->funcs = xmlHashCreate(FUNC_BY_NAME_HASH_SIZE);
+   if (xmlapi->lazy->funcs == NULL) {
+      lazy_free(xmlapi->lazy);
+      xmlapi->lazy = NULL;
+      return xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
+   }
+
+   memset(&sax, 0, sizeof(sax));
+   sax.initialized = XML_SAX2_MAGIC;
+   sax.startElementNs = lazy_scan_start;
+   sax.endElementNs = lazy_scan_end;
+
+   memset(&scan, 0, sizeof(scan));
+   scan.xmlapi = xmlapi;
+   scan.res = OURFA_OK;
+
+   xmlSetStructuredErrorFunc(xmlapi, xml_structured_error_func);
+
+   scan.ctxt = xmlCreateFileParserCtxt(xmlapi->file);
+   if (scan.ctxt == NULL)
+      res = OURFA_ERROR_XML;
+   else {
+      old_sax = scan.ctxt->sax;
+      scan.ctxt->sax = &sax;
+      scan.ctxt->userData = &scan;
+      xmlCtxtUseOptions(scan.ctxt, XML_PARSE_COMPACT);
+      xmlParseDocument(scan.ctxt);
+      scan.ctxt->sax = old_sax;
+
+      if (scan.res != OURFA_OK)
+	 res = scan.res;
+      else if (!scan.ctxt->wellFormed)
+	 res = OURFA_ERROR_XML;
+      else if ((scan.ctxt->input->buf != NULL)
+	    && (scan.ctxt->input->buf->encoder != NULL))
+	 res = OURFA_ERROR_NOT_IMPLEMENTED;
+      else if (scan.depth != 0)
+	 res = xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
+	       "Can not find XML Root Element");
+      else
+	 res = OURFA_OK;
+      xmlFreeParserCtxt(scan.ctxt);
+   }
+   free(scan.name);
+
+   xmlSetStructuredErrorFunc(NULL, NULL);
+
+   if (res != OURFA_OK) {
+      lazy_free(xmlapi->lazy);
+      xmlapi->lazy = NULL;
+   }
+
+   return res;
+}
+
+/* Parse function recorded by lazy_scan()  */
+static ourfa_xmlapi_func_t *lazy_load_func(ourfa_xmlapi_t *xmlapi, const char *name)
+{
+   static const char tag[] = "<function";
+   struct lazy_func_t *lf;
+   ourfa_xmlapi_func_t *f;
+   struct stat st;
+   xmlDoc *xmldoc;
+   xmlNode *root;
+   char *buf;
+   size_t len;
+   FILE *fp;
+
+   lf = xmlHashLookup(xmlapi->lazy->funcs, (const xmlChar *)name);
+   if (lf == NULL)
+      return NULL;
+
+   f = NULL;
+   xmldoc = NULL;
+   buf = NULL;
+
+   if ((stat(xmlapi->file, &st) != 0)
+	 || ((long long)st.st_mtime != xmlapi->lazy->mtime)
+	 || ((long long)st.st_size != xmlapi->lazy->size)) {
+      xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
+	    "File `%s` changed after load. Function `%s` not loaded",
+	    xmlapi->file, name);
+      goto lazy_load_end;
+   }
+
+   /* Element without attributes of the start tag: <function ...>  */
+   len = sizeof(tag)-1 + lf->len;
+   buf = malloc(len);
+   if (buf == NULL) {
+      xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
+      goto lazy_load_end;
+   }
+   memcpy(buf, tag, sizeof(tag)-1);
+   fp = fopen(xmlapi->file, "rb");
+   if (fp == NULL) {
+      xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx,
+	    "Can not open file `%s`: %s", xmlapi->file, strerror(errno));
+      goto lazy_load_end;
+   }
+   if ((fseek(fp, (long)lf->start, SEEK_SET) != 0)
+	 || (fread(buf + sizeof(tag)-1, 1, lf->len, fp) != lf->len)
+	 || (buf[sizeof(tag)-1] != '>' && buf[sizeof(tag)-1] != '/')
+	 || (buf[len-1] != '>')) {
+      fclose(fp);
+      xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
+	    "Can not read function `%s` from file `%s`", name, xmlapi->file);
+      goto lazy_load_end;
+   }
+   fclose(fp);
+
+   xmlSetStructuredErrorFunc(xmlapi, xml_structured_error_func);
+   xmldoc = xmlReadMemory(buf, (int)len, xmlapi->file, NULL, XML_PARSE_COMPACT);
+   xmlSetStructuredErrorFunc(NULL, NULL);
+   if (xmldoc == NULL)
+      goto lazy_load_end;
+   root = xmlDocGetRootElement(xmldoc);
+   if (root == NULL)
+      goto lazy_load_end;
+
+   len = strlen(name);
+   f = (ourfa_xmlapi_func_t *)xmlapi_alloc(xmlapi, sizeof(*f)+len+2);
+   if (f == NULL) {
+      xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
+      goto lazy_load_end;
+   }
+   f->in = f->out = f->script = NULL;
+   f->xmlapi = xmlapi;
+   f->id = lf->id;
+   memcpy(f->name, name, len+1);
+
+   if (load_func_io(xmlapi, f, root) != OURFA_OK) {
+      f = NULL;
+      goto lazy_load_end;
+   }
+
+   if (xmlHashUpdateEntry(xmlapi->func_by_name, (const xmlChar *)f->name, f, NULL) < 0) {
+      xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
+	    "Can not add function `%s` to hash.", f->name);
+      f = NULL;
+   }
+
+lazy_load_end:
+   /* Function is parsed only once, errors are not repeated  */
+   xmlHashRemoveEntry(xmlapi->lazy->funcs, (const xmlChar *)name, lazy_func_free);
+   if (xmldoc)
+      xmlFreeDoc(xmldoc);
+   free(buf);
+
+   return f;
+}
+
+static char *cache_file_name(const char *file)
+{
+   char *res;
+
+   if (ourfa_asprintf(&res, "%s.cache", file) <= 0)
+      return NULL;
+   return res;
+}
+
+/* Add functions from precompiled cache of the file. func_name - name of
+ * the script function, NULL - api.xml.
+ * Returns 0 on success, -1 if cache does not exists or outdated  */
+static int load_cache(ourfa_xmlapi_t *xmlapi, const char *file, const char *func_name)
 {
-   ourfa_xmlapi_func_t *val;
+   struct ourfa_xmlapi_image_t *img;
+   ourfa_xmlapi_func_t **prev;
+   char *cache_file;
+   unsigned i;
+
+   cache_file = cache_file_name(file);
+   if (cache_file == NULL)
+      return -1;
+   img = ourfa_xmlapi_image_load(cache_file, file);
+   free(cache_file);
+   if (img == NULL)
+      return -1;
+
+   if (func_name
+	 && ((img->funcs_cnt != 1)
+	    || (img->funcs[0]->script == NULL)
+	    || (strcmp(img->funcs[0]->name, func_name) != 0))) {
+      ourfa_xmlapi_image_free(img);
+      return -1;
+   }
+
+   /* Replaced entries, to restore func_by_name on error  */
+   prev = malloc((img->funcs_cnt + 1) * sizeof(prev[0]));
+   if (prev == NULL) {
+      ourfa_xmlapi_image_free(img);
+      return -1;
+   }
+
+   for (i=0; i < img->funcs_cnt; i++) {
+      prev[i] = xmlHashLookup(xmlapi->func_by_name,
+	    (const xmlChar *)img->funcs[i]->name);
+      if (xmlHashUpdateEntry(xmlapi->func_by_name,
+	       (const xmlChar *)img->funcs[i]->name, img->funcs[i], NULL) < 0)
+	 break;
+   }
+
+   if (i < img->funcs_cnt) {
+      while (i-- > 0) {
+	 if (prev[i] != NULL)
+	    xmlHashUpdateEntry(xmlapi->func_by_name,
+		  (const xmlChar *)img->funcs[i]->name, prev[i], NULL);
+	 else
+	    xmlHashRemoveEntry(xmlapi->func_by_name,
+		  (const xmlChar *)img->funcs[i]->name, NULL);
+      }
+      free(prev);
+      ourfa_xmlapi_image_free(img);
+      return -1;
+   }
+   free(prev);
+
+   for (i=0; i < img->funcs_cnt; i++)
+      img->funcs[i]->xmlapi = xmlapi;
+   img->next = xmlapi->images;
+   xmlapi->images = img;
+
+   return 0;
+}
+
+struct funcs_list_t {
+   ourfa_xmlapi_func_t **funcs;
+   unsigned cnt;
+};
+
+static void collect_apixml_func(void *payload, void *data, const xmlChar *name)
+{
+   ourfa_xmlapi_func_t *f;
+   struct funcs_list_t *list;
 
    if (name) {};
 
-   val = (ourfa_xmlapi_func_t *)payload;
+   f = (ourfa_xmlapi_func_t *)payload;
+   list = (struct funcs_list_t *)data;
+   if (f->script == NULL)
+      list->funcs[list->cnt++] = f;
+}
+
+/* Write precompiled cache of the file. Errors are ignored: cache is
+ * optional and directory of XML files may be read-only.
+ * funcs == NULL - all api.xml functions  */
+static void save_cache(ourfa_xmlapi_t *xmlapi, const char *file,
+      ourfa_xmlapi_func_t * const *funcs, unsigned funcs_cnt)
+{
+   struct funcs_list_t list;
+   char *cache_file;
+
+   list.funcs = NULL;
+   list.cnt = 0;
+   if (funcs == NULL) {
+      list.funcs = malloc((xmlHashSize(xmlapi->func_by_name) + 1) * sizeof(list.funcs[0]));
+      if (list.funcs == NULL)
+	 return;
+      xmlHashScan(xmlapi->func_by_name, collect_apixml_func, &list);
+      funcs = list.funcs;
+      funcs_cnt = list.cnt;
+   }
 
-   free_func_def(val->in);
-   free_func_def(val->out);
-   free_func_def(val->script);
+   cache_file = cache_file_name(file);
+   if (cache_file != NULL)
+      ourfa_xmlapi_image_save(cache_file, file, funcs, funcs_cnt);
 
-   free(val);
+   free(cache_file);
+   free(list.funcs);
+}
+
+struct freeze_list_t {
+   ourfa_xmlapi_t *xmlapi;
+   ourfa_xmlapi_func_t **funcs;
+   const xmlChar **names;
+   unsigned cnt;
+};
+
+static void collect_lazy_name(void *payload, void *data, const xmlChar *name)
+{
+   struct freeze_list_t *list;
+
+   if (payload) {};
+
+   list = (struct freeze_list_t *)data;
+   list->names[list->cnt] = (const xmlChar *)xmlapi_strdup(list->xmlapi,
+	 (const char *)name);
+   if (list->names[list->cnt] != NULL)
+      list->cnt++;
+}
+
+static void collect_func(void *payload, void *data, const xmlChar *name)
+{
+   struct freeze_list_t *list;
+
+   list = (struct freeze_list_t *)data;
+   list->funcs[list->cnt] = (ourfa_xmlapi_func_t *)payload;
+   list->names[list->cnt] = name;
+   list->cnt++;
+}
+
+int ourfa_xmlapi_freeze(ourfa_xmlapi_t *xmlapi)
+{
+   struct freeze_list_t list;
+   struct ourfa_xmlapi_image_t *img;
+   unsigned i, size;
+   int res;
+
+   assert(xmlapi);
+
+   if (xmlapi->frozen)
+      return OURFA_OK;
+
+   res = OURFA_OK;
+   list.xmlapi = xmlapi;
+   list.cnt = 0;
+
+   size = xmlHashSize(xmlapi->func_by_name);
+   if (xmlapi->lazy)
+      size += xmlHashSize(xmlapi->lazy->funcs);
+   list.funcs = malloc((size + 1) * sizeof(list.funcs[0]));
+   list.names = malloc((size + 1) * sizeof(list.names[0]));
+   if ((list.funcs == NULL) || (list.names == NULL)) {
+      res = xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
+      goto freeze_end;
+   }
+
+   /* Parse all functions not loaded yet: no writes after freeze */
+   if (xmlapi->lazy) {
+      xmlHashScan(xmlapi->lazy->funcs, collect_lazy_name, &list);
+      for (i=0; i < list.cnt; i++)
+	 ourfa_xmlapi_func(xmlapi, (const char *)list.names[i]);
+      lazy_free(xmlapi->lazy);
+      xmlapi->lazy = NULL;
+   }
+
+   /* Move definitions to one block  */
+   list.cnt = 0;
+   xmlHashScan(xmlapi->func_by_name, collect_func, &list);
+   img = ourfa_xmlapi_image_pack(list.funcs, list.cnt);
+   if (img == NULL) {
+      res = xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
+      goto freeze_end;
+   }
+
+   /* Keys exist, entries are replaced in place  */
+   for (i=0; i < img->funcs_cnt; i++) {
+      img->funcs[i]->xmlapi = xmlapi;
+      xmlHashUpdateEntry(xmlapi->func_by_name, list.names[i],
+	    img->funcs[i], NULL);
+   }
+
+   if (ourfa_atomic_get(&xmlapi->ref_cnt) == 1) {
+      ourfa_xmlapi_image_free(xmlapi->images);
+      arena_free(xmlapi->arena);
+      xmlDictFree(xmlapi->dict);
+   }else {
+      /* Somebody holds functions or calls with old definitions  */
+      xmlapi->old_images = xmlapi->images;
+      xmlapi->old_arena = xmlapi->arena;
+      xmlapi->old_dict = xmlapi->dict;
+   }
+   xmlapi->images = img;
+   xmlapi->arena = NULL;
+   xmlapi->dict = NULL;
+   xmlapi->frozen = 1;
+   /* Frozen definitions are not reference counted, so they are kept
+    * until exit by one permanent reference */
+   ourfa_xmlapi_ref(xmlapi);
+
+freeze_end:
+   free(list.funcs);
+   free(list.names);
+
+   return res;
 }
 
 int ourfa_xmlapi_node_type_by_name(const char *node_name)
@@ -487,9 +1155,36 @@ const char *ourfa_xmlapi_node_name_by_type(int node_type)
 
 ourfa_xmlapi_func_t *ourfa_xmlapi_func(ourfa_xmlapi_t *api, const char *name)
 {
+   ourfa_xmlapi_func_t *f;
+
    if (api->func_by_name == NULL)
       return NULL;
-   return xmlHashLookup(api->func_by_name, (const xmlChar *)name);
+   if (api->lazy == NULL)
+      return xmlHashLookup(api->func_by_name, (const xmlChar *)name);
+
+   lazy_lock_acquire();
+   f = xmlHashLookup(api->func_by_name, (const xmlChar *)name);
+   if (f == NULL)
+      f = lazy_load_func(api, name);
+   lazy_lock_release();
+
+   return f;
+}
+
+/*
+ * Function is in the frozen image. Such functions are not reference
+ * counted: pages of the image are not written by calls. Functions taken
+ * before freeze are counted as before
+ */
+static int is_frozen_func(const ourfa_xmlapi_func_t *func)
+{
+   const struct ourfa_xmlapi_image_t *img;
+
+   if (!func->xmlapi->frozen)
+      return 0;
+   img = func->xmlapi->images;
+   return ((const char *)func >= img->data)
+      && ((const char *)func < img->data + img->size);
 }
 
 ourfa_xmlapi_func_t *ourfa_xmlapi_func_ref(ourfa_xmlapi_func_t  *func)
@@ -497,7 +1192,8 @@ ourfa_xmlapi_func_t *ourfa_xmlapi_func_ref(ourfa_xmlapi_func_t  *func)
    if (func == NULL)
       return NULL;
    assert(func->xmlapi);
-   ourfa_xmlapi_ref(func->xmlapi);
+   if (!is_frozen_func(func))
+      ourfa_xmlapi_ref(func->xmlapi);
    return func;
 }
 
@@ -505,7 +1201,8 @@ void ourfa_xmlapi_func_deref(ourfa_xmlapi_func_t  *func)
 {
    if (func == NULL)
       return;
-   ourfa_xmlapi_free(func->xmlapi);
+   if (!is_frozen_func(func))
+      ourfa_xmlapi_free(func->xmlapi);
 }
 
 int ourfa_xmlapi_f_have_input(ourfa_xmlapi_func_t *f)
@@ -535,37 +1232,35 @@ static int get_xml_attributes(xmlNode *xml_node,
       ourfa_xmlapi_t *xmlapi)
 {
    unsigned n;
+   xmlAttr *attr;
    xmlChar *src;
-   int res = OURFA_OK;
 
    for (n=0; n<size; n++)
       *nodes[n].dst = NULL;
 
    for (n=0; n<size; n++) {
-      src = xmlGetProp(xml_node, (const xmlChar *)nodes[n].name);
-      if (src) {
-	 *nodes[n].dst = strdup((char *)src);
-	 if (*nodes[n].dst == NULL) {
-	    res = xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
-	    xmlFree(src);
-	    break;
-	 }
-	 xmlFree(src);
-      }else {
-	 if (nodes[n].required) {
-	    res = xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
+      attr = xmlHasProp(xml_node, (const xmlChar *)nodes[n].name);
+      if (attr == NULL) {
+	 if (nodes[n].required)
+	    return xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
 		  "No `%s` attribute of node `%s`", nodes[n].name, xml_node->name);
-	    break;
-	 }
+	 continue;
       }
+      /* Plain value: text node without entity references  */
+      if ((attr->children != NULL)
+	    && (attr->children->type == XML_TEXT_NODE)
+	    && (attr->children->next == NULL))
+	 *nodes[n].dst = xmlapi_strdup(xmlapi, (const char *)attr->children->content);
+      else {
+	 src = xmlGetProp(xml_node, (const xmlChar *)nodes[n].name);
+	 *nodes[n].dst = xmlapi_strdup(xmlapi, src ? (const char *)src : "");
+	 xmlFree(src);
+      }
+      if (*nodes[n].dst == NULL)
+	 return xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
    }
 
-   if (res != OURFA_OK) {
-      for (n=0; n<size; n++)
-	 free(nodes[n].dst);
-   }
-
-   return res;
+   return OURFA_OK;
 }
 
 static ourfa_xmlapi_func_node_t *load_func_def(xmlNode *xml_root, ourfa_xmlapi_t *xmlapi, ourfa_xmlapi_func_t *f)
@@ -576,7 +1271,7 @@ static ourfa_xmlapi_func_node_t *load_func_def(xmlNode *xml_root, ourfa_xmlapi_t
 
    assert(xmlapi);
 
-   root = malloc(sizeof(*root));
+   root = xmlapi_alloc(xmlapi, sizeof(*root));
    if (root == NULL) {
       ret_code = xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
       return NULL;
@@ -587,10 +1282,14 @@ static ourfa_xmlapi_func_node_t *load_func_def(xmlNode *xml_root, ourfa_xmlapi_t
    root->children = NULL;
    root->type = OURFA_XMLAPI_NODE_ROOT;
    root->func = f;
+   root->n.n_root.prog = NULL;
    cur_node = NULL;
 
-   if ((xml_root == NULL) || (xml_root->children == NULL))
+   if ((xml_root == NULL) || (xml_root->children == NULL)) {
+      if (compile_func_def(root, xmlapi) != OURFA_OK)
+	 return NULL;
       return root;
+   }
 
    xml_node = xml_root->children;
    ret_code = OURFA_OK;
@@ -601,7 +1300,7 @@ static ourfa_xmlapi_func_node_t *load_func_def(xmlNode *xml_root, ourfa_xmlapi_t
       if ((xml_node->type != XML_ELEMENT_NODE) || (xml_node->name == NULL))
 	 goto load_f_def_next_node;
 
-      node = malloc(sizeof(*node));
+      node = xmlapi_alloc(xmlapi, sizeof(*node));
       if (node == NULL) {
 	 ret_code = xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
 	 break;
@@ -658,12 +1357,8 @@ static ourfa_xmlapi_func_node_t *load_func_def(xmlNode *xml_root, ourfa_xmlapi_t
 			xml_node->name,
 			f->name
 			);
-		  free(condition);
-		  free(node->n.n_if.variable);
-		  free(node->n.n_if.value);
 		  break;
 	       }
-	       free(condition);
 	       node->children = node; /* uninitialized  */
 	    }
 	    break;
@@ -688,14 +1383,12 @@ static ourfa_xmlapi_func_node_t *load_func_def(xmlNode *xml_root, ourfa_xmlapi_t
 			   node->n.n_set.value,
 			   f->name
 			   );
-		     free_func_def(node);
 		     break;
 		  }
 		  if (!node->n.n_set.src && !node->n.n_set.dst) {
 		     ret_code = xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
 			   "No 'src' and no 'value' properties defined in 'set' node. Function: '%s'",
 			   f->name);
-		     free_func_def(node);
 		     break;
 		  }
 	       }
@@ -704,6 +1397,7 @@ static ourfa_xmlapi_func_node_t *load_func_def(xmlNode *xml_root, ourfa_xmlapi_t
 	 case OURFA_XMLAPI_NODE_FOR:
 	    {
 	       unsigned i;
+	       char array_name[32];
 	       ourfa_xmlapi_func_node_t *tmp;
 
 	       struct t_nodes my_nodes[]= {
@@ -723,10 +1417,10 @@ static ourfa_xmlapi_func_node_t *load_func_def(xmlNode *xml_root, ourfa_xmlapi_t
 			   i++;
 		  }
 	       }
-	       node->n.n_for.array_name = NULL;
-	       if (ourfa_asprintf(&node->n.n_for.array_name, "array-%d", i) <= 0) {
-		  ret_code = xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx, "asprintf error");
-		  free_func_def(node);
+	       snprintf(array_name, sizeof(array_name), "array-%u", i);
+	       node->n.n_for.array_name = xmlapi_strdup(xmlapi, array_name);
+	       if (node->n.n_for.array_name == NULL) {
+		  ret_code = xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
 		  break;
 	       }
 	    }
@@ -771,12 +1465,8 @@ static ourfa_xmlapi_func_node_t *load_func_def(xmlNode *xml_root, ourfa_xmlapi_t
 		     ret_code = xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
 			   "Wrong error code `%s` of node `%s`. Function: '%s'",
 			   code_str, xml_node->name, f->name);
-		     free(code_str);
-		     free(node->n.n_error.comment);
-		     free(node->n.n_error.variable);
 		     break;
 		  }
-		  free(code_str);
 	       }
 	    }
 	    break;
@@ -799,13 +1489,10 @@ static ourfa_xmlapi_func_node_t *load_func_def(xmlNode *xml_root, ourfa_xmlapi_t
 		     ret_code = xmlapi->printf_err(OURFA_ERROR_XML, xmlapi->err_ctx,
 			   "Wrong output attribute value  `%s` of node `%s`. Function: '%s'",
 			   output, xml_node->name, f->name);
-		     free(output);
-		     free_func_def(node);
 		     break;
 		  }
 	       }else
 		  node->n.n_call.output = 1;
-	       free(output);
 	       node->children = node; /* uninitialized  */
 	    }
 	    break;
@@ -891,10 +1578,8 @@ static ourfa_xmlapi_func_node_t *load_func_def(xmlNode *xml_root, ourfa_xmlapi_t
 	    break;
       }
 
-      if (ret_code != OURFA_OK) {
-	 free(node);
+      if (ret_code != OURFA_OK)
 	 break;
-      }
 
       /* Add node to tree  */
       if (cur_node == NULL) {
@@ -968,14 +1653,289 @@ load_f_def_next_node:
       }
    } /*  while  */
 
-   if (ret_code != OURFA_OK) {
-      free_func_def(root);
+   if (ret_code == OURFA_OK)
+      ret_code = compile_func_def(root, xmlapi);
+
+   if (ret_code != OURFA_OK)
       return NULL;
-   }
 
    return root;
 }
 
+#define NO_PC ((unsigned)-1)
+
+static unsigned func_def_insn_cnt(ourfa_xmlapi_func_node_t *node)
+{
+   unsigned cnt;
+
+   for (cnt=0; node; node=node->next) {
+      cnt++;
+      if ((node->type == OURFA_XMLAPI_NODE_IF)
+	    || (node->type == OURFA_XMLAPI_NODE_FOR)
+	    || (node->type == OURFA_XMLAPI_NODE_CALL))
+	 cnt += 1 + func_def_insn_cnt(node->children);
+   }
+
+   return cnt;
+}
+
+static void compile_operand(struct ourfa_xmlapi_operand_t *op, const char *prop)
+{
+   char *p_end;
+
+   /* Same rules as ourfa_func_call_get_long_prop_val()  */
+   errno = 0;
+   op->val = strtol(prop, &p_end, 0);
+   if ((*p_end != '\0') || (errno == ERANGE)) {
+      op->var = prop;
+      op->val = 0;
+   }else
+      op->var = NULL;
+}
+
+/* Emit instructions for the node list. Returns index of the next free slot */
+static unsigned compile_nodes(struct ourfa_xmlapi_prog_t *prog,
+      ourfa_xmlapi_func_node_t *node, unsigned pc)
+{
+   unsigned head, i;
+   struct ourfa_xmlapi_insn_t *insn;
+   char *p_end;
+
+   for (; node; node=node->next) {
+      head = pc++;
+      insn = &prog->insn[head];
+      insn->node = node;
+      insn->jmp = insn->up = NO_PC;
+
+      switch (node->type) {
+	 case OURFA_XMLAPI_NODE_IF:
+	    insn->op = OURFA_XMLAPI_OP_IF;
+	    insn->a.i_if.value = ourfa_strtod_c(node->n.n_if.value, &p_end);
+	    insn->a.i_if.is_const = (p_end != node->n.n_if.value) && (*p_end == '\0');
+	    break;
+	 case OURFA_XMLAPI_NODE_FOR:
+	    insn->op = OURFA_XMLAPI_OP_FOR;
+	    compile_operand(&insn->a.i_for.from, node->n.n_for.from);
+	    compile_operand(&insn->a.i_for.count, node->n.n_for.count);
+	    break;
+	 case OURFA_XMLAPI_NODE_CALL:
+	    insn->op = OURFA_XMLAPI_OP_CALL;
+	    break;
+	 case OURFA_XMLAPI_NODE_SET:
+	    insn->op = OURFA_XMLAPI_OP_SET;
+	    break;
+	 case OURFA_XMLAPI_NODE_BREAK:
+	    insn->op = OURFA_XMLAPI_OP_BREAK;
+	    break;
+	 case OURFA_XMLAPI_NODE_ERROR:
+	    insn->op = OURFA_XMLAPI_OP_ERROR;
+	    break;
+	 case OURFA_XMLAPI_NODE_PARAMETER:
+	    insn->op = OURFA_XMLAPI_OP_PARAMETER;
+	    break;
+	 case OURFA_XMLAPI_NODE_ADD:
+	 case OURFA_XMLAPI_NODE_SUB:
+	 case OURFA_XMLAPI_NODE_DIV:
+	 case OURFA_XMLAPI_NODE_MUL:
+	    insn->op = OURFA_XMLAPI_OP_MATH;
+	    break;
+	 default:
+	    insn->op = OURFA_XMLAPI_OP_NODE;
+	    break;
+      }
+
+      if ((insn->op != OURFA_XMLAPI_OP_IF)
+	    && (insn->op != OURFA_XMLAPI_OP_FOR)
+	    && (insn->op != OURFA_XMLAPI_OP_CALL))
+	 continue;
+
+      /* Block body and end instruction  */
+      pc = compile_nodes(prog, node->children, pc);
+      insn = &prog->insn[pc];
+      insn->node = node;
+      insn->jmp = head;
+      insn->up = NO_PC;
+      insn->op = node->type == OURFA_XMLAPI_NODE_IF ? OURFA_XMLAPI_OP_ENDIF
+	 : (node->type == OURFA_XMLAPI_NODE_FOR ? OURFA_XMLAPI_OP_ENDFOR : OURFA_XMLAPI_OP_ENDCALL);
+      prog->insn[head].jmp = pc;
+
+      for (i=head+1; i < pc; i++) {
+	 if (prog->insn[i].up == NO_PC)
+	    prog->insn[i].up = pc;
+	 if ((node->type == OURFA_XMLAPI_NODE_FOR)
+	       && (prog->insn[i].op == OURFA_XMLAPI_OP_BREAK)
+	       && (prog->insn[i].jmp == NO_PC))
+	    prog->insn[i].jmp = pc;
+      }
+      pc++;
+   }
+
+   return pc;
+}
+
+static int compile_func_def(ourfa_xmlapi_func_node_t *root, ourfa_xmlapi_t *xmlapi)
+{
+   unsigned cnt, i;
+   struct ourfa_xmlapi_prog_t *prog;
+
+   assert(root->type == OURFA_XMLAPI_NODE_ROOT);
+
+   cnt = func_def_insn_cnt(root->children) + 1;
+   prog = xmlapi_alloc(xmlapi, sizeof(*prog) + cnt * sizeof(prog->insn[0]));
+   if (prog == NULL)
+      return xmlapi->printf_err(OURFA_ERROR_SYSTEM, xmlapi->err_ctx, NULL);
+
+   prog->insn_cnt = cnt;
+   i = compile_nodes(prog, root->children, 0);
+   assert(i == cnt-1);
+   prog->insn[i].op = OURFA_XMLAPI_OP_END;
+   prog->insn[i].node = root;
+   prog->insn[i].jmp = 0;
+   prog->insn[i].up = i;
+   for (; i > 0; i--) {
+      if (prog->insn[i-1].up == NO_PC)
+	 prog->insn[i-1].up = cnt-1;
+   }
+
+   compile_decode_plan(prog);
+   root->n.n_root.prog = prog;
+
+   return OURFA_OK;
+}
+
+/* Parse array_index of value node into constants and references to
+ * enclosing loops. Same rules as ourfa_hash_parse_idx_list()  */
+static int compile_val_idx(struct ourfa_xmlapi_prog_t *prog,
+      struct ourfa_xmlapi_insn_t *insn,
+      const unsigned *loops, unsigned depth)
+{
+   const char *p;
+   char tok[20];
+   char *p_end;
+   unsigned len, cnt, i;
+
+   p = insn->node->n.n_val.array_index;
+   if ((p == NULL) || (p[0] == '\0'))
+      p = "0";
+
+   cnt = len = 0;
+   for (;; p++) {
+      if ((*p != '\0') && isspace((unsigned char)*p))
+	 continue;
+      if ((*p != ',') && (*p != '\0')) {
+	 if (len+1 >= sizeof(tok)-2)
+	    return 0;
+	 tok[len++] = *p;
+	 continue;
+      }
+      tok[len] = '\0';
+      if ((*p == '\0') && (len == 0))
+	 break;
+      if ((len == 0) || (cnt == OURFA_XMLAPI_DECODE_MAX_IDX))
+	 return 0;
+
+      if (isdigit((unsigned char)tok[0])) {
+	 insn->a.i_val.idx[cnt].is_loop = 0;
+	 insn->a.i_val.idx[cnt].val = strtoul(tok, &p_end, 0);
+	 if (*p_end != '\0')
+	    return 0;
+      }else {
+	 /* Loop counter only  */
+	 for (i=depth; i > 0; i--) {
+	    if (strcmp(prog->insn[loops[i-1]].node->n.n_for.name, tok) == 0)
+	       break;
+	 }
+	 if (i == 0)
+	    return 0;
+	 insn->a.i_val.idx[cnt].is_loop = 1;
+	 insn->a.i_val.idx[cnt].val = i-1;
+      }
+      cnt++;
+      len = 0;
+      if (*p == '\0')
+	 break;
+   }
+
+   insn->a.i_val.idx_cnt = cnt;
+
+   return cnt > 0;
+}
+
+static void compile_decode_plan(struct ourfa_xmlapi_prog_t *prog)
+{
+   unsigned pc, i, depth;
+   unsigned loops[OURFA_XMLAPI_DECODE_MAX_DEPTH];
+   struct ourfa_xmlapi_insn_t *insn;
+
+   prog->decodable = 0;
+   prog->col_cnt = 0;
+   depth = 0;
+
+   for (pc=0; pc < prog->insn_cnt; pc++) {
+      insn = &prog->insn[pc];
+      switch (insn->op) {
+	 case OURFA_XMLAPI_OP_NODE:
+	    switch (insn->node->type) {
+	       case OURFA_XMLAPI_NODE_INTEGER:
+	       case OURFA_XMLAPI_NODE_LONG:
+	       case OURFA_XMLAPI_NODE_DOUBLE:
+	       case OURFA_XMLAPI_NODE_STRING:
+	       case OURFA_XMLAPI_NODE_IP:
+		  break;
+	       default:
+		  return;
+	    }
+	    if (!compile_val_idx(prog, insn, loops, depth))
+	       return;
+
+	    /* One slot per variable name  */
+	    for (i=0; i < pc; i++) {
+	       if ((prog->insn[i].op == OURFA_XMLAPI_OP_NODE)
+		     && (strcmp(prog->insn[i].node->n.n_val.name,
+			   insn->node->n.n_val.name) == 0))
+		  break;
+	    }
+	    insn->a.i_val.col = i < pc ? prog->insn[i].a.i_val.col : prog->col_cnt++;
+	    break;
+	 case OURFA_XMLAPI_OP_FOR:
+	    if (depth == OURFA_XMLAPI_DECODE_MAX_DEPTH)
+	       return;
+	    for (i=0; i < depth; i++) {
+	       if (strcmp(prog->insn[loops[i]].node->n.n_for.name,
+			insn->node->n.n_for.name) == 0)
+		  return;
+	    }
+	    insn->a.i_for.depth = depth;
+	    loops[depth++] = pc;
+	    break;
+	 case OURFA_XMLAPI_OP_ENDFOR:
+	    assert(depth > 0);
+	    depth--;
+	    break;
+	 case OURFA_XMLAPI_OP_IF:
+	 case OURFA_XMLAPI_OP_ENDIF:
+	 case OURFA_XMLAPI_OP_END:
+	    break;
+	 default:
+	    return;
+      }
+   }
+
+   /* Loop counters must not be overwritten by received values  */
+   for (pc=0; pc < prog->insn_cnt; pc++) {
+      if (prog->insn[pc].op != OURFA_XMLAPI_OP_FOR)
+	 continue;
+      for (i=0; i < prog->insn_cnt; i++) {
+	 if ((prog->insn[i].op == OURFA_XMLAPI_OP_NODE)
+	       && (strcmp(prog->insn[i].node->n.n_val.name,
+		     prog->insn[pc].node->n.n_for.name) == 0))
+	    return;
+      }
+   }
+
+   prog->decodable = 1;
+}
+
 static int dump_func_def(ourfa_xmlapi_func_node_t *def, FILE *stream)
 {
    ourfa_xmlapi_func_node_t *root, *cur;
@@ -1157,90 +2117,59 @@ void ourfa_xmlapi_dump_func_definitions(ourfa_xmlapi_func_t *f, FILE *stream)
 
 }
 
-static void free_func_def(ourfa_xmlapi_func_node_t *def)
+static void *xmlapi_alloc(ourfa_xmlapi_t *xmlapi, size_t size)
 {
-   ourfa_xmlapi_func_node_t *next;
-
-   while(def) {
-      next = def->next;
-      if (def->children) {
-	 assert(def->children != def);
-	 free_func_def(def->children);
+   struct ourfa_xmlapi_arena_t *chunk;
+   size_t hdr_size, chunk_size;
+   void *res;
+
+   hdr_size = ARENA_ALIGN(sizeof(*chunk));
+   size = ARENA_ALIGN(size);
+
+   chunk = xmlapi->arena;
+   if ((chunk == NULL) || (chunk->size - chunk->used < size)) {
+      chunk_size = hdr_size + size;
+      if (chunk_size < ARENA_CHUNK_SIZE)
+	 chunk_size = ARENA_CHUNK_SIZE;
+      chunk = malloc(chunk_size);
+      if (chunk == NULL)
+	 return NULL;
+      chunk->size = chunk_size;
+      chunk->used = hdr_size;
+      /* Keep partially used chunk on top if the new one is a big block */
+      if ((xmlapi->arena != NULL)
+	    && (chunk_size - hdr_size - size
+	       < xmlapi->arena->size - xmlapi->arena->used)) {
+	 chunk->next = xmlapi->arena->next;
+	 xmlapi->arena->next = chunk;
+      }else {
+	 chunk->next = xmlapi->arena;
+	 xmlapi->arena = chunk;
       }
+   }
 
-      assert(def->func);
+   res = (char *)chunk + chunk->used;
+   chunk->used += size;
+   memset(res, 0, size);
 
-      switch (def->type) {
-	 case OURFA_XMLAPI_NODE_INTEGER:
-	 case OURFA_XMLAPI_NODE_STRING:
-	 case OURFA_XMLAPI_NODE_LONG:
-	 case OURFA_XMLAPI_NODE_DOUBLE:
-	 case OURFA_XMLAPI_NODE_IP:
-	    free(def->n.n_val.name);
-	    free(def->n.n_val.array_index);
-	    free(def->n.n_val.defval);
-	    break;
-	 case OURFA_XMLAPI_NODE_IF:
-	    free(def->n.n_if.variable);
-	    free(def->n.n_if.value);
-	    break;
-	 case OURFA_XMLAPI_NODE_SET:
-	    free(def->n.n_set.src);
-	    free(def->n.n_set.src_index);
-	    free(def->n.n_set.dst);
-	    free(def->n.n_set.dst_index);
-	    free(def->n.n_set.value);
-	    break;
-	 case OURFA_XMLAPI_NODE_FOR:
-	    free(def->n.n_for.name);
-	    free(def->n.n_for.from);
-	    free(def->n.n_for.count);
-	    free(def->n.n_for.array_name);
-	    break;
-         case OURFA_XMLAPI_NODE_ERROR:
-	    free(def->n.n_error.comment);
-	    free(def->n.n_error.variable);
-	    break;
-	 case OURFA_XMLAPI_NODE_CALL:
-	    free(def->n.n_call.function);
-	    break;
-	 case OURFA_XMLAPI_NODE_PARAMETER:
-	    free(def->n.n_parameter.name);
-	    free(def->n.n_parameter.value);
-	    free(def->n.n_parameter.comment);
-	    break;
-	 case OURFA_XMLAPI_NODE_MESSAGE:
-	    free(def->n.n_message.text);
-	    break;
-	 case OURFA_XMLAPI_NODE_SHIFT:
-	    free(def->n.n_shift.name);
-	    break;
-	 case OURFA_XMLAPI_NODE_REMOVE:
-	    free(def->n.n_remove.name);
-	    free(def->n.n_remove.array_index);
-	    break;
-	 case OURFA_XMLAPI_NODE_ADD:
-	 case OURFA_XMLAPI_NODE_SUB:
-	 case OURFA_XMLAPI_NODE_DIV:
-	 case OURFA_XMLAPI_NODE_MUL:
-	    free(def->n.n_math.arg1);
-	    free(def->n.n_math.arg2);
-	    free(def->n.n_math.dst);
-	    break;
-	 case OURFA_XMLAPI_NODE_OUT:
-	    free(def->n.n_out.var);
-	    break;
-	 case OURFA_XMLAPI_NODE_BREAK:
-	 case OURFA_XMLAPI_NODE_ROOT:
-	    break;
-	 default:
-	    assert(0);
-	    break;
-      }
-      free(def);
-      def = next;
-   }
+   return res;
+}
 
+static char *xmlapi_strdup(ourfa_xmlapi_t *xmlapi, const char *s)
+{
+   /* Interned strings are shared and must not be modified */
+   return (char *)xmlDictLookup(xmlapi->dict, (const xmlChar *)s, -1);
+}
+
+static void arena_free(struct ourfa_xmlapi_arena_t *arena)
+{
+   struct ourfa_xmlapi_arena_t *next;
+
+   while (arena) {
+      next = arena->next;
+      free(arena);
+      arena = next;
+   }
 }
 
 static void xml_generic_error_func(void *ctx, const char *msg, ...)
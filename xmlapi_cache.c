@@ -0,0 +1,727 @@
+/*-
+ * Copyright (c) 2009-2010 Alexey Illarionov <littlesavage@rambler.ru>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Precompiled cache of loaded XML API definitions.
+ *
+ * Image is a copy of function structs, definition trees, compiled
+ * programs and strings in one block. Pointers are stored as offsets from
+ * the start of the block, offsets of all pointer slots are listed in the
+ * relocation table. Loading is read of the file and one pass over the
+ * relocation table. Image is valid only for the same build of the library
+ * (sizes of structs are checked) and the same source file (path, mtime,
+ * size).
+ */
+
+#ifdef WIN32
+#include <process.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+#include <sys/stat.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/ssl.h>
+
+#include "ourfa.h"
+#include "ourfa_private.h"
+
+#define CACHE_MAGIC "OURFAXC"
+#define CACHE_VERSION 1
+#define CACHE_ALIGN 8
+#define CACHE_ENDIAN_MARK 0x01020304
+
+typedef struct ourfa_xmlapi_func_node_t node_t;
+
+struct cache_hdr_t {
+   char magic[8];
+   unsigned version;
+   unsigned endian;
+   unsigned ptr_size;
+   unsigned func_size;
+   unsigned node_size;
+   unsigned prog_size;
+   unsigned insn_size;
+
+   unsigned size;        /* Size of the image including header  */
+   long long src_mtime;
+   long long src_size;
+   unsigned src_path;    /* Offset of path of the source file  */
+   unsigned funcs;       /* Offset of array of function pointers  */
+   unsigned funcs_cnt;
+   unsigned relocs;      /* Offset of array of pointer slot offsets  */
+   unsigned relocs_cnt;
+};
+
+struct node_off_t {
+   const node_t *node;
+   unsigned off;
+};
+
+struct cache_writer_t {
+   char *buf;
+   size_t size;
+   size_t buf_size;
+
+   unsigned *relocs;
+   unsigned relocs_cnt;
+   unsigned relocs_size;
+
+   /* Written strings, open addressing  */
+   unsigned *strs;
+   unsigned strs_cnt;
+   unsigned strs_size;
+
+   /* Written nodes of the current definition tree  */
+   struct node_off_t *nodes;
+   unsigned nodes_cnt;
+   unsigned nodes_size;
+
+   int err;
+};
+
+static unsigned cache_alloc(struct cache_writer_t *w, size_t size, size_t align)
+{
+   size_t off, new_size;
+   char *tmp;
+
+   if (w->err)
+      return 0;
+
+   off = (w->size + align - 1) & ~(align - 1);
+   if (off + size > UINT32_MAX) {
+      w->err = 1;
+      return 0;
+   }
+
+   if (off + size > w->buf_size) {
+      new_size = w->buf_size ? w->buf_size : 65536;
+      while (new_size < off + size)
+	 new_size *= 2;
+      tmp = realloc(w->buf, new_size);
+      if (tmp == NULL) {
+	 w->err = 1;
+	 return 0;
+      }
+      w->buf = tmp;
+      w->buf_size = new_size;
+   }
+
+   memset(w->buf + w->size, 0, off + size - w->size);
+   w->size = off + size;
+
+   return (unsigned)off;
+}
+
+/* Store offset of target into pointer slot  */
+static void cache_set_ptr(struct cache_writer_t *w, unsigned slot, unsigned target)
+{
+   void *p;
+
+   if (w->err)
+      return;
+
+   p = (void *)(uintptr_t)target;
+   memcpy(w->buf + slot, &p, sizeof(p));
+   if (target == 0)
+      return;
+
+   if (w->relocs_cnt == w->relocs_size) {
+      unsigned *tmp;
+      unsigned new_size = w->relocs_size ? w->relocs_size * 2 : 4096;
+      tmp = realloc(w->relocs, new_size * sizeof(tmp[0]));
+      if (tmp == NULL) {
+	 w->err = 1;
+	 return;
+      }
+      w->relocs = tmp;
+      w->relocs_size = new_size;
+   }
+   w->relocs[w->relocs_cnt++] = slot;
+}
+
+static unsigned str_hash(const char *s)
+{
+   unsigned h = 2166136261u;
+
+   for (; *s; s++)
+      h = (h ^ (unsigned char)*s) * 16777619u;
+   return h;
+}
+
+/* Write string once, return its offset. 0 - NULL  */
+static unsigned cache_str(struct cache_writer_t *w, const char *s)
+{
+   unsigned i, off;
+   size_t len;
+
+   if ((s == NULL) || w->err)
+      return 0;
+
+   if (2 * (w->strs_cnt + 1) > w->strs_size) {
+      unsigned *tmp, new_size, j;
+      new_size = w->strs_size ? w->strs_size * 2 : 4096;
+      tmp = calloc(new_size, sizeof(tmp[0]));
+      if (tmp == NULL) {
+	 w->err = 1;
+	 return 0;
+      }
+      for (j=0; j < w->strs_size; j++) {
+	 if (w->strs[j] == 0)
+	    continue;
+	 i = str_hash(w->buf + w->strs[j]) & (new_size - 1);
+	 while (tmp[i] != 0)
+	    i = (i + 1) & (new_size - 1);
+	 tmp[i] = w->strs[j];
+      }
+      free(w->strs);
+      w->strs = tmp;
+      w->strs_size = new_size;
+   }
+
+   for (i = str_hash(s) & (w->strs_size - 1);
+	 w->strs[i] != 0;
+	 i = (i + 1) & (w->strs_size - 1)) {
+      if (strcmp(w->buf + w->strs[i], s) == 0)
+	 return w->strs[i];
+   }
+
+   len = strlen(s) + 1;
+   off = cache_alloc(w, len, 1);
+   if (off == 0)
+      return 0;
+   memcpy(w->buf + off, s, len);
+   w->strs[i] = off;
+   w->strs_cnt++;
+
+   return off;
+}
+
+/*
+ * Offsets of string attributes of the node: char * fields filled by
+ * load_func_def() (xmlapi.c) from XML attributes. Keep both lists in
+ * sync: field missing here is not copied to the image and keeps pointer
+ * to memory of the process that wrote the cache.
+ */
+static unsigned node_strings(const node_t *n, size_t *off)
+{
+   switch (n->type) {
+      case OURFA_XMLAPI_NODE_INTEGER:
+      case OURFA_XMLAPI_NODE_STRING:
+      case OURFA_XMLAPI_NODE_LONG:
+      case OURFA_XMLAPI_NODE_DOUBLE:
+      case OURFA_XMLAPI_NODE_IP:
+	 off[0] = offsetof(node_t, n.n_val.name);
+	 off[1] = offsetof(node_t, n.n_val.array_index);
+	 off[2] = offsetof(node_t, n.n_val.defval);
+	 return 3;
+      case OURFA_XMLAPI_NODE_IF:
+	 off[0] = offsetof(node_t, n.n_if.variable);
+	 off[1] = offsetof(node_t, n.n_if.value);
+	 return 2;
+      case OURFA_XMLAPI_NODE_SET:
+	 off[0] = offsetof(node_t, n.n_set.src);
+	 off[1] = offsetof(node_t, n.n_set.src_index);
+	 off[2] = offsetof(node_t, n.n_set.dst);
+	 off[3] = offsetof(node_t, n.n_set.dst_index);
+	 off[4] = offsetof(node_t, n.n_set.value);
+	 return 5;
+      case OURFA_XMLAPI_NODE_FOR:
+	 off[0] = offsetof(node_t, n.n_for.name);
+	 off[1] = offsetof(node_t, n.n_for.from);
+	 off[2] = offsetof(node_t, n.n_for.count);
+	 off[3] = offsetof(node_t, n.n_for.array_name);
+	 return 4;
+      case OURFA_XMLAPI_NODE_ERROR:
+	 off[0] = offsetof(node_t, n.n_error.comment);
+	 off[1] = offsetof(node_t, n.n_error.variable);
+	 return 2;
+      case OURFA_XMLAPI_NODE_CALL:
+	 off[0] = offsetof(node_t, n.n_call.function);
+	 return 1;
+      case OURFA_XMLAPI_NODE_PARAMETER:
+	 off[0] = offsetof(node_t, n.n_parameter.name);
+	 off[1] = offsetof(node_t, n.n_parameter.value);
+	 off[2] = offsetof(node_t, n.n_parameter.comment);
+	 return 3;
+      case OURFA_XMLAPI_NODE_MESSAGE:
+	 off[0] = offsetof(node_t, n.n_message.text);
+	 return 1;
+      case OURFA_XMLAPI_NODE_SHIFT:
+	 off[0] = offsetof(node_t, n.n_shift.name);
+	 return 1;
+      case OURFA_XMLAPI_NODE_REMOVE:
+	 off[0] = offsetof(node_t, n.n_remove.name);
+	 off[1] = offsetof(node_t, n.n_remove.array_index);
+	 return 2;
+      case OURFA_XMLAPI_NODE_ADD:
+      case OURFA_XMLAPI_NODE_SUB:
+      case OURFA_XMLAPI_NODE_DIV:
+      case OURFA_XMLAPI_NODE_MUL:
+	 off[0] = offsetof(node_t, n.n_math.arg1);
+	 off[1] = offsetof(node_t, n.n_math.arg2);
+	 off[2] = offsetof(node_t, n.n_math.dst);
+	 return 3;
+      case OURFA_XMLAPI_NODE_OUT:
+	 off[0] = offsetof(node_t, n.n_out.var);
+	 return 1;
+      default:
+	 break;
+   }
+
+   return 0;
+}
+
+static int node_off_cmp(const void *a, const void *b)
+{
+   uintptr_t pa, pb;
+
+   pa = (uintptr_t)((const struct node_off_t *)a)->node;
+   pb = (uintptr_t)((const struct node_off_t *)b)->node;
+
+   return pa < pb ? -1 : (pa > pb ? 1 : 0);
+}
+
+static unsigned node_off(struct cache_writer_t *w, const node_t *node)
+{
+   struct node_off_t key, *res;
+
+   key.node = node;
+   res = bsearch(&key, w->nodes, w->nodes_cnt, sizeof(w->nodes[0]), node_off_cmp);
+   if (res == NULL) {
+      w->err = 1;
+      return 0;
+   }
+   return res->off;
+}
+
+/* Write node list. Returns offset of the first node  */
+static unsigned cache_write_nodes(struct cache_writer_t *w, const node_t *node,
+      unsigned parent, unsigned func)
+{
+   unsigned first, prev, off, i, cnt;
+   size_t str_off[5];
+   char *s;
+
+   first = prev = 0;
+   for (; node && !w->err; node = node->next) {
+      off = cache_alloc(w, sizeof(*node), CACHE_ALIGN);
+      if (off == 0)
+	 break;
+      memcpy(w->buf + off, node, sizeof(*node));
+
+      if (w->nodes_cnt == w->nodes_size) {
+	 struct node_off_t *tmp;
+	 unsigned new_size = w->nodes_size ? w->nodes_size * 2 : 256;
+	 tmp = realloc(w->nodes, new_size * sizeof(tmp[0]));
+	 if (tmp == NULL) {
+	    w->err = 1;
+	    break;
+	 }
+	 w->nodes = tmp;
+	 w->nodes_size = new_size;
+      }
+      w->nodes[w->nodes_cnt].node = node;
+      w->nodes[w->nodes_cnt++].off = off;
+
+      cache_set_ptr(w, off + offsetof(node_t, func), func);
+      cache_set_ptr(w, off + offsetof(node_t, parent), parent);
+      cache_set_ptr(w, off + offsetof(node_t, next), 0);
+      cache_set_ptr(w, off + offsetof(node_t, children), 0);
+      if (node->type == OURFA_XMLAPI_NODE_ROOT)
+	 cache_set_ptr(w, off + offsetof(node_t, n.n_root.prog), 0);
+
+      cnt = node_strings(node, str_off);
+      for (i=0; i < cnt; i++) {
+	 memcpy(&s, (const char *)node + str_off[i], sizeof(s));
+	 cache_set_ptr(w, off + str_off[i], cache_str(w, s));
+      }
+
+      if (node->children)
+	 cache_set_ptr(w, off + offsetof(node_t, children),
+	       cache_write_nodes(w, node->children, off, func));
+
+      if (prev)
+	 cache_set_ptr(w, prev + offsetof(node_t, next), off);
+      else
+	 first = off;
+      prev = off;
+   }
+
+   return first;
+}
+
+/* Write definition tree with compiled program  */
+static unsigned cache_write_def(struct cache_writer_t *w, const node_t *root,
+      unsigned func)
+{
+   const struct ourfa_xmlapi_prog_t *prog;
+   unsigned root_off, prog_off, i, slot;
+   size_t prog_size;
+
+   if (root == NULL)
+      return 0;
+
+   assert(root->type == OURFA_XMLAPI_NODE_ROOT);
+   assert(root->next == NULL);
+
+   w->nodes_cnt = 0;
+   root_off = cache_write_nodes(w, root, 0, func);
+   if (w->err)
+      return 0;
+
+   prog = root->n.n_root.prog;
+   prog_size = sizeof(*prog) + prog->insn_cnt * sizeof(prog->insn[0]);
+   prog_off = cache_alloc(w, prog_size, CACHE_ALIGN);
+   if (prog_off == 0)
+      return 0;
+   memcpy(w->buf + prog_off, prog, prog_size);
+   cache_set_ptr(w, root_off + offsetof(node_t, n.n_root.prog), prog_off);
+
+   qsort(w->nodes, w->nodes_cnt, sizeof(w->nodes[0]), node_off_cmp);
+   for (i=0; i < prog->insn_cnt; i++) {
+      slot = prog_off + offsetof(struct ourfa_xmlapi_prog_t, insn)
+	 + i * sizeof(prog->insn[0]);
+      cache_set_ptr(w, slot + offsetof(struct ourfa_xmlapi_insn_t, node),
+	    node_off(w, prog->insn[i].node));
+      if (prog->insn[i].op == OURFA_XMLAPI_OP_FOR) {
+	 cache_set_ptr(w, slot + offsetof(struct ourfa_xmlapi_insn_t, a.i_for.from.var),
+	       cache_str(w, prog->insn[i].a.i_for.from.var));
+	 cache_set_ptr(w, slot + offsetof(struct ourfa_xmlapi_insn_t, a.i_for.count.var),
+	       cache_str(w, prog->insn[i].a.i_for.count.var));
+      }
+   }
+
+   return root_off;
+}
+
+static unsigned cache_write_func(struct cache_writer_t *w,
+      const ourfa_xmlapi_func_t *f)
+{
+   unsigned off;
+   size_t size;
+
+   size = sizeof(*f) + strlen(f->name) + 1;
+   off = cache_alloc(w, size, CACHE_ALIGN);
+   if (off == 0)
+      return 0;
+   memcpy(w->buf + off, f, size);
+   cache_set_ptr(w, off + offsetof(ourfa_xmlapi_func_t, xmlapi), 0);
+   cache_set_ptr(w, off + offsetof(ourfa_xmlapi_func_t, in),
+	 cache_write_def(w, f->in, off));
+   cache_set_ptr(w, off + offsetof(ourfa_xmlapi_func_t, out),
+	 cache_write_def(w, f->out, off));
+   cache_set_ptr(w, off + offsetof(ourfa_xmlapi_func_t, script),
+	 cache_write_def(w, f->script, off));
+
+   return off;
+}
+
+/* Write header, functions and relocation table to the writer.
+ * st - source file, NULL - image is not bound to a file  */
+static void image_build(struct cache_writer_t *w, const char *src_file,
+      const struct stat *st, ourfa_xmlapi_func_t * const *funcs,
+      unsigned funcs_cnt)
+{
+   struct cache_hdr_t *hdr;
+   unsigned hdr_off, funcs_off, relocs_off, src_path, i, f_off;
+
+   hdr_off = cache_alloc(w, sizeof(*hdr), CACHE_ALIGN);
+   assert(w->err || (hdr_off == 0));
+
+   funcs_off = cache_alloc(w, funcs_cnt * sizeof(funcs[0]) + 1, CACHE_ALIGN);
+   for (i=0; i < funcs_cnt; i++) {
+      f_off = cache_write_func(w, funcs[i]);
+      cache_set_ptr(w, funcs_off + i * sizeof(funcs[0]), f_off);
+   }
+
+   src_path = src_file ? cache_str(w, src_file) : 0;
+
+   relocs_off = cache_alloc(w, w->relocs_cnt * sizeof(w->relocs[0]) + 1, CACHE_ALIGN);
+   if (w->err)
+      return;
+   memcpy(w->buf + relocs_off, w->relocs, w->relocs_cnt * sizeof(w->relocs[0]));
+
+   hdr = (struct cache_hdr_t *)w->buf;
+   memcpy(hdr->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+   hdr->version = CACHE_VERSION;
+   hdr->endian = CACHE_ENDIAN_MARK;
+   hdr->ptr_size = sizeof(void *);
+   hdr->func_size = sizeof(ourfa_xmlapi_func_t);
+   hdr->node_size = sizeof(node_t);
+   hdr->prog_size = sizeof(struct ourfa_xmlapi_prog_t);
+   hdr->insn_size = sizeof(struct ourfa_xmlapi_insn_t);
+   hdr->size = (unsigned)w->size;
+   hdr->src_mtime = st ? (long long)st->st_mtime : 0;
+   hdr->src_size = st ? (long long)st->st_size : 0;
+   hdr->src_path = src_path;
+   hdr->funcs = funcs_off;
+   hdr->funcs_cnt = funcs_cnt;
+   hdr->relocs = relocs_off;
+   hdr->relocs_cnt = w->relocs_cnt;
+}
+
+static void writer_free(struct cache_writer_t *w)
+{
+   free(w->buf);
+   free(w->relocs);
+   free(w->strs);
+   free(w->nodes);
+}
+
+/* Convert offsets of the image to pointers. Returns -1 on broken image */
+static int image_relocate(char *data)
+{
+   const struct cache_hdr_t *hdr;
+   unsigned i, slot, *relocs;
+   uintptr_t target;
+
+   hdr = (const struct cache_hdr_t *)data;
+   relocs = (unsigned *)(data + hdr->relocs);
+   for (i=0; i < hdr->relocs_cnt; i++) {
+      slot = relocs[i];
+      if ((slot % sizeof(void *) != 0)
+	    || (slot > hdr->size - sizeof(void *)))
+	 return -1;
+      memcpy(&target, data + slot, sizeof(target));
+      if (target >= hdr->size)
+	 return -1;
+      target += (uintptr_t)data;
+      memcpy(data + slot, &target, sizeof(target));
+   }
+
+   return 0;
+}
+
+static struct ourfa_xmlapi_image_t *image_new(char *data)
+{
+   struct ourfa_xmlapi_image_t *img;
+   const struct cache_hdr_t *hdr;
+
+   img = malloc(sizeof(*img));
+   if (img == NULL)
+      return NULL;
+
+   hdr = (const struct cache_hdr_t *)data;
+   img->next = NULL;
+   img->data = data;
+   img->size = hdr->size;
+   img->funcs = (ourfa_xmlapi_func_t **)(data + hdr->funcs);
+   img->funcs_cnt = hdr->funcs_cnt;
+
+   return img;
+}
+
+int ourfa_xmlapi_image_save(const char *cache_file, const char *src_file,
+      ourfa_xmlapi_func_t * const *funcs, unsigned funcs_cnt)
+{
+   struct cache_writer_t w;
+   struct stat st;
+   char *tmp_file;
+   FILE *fp;
+   int res;
+
+   assert(cache_file);
+   assert(src_file);
+
+   if (stat(src_file, &st) != 0)
+      return -1;
+
+   memset(&w, 0, sizeof(w));
+   res = -1;
+   tmp_file = NULL;
+
+   image_build(&w, src_file, &st, funcs, funcs_cnt);
+   if (w.err)
+      goto image_save_end;
+
+   /* Write to temporary file and rename, readers see old or new cache  */
+   if (ourfa_asprintf(&tmp_file, "%s.%u.tmp", cache_file,
+#ifdef WIN32
+	    (unsigned)_getpid()
+#else
+	    (unsigned)getpid()
+#endif
+	    ) <= 0) {
+      tmp_file = NULL;
+      goto image_save_end;
+   }
+
+   fp = fopen(tmp_file, "wb");
+   if (fp == NULL)
+      goto image_save_end;
+   if (fwrite(w.buf, 1, w.size, fp) != w.size) {
+      fclose(fp);
+      remove(tmp_file);
+      goto image_save_end;
+   }
+   if (fclose(fp) != 0) {
+      remove(tmp_file);
+      goto image_save_end;
+   }
+#ifdef WIN32
+   remove(cache_file);
+#endif
+   if (rename(tmp_file, cache_file) != 0) {
+      remove(tmp_file);
+      goto image_save_end;
+   }
+
+   res = 0;
+
+image_save_end:
+   free(tmp_file);
+   writer_free(&w);
+
+   return res;
+}
+
+struct ourfa_xmlapi_image_t *ourfa_xmlapi_image_pack(
+      ourfa_xmlapi_func_t * const *funcs, unsigned funcs_cnt)
+{
+   struct ourfa_xmlapi_image_t *img;
+   struct cache_writer_t w;
+   char *data;
+
+   memset(&w, 0, sizeof(w));
+
+   image_build(&w, NULL, NULL, funcs, funcs_cnt);
+   if (w.err) {
+      writer_free(&w);
+      return NULL;
+   }
+
+   /* Shrink to the image size before pointers are fixed */
+   data = realloc(w.buf, w.size);
+   if (data != NULL)
+      w.buf = data;
+   data = w.buf;
+   w.buf = NULL;
+   writer_free(&w);
+
+   if (image_relocate(data) != 0) {
+      free(data);
+      return NULL;
+   }
+
+   img = image_new(data);
+   if (img == NULL)
+      free(data);
+
+   return img;
+}
+
+struct ourfa_xmlapi_image_t *ourfa_xmlapi_image_load(const char *cache_file,
+      const char *src_file)
+{
+   struct ourfa_xmlapi_image_t *img;
+   const struct cache_hdr_t *hdr;
+   struct stat st, cache_st;
+   char *data;
+   FILE *fp;
+
+   assert(cache_file);
+   assert(src_file);
+
+   if ((stat(src_file, &st) != 0) || (stat(cache_file, &cache_st) != 0))
+      return NULL;
+
+   if (((size_t)cache_st.st_size < sizeof(*hdr))
+	 || ((unsigned long long)cache_st.st_size > UINT32_MAX))
+      return NULL;
+
+   data = malloc((size_t)cache_st.st_size);
+   if (data == NULL)
+      return NULL;
+
+   fp = fopen(cache_file, "rb");
+   if (fp == NULL) {
+      free(data);
+      return NULL;
+   }
+   if (fread(data, 1, (size_t)cache_st.st_size, fp) != (size_t)cache_st.st_size) {
+      fclose(fp);
+      free(data);
+      return NULL;
+   }
+   fclose(fp);
+
+   hdr = (const struct cache_hdr_t *)data;
+   if ((memcmp(hdr->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0)
+	 || (hdr->version != CACHE_VERSION)
+	 || (hdr->endian != CACHE_ENDIAN_MARK)
+	 || (hdr->ptr_size != sizeof(void *))
+	 || (hdr->func_size != sizeof(ourfa_xmlapi_func_t))
+	 || (hdr->node_size != sizeof(node_t))
+	 || (hdr->prog_size != sizeof(struct ourfa_xmlapi_prog_t))
+	 || (hdr->insn_size != sizeof(struct ourfa_xmlapi_insn_t))
+	 || (hdr->size != (unsigned)cache_st.st_size)
+	 || (hdr->src_mtime != (long long)st.st_mtime)
+	 || (hdr->src_size != (long long)st.st_size)
+	 || (hdr->src_path == 0)
+	 || (hdr->src_path >= hdr->size)
+	 || (memchr(data + hdr->src_path, '\0', hdr->size - hdr->src_path) == NULL)
+	 || (strcmp(data + hdr->src_path, src_file) != 0)
+	 || (hdr->funcs >= hdr->size)
+	 || (hdr->funcs_cnt > (hdr->size - hdr->funcs) / sizeof(void *))
+	 || (hdr->relocs >= hdr->size)
+	 || (hdr->relocs % sizeof(unsigned) != 0)
+	 || (hdr->relocs_cnt > (hdr->size - hdr->relocs) / sizeof(unsigned))
+	 || (image_relocate(data) != 0)) {
+      free(data);
+      return NULL;
+   }
+
+   img = image_new(data);
+   if (img == NULL)
+      free(data);
+
+   return img;
+}
+
+void ourfa_xmlapi_image_free(struct ourfa_xmlapi_image_t *img)
+{
+   struct ourfa_xmlapi_image_t *next;
+
+   while (img) {
+      next = img->next;
+      free(img->data);
+      free(img);
+      img = next;
+   }
+}